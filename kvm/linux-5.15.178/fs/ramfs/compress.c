@@ -0,0 +1,511 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 压缩镜像（mount -o compress=lz4）
+ *
+ * 日志、JSON 之类的内容能压缩 4~8 倍，原样写进同步目录既费磁盘带宽又拖慢刷盘。
+ * 压缩模式下镜像按块存放，每个逻辑块在镜像里有一个固定位置的槽：
+ *
+ *   文件头 | 槽 0 | 槽 1 | ...     槽 n 从 RAMFS_CZ_HEAD_SIZE + n * RAMFS_CZ_SLOT_SIZE 开始
+ *
+ * 槽里是块头加 LZ4 压缩后的数据，压不小的块原样存放；槽的其余部分从不写入，
+ * 在下层文件系统里是空洞，所以只占用压缩后的空间。块的位置和内容无关，
+ * 增量刷盘只需要重新编码脏块，照样经过意图日志原地覆盖对应的槽。
+ * 没写过的槽和镜像末尾之外的块都按全零处理。
+ *
+ * 预热挂载从文件头识别压缩镜像，缺页时解码所在的块，
+ * 块里其他还不在页缓存里的页一起填好。
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/crc32c.h>
+#include "internal.h"
+
+/* ramfs 总是编进内核，只能用同样编进内核的 LZ4 */
+#if IS_BUILTIN(CONFIG_LZ4_COMPRESS) && IS_BUILTIN(CONFIG_LZ4_DECOMPRESS)
+#include <linux/lz4.h>
+#define RAMFS_CZ_LZ4		1
+#else
+#define RAMFS_CZ_LZ4		0
+#endif
+
+#define RAMFS_CZ_MAGIC		0x345a4c52	/* "RLZ4" */
+#define RAMFS_CZ_BLOCK_MAGIC	0x4b4c4252	/* "RBLK" */
+#define RAMFS_CZ_HEAD_SIZE	4096
+#define RAMFS_CZ_SLOT_SIZE	(RAMFS_CZ_BLOCK_SIZE + 4096)
+
+struct ramfs_cz_header {
+    u32 magic;
+    u32 block_size;
+    u64 size;		/* 文件的逻辑大小 */
+    u32 pad;
+    u32 crc;		/* 本结构的 crc32c，计算时 crc 字段按 0 算 */
+};
+
+struct ramfs_cz_block {
+    u32 magic;
+    u32 crc;		/* 块头（crc 按 0 算）加数据的 crc32c */
+    u32 clen;		/* 后面的数据长度，等于 ulen 表示没压缩 */
+    u32 ulen;		/* 解压后的长度 */
+};
+
+/* 一次刷盘用到的缓冲区 */
+struct ramfs_cz_ctx {
+    struct ramfs_fs_info *fsi;
+    void *wrkmem;
+    char *src;		/* 一个块的原始数据 */
+    char *dst;		/* 块头 + 压缩后的数据 */
+};
+
+static inline loff_t ramfs_cz_slot(pgoff_t block)
+{
+    return RAMFS_CZ_HEAD_SIZE + (loff_t)block * RAMFS_CZ_SLOT_SIZE;
+}
+
+bool ramfs_cz_supported(void)
+{
+    return RAMFS_CZ_LZ4;
+}
+
+static void ramfs_cz_free(struct ramfs_cz_ctx *cz)
+{
+    kvfree(cz->wrkmem);
+    kvfree(cz->src);
+    kvfree(cz->dst);
+}
+
+static int ramfs_cz_init(struct ramfs_cz_ctx *cz, struct ramfs_fs_info *fsi)
+{
+    cz->fsi = fsi;
+#if RAMFS_CZ_LZ4
+    cz->wrkmem = kvmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+#else
+    cz->wrkmem = NULL;
+#endif
+    cz->src = kvmalloc(RAMFS_CZ_BLOCK_SIZE, GFP_KERNEL);
+    cz->dst = kvmalloc(sizeof(struct ramfs_cz_block) + RAMFS_CZ_BLOCK_SIZE,
+                       GFP_KERNEL);
+    if ((RAMFS_CZ_LZ4 && !cz->wrkmem) || !cz->src || !cz->dst) {
+        ramfs_cz_free(cz);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void ramfs_cz_fill_header(struct ramfs_cz_header *hdr, loff_t size)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = RAMFS_CZ_MAGIC;
+    hdr->block_size = RAMFS_CZ_BLOCK_SIZE;
+    hdr->size = size;
+    hdr->crc = crc32c(~0, hdr, sizeof(*hdr));
+}
+
+/**
+ * ramfs_cz_read_header - 判断镜像是不是压缩格式
+ * @file: 同步目录中的镜像
+ * @size: 输出参数，文件的逻辑大小
+ *
+ * 返回0表示是压缩镜像，-ENODATA 表示是普通镜像
+ */
+int ramfs_cz_read_header(struct file *file, loff_t *size)
+{
+    struct ramfs_cz_header hdr;
+    loff_t pos = 0;
+    u32 crc;
+
+    if (kernel_read(file, &hdr, sizeof(hdr), &pos) != sizeof(hdr) ||
+        hdr.magic != RAMFS_CZ_MAGIC)
+        return -ENODATA;
+    crc = hdr.crc;
+    hdr.crc = 0;
+    if (crc32c(~0, &hdr, sizeof(hdr)) != crc ||
+        hdr.block_size != RAMFS_CZ_BLOCK_SIZE)
+        return -ENODATA;
+
+    *size = hdr.size;
+    return 0;
+}
+
+/*
+ * 把快照中的第 block 块编码进 cz->dst，返回编码后的长度（块头加数据）；
+ * 整块都是空洞时返回 0，读不到快照中的页时返回负数
+ */
+static ssize_t ramfs_cz_encode(struct ramfs_cz_ctx *cz,
+                              struct ramfs_snapshot *snap, pgoff_t block,
+                              loff_t size)
+{
+    struct ramfs_cz_block *bh = (struct ramfs_cz_block *)cz->dst;
+    char *data = cz->dst + sizeof(*bh);
+    loff_t start = (loff_t)block << RAMFS_CZ_BLOCK_SHIFT;
+    size_t ulen = min_t(loff_t, RAMFS_CZ_BLOCK_SIZE, size - start);
+    pgoff_t index = start >> PAGE_SHIFT;
+    bool present = false;
+    size_t off;
+    u64 t0;
+    int clen = 0;
+
+    for (off = 0; off < ulen; off += PAGE_SIZE, index++) {
+        struct page *page = ramfs_snapshot_page(snap, index);
+        size_t chunk = min_t(size_t, ulen - off, PAGE_SIZE);
+
+        if (IS_ERR(page))
+            return PTR_ERR(page);
+        if (page) {
+            memcpy_from_page(cz->src + off, page, 0, chunk);
+            put_page(page);
+            present = true;
+        } else {
+            memset(cz->src + off, 0, chunk);
+        }
+    }
+    if (!present)
+        return 0;
+
+    t0 = ktime_get_ns();
+#if RAMFS_CZ_LZ4
+    /* 输出上限比输入小一字节，压不小的块直接失败，改为原样存放 */
+    clen = LZ4_compress_default(cz->src, data, ulen, ulen - 1, cz->wrkmem);
+#endif
+    if (clen <= 0) {
+        memcpy(data, cz->src, ulen);
+        clen = ulen;
+    }
+    atomic64_add(ktime_get_ns() - t0, &cz->fsi->cz_ns);
+
+    bh->magic = RAMFS_CZ_BLOCK_MAGIC;
+    bh->crc = 0;
+    bh->clen = clen;
+    bh->ulen = ulen;
+    bh->crc = crc32c(crc32c(~0, bh, sizeof(*bh)), data, clen);
+
+    atomic64_add(ulen, &cz->fsi->cz_in_bytes);
+    atomic64_add(sizeof(*bh) + clen, &cz->fsi->cz_out_bytes);
+    return sizeof(*bh) + clen;
+}
+
+/**
+ * ramfs_cz_write_file - 整文件刷盘时把快照编码写入新镜像
+ * @snap: 整文件刷盘的快照
+ * @out: 刚截断的临时镜像
+ * @written: 返回实际写入的字节数
+ *
+ * 空洞块不写，对应的槽留成空洞
+ */
+int ramfs_cz_write_file(struct ramfs_snapshot *snap, struct file *out,
+                        loff_t *written)
+{
+    loff_t size = snap->size, pos = 0;
+    struct ramfs_cz_header hdr;
+    struct ramfs_cz_ctx cz;
+    pgoff_t block, nr_blocks;
+    int ret;
+
+    ret = ramfs_cz_init(&cz, snap->inode->i_sb->s_fs_info);
+    if (ret)
+        return ret;
+
+    ramfs_cz_fill_header(&hdr, size);
+    ret = ramfs_write_all(out, &hdr, sizeof(hdr), &pos);
+    *written = sizeof(hdr);
+
+    nr_blocks = DIV_ROUND_UP(size, RAMFS_CZ_BLOCK_SIZE);
+    for (block = 0; block < nr_blocks && !ret; block++) {
+        ssize_t len = ramfs_cz_encode(&cz, snap, block, size);
+
+        pos = ramfs_cz_slot(block);
+        if (len < 0)
+            ret = len;
+        else if (len)
+            ret = ramfs_write_all(out, cz.dst, len, &pos);
+        *written += max_t(ssize_t, len, 0);
+        cond_resched();
+    }
+
+    ramfs_cz_free(&cz);
+    return ret;
+}
+
+/*
+ * 增量刷盘：日志的第 0 段是新的文件头，之后每段是一个重新编码的块，
+ * 覆盖它在镜像里的槽
+ */
+struct ramfs_cz_src {
+    struct ramfs_journal_src src;
+    struct ramfs_cz_ctx cz;
+    struct ramfs_snapshot *snap;
+    loff_t size;
+    pgoff_t *blocks;	/* 要重写的块号，升序 */
+};
+
+static int ramfs_cz_src_emit(struct ramfs_journal_src *src, int i,
+                             struct file *jf, loff_t *pos)
+{
+    struct ramfs_cz_src *cs = container_of(src, struct ramfs_cz_src, src);
+    struct ramfs_cz_header hdr;
+    ssize_t len;
+    int ret;
+
+    if (i == 0) {
+        ramfs_cz_fill_header(&hdr, cs->size);
+        ret = ramfs_journal_put_range(src, jf, pos, 0, sizeof(hdr));
+        return ret ? ret : ramfs_journal_put(src, jf, &hdr, sizeof(hdr), pos);
+    }
+
+    /* 整块都是空洞时写一个空段，旧槽已经随截断去掉了 */
+    len = ramfs_cz_encode(&cs->cz, cs->snap, cs->blocks[i - 1], cs->size);
+    if (len < 0)
+        return len;
+    ret = ramfs_journal_put_range(src, jf, pos,
+                                  ramfs_cz_slot(cs->blocks[i - 1]), len);
+    if (!ret && len)
+        ret = ramfs_journal_put(src, jf, cs->cz.dst, len, pos);
+    return ret;
+}
+
+static void ramfs_cz_src_release(struct ramfs_journal_src *src)
+{
+    struct ramfs_cz_src *cs = container_of(src, struct ramfs_cz_src, src);
+
+    ramfs_cz_free(&cs->cz);
+    kvfree(cs->blocks);
+    kfree(cs);
+}
+
+/**
+ * ramfs_cz_journal_src - 为压缩镜像的增量刷盘准备日志内容
+ * @snap: 增量刷盘的快照，脏范围升序且已截到 size 以内
+ * @target: 同步目录中已有的镜像
+ *
+ * 镜像先截到 min_size 所在块的槽，跨 min_size 的那一块重新编码；
+ * 之后的块要么是脏块要么全零，不需要保留。
+ * 快照冻结的范围已经按块对齐并包含了跨 min_size 的那一块
+ * 返回 -ENOENT 表示目标不是压缩镜像，调用者应改为整文件刷盘
+ */
+struct ramfs_journal_src *ramfs_cz_journal_src(struct ramfs_snapshot *snap,
+                                               struct file *target)
+{
+    const struct ramfs_range *ranges = snap->ranges;
+    loff_t min_size = snap->min_size;
+    int nr = snap->nr;
+    pgoff_t boundary = min_size >> RAMFS_CZ_BLOCK_SHIFT;
+    bool partial = min_size & (RAMFS_CZ_BLOCK_SIZE - 1);
+    struct ramfs_cz_src *cs;
+    loff_t old_size, cut, end;
+    pgoff_t b, last = 0;
+    int i, n = 0, cap;
+    int ret;
+
+    if (ramfs_cz_read_header(target, &old_size))
+        return ERR_PTR(-ENOENT);
+
+    cs = kzalloc(sizeof(*cs), GFP_KERNEL);
+    if (!cs)
+        return ERR_PTR(-ENOMEM);
+
+    /* 每个页最多落在一个块里，加上跨 min_size 的那一块 */
+    cap = 1;
+    for (i = 0; i < nr; i++)
+        cap += DIV_ROUND_UP(ranges[i].len, RAMFS_CZ_BLOCK_SIZE) + 1;
+    cs->blocks = kvmalloc_array(cap, sizeof(*cs->blocks), GFP_KERNEL);
+    ret = cs->blocks ? ramfs_cz_init(&cs->cz, snap->inode->i_sb->s_fs_info) : -ENOMEM;
+    if (ret) {
+        kvfree(cs->blocks);
+        kfree(cs);
+        return ERR_PTR(ret);
+    }
+
+    /* 两边都是升序，合并出去重后的块号 */
+    for (i = 0; i <= nr; i++) {
+        pgoff_t first = 0;
+
+        if (i < nr) {
+            first = ranges[i].start >> RAMFS_CZ_BLOCK_SHIFT;
+            last = (ranges[i].start + ranges[i].len - 1) >> RAMFS_CZ_BLOCK_SHIFT;
+        }
+        if (partial && (i == nr || boundary < first)) {
+            if (!n || cs->blocks[n - 1] < boundary)
+                cs->blocks[n++] = boundary;
+            partial = false;
+        }
+        if (i == nr)
+            break;
+        for (b = first; b <= last; b++)
+            if (!n || cs->blocks[n - 1] < b)
+                cs->blocks[n++] = b;
+    }
+
+    cut = ramfs_cz_slot(boundary);
+    end = max_t(loff_t, min(i_size_read(file_inode(target)), cut),
+                sizeof(struct ramfs_cz_header));
+    if (n)
+        end = max_t(loff_t, end,
+                    ramfs_cz_slot(cs->blocks[n - 1]) + RAMFS_CZ_SLOT_SIZE);
+
+    cs->snap = snap;
+    cs->size = snap->size;
+    cs->src.nr = n + 1;
+    cs->src.min_size = cut;
+    cs->src.new_size = end;
+    cs->src.emit = ramfs_cz_src_emit;
+    cs->src.release = ramfs_cz_src_release;
+    return &cs->src;
+}
+
+/*
+ * 解码第 block 块到 out，返回块内有效长度；
+ * 没写过的槽和镜像末尾之外的块返回 0
+ */
+static int ramfs_cz_decode(struct ramfs_fs_info *fsi, struct file *img,
+                           pgoff_t block, char *out, char *cbuf)
+{
+    struct ramfs_cz_block bh;
+    loff_t pos = ramfs_cz_slot(block);
+    ssize_t n;
+    u32 crc;
+    u64 t0;
+    int ret;
+
+    n = kernel_read(img, &bh, sizeof(bh), &pos);
+    if (n < 0)
+        return n;
+    if (n == 0 || (n == sizeof(bh) && !bh.magic))
+        return 0;
+    if (n != sizeof(bh) || bh.magic != RAMFS_CZ_BLOCK_MAGIC ||
+        bh.ulen > RAMFS_CZ_BLOCK_SIZE || bh.clen > bh.ulen)
+        return -EBADMSG;
+
+    if (kernel_read(img, cbuf, bh.clen, &pos) != bh.clen)
+        return -EIO;
+    crc = bh.crc;
+    bh.crc = 0;
+    if (crc32c(crc32c(~0, &bh, sizeof(bh)), cbuf, bh.clen) != crc)
+        return -EBADMSG;
+
+    t0 = ktime_get_ns();
+    if (bh.clen == bh.ulen) {
+        memcpy(out, cbuf, bh.ulen);
+        ret = bh.ulen;
+    } else {
+#if RAMFS_CZ_LZ4
+        ret = LZ4_decompress_safe(cbuf, out, bh.clen, bh.ulen);
+        if (ret != bh.ulen)
+            ret = -EBADMSG;
+#else
+        ret = -EOPNOTSUPP;
+#endif
+    }
+    atomic64_add(ktime_get_ns() - t0, &fsi->dcz_ns);
+    if (ret > 0)
+        atomic64_add(ret, &fsi->dcz_bytes);
+    return ret;
+}
+
+/*
+ * 把解码出来的块填进同一块里其他还不在页缓存里的页，顺序读和后台预读
+ * 不用每一页都把整块解码一遍。不等页锁，被别人锁着的页由别人去读；
+ * 和预读一样走通用的分配路径
+ */
+static void ramfs_cz_fill_block(struct inode *inode, pgoff_t skip,
+                                const char *out, size_t len, loff_t limit)
+{
+    struct address_space *mapping = inode->i_mapping;
+    pgoff_t per_block = RAMFS_CZ_BLOCK_SIZE >> PAGE_SHIFT;
+    pgoff_t index = round_down(skip, per_block);
+    pgoff_t end = index + per_block;
+
+    limit = min(limit, i_size_read(inode));
+    for (; index < end; index++) {
+        loff_t pos = (loff_t)index << PAGE_SHIFT;
+        size_t off = pos & (RAMFS_CZ_BLOCK_SIZE - 1);
+        struct page *page;
+        size_t n = 0;
+        void *addr;
+
+        if (index == skip || pos >= limit)
+            continue;
+        page = grab_cache_page_nowait(mapping, index);
+        if (!page)
+            continue;
+        if (!PageUptodate(page)) {
+            if (len > off)
+                n = min_t(loff_t, min(len - off, PAGE_SIZE), limit - pos);
+            addr = kmap_local_page(page);
+            memcpy(addr, out + off, n);
+            memset(addr + n, 0, PAGE_SIZE - n);
+            kunmap_local(addr);
+            ramfs_charge_page(page, true);
+            ramfs_tier_charge(inode);
+            flush_dcache_page(page);
+            SetPageUptodate(page);
+        }
+        unlock_page(page);
+        put_page(page);
+    }
+}
+
+/**
+ * ramfs_cz_read_page - 从压缩镜像中读出一页
+ * @inode: 正在恢复的 ramfs 文件
+ * @img: 压缩镜像
+ * @index: 页号
+ * @addr: 页的内核地址
+ * @limit: 镜像中仍然有效的逻辑长度，之后的部分填零
+ */
+int ramfs_cz_read_page(struct inode *inode, struct file *img, pgoff_t index,
+                       void *addr, loff_t limit)
+{
+    loff_t pos = (loff_t)index << PAGE_SHIFT;
+    size_t off = pos & (RAMFS_CZ_BLOCK_SIZE - 1);
+    size_t n = 0;
+    char *out, *cbuf;
+    int ret = 0;
+
+    if (pos < limit) {
+        out = kvmalloc(RAMFS_CZ_BLOCK_SIZE, GFP_KERNEL);
+        cbuf = kvmalloc(RAMFS_CZ_BLOCK_SIZE, GFP_KERNEL);
+        if (out && cbuf)
+            ret = ramfs_cz_decode(inode->i_sb->s_fs_info, img,
+                                  pos >> RAMFS_CZ_BLOCK_SHIFT, out, cbuf);
+        else
+            ret = -ENOMEM;
+        if (ret > (int)off) {
+            n = min_t(size_t, ret - off, PAGE_SIZE);
+            n = min_t(loff_t, n, limit - pos);
+            memcpy(addr, out + off, n);
+        }
+        if (ret >= 0)
+            ramfs_cz_fill_block(inode, index, out, ret, limit);
+        kvfree(out);
+        kvfree(cbuf);
+        if (ret < 0)
+            return ret;
+    }
+    memset(addr + n, 0, PAGE_SIZE - n);
+    return 0;
+}
+
+void ramfs_cz_show_stats(struct seq_file *m, struct ramfs_fs_info *fsi)
+{
+    u64 in = atomic64_read(&fsi->cz_in_bytes);
+    u64 out = atomic64_read(&fsi->cz_out_bytes);
+    u64 ratio = out ? div64_u64(in * 100, out) : 0;
+
+    seq_printf(m, "compress %s\n", fsi->mount_opts.compress ? "lz4" : "none");
+    seq_printf(m, "compress_in_bytes %llu\n", in);
+    seq_printf(m, "compress_out_bytes %llu\n", out);
+    seq_printf(m, "compress_ratio %llu.%02llu\n", ratio / 100, ratio % 100);
+    seq_printf(m, "compress_time_us %llu\n",
+               div_u64(atomic64_read(&fsi->cz_ns), NSEC_PER_USEC));
+    seq_printf(m, "decompress_bytes %llu\n", (u64)atomic64_read(&fsi->dcz_bytes));
+    seq_printf(m, "decompress_time_us %llu\n",
+               div_u64(atomic64_read(&fsi->dcz_ns), NSEC_PER_USEC));
+}
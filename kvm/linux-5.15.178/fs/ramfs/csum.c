@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 镜像校验和
+ *
+ * 普通（非压缩）镜像旁边放一个 ".<name>.crc"：文件头之后每页一个 crc32c，
+ * 按整页计算，镜像结尾之后的部分按零算。刷盘把页交给目标文件的同一个循环里
+ * 顺手算出校验和（crc32c 走 SSE4.2 等加速实现），不用再把页缓存读一遍。
+ * 预热挂载和分层挂载从镜像读回一页时才校验这一页，挂载时不扫描。
+ *
+ * 文件头记下镜像的 inode 号和 generation。整文件刷盘先 rename 校验和文件
+ * 再 rename 镜像，两步之间崩溃时头部对不上，只是失去校验，不会误报；
+ * 增量刷盘回放完日志后原地更新受影响的项，日志作废之前崩溃的话，
+ * 日志恢复和日志模式回放改过镜像以后直接删掉校验和文件，等下一次整文件刷盘重建。
+ * 压缩镜像每块自带 crc32c，不需要旁路文件
+ */
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/crc32c.h>
+#include "internal.h"
+
+#define RAMFS_CSUM_MAGIC	0x52435243	/* "CRCR" */
+
+struct ramfs_csum_header {
+    u32 magic;
+    u32 page_size;
+    u64 ino;		/* 对应镜像的 inode 号 */
+    u32 generation;	/* 和 ino 一起识别镜像，防止 inode 号被复用 */
+    u32 pad;
+};
+
+/* 一页的校验和，len 之后按零计算；page 为 NULL 表示空洞 */
+u32 ramfs_csum_page(struct page *page, unsigned int len)
+{
+    u32 crc = ~0;
+    void *addr;
+
+    if (!page)
+        len = 0;
+    if (len) {
+        addr = kmap_local_page(page);
+        crc = crc32c(crc, addr, len);
+        kunmap_local(addr);
+    }
+    if (len < PAGE_SIZE)
+        crc = crc32c(crc, page_address(ZERO_PAGE(0)), PAGE_SIZE - len);
+    return crc;
+}
+
+static void ramfs_csum_fill_header(struct ramfs_csum_header *hdr,
+                                   struct file *img)
+{
+    struct inode *inode = file_inode(img);
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = RAMFS_CSUM_MAGIC;
+    hdr->page_size = PAGE_SIZE;
+    hdr->ino = inode->i_ino;
+    hdr->generation = inode->i_generation;
+}
+
+/* 校验和文件是不是 img 的 */
+static bool ramfs_csum_match(struct file *csum, struct file *img)
+{
+    struct ramfs_csum_header hdr, want;
+    loff_t pos = 0;
+
+    if (kernel_read(csum, &hdr, sizeof(hdr), &pos) != sizeof(hdr))
+        return false;
+    ramfs_csum_fill_header(&want, img);
+    return !memcmp(&hdr, &want, sizeof(hdr));
+}
+
+/* 在同步目录 dir 下把 from 改名为 to，或者 to 为 NULL 时删掉 from */
+static int ramfs_csum_rename(const char *dir, const char *from, const char *to)
+{
+    struct dentry *old_dentry, *new_dentry;
+    struct renamedata rd = {};
+    struct path parent;
+    struct inode *pdir;
+    int ret;
+
+    ret = kern_path(dir, LOOKUP_DIRECTORY, &parent);
+    if (ret)
+        return ret;
+    pdir = d_inode(parent.dentry);
+
+    inode_lock_nested(pdir, I_MUTEX_PARENT);
+    old_dentry = lookup_one_len(from, parent.dentry, strlen(from));
+    if (IS_ERR(old_dentry)) {
+        ret = PTR_ERR(old_dentry);
+        goto out_unlock;
+    }
+    if (d_really_is_negative(old_dentry)) {
+        ret = -ENOENT;
+        goto out_put_old;
+    }
+
+    if (!to) {
+        ret = vfs_unlink(mnt_user_ns(parent.mnt), pdir, old_dentry, NULL);
+        goto out_put_old;
+    }
+
+    new_dentry = lookup_one_len(to, parent.dentry, strlen(to));
+    if (IS_ERR(new_dentry)) {
+        ret = PTR_ERR(new_dentry);
+        goto out_put_old;
+    }
+    rd.old_mnt_userns = mnt_user_ns(parent.mnt);
+    rd.old_dir = pdir;
+    rd.old_dentry = old_dentry;
+    rd.new_mnt_userns = mnt_user_ns(parent.mnt);
+    rd.new_dir = pdir;
+    rd.new_dentry = new_dentry;
+    ret = vfs_rename(&rd);
+    dput(new_dentry);
+
+out_put_old:
+    dput(old_dentry);
+out_unlock:
+    inode_unlock(pdir);
+    path_put(&parent);
+    return ret;
+}
+
+/**
+ * ramfs_csum_drop - 删掉镜像的校验和文件
+ * @dir: 镜像所在目录
+ * @name: 镜像文件名
+ *
+ * 镜像被不经过本文件的方式改过（日志恢复、日志模式回放）之后调用
+ */
+void ramfs_csum_drop(const char *dir, const char *name)
+{
+    char *csum_name = kasprintf(GFP_KERNEL, ".%s.crc", name);
+    int ret;
+
+    if (!csum_name)
+        return;
+    ret = ramfs_csum_rename(dir, csum_name, NULL);
+    if (ret && ret != -ENOENT)
+        pr_warn("RAMfs: Failed to remove %s/%s: %d\n", dir, csum_name, ret);
+    kfree(csum_name);
+}
+
+/**
+ * ramfs_csum_write_full - 整文件刷盘时为新镜像写校验和文件
+ * @dir: 镜像所在目录
+ * @name: 镜像文件名
+ * @img: 已经写完并 fsync 的临时镜像，还没有 rename
+ * @crcs: 每页的校验和
+ * @nr: 页数
+ *
+ * 返回0表示成功，负数表示错误码
+ */
+int ramfs_csum_write_full(const char *dir, const char *name, struct file *img,
+                          const u32 *crcs, pgoff_t nr)
+{
+    struct ramfs_csum_header hdr;
+    char *tmp_name, *path;
+    struct file *file;
+    loff_t pos = 0;
+    int ret;
+
+    tmp_name = kasprintf(GFP_KERNEL, ".%s.crc.tmp", name);
+    path = kasprintf(GFP_KERNEL, "%s/%s", dir, tmp_name);
+    if (!tmp_name || !path) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    file = filp_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+    if (IS_ERR(file)) {
+        ret = PTR_ERR(file);
+        goto out_free;
+    }
+    ramfs_csum_fill_header(&hdr, img);
+    ret = ramfs_write_all(file, &hdr, sizeof(hdr), &pos);
+    if (!ret)
+        ret = ramfs_write_all(file, crcs, nr * sizeof(u32), &pos);
+    if (!ret)
+        ret = vfs_fsync(file, 0);
+    filp_close(file, NULL);
+
+    /* 文件名少了 ".tmp" 就是 ".<name>.crc" */
+    if (!ret) {
+        path[0] = '\0';
+        strscpy(path, tmp_name, strlen(tmp_name) - 3);
+        ret = ramfs_csum_rename(dir, tmp_name, path);
+    }
+
+out_free:
+    kfree(path);
+    kfree(tmp_name);
+    return ret;
+}
+
+static int ramfs_csum_put(struct file *file, pgoff_t index, const u32 *crcs,
+                          size_t nr)
+{
+    loff_t pos = sizeof(struct ramfs_csum_header) + (loff_t)index * sizeof(u32);
+
+    return ramfs_write_all(file, crcs, nr * sizeof(u32), &pos);
+}
+
+/**
+ * ramfs_csum_update - 增量刷盘回放日志以后更新校验和文件
+ * @dir: 镜像所在目录
+ * @name: 镜像文件名
+ * @img: 已经回放并 fsync 的镜像（可读）
+ * @snap: 这次刷盘的快照
+ * @crcs: 按顺序排列的各脏范围每页的校验和
+ * @buf: PAGE_SIZE 大小的缓冲区
+ *
+ * 没有校验和文件、或者它属于别的镜像时什么也不做（后者顺便删掉）
+ * 返回0表示成功，负数表示错误码
+ */
+int ramfs_csum_update(const char *dir, const char *name, struct file *img,
+                      struct ramfs_snapshot *snap, const u32 *crcs, char *buf)
+{
+    pgoff_t index, end = DIV_ROUND_UP(snap->size, PAGE_SIZE);
+    u32 *entries = (u32 *)buf;
+    struct file *file;
+    char *path;
+    int i, ret = 0;
+
+    path = kasprintf(GFP_KERNEL, "%s/.%s.crc", dir, name);
+    if (!path)
+        return -ENOMEM;
+    file = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+    kfree(path);
+    if (IS_ERR(file))
+        return PTR_ERR(file) == -ENOENT ? 0 : PTR_ERR(file);
+
+    if (!ramfs_csum_match(file, img)) {
+        filp_close(file, NULL);
+        ramfs_csum_drop(dir, name);
+        return 0;
+    }
+
+    /* 截断后又扩展出来的部分在镜像里全是零 */
+    if (snap->min_size < snap->size) {
+        u32 zero = ramfs_csum_page(NULL, 0);
+        size_t batch = PAGE_SIZE / sizeof(u32);
+
+        for (i = 0; i < batch; i++)
+            entries[i] = zero;
+        for (index = snap->min_size >> PAGE_SHIFT; index < end && !ret;
+             index += batch)
+            ret = ramfs_csum_put(file, index, entries,
+                                 min_t(pgoff_t, batch, end - index));
+
+        /* 跨 min_size 的那一页尾部被截断清零了，从镜像重新算 */
+        if (!ret && offset_in_page(snap->min_size)) {
+            loff_t pos = round_down(snap->min_size, PAGE_SIZE);
+            ssize_t n;
+            u32 crc;
+
+            index = pos >> PAGE_SHIFT;
+            n = kernel_read(img, buf, PAGE_SIZE, &pos);
+            if (n < 0) {
+                ret = n;
+            } else {
+                memset(buf + n, 0, PAGE_SIZE - n);
+                crc = crc32c(~0, buf, PAGE_SIZE);
+                ret = ramfs_csum_put(file, index, &crc, 1);
+            }
+        }
+    }
+
+    /* 脏页的校验和是写日志时算好的 */
+    for (i = 0; i < snap->nr && !ret; i++) {
+        const struct ramfs_range *r = &snap->ranges[i];
+        size_t nr = DIV_ROUND_UP(r->len, PAGE_SIZE);
+
+        ret = ramfs_csum_put(file, r->start >> PAGE_SHIFT, crcs, nr);
+        crcs += nr;
+    }
+
+    if (!ret)
+        ret = vfs_truncate(&file->f_path, sizeof(struct ramfs_csum_header) +
+                                          (loff_t)end * sizeof(u32));
+    if (!ret)
+        ret = vfs_fsync(file, 1);
+    filp_close(file, NULL);
+    return ret;
+}
+
+/**
+ * ramfs_csum_open - 打开镜像的校验和文件用于读回时校验
+ * @img: 已打开的镜像
+ * @img_path: 镜像路径
+ *
+ * 没有校验和文件或者对不上时返回 NULL，这个镜像读回时不校验
+ */
+struct file *ramfs_csum_open(struct file *img, const char *img_path)
+{
+    const char *base = strrchr(img_path, '/');
+    struct file *file;
+    char *path;
+
+    if (!base)
+        return NULL;
+    path = kasprintf(GFP_KERNEL, "%.*s/.%s.crc", (int)(base - img_path),
+                     img_path, base + 1);
+    if (!path)
+        return NULL;
+    file = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+    kfree(path);
+    if (IS_ERR(file))
+        return NULL;
+
+    if (!ramfs_csum_match(file, img)) {
+        fput(file);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * ramfs_csum_verify - 校验从镜像读回的一页
+ * @inode: ramfs 文件
+ * @csum: ramfs_csum_open 打开的校验和文件
+ * @index: 页号
+ * @addr: 读回的整页内容，镜像结尾之后已经清零
+ *
+ * 校验和文件里没有这一页时不校验
+ * 返回0表示通过，-EIO 表示内容和刷盘时不一致
+ */
+int ramfs_csum_verify(struct inode *inode, struct file *csum, pgoff_t index,
+                      const void *addr)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    loff_t pos = sizeof(struct ramfs_csum_header) + (loff_t)index * sizeof(u32);
+    u32 want;
+
+    if (kernel_read(csum, &want, sizeof(want), &pos) != sizeof(want))
+        return 0;
+    if (crc32c(~0, addr, PAGE_SIZE) == want)
+        return 0;
+
+    atomic64_inc(&fsi->csum_errors);
+    pr_err_ratelimited("RAMfs: Checksum mismatch in image of inode %lu, page %lu\n",
+                       inode->i_ino, index);
+    return -EIO;
+}
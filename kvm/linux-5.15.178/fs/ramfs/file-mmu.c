@@ -28,27 +28,242 @@
 #include <linux/mm.h>
 #include <linux/ramfs.h>
 #include <linux/sched.h>
+#include <linux/pagemap.h>
 
 #include "internal.h"
 
+/*
+ * fault_around= 挂载选项
+ *
+ * ramfs 的页仍然是 4K，不会变成透明大页（5.15 的页缓存只有 shmem 能放
+ * 可写的大页）。这个选项只改预映射：大文件的映射按 PMD 对齐，
+ * 缺页时一次把所在 2M 窗口里已经在页缓存中的页都映射上，
+ * 而不是每次 fault_around_bytes（默认 64K）；PTE 表也就正好一张
+ */
+static bool ramfs_fault_around_pmd(struct inode *inode, unsigned long vm_flags)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+
+    switch (fsi->mount_opts.fault_around) {
+    case RAMFS_FAULT_AROUND_PMD:
+        return true;
+    case RAMFS_FAULT_AROUND_WITHIN_SIZE:
+        return i_size_read(inode) >= PMD_SIZE;
+    case RAMFS_FAULT_AROUND_ADVISE:
+        return vm_flags & VM_HUGEPAGE;
+    default:
+        return false;
+    }
+}
+
+/* 和 __thp_get_unmapped_area 一样多要 PMD_SIZE，再挪到和文件偏移同余的位置 */
 static unsigned long ramfs_mmu_get_unmapped_area(struct file *file,
 		unsigned long addr, unsigned long len, unsigned long pgoff,
 		unsigned long flags)
 {
-	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+    loff_t off = (loff_t)pgoff << PAGE_SHIFT;
+    unsigned long len_pad, ret;
+
+    /* 映射之前还没有 VM_HUGEPAGE，advise 模式也先对齐 */
+    if (addr || (flags & MAP_FIXED) || len < PMD_SIZE ||
+        !ramfs_fault_around_pmd(file_inode(file), VM_HUGEPAGE))
+        goto out;
+
+    len_pad = len + PMD_SIZE;
+    if (len_pad < len || (off + len_pad) < off)
+        goto out;
+
+    ret = current->mm->get_unmapped_area(file, 0, len_pad, pgoff, flags);
+    if (IS_ERR_VALUE(ret))
+        goto out;
+    return ret + ((off - ret) & (PMD_SIZE - 1));
+
+out:
+    return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+}
+
+static inline bool ramfs_wal_mode(struct inode *inode)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+
+    return fsi->mount_opts.wal;
+}
+
+/*
+ * 和 generic_file_write_iter 一样，只是在 inode 锁内还要：
+ * 先让正在写出的快照留下要被覆盖的页，写入后标记脏页，
+ * 日志模式下再追加日志记录（同一文件的记录顺序就是写入顺序）。
+ * 刷盘也在 inode 锁下冻结快照，看到的页内容和脏页标记总是一致的
+ */
+static ssize_t ramfs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct file *file = iocb->ki_filp;
+    struct inode *inode = file_inode(file);
+    ssize_t ret;
+
+    ramfs_tier_touch(inode);
+    inode_lock(inode);
+    ret = generic_write_checks(iocb, from);
+    if (ret > 0) {
+        ramfs_snapshot_cow(inode, iocb->ki_pos, ret);
+        ret = __generic_file_write_iter(iocb, from);
+    }
+    if (ret > 0) {
+        /* 写入成功后，ki_pos 已经前移了 ret 字节 */
+        ramfs_mark_dirty(inode, iocb->ki_pos - ret, ret);
+        /* 没记进日志的写入只能靠下一次普通刷盘 */
+        if (ramfs_wal_mode(inode) &&
+            ramfs_wal_log_write(file, iocb->ki_pos - ret, ret))
+            set_bit(RAMFS_I_WAL_BYPASS, &RAMFS_I(inode)->flags);
+    }
+    inode_unlock(inode);
+
+    if (ret > 0) {
+        ret = generic_write_sync(iocb, ret);
+        ramfs_balance_dirty(inode);
+    }
+    return ret;
+}
+
+/* 分层挂载按最近有没有被读写挑要逐出的文件 */
+static ssize_t ramfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    ramfs_tier_touch(file_inode(iocb->ki_filp));
+    return generic_file_read_iter(iocb, to);
+}
+
+/*
+ * 共享可写映射第一次写某页时会走到这里；刷盘后 ramfs_file_flush
+ * 会用 page_mkclean 重新写保护这些页，保证下一次写还能被记录。
+ * 正在写出的快照里的页先换成拷贝，重新缺页后再写
+ */
+static vm_fault_t ramfs_page_mkwrite(struct vm_fault *vmf)
+{
+    struct inode *inode = file_inode(vmf->vma->vm_file);
+    struct page *page = vmf->page;
+    vm_fault_t ret;
+    int err;
+
+    /*
+     * 写缺页之前的读缺页不检查 size=，还没记账的页在这里拦下；
+     * 已经记过账的页写进去不多占空间，用量超出 size= 也照样放行
+     */
+    lock_page(page);
+    if (page->mapping != inode->i_mapping) {
+        unlock_page(page);
+        return VM_FAULT_NOPAGE;
+    }
+    err = ramfs_charge_page(page, false);
+    unlock_page(page);
+    if (err)
+        return VM_FAULT_SIGBUS;
+
+    ret = ramfs_snapshot_mkwrite(vmf);
+    if (ret)
+        return ret;
+
+    /* mmap 写入不进日志 */
+    if (ramfs_wal_mode(inode))
+        set_bit(RAMFS_I_WAL_BYPASS, &RAMFS_I(inode)->flags);
+    ramfs_mark_dirty(inode, (loff_t)vmf->pgoff << PAGE_SHIFT, PAGE_SIZE);
+    return filemap_page_mkwrite(vmf);
+}
+
+/* 把缺页预映射的窗口扩大到缺页地址所在的整个 PMD（不超出 vma） */
+static vm_fault_t ramfs_map_pages(struct vm_fault *vmf, pgoff_t start_pgoff,
+                                  pgoff_t end_pgoff)
+{
+    struct vm_area_struct *vma = vmf->vma;
+    unsigned long start, end;
+
+    if (ramfs_fault_around_pmd(file_inode(vma->vm_file), vma->vm_flags)) {
+        start = max(vmf->address & PMD_MASK, vma->vm_start);
+        end = min((vmf->address & PMD_MASK) + PMD_SIZE, vma->vm_end);
+        start_pgoff = vmf->pgoff - ((vmf->address - start) >> PAGE_SHIFT);
+        end_pgoff = vmf->pgoff + ((end - vmf->address) >> PAGE_SHIFT) - 1;
+    }
+    return filemap_map_pages(vmf, start_pgoff, end_pgoff);
+}
+
+/* 缺的页先按文件的 NUMA 策略放进页缓存，见 mpol.c */
+static vm_fault_t ramfs_fault(struct vm_fault *vmf)
+{
+    ramfs_mpol_prefault(vmf->vma->vm_file, vmf->pgoff);
+    return filemap_fault(vmf);
+}
+
+static const struct vm_operations_struct ramfs_file_vm_ops = {
+	.fault		= ramfs_fault,
+	.map_pages	= ramfs_map_pages,
+	.page_mkwrite	= ramfs_page_mkwrite,
+#ifdef CONFIG_NUMA
+	.set_policy	= ramfs_set_policy,
+	.get_policy	= ramfs_get_policy,
+#endif
+};
+
+static int ramfs_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	file_accessed(file);
+	ramfs_tier_touch(file_inode(file));
+	vma->vm_ops = &ramfs_file_vm_ops;
+	return 0;
+}
+
+/* 截断会让持久化文件尾部失效，需要记录下来 */
+static int ramfs_setattr(struct user_namespace *mnt_userns,
+			 struct dentry *dentry, struct iattr *iattr)
+{
+    struct inode *inode = d_inode(dentry);
+    unsigned long nrpages;
+    int ret;
+
+    /* 截断会原地清零最后一页的尾部，正在写出的快照要先留一份 */
+    if (iattr->ia_valid & ATTR_SIZE)
+        ramfs_snapshot_truncate(inode, iattr->ia_size);
+    nrpages = inode->i_mapping->nrpages;
+    ret = simple_setattr(mnt_userns, dentry, iattr);
+    if (!ret && (iattr->ia_valid & ATTR_SIZE)) {
+        /* 截掉的页退账，见 limit.c */
+        if (inode->i_mapping->nrpages < nrpages)
+            ramfs_uncharge_pages(inode, nrpages - inode->i_mapping->nrpages);
+        ramfs_note_size(inode, iattr->ia_size);
+        if (ramfs_wal_mode(inode) && ramfs_wal_log_truncate(dentry))
+            set_bit(RAMFS_I_WAL_BYPASS, &RAMFS_I(inode)->flags);
+    }
+    return ret;
+}
+
+/*
+ * ramfs 没有 bdi，默认不预读；还在从镜像恢复的文件和分层挂载的文件打开预读，
+ * 顺序读和 mmap 缺页时成批读入
+ */
+static int ramfs_file_open(struct inode *inode, struct file *file)
+{
+    if (ramfs_image_backed(inode))
+        file->f_ra.ra_pages = VM_READAHEAD_PAGES;
+    return generic_file_open(inode, file);
 }
 
 /* 实现文件系统同步函数 */
 static int ramfs_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 {
+    struct inode *inode = file_inode(file);
+
+    /* 日志模式下修改都在日志里，只要日志尾部落盘 */
+    if (ramfs_wal_mode(inode) &&
+        !test_bit(RAMFS_I_WAL_BYPASS, &RAMFS_I(inode)->flags))
+        return ramfs_wal_fsync(inode->i_sb);
+
     /* 调用我们的持久化函数 */
     return ramfs_file_flush(file);
 }
 
 const struct file_operations ramfs_file_operations = {
-	.read_iter	= generic_file_read_iter,
-	.write_iter	= generic_file_write_iter,
-	.mmap		= generic_file_mmap,
+	.open		= ramfs_file_open,
+	.read_iter	= ramfs_file_read_iter,
+	.write_iter	= ramfs_file_write_iter,
+	.mmap		= ramfs_file_mmap,
 	.fsync		= ramfs_fsync,  /* 替换为我们的fsync实现 */
 	.splice_read	= generic_file_splice_read,
 	.splice_write	= iter_file_splice_write,
@@ -57,6 +272,7 @@ const struct file_operations ramfs_file_operations = {
 };
 
 const struct inode_operations ramfs_file_inode_operations = {
-	.setattr	= simple_setattr,
+	.setattr	= ramfs_setattr,
 	.getattr	= simple_getattr,
+	.listxattr	= ramfs_listxattr,
 };
@@ -51,6 +51,7 @@ const struct file_operations ramfs_file_operations = {
 const struct inode_operations ramfs_file_inode_operations = {
 	.setattr		= ramfs_nommu_setattr,
 	.getattr		= simple_getattr,
+	.listxattr		= ramfs_listxattr,
 };
 
 /*****************************************************************************/
@@ -50,45 +50,164 @@
 #include <linux/mount.h>
 #include <linux/fs_struct.h>
 #include <linux/buffer_head.h>
-
-// 在文件中添加全局变量和互斥锁
-char *ramfs_sync_dir = NULL;
-DEFINE_MUTEX(ramfs_sync_mutex);
+#include <linux/crc32c.h>
+#include <linux/rmap.h>
+#include <linux/uio.h>
+#include <linux/bvec.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/cred.h>
+#include <linux/sort.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
+// 同步目录绑定在各自的超级块上（ramfs_fs_info->sync_dir），这里只记录所有挂载
+static LIST_HEAD(ramfs_supers);
+static DEFINE_MUTEX(ramfs_supers_mutex);
 static struct proc_dir_entry *ramfs_proc_dir;
 
 /* 常量定义 */
 #define RAMFS_PROC_DIR "fs/ramfs"
 #define RAMFS_BIND_ENTRY "bind"
 #define RAMFS_SYNC_ENTRY "sync"
+#define RAMFS_SYNC_DIR_ENTRY "sync_dir"
+#define RAMFS_STATS_ENTRY "stats"
 #define RAMFS_MAX_PATH 256
 
-int ramfs_bind(const char *sync_dir);
+int ramfs_bind(struct super_block *sb, const char *sync_dir);
 int ramfs_file_flush(struct file *file);
 
-struct ramfs_mount_opts {
-	umode_t mode;
-};
-
-struct ramfs_fs_info {
-	struct ramfs_mount_opts mount_opts;
-};
-
 #define RAMFS_DEFAULT_MODE	0755
 
 static const struct super_operations ramfs_ops;
 static const struct inode_operations ramfs_dir_inode_operations;
 
+static int ramfs_writeback_thread(void *data);
+static void ramfs_register_sb(struct super_block *sb);
+static void ramfs_unregister_sb(struct super_block *sb);
+
+static struct kmem_cache *ramfs_inode_cachep;
+static DEFINE_MUTEX(ramfs_inode_cache_mutex);
+
+static void ramfs_init_once(void *foo)
+{
+	struct ramfs_inode_info *ri = foo;
+
+	spin_lock_init(&ri->lock);
+	mutex_init(&ri->flush_mutex);
+	INIT_LIST_HEAD(&ri->dirty_list);
+	INIT_LIST_HEAD(&ri->restore_list);
+	INIT_LIST_HEAD(&ri->tier_list);
+	init_rwsem(&ri->xattr_sem);
+	inode_init_once(&ri->vfs_inode);
+}
+
+/*
+ * rootfs 可能在 init_ramfs_fs 之前就挂载了 ramfs，
+ * 所以 inode 缓存在第一次创建 fs_context 时按需建立
+ */
+static int ramfs_init_inodecache(void)
+{
+	int ret = 0;
+
+	mutex_lock(&ramfs_inode_cache_mutex);
+	if (!ramfs_inode_cachep) {
+		ramfs_inode_cachep = kmem_cache_create("ramfs_inode_cache",
+				sizeof(struct ramfs_inode_info), 0,
+				SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT,
+				ramfs_init_once);
+		if (!ramfs_inode_cachep)
+			ret = -ENOMEM;
+	}
+	mutex_unlock(&ramfs_inode_cache_mutex);
+	return ret;
+}
+
+static struct inode *ramfs_alloc_inode(struct super_block *sb)
+{
+	struct ramfs_inode_info *ri;
+
+	ri = kmem_cache_alloc(ramfs_inode_cachep, GFP_KERNEL);
+	if (!ri)
+		return NULL;
+	xa_init(&ri->dirty_pages);
+	ri->min_size = 0;
+	ri->restore_path = NULL;
+	ri->restore_file = NULL;
+	ri->csum_file = NULL;
+	ri->restore_size = 0;
+	ri->pack_map = NULL;
+	ri->snap = NULL;
+	ri->xattrs = RB_ROOT;
+	ri->xattr_bytes = 0;
+	/*
+	 * 同名的旧持久化文件可能属于别的 inode，第一次必须整文件写；
+	 * 日志模式下第一次 fsync 也要建出镜像，空文件才不会丢
+	 */
+	ri->flags = BIT(RAMFS_I_FULL_FLUSH) | BIT(RAMFS_I_WAL_BYPASS);
+	return &ri->vfs_inode;
+}
+
+static void ramfs_free_inode(struct inode *inode)
+{
+	kmem_cache_free(ramfs_inode_cachep, RAMFS_I(inode));
+}
+
+static void ramfs_evict_inode(struct inode *inode)
+{
+	struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	struct ramfs_inode_info *ri = RAMFS_I(inode);
+	unsigned long index, nr = 0;
+	void *entry;
+
+	ramfs_uncharge_pages(inode, inode->i_data.nrpages);
+	ramfs_uncharge_inode(fsi);
+	truncate_inode_pages_final(&inode->i_data);
+	clear_inode(inode);
+	ramfs_mpol_evict(inode);
+	ramfs_xattr_evict(inode);
+	ramfs_tier_evict(inode);
+	ramfs_restore_evict(inode);
+	ramfs_pack_evict(inode);
+
+	/* 被删掉的文件不再需要回写 */
+	spin_lock(&fsi->dirty_lock);
+	list_del_init(&ri->dirty_list);
+	spin_unlock(&fsi->dirty_lock);
+	xa_for_each(&ri->dirty_pages, index, entry)
+		nr++;
+	atomic_long_sub(nr, &fsi->nr_dirty_pages);
+	xa_destroy(&ri->dirty_pages);
+}
+
 struct inode *ramfs_get_inode(struct super_block *sb,
 				const struct inode *dir, umode_t mode, dev_t dev)
 {
-	struct inode * inode = new_inode(sb);
+	struct ramfs_fs_info *fsi = sb->s_fs_info;
+	struct inode * inode;
+	/* 分层挂载的文件页可以被回收，缺页时从镜像读回来 */
+	bool tiered = S_ISREG(mode) && fsi && fsi->mount_opts.max_resident;
+
+	/* nr_inodes= 用完了，调用者返回 -ENOSPC */
+	if (ramfs_charge_inode(fsi))
+		return NULL;
+	inode = new_inode(sb);
+	if (!inode)
+		ramfs_uncharge_inode(fsi);
 
 	if (inode) {
 		inode->i_ino = get_next_ino();
 		inode_init_owner(&init_user_ns, inode, dir, mode);
-		inode->i_mapping->a_ops = &ram_aops;
+		ramfs_mpol_init(inode);
+		inode->i_mapping->a_ops = tiered ? &ramfs_restore_aops : &ramfs_aops;
 		mapping_set_gfp_mask(inode->i_mapping, GFP_HIGHUSER);
-		mapping_set_unevictable(inode->i_mapping);
+		if (!tiered)
+			mapping_set_unevictable(inode->i_mapping);
 		inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
 		switch (mode & S_IFMT) {
 		default:
@@ -181,17 +300,59 @@ static int ramfs_tmpfile(struct user_namespace *mnt_userns,
 	return 0;
 }
 
+/* 换了名字之后，同步目录里对应的文件不再是它的旧镜像 */
+static int ramfs_link(struct dentry *old_dentry, struct inode *dir,
+		      struct dentry *dentry)
+{
+	int ret = simple_link(old_dentry, dir, dentry);
+
+	if (!ret) {
+		ramfs_restore_pin(d_inode(old_dentry));
+		set_bit(RAMFS_I_FULL_FLUSH, &RAMFS_I(d_inode(old_dentry))->flags);
+		/* 日志记录按路径回放，换名之后必须先建出新名字下的镜像 */
+		set_bit(RAMFS_I_WAL_BYPASS, &RAMFS_I(d_inode(old_dentry))->flags);
+		ramfs_inode_dirtied(d_inode(old_dentry));
+	}
+	return ret;
+}
+
+static int ramfs_rename(struct user_namespace *mnt_userns,
+			struct inode *old_dir, struct dentry *old_dentry,
+			struct inode *new_dir, struct dentry *new_dentry,
+			unsigned int flags)
+{
+	int ret = simple_rename(mnt_userns, old_dir, old_dentry,
+				new_dir, new_dentry, flags);
+
+	if (!ret) {
+		ramfs_restore_pin(d_inode(old_dentry));
+		set_bit(RAMFS_I_FULL_FLUSH, &RAMFS_I(d_inode(old_dentry))->flags);
+		/* 日志记录按路径回放，换名之后必须先建出新名字下的镜像 */
+		set_bit(RAMFS_I_WAL_BYPASS, &RAMFS_I(d_inode(old_dentry))->flags);
+		ramfs_inode_dirtied(d_inode(old_dentry));
+	}
+	return ret;
+}
+
 static const struct inode_operations ramfs_dir_inode_operations = {
 	.create		= ramfs_create,
 	.lookup		= simple_lookup,
-	.link		= simple_link,
+	.link		= ramfs_link,
 	.unlink		= simple_unlink,
 	.symlink	= ramfs_symlink,
 	.mkdir		= ramfs_mkdir,
 	.rmdir		= simple_rmdir,
 	.mknod		= ramfs_mknod,
-	.rename		= simple_rename,
+	.rename		= ramfs_rename,
 	.tmpfile	= ramfs_tmpfile,
+	.listxattr	= ramfs_listxattr,
+};
+
+static const char * const ramfs_fault_around_names[] = {
+	[RAMFS_FAULT_AROUND_DEFAULT]		= "default",
+	[RAMFS_FAULT_AROUND_PMD]		= "pmd",
+	[RAMFS_FAULT_AROUND_WITHIN_SIZE]	= "within_size",
+	[RAMFS_FAULT_AROUND_ADVISE]		= "advise",
 };
 
 /*
@@ -203,21 +364,84 @@ static int ramfs_show_options(struct seq_file *m, struct dentry *root)
 
 	if (fsi->mount_opts.mode != RAMFS_DEFAULT_MODE)
 		seq_printf(m, ",mode=%o", fsi->mount_opts.mode);
+	if (fsi->mount_opts.flush_interval)
+		seq_printf(m, ",flush_interval=%u", fsi->mount_opts.flush_interval);
+	if (fsi->mount_opts.dirty_bytes)
+		seq_printf(m, ",dirty_bytes=%llu", fsi->mount_opts.dirty_bytes);
+	if (fsi->mount_opts.wal)
+		seq_printf(m, ",wal,wal_size=%llu", fsi->mount_opts.wal_size);
+	if (fsi->mount_opts.warm)
+		seq_puts(m, ",warm");
+	if (fsi->mount_opts.pack)
+		seq_puts(m, ",pack");
+	if (fsi->mount_opts.compress)
+		seq_puts(m, ",compress=lz4");
+	if (fsi->mount_opts.max_resident)
+		seq_printf(m, ",max_resident=%llu", fsi->mount_opts.max_resident);
+	if (fsi->mount_opts.fault_around != RAMFS_FAULT_AROUND_DEFAULT)
+		seq_printf(m, ",fault_around=%s",
+			   ramfs_fault_around_names[fsi->mount_opts.fault_around]);
+	if (fsi->mount_opts.max_blocks)
+		seq_printf(m, ",size=%luk",
+			   fsi->mount_opts.max_blocks << (PAGE_SHIFT - 10));
+	if (fsi->mount_opts.max_inodes)
+		seq_printf(m, ",nr_inodes=%lu", fsi->mount_opts.max_inodes);
+#if defined(CONFIG_NUMA) && defined(CONFIG_TMPFS)
+	if (fsi->mpol) {
+		char buffer[64];
+
+		mpol_to_str(buffer, sizeof(buffer), fsi->mpol);
+		seq_printf(m, ",mpol=%s", buffer);
+	}
+#endif
+	mutex_lock(&fsi->sync_mutex);
+	if (fsi->sync_dir)
+		seq_show_option(m, "sync_dir", fsi->sync_dir);
+	mutex_unlock(&fsi->sync_mutex);
 	return 0;
 }
 
 static const struct super_operations ramfs_ops = {
-	.statfs		= simple_statfs,
+	.alloc_inode	= ramfs_alloc_inode,
+	.free_inode	= ramfs_free_inode,
+	.evict_inode	= ramfs_evict_inode,
+	.statfs		= ramfs_statfs,
 	.drop_inode	= generic_delete_inode,
 	.show_options	= ramfs_show_options,
 };
 
 enum ramfs_param {
 	Opt_mode,
+	Opt_flush_interval,
+	Opt_dirty_bytes,
+	Opt_wal,
+	Opt_wal_size,
+	Opt_warm,
+	Opt_sync_dir,
+	Opt_pack,
+	Opt_compress,
+	Opt_max_resident,
+	Opt_fault_around,
+	Opt_size,
+	Opt_nr_inodes,
+	Opt_mpol,
 };
 
 const struct fs_parameter_spec ramfs_fs_parameters[] = {
 	fsparam_u32oct("mode",	Opt_mode),
+	fsparam_u32("flush_interval",	Opt_flush_interval),
+	fsparam_string("dirty_bytes",	Opt_dirty_bytes),
+	fsparam_flag("wal",		Opt_wal),
+	fsparam_string("wal_size",	Opt_wal_size),
+	fsparam_flag("warm",		Opt_warm),
+	fsparam_string("sync_dir",	Opt_sync_dir),
+	fsparam_flag("pack",		Opt_pack),
+	fsparam_string("compress",	Opt_compress),
+	fsparam_string("max_resident",	Opt_max_resident),
+	fsparam_string("fault_around",	Opt_fault_around),
+	fsparam_string("size",		Opt_size),
+	fsparam_string("nr_inodes",	Opt_nr_inodes),
+	fsparam_string("mpol",		Opt_mpol),
 	{}
 };
 
@@ -244,6 +468,105 @@ static int ramfs_parse_param(struct fs_context *fc, struct fs_parameter *param)
 	case Opt_mode:
 		fsi->mount_opts.mode = result.uint_32 & S_IALLUGO;
 		break;
+	case Opt_flush_interval:
+		fsi->mount_opts.flush_interval = result.uint_32;
+		break;
+	case Opt_dirty_bytes: {
+		char *rest;
+
+		/* 和 tmpfs 的 size= 一样接受 k/m/g 后缀 */
+		fsi->mount_opts.dirty_bytes = memparse(param->string, &rest);
+		if (*rest)
+			return invalfc(fc, "Bad value for '%s'", param->key);
+		break;
+	}
+	case Opt_wal:
+		fsi->mount_opts.wal = true;
+		break;
+	case Opt_wal_size: {
+		char *rest;
+
+		fsi->mount_opts.wal_size = memparse(param->string, &rest);
+		if (*rest || !fsi->mount_opts.wal_size)
+			return invalfc(fc, "Bad value for '%s'", param->key);
+		break;
+	}
+	case Opt_warm:
+		fsi->mount_opts.warm = true;
+		break;
+	case Opt_sync_dir:
+		/* 先记下来，fill_super 里再校验和绑定 */
+		kfree(fsi->sync_dir);
+		fsi->sync_dir = param->string;
+		param->string = NULL;
+		break;
+	case Opt_pack:
+		fsi->mount_opts.pack = true;
+		break;
+	case Opt_compress:
+		if (!strcmp(param->string, "none")) {
+			fsi->mount_opts.compress = false;
+		} else if (!strcmp(param->string, "lz4")) {
+			if (!ramfs_cz_supported())
+				return invalfc(fc, "LZ4 is not built into this kernel");
+			fsi->mount_opts.compress = true;
+		} else {
+			return invalfc(fc, "Bad value for '%s'", param->key);
+		}
+		break;
+	case Opt_max_resident: {
+		char *rest;
+
+		fsi->mount_opts.max_resident = memparse(param->string, &rest);
+		if (*rest)
+			return invalfc(fc, "Bad value for '%s'", param->key);
+		break;
+	}
+	case Opt_fault_around:
+		opt = match_string(ramfs_fault_around_names,
+				   ARRAY_SIZE(ramfs_fault_around_names),
+				   param->string);
+		if (opt < 0)
+			return invalfc(fc, "Bad value for '%s'", param->key);
+		fsi->mount_opts.fault_around = opt;
+		break;
+	case Opt_size: {
+		unsigned long long size;
+		char *rest;
+
+		/* 和 tmpfs 一样，可以写成物理内存的百分比 */
+		size = memparse(param->string, &rest);
+		if (*rest == '%') {
+			size <<= PAGE_SHIFT;
+			size *= totalram_pages();
+			do_div(size, 100);
+			rest++;
+		}
+		if (*rest)
+			return invalfc(fc, "Bad value for '%s'", param->key);
+		fsi->mount_opts.max_blocks = DIV_ROUND_UP(size, PAGE_SIZE);
+		break;
+	}
+	case Opt_nr_inodes: {
+		char *rest;
+
+		fsi->mount_opts.max_inodes = memparse(param->string, &rest);
+		if (*rest)
+			return invalfc(fc, "Bad value for '%s'", param->key);
+		break;
+	}
+	case Opt_mpol:
+		/* mpol_parse_str 和 mpol_to_str 只在 CONFIG_TMPFS 下才有 */
+#if defined(CONFIG_NUMA) && defined(CONFIG_TMPFS)
+		/* mpol=default 解析出来是 NULL，即按分配者自己的策略 */
+		mpol_put(fsi->mpol);
+		fsi->mpol = NULL;
+		if (mpol_parse_str(param->string, &fsi->mpol))
+			return invalfc(fc, "Bad value for '%s'", param->key);
+		break;
+#else
+		return invalfc(fc, "mpol= needs CONFIG_NUMA and CONFIG_TMPFS");
+#endif
 	}
 
 	return 0;
@@ -253,6 +576,7 @@ static int ramfs_fill_super(struct super_block *sb, struct fs_context *fc)
 {
 	struct ramfs_fs_info *fsi = sb->s_fs_info;
 	struct inode *inode;
+	int err;
 
 	sb->s_maxbytes		= MAX_LFS_FILESIZE;
 	sb->s_blocksize		= PAGE_SIZE;
@@ -261,11 +585,80 @@ static int ramfs_fill_super(struct super_block *sb, struct fs_context *fc)
 	sb->s_op		= &ramfs_ops;
 	sb->s_time_gran		= 1;
 
+	/* 打包镜像自己管理整棵树，不能和按文件的日志、预热混用 */
+	if (fsi->mount_opts.pack) {
+		if (!fsi->sync_dir)
+			return invalf(fc, "ramfs: pack needs sync_dir=");
+		if (fsi->mount_opts.wal || fsi->mount_opts.warm)
+			return invalf(fc, "ramfs: pack cannot be combined with wal or warm");
+	}
+	/* 日志回放和打包镜像都按字节偏移写数据，认不得压缩块 */
+	if (fsi->mount_opts.compress &&
+	    (fsi->mount_opts.wal || fsi->mount_opts.pack))
+		return invalf(fc, "ramfs: compress cannot be combined with wal or pack");
+	/*
+	 * 被回收的页从按文件的普通镜像读回来；压缩镜像增量刷盘时会原地重写
+	 * 整块，读回和回放撞在一起会读到半个块
+	 */
+	if (fsi->mount_opts.max_resident) {
+		if (!fsi->sync_dir)
+			return invalf(fc, "ramfs: max_resident needs sync_dir=");
+		if (fsi->mount_opts.pack || fsi->mount_opts.compress)
+			return invalf(fc, "ramfs: max_resident cannot be combined with pack or compress");
+		/* 脏页不能被回收，默认最多占一半 */
+		if (!fsi->mount_opts.dirty_bytes)
+			fsi->mount_opts.dirty_bytes = fsi->mount_opts.max_resident / 2;
+	}
+
+	sb->s_xattr = ramfs_xattr_handlers;
 	inode = ramfs_get_inode(sb, NULL, S_IFDIR | fsi->mount_opts.mode, 0);
 	sb->s_root = d_make_root(inode);
 	if (!sb->s_root)
 		return -ENOMEM;
 
+	/* sync_dir= 在这里真正绑定，顺带回放日志模式留下的日志 */
+	if (fsi->sync_dir) {
+		char *sync_dir = fsi->sync_dir;
+
+		fsi->sync_dir = NULL;
+		err = ramfs_bind(sb, sync_dir);
+		kfree(sync_dir);
+		if (err)
+			return err;
+	}
+
+	/* 预热挂载：从同步目录重建目录树，数据按需读入 */
+	if (fsi->mount_opts.warm) {
+		if (!fsi->sync_dir)
+			return invalf(fc, "ramfs: warm needs sync_dir=");
+		err = ramfs_restore_tree(sb, fsi->sync_dir);
+		if (err)
+			return err;
+	}
+
+	/* 打包模式：载入镜像中的目录树和数据 */
+	if (fsi->mount_opts.pack) {
+		err = ramfs_pack_open(sb);
+		if (err)
+			return err;
+	}
+
+	if (fsi->mount_opts.wal && !fsi->mount_opts.wal_size)
+		fsi->mount_opts.wal_size = RAMFS_WAL_DEFAULT_SIZE;
+
+	/* 设置了回写周期或脏数据上限才需要后台线程；日志模式靠它做检查点 */
+	if (fsi->mount_opts.flush_interval || fsi->mount_opts.dirty_bytes ||
+	    fsi->mount_opts.wal) {
+		struct task_struct *task;
+
+		task = kthread_run(ramfs_writeback_thread, sb, "ramfs-wb");
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+		fsi->writeback_task = task;
+	}
+
+	ramfs_register_sb(sb);
+
 	return 0;
 }
 
@@ -276,7 +669,14 @@ static int ramfs_get_tree(struct fs_context *fc)
 
 static void ramfs_free_fc(struct fs_context *fc)
 {
-	kfree(fc->s_fs_info);
+	struct ramfs_fs_info *fsi = fc->s_fs_info;
+
+	if (fsi) {
+		ramfs_limit_destroy(fsi);
+		mpol_put(fsi->mpol);
+		kfree(fsi->sync_dir);
+	}
+	kfree(fsi);
 }
 
 static const struct fs_context_operations ramfs_context_ops = {
@@ -289,11 +689,28 @@ int ramfs_init_fs_context(struct fs_context *fc)
 {
 	struct ramfs_fs_info *fsi;
 
+	if (ramfs_init_inodecache())
+		return -ENOMEM;
+
 	fsi = kzalloc(sizeof(*fsi), GFP_KERNEL);
 	if (!fsi)
 		return -ENOMEM;
+	if (ramfs_limit_init(fsi)) {
+		kfree(fsi);
+		return -ENOMEM;
+	}
 
 	fsi->mount_opts.mode = RAMFS_DEFAULT_MODE;
+	spin_lock_init(&fsi->dirty_lock);
+	INIT_LIST_HEAD(&fsi->dirty_inodes);
+	init_waitqueue_head(&fsi->writeback_wait);
+	mutex_init(&fsi->wal_mutex);
+	spin_lock_init(&fsi->restore_lock);
+	INIT_LIST_HEAD(&fsi->restore_inodes);
+	spin_lock_init(&fsi->tier_lock);
+	INIT_LIST_HEAD(&fsi->tier_inodes);
+	mutex_init(&fsi->sync_mutex);
+	INIT_LIST_HEAD(&fsi->sb_list);
 	fc->s_fs_info = fsi;
 	fc->ops = &ramfs_context_ops;
 	return 0;
@@ -301,8 +718,30 @@ int ramfs_init_fs_context(struct fs_context *fc)
 
 void ramfs_kill_sb(struct super_block *sb)
 {
-	kfree(sb->s_fs_info);
+	struct ramfs_fs_info *fsi = sb->s_fs_info;
+
+	/* sget_fc 还没把 fc->s_fs_info 交给超级块 */
+	if (!fsi) {
+		kill_litter_super(sb);
+		return;
+	}
+
+	/* 先摘掉 proc 节点，之后不会再有人重新绑定 */
+	ramfs_unregister_sb(sb);
+	/* 线程退出前会把剩下的脏文件写完，必须在拆除 inode 之前 */
+	ramfs_restore_stop(fsi);
+	if (fsi->writeback_task)
+		kthread_stop(fsi->writeback_task);
+	ramfs_wal_close(fsi);
+	ramfs_pack_close(fsi);
+	/* evict_inode 还要用到 fsi，最后再释放 */
 	kill_litter_super(sb);
+	if (fsi->restore_cred)
+		put_cred(fsi->restore_cred);
+	ramfs_limit_destroy(fsi);
+	mpol_put(fsi->mpol);
+	kfree(fsi->sync_dir);
+	kfree(fsi);
 }
 
 static struct file_system_type ramfs_fs_type = {
@@ -364,21 +803,26 @@ static int parse_mount_path(const char *buffer, char *ramfs_path, char *sync_pat
 
 /**
  * ramfs_bind - 绑定同步目录
- * @ramfs_path: ramfs 的挂载路径
+ * @sb: ramfs 超级块
  * @sync_dir: 同步目录的路径
  *
- * 设置用于持久化存储ramfs文件的目录
+ * 设置这个挂载用于持久化存储ramfs文件的目录，不影响其他挂载
  * 返回0表示成功，负数表示错误码
  */
-int ramfs_bind(const char *sync_dir)
+int ramfs_bind(struct super_block *sb, const char *sync_dir)
 {
-    char *new_dir;
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    char *new_dir, *old_dir;
     int ret = 0;
     struct path path;
 
-    if (!sync_dir)
+    if (!sync_dir || sb->s_type != &ramfs_fs_type)
         return -EINVAL;
 
+    /* 打包镜像在挂载时就打开了，不能换目录 */
+    if (fsi->pack)
+        return -EBUSY;
+
     /* 验证同步目录路径是否有效 */
     ret = kern_path(sync_dir, LOOKUP_FOLLOW, &path);
     if (ret)
@@ -396,22 +840,29 @@ int ramfs_bind(const char *sync_dir)
         goto out;
     }
 
-    mutex_lock(&ramfs_sync_mutex);
+    /* 上次崩溃前日志模式留下的记录先合并进镜像 */
+    ret = ramfs_wal_replay(sync_dir);
+    if (ret) {
+        pr_err("RAMfs: Failed to replay log in %s: %d\n", sync_dir, ret);
+        goto out;
+    }
 
     /* 复制路径字符串 */
     new_dir = kstrdup(sync_dir, GFP_KERNEL);
     if (!new_dir) {
         ret = -ENOMEM;
-        mutex_unlock(&ramfs_sync_mutex);
         goto out;
     }
 
-    /* 如果已存在旧目录，释放它 */
-    kfree(ramfs_sync_dir);
-    ramfs_sync_dir = new_dir;
+    mutex_lock(&fsi->sync_mutex);
+    old_dir = fsi->sync_dir;
+    fsi->sync_dir = new_dir;
+    WRITE_ONCE(fsi->sync_gen, fsi->sync_gen + 1);
+    mutex_unlock(&fsi->sync_mutex);
 
-    mutex_unlock(&ramfs_sync_mutex);
-    pr_info("RAMfs: Bound to sync directory %s\n", ramfs_sync_dir);
+    /* 如果已存在旧目录，释放它 */
+    kfree(old_dir);
+    pr_info("RAMfs: %s bound to sync directory %s\n", sb->s_id, sync_dir);
 
 out:
     path_put(&path);
@@ -420,268 +871,1654 @@ out:
 EXPORT_SYMBOL(ramfs_bind);
 
 /**
- * ramfs_file_flush - 将ramfs文件刷新到持久存储
- * @file: 要持久化的文件
+ * ramfs_get_sync_dir - 复制一份当前绑定的同步目录
+ * @fsi: ramfs 超级块私有数据
+ * @gen: 非空时返回绑定的版本号，每次重新绑定加一
  *
- * 把ramfs文件的内容写入到已绑定的同步目录中
- * 返回0表示成功，负数表示错误码
+ * 只持有本挂载自己的锁，不同挂载之间互不影响
+ * 返回 NULL 表示没有绑定；调用者负责 kfree
  */
-int ramfs_file_flush(struct file *file)
+char *ramfs_get_sync_dir(struct ramfs_fs_info *fsi, int *gen)
 {
-    struct dentry *dentry = file->f_path.dentry;
-    struct inode *inode = d_inode(dentry);
-    const char *filename = dentry->d_name.name;
-    char *filepath = NULL;
-    struct file *sync_file = NULL;
-    struct file *read_file = NULL;  // 新增：专门用于读取的文件句柄
-    loff_t pos = 0;
-    int ret = 0;
-    char *buf = NULL;
-    ssize_t bytes_read, bytes_written;
-    size_t len;
-    loff_t size;
-    char *temp_path = NULL;
-	char fullpath[PATH_MAX];
-    char *pathname;
-    // pid_t pid;
-
-    pr_info("RAMfs: flushing file %s\n", file->f_path.dentry->d_name.name);
-    
-    // 确保检查 file 参数是否有效
-    if (!file || IS_ERR(file)) {
-        pr_err("RAMfs: Invalid file pointer passed to ramfs_file_flush\n");
-        return -EINVAL;
-    }
+    char *dir = NULL;
 
-    // 检查文件是否属于RAMfs
-    if (!file->f_path.dentry || !file->f_path.dentry->d_sb || 
-        file->f_path.dentry->d_sb->s_type != &ramfs_fs_type) {
-        pr_info("RAMfs: Not a ramfs file, skipping flush\n");
-        return 0;  // 返回成功但不做任何事
+    mutex_lock(&fsi->sync_mutex);
+    if (fsi->sync_dir) {
+        dir = kstrdup(fsi->sync_dir, GFP_KERNEL);
+        if (!dir)
+            dir = ERR_PTR(-ENOMEM);
     }
+    if (gen)
+        *gen = fsi->sync_gen;
+    mutex_unlock(&fsi->sync_mutex);
+    return dir;
+}
 
-    /* 如果没有设置同步目录，直接返回成功 */
-    mutex_lock(&ramfs_sync_mutex);
-    if (!ramfs_sync_dir) {
-        mutex_unlock(&ramfs_sync_mutex);
-        return 0;
-    }
-    /* 复制同步目录路径，避免在后续操作中持有mutex */
-    temp_path = kstrdup(ramfs_sync_dir, GFP_KERNEL);
-    mutex_unlock(&ramfs_sync_mutex);
-    
-    if (!temp_path)
-        return -ENOMEM;
+/*
+ * 增量刷盘
+ *
+ * ramfs 在 write_iter / page_mkwrite 时把页号记到 ramfs_inode_info->dirty_pages，
+ * 刷盘时只把这些范围写回同步目录中已有的镜像文件。为了保证原地更新的原子性，
+ * 先把要写的数据连同校验和写进 ".<name>.journal" 并 fsync，再覆盖目标文件；
+ * 中途崩溃的话，下一次刷盘会先回放完整提交的日志。
+ *
+ * 日志格式：header | (range, data)* | commit
+ */
+#define RAMFS_JOURNAL_MAGIC	0x4c4e4a52	/* "RJNL" */
+#define RAMFS_JOURNAL_COMMIT	0x54494d43	/* "CMIT" */
+
+struct ramfs_journal_header {
+    u32 magic;
+    u32 nr_ranges;
+    u64 min_size;	/* 先把目标截断到这里，去掉已经被截掉的旧数据 */
+    u64 new_size;	/* 最后把目标设置成这个大小 */
+};
 
-    /* 构造完整的文件路径 */
-    filepath = kmalloc(PATH_MAX, GFP_KERNEL);
-    if (!filepath) {
-        kfree(temp_path);
-        return -ENOMEM;
-    }
-	pr_info("RAMfs: filepath %s\n", filepath);
+struct ramfs_journal_range {
+    u64 offset;
+    u64 len;		/* 后面紧跟 len 字节数据 */
+};
 
-    /* 创建临时文件路径，tmp 是为了保证原子性 */
-    snprintf(filepath, PATH_MAX, "%s/.%s.tmp", temp_path, filename);
-    
-    /* 以"写+截断"模式打开临时文件 */
-    sync_file = filp_open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (IS_ERR(sync_file)) {
-        ret = PTR_ERR(sync_file);
-        pr_err("RAMfs: Failed to open temp file %s: %d\n", filepath, ret);
-        goto out_free_path;
-    }
+struct ramfs_journal_commit {
+    u32 magic;
+    u32 crc;		/* header 到最后一段数据的 crc32c */
+};
 
-	pathname = d_path(&file->f_path, fullpath, PATH_MAX);
-    if (IS_ERR(pathname)) {
-        ret = PTR_ERR(pathname);
-        pr_err("RAMfs: Failed to get file path: %d\n", ret);
-        goto out_close_file;
-    }
-    
-    // pr_info("RAMfs: Opening source file with full path: %s\n", pathname);
-    
-    /* 以只读模式打开源文件 */
-    read_file = filp_open(pathname, O_RDONLY, 0);
-    if (IS_ERR(read_file)) {
-        ret = PTR_ERR(read_file);
-        pr_err("RAMfs: Failed to open source file for reading: %d\n", ret);
-        goto out_close_file;
+static bool ramfs_over_dirty_limit(struct ramfs_fs_info *fsi, int factor)
+{
+    unsigned long long limit = fsi->mount_opts.dirty_bytes;
+
+    return limit && (unsigned long long)atomic_long_read(&fsi->nr_dirty_pages) *
+                    PAGE_SIZE > limit * factor;
+}
+
+/* 把 inode 挂到回写队列上；超过脏数据上限时立刻唤醒回写线程 */
+void ramfs_inode_dirtied(struct inode *inode)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+    if (!fsi->writeback_task || !S_ISREG(inode->i_mode))
+        return;
+
+    if (list_empty(&ri->dirty_list)) {
+        spin_lock(&fsi->dirty_lock);
+        if (list_empty(&ri->dirty_list))
+            list_add_tail(&ri->dirty_list, &fsi->dirty_inodes);
+        spin_unlock(&fsi->dirty_lock);
     }
 
-    /* 分配缓冲区以复制文件内容 */
-    size = i_size_read(inode);
-    
-    len = PAGE_SIZE; /* 使用页大小作为缓冲区大小 */
-    buf = kmalloc(len, GFP_KERNEL);
-    if (!buf) {
-        ret = -ENOMEM;
-        goto out_close_read_file;
+    if (ramfs_over_dirty_limit(fsi, 1))
+        wake_up_process(fsi->writeback_task);
+}
+
+/* 标记 [pos, pos + len) 覆盖的页为脏 */
+void ramfs_mark_dirty(struct inode *inode, loff_t pos, size_t len)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    pgoff_t index, end;
+    long added = 0;
+    int err;
+
+    if (!len)
+        return;
+
+    index = pos >> PAGE_SHIFT;
+    end = (pos + len - 1) >> PAGE_SHIFT;
+    for (; index <= end; index++) {
+        /* 小块追加写大多落在已标记的页上，先无锁查一下 */
+        if (xa_load(&ri->dirty_pages, index))
+            continue;
+        err = xa_insert(&ri->dirty_pages, index, xa_mk_value(0), GFP_KERNEL);
+        if (!err)
+            added++;
+        else if (err != -EBUSY)
+            /* 记录失败就退化成整文件刷盘，保证不会漏写 */
+            set_bit(RAMFS_I_FULL_FLUSH, &ri->flags);
     }
 
-    pos = 0; /* 逐块读取 src 文件内容并写入 tmp 文件 */
-    while (pos < size) {
-        loff_t read_pos = pos;
-        loff_t write_pos = pos;
-        size_t bytes_to_read = min_t(size_t, len, size - pos);
-        
-        /* 从ramfs文件读取 */
-        bytes_read = kernel_read(read_file, buf, bytes_to_read, &read_pos);
-        if (bytes_read < 0) {
-            ret = bytes_read;
-            pr_err("RAMfs: Failed to read from source file: %d\n", ret);
-            goto out_free_buf;
+    atomic_long_add(added, &fsi->nr_dirty_pages);
+    ramfs_inode_dirtied(inode);
+}
+
+/* 记录截断：持久化镜像里超过 newsize 的部分在下次刷盘时要丢掉 */
+void ramfs_note_size(struct inode *inode, loff_t newsize)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+    spin_lock(&ri->lock);
+    if (newsize < ri->min_size)
+        ri->min_size = newsize;
+    /* 预热中的文件：被截掉的部分以后不能再从镜像读回来 */
+    if (newsize < ri->restore_size)
+        ri->restore_size = newsize;
+    spin_unlock(&ri->lock);
+    ramfs_inode_dirtied(inode);
+}
+
+/*
+ * 写者限流：未刷盘数据超过上限两倍时，等回写线程追上来，
+ * 这样不需要应用配合也能限制崩溃时丢失的数据量
+ */
+void ramfs_balance_dirty(struct inode *inode)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+
+    if (!fsi->writeback_task || !ramfs_over_dirty_limit(fsi, 2))
+        return;
+
+    wake_up_process(fsi->writeback_task);
+    wait_event_killable_timeout(fsi->writeback_wait,
+                                !ramfs_over_dirty_limit(fsi, 1), HZ);
+}
+
+/* 重新写保护被 mmap 的页，后续写入会再走一次 page_mkwrite */
+static void ramfs_page_mkclean(struct address_space *mapping, pgoff_t index)
+{
+    struct page *page = find_lock_page(mapping, index);
+
+    if (!page)
+        return;
+    if (page_mapped(page))
+        page_mkclean(page);
+    unlock_page(page);
+    put_page(page);
+}
+
+/**
+ * ramfs_take_dirty - 取出并清空脏页集合
+ * @inode: ramfs inode
+ * @size: 本次刷盘的文件大小，超出部分的脏页直接丢弃
+ * @out: 输出参数，合并后的连续字节范围（调用者 kfree）
+ * @nr_out: 输出参数，范围个数
+ * @bytes_out: 输出参数，脏数据总字节数
+ *
+ * 必须先清除标记、再读取数据，这样刷盘期间的新写入会留到下一次
+ * 返回0表示成功；失败时已设置 RAMFS_I_FULL_FLUSH
+ */
+int ramfs_take_dirty(struct inode *inode, loff_t size,
+                     struct ramfs_range **out, int *nr_out,
+                     loff_t *bytes_out)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct address_space *mapping = inode->i_mapping;
+    struct ramfs_range *ranges = NULL, *tmp;
+    bool mapped = mapping_mapped(mapping);
+    int nr = 0, cap = 0, i;
+    unsigned long index;
+    loff_t bytes = 0;
+    void *entry;
+    int ret = 0;
+
+    xa_for_each(&ri->dirty_pages, index, entry) {
+        loff_t start = (loff_t)index << PAGE_SHIFT;
+
+        xa_erase(&ri->dirty_pages, index);
+        atomic_long_dec(&fsi->nr_dirty_pages);
+        if (mapped)
+            ramfs_page_mkclean(mapping, index);
+        if (ret || start >= size)
+            continue;
+
+        if (nr && ranges[nr - 1].start + ranges[nr - 1].len == start) {
+            ranges[nr - 1].len += PAGE_SIZE;
+            continue;
         }
-        
-        if (bytes_read == 0)
-            break;
-        
-        /* 写入同步文件 */
-        bytes_written = kernel_write(sync_file, buf, bytes_read, &write_pos);
-        if (bytes_written < 0) {
-            ret = bytes_written;
-            pr_err("RAMfs: Failed to write to temp file: %d\n", ret);
-            goto out_free_buf;
+        if (nr == cap) {
+            cap = cap ? cap * 2 : 16;
+            tmp = krealloc(ranges, cap * sizeof(*ranges), GFP_KERNEL);
+            if (!tmp) {
+                /* 继续清空集合，这一次改为整文件刷盘 */
+                set_bit(RAMFS_I_FULL_FLUSH, &ri->flags);
+                ret = -ENOMEM;
+                continue;
+            }
+            ranges = tmp;
         }
-        
-        pos += bytes_written;
+        ranges[nr].start = start;
+        ranges[nr].len = PAGE_SIZE;
+        nr++;
     }
-    
-    /* 确保数据被写入磁盘 */
-    /* vfs_fsync：强制将文件的所有待写入数据从内存缓冲区刷到磁盘上 */
-    ret = vfs_fsync(sync_file, 0);
+
     if (ret) {
-        pr_err("RAMfs: Failed to sync temp file: %d\n", ret);
-        goto out_free_buf;
+        kfree(ranges);
+        return ret;
     }
-    
-    filp_close(sync_file, NULL);
-    sync_file = NULL;
-    filp_close(read_file, NULL);
-    read_file = NULL;
-    
-    /* 最终文件路径 */
-    snprintf(filepath, PATH_MAX, "%s/%s", temp_path, filename);
-    
-    /* 原子重命名临时文件到最终文件 */
-    {
-        struct path old_path, new_dir_path;
-        struct dentry *new_dentry;
-        char *tmp_path = kmalloc(PATH_MAX, GFP_KERNEL);
-        char *final_name = NULL;
-        struct renamedata rd;  // 使用 renamedata 结构体
-        struct inode *dir_inode;
-        
-        if (!tmp_path) {
-            ret = -ENOMEM;
-            goto out_free_buf;
-        }
-        
-        /* 获取临时文件路径 */
-        snprintf(tmp_path, PATH_MAX, "%s/.%s.tmp", temp_path, filename);
-        // snprintf(filepath, PATH_MAX, "%s/.%s.%d.tmp", temp_path, filename, pid);
-        ret = kern_path(tmp_path, 0, &old_path);
-        if (ret) {
-            pr_err("RAMfs: Failed to get temp file path: %d\n", ret);
-            kfree(tmp_path);
-            goto out_free_buf;
-        }
-        
-        /* 获取目标目录路径 */
-        ret = kern_path(temp_path, 0, &new_dir_path);
-        if (ret) {
-            pr_err("RAMfs: Failed to get sync dir path: %d\n", ret);
-            path_put(&old_path);
-            kfree(tmp_path);
-            goto out_free_buf;
-        }
-
-        /* 获取目录的 inode 并锁定 */
-        dir_inode = d_inode(new_dir_path.dentry);
-        inode_lock(dir_inode);
-        
-        /* 在目标目录中查找或创建文件名 */
-        final_name = (char *)filename;
-        new_dentry = lookup_one_len(final_name, new_dir_path.dentry, strlen(final_name));
-        if (IS_ERR(new_dentry)) {
-            ret = PTR_ERR(new_dentry);
-            pr_err("RAMfs: Failed to lookup target file: %d\n", ret);
-            inode_unlock(dir_inode);  // 确保解锁
-            path_put(&old_path);
-            path_put(&new_dir_path);
-            kfree(tmp_path);
-            goto out_free_buf;
-        }
 
-        memset(&rd, 0, sizeof(rd));
-        rd.old_dentry = old_path.dentry;
-        rd.old_dir = d_inode(old_path.dentry->d_parent);
-        rd.new_dentry = new_dentry;
-        rd.new_dir = dir_inode;  // 使用已获取的指针
-        rd.flags = 0;
-        
-        /* 执行原子重命名操作 */
-        ret = vfs_rename(&rd);
-        
-        if (ret)
-            pr_err("RAMfs: Failed to rename temp file to target: %d\n", ret);
-        else
-            pr_info("RAMfs: Successfully synced file %s\n", filename);
-        
-        dput(new_dentry);
-        inode_unlock(dir_inode);  // 解锁 inode
-        path_put(&old_path);
-        path_put(&new_dir_path);
-        kfree(tmp_path);
+    for (i = 0; i < nr; i++) {
+        if (ranges[i].start + ranges[i].len > size)
+            ranges[i].len = size - ranges[i].start;
+        bytes += ranges[i].len;
     }
-    
-    kfree(buf);
-    kfree(filepath);
-    kfree(temp_path);
-    return ret;
 
-out_free_buf:
-    kfree(buf);
-out_close_read_file:
-    if (read_file && !IS_ERR(read_file))
-        filp_close(read_file, NULL);
-out_close_file:
-    if (sync_file && !IS_ERR(sync_file))
-        filp_close(sync_file, NULL);
-out_free_path:
-    kfree(filepath);
-    kfree(temp_path);
-    return ret;
+    *out = ranges;
+    *nr_out = nr;
+    *bytes_out = bytes;
+    return 0;
 }
-EXPORT_SYMBOL(ramfs_file_flush);
 
-/* 处理 /proc/fs/ramfs/bind 的读操作 */
-static ssize_t ramfs_proc_bind_read(struct file *file, char __user *buf,
-                                    size_t count, loff_t *ppos)
+/* 完整写出 len 字节，短写视为 -EIO */
+int ramfs_write_all(struct file *file, const void *buf, size_t len,
+                    loff_t *pos)
 {
-    char temp[PATH_MAX];
-    int len;
-    
-    mutex_lock(&ramfs_sync_mutex);
-    if (!ramfs_sync_dir) {
-        len = snprintf(temp, PATH_MAX, "No sync directory bound\n");
-    } else { 
-        /* 将 ramfs_sync_dir 字符串格式化到 temp 缓冲区 */
-        len = snprintf(temp, PATH_MAX, "%s\n", ramfs_sync_dir); 
-    }
-    mutex_unlock(&ramfs_sync_mutex);
-    
-    if (*ppos >= len) /* 当前读取偏移（*ppos）已经超过数据长度（len），说明数据已经读完 */
+    ssize_t n = kernel_write(file, buf, len, pos);
+
+    if (n < 0)
+        return n;
+    return n == len ? 0 : -EIO;
+}
+
+#define RAMFS_FLUSH_BATCH	256	/* 每次 vfs_iter_write 最多提交的页数 */
+
+/*
+ * 页以 bio_vec 的形式成批交给目标文件系统，只在目标页缓存里拷贝一次，
+ * 不经过中间缓冲区；空洞用零页代替。snap 不为空时从快照读页；
+ * crcs 不为空时顺便算出每页的校验和，start 必须页对齐，见 csum.c；
+ * crc 不为空时把写出的字节累加进去
+ */
+static int __ramfs_write_pages(struct address_space *mapping,
+                               struct ramfs_snapshot *snap, loff_t start,
+                               loff_t len, struct file *out, loff_t *pos,
+                               u32 *crcs, u32 *crc)
+{
+    struct page *zero = ZERO_PAGE(0);
+    pgoff_t index = start >> PAGE_SHIFT;
+    unsigned int offset = offset_in_page(start);
+    struct bio_vec *bvec;
+    int ret = 0;
+
+    bvec = kmalloc_array(RAMFS_FLUSH_BATCH, sizeof(*bvec), GFP_KERNEL);
+    if (!bvec)
+        return -ENOMEM;
+
+    while (len > 0 && !ret) {
+        struct iov_iter iter;
+        size_t bytes = 0;
+        int nr = 0, i;
+        ssize_t n;
+
+        while (nr < RAMFS_FLUSH_BATCH && len > 0) {
+            unsigned int chunk = min_t(loff_t, len, PAGE_SIZE - offset);
+            struct page *page = snap ? ramfs_snapshot_page(snap, index) :
+                                       find_get_page(mapping, index);
+
+            if (IS_ERR(page)) {
+                ret = PTR_ERR(page);
+                break;
+            }
+            if (crcs)
+                *crcs++ = ramfs_csum_page(page, chunk);
+            if (crc) {
+                void *addr = kmap_local_page(page ? page : zero);
+
+                *crc = crc32c(*crc, addr + offset, chunk);
+                kunmap_local(addr);
+            }
+            bvec[nr].bv_page = page ? page : zero;
+            bvec[nr].bv_offset = offset;
+            bvec[nr].bv_len = chunk;
+            nr++;
+            bytes += chunk;
+            len -= chunk;
+            index++;
+            offset = 0;
+        }
+
+        if (!ret) {
+            iov_iter_bvec(&iter, WRITE, bvec, nr, bytes);
+            n = vfs_iter_write(out, &iter, pos, 0);
+            if (n < 0)
+                ret = n;
+            else if (n != bytes)
+                ret = -EIO;
+        }
+
+        for (i = 0; i < nr; i++)
+            if (bvec[i].bv_page != zero)
+                put_page(bvec[i].bv_page);
+    }
+
+    kfree(bvec);
+    return ret;
+}
+
+/**
+ * ramfs_write_pages - 把 ramfs 页缓存中的一段直接写进目标文件
+ * @mapping: ramfs 文件的 address_space
+ * @start: 起始偏移
+ * @len: 长度
+ * @out: 目标文件（可写）
+ * @pos: 目标文件中的写入位置，完成后前移
+ */
+int ramfs_write_pages(struct address_space *mapping, loff_t start,
+                      loff_t len, struct file *out, loff_t *pos)
+{
+    return __ramfs_write_pages(mapping, NULL, start, len, out, pos, NULL, NULL);
+}
+
+/* 同上，但读的是刷盘快照 */
+int ramfs_write_snapshot(struct ramfs_snapshot *snap, loff_t start,
+                         loff_t len, struct file *out, loff_t *pos,
+                         u32 *crcs, u32 *crc)
+{
+    return __ramfs_write_pages(NULL, snap, start, len, out, pos, crcs, crc);
+}
+
+/* 对页缓存中的一段累加 crc32c，空洞按零计算 */
+u32 ramfs_crc_pages(struct address_space *mapping, loff_t start,
+                    loff_t len, u32 crc)
+{
+    pgoff_t index = start >> PAGE_SHIFT;
+    unsigned int offset = offset_in_page(start);
+
+    while (len > 0) {
+        unsigned int chunk = min_t(loff_t, len, PAGE_SIZE - offset);
+        struct page *page = find_get_page(mapping, index);
+        void *addr;
+
+        addr = kmap_local_page(page ? page : ZERO_PAGE(0));
+        crc = crc32c(crc, addr + offset, chunk);
+        kunmap_local(addr);
+        if (page)
+            put_page(page);
+
+        len -= chunk;
+        index++;
+        offset = 0;
+    }
+    return crc;
+}
+
+/* 在两个同步目录文件之间用 splice 搬运数据，不经过用户缓冲区 */
+int ramfs_splice_range(struct file *in, loff_t *in_pos,
+                       struct file *out, loff_t *out_pos, loff_t len)
+{
+    while (len > 0) {
+        long n = do_splice_direct(in, in_pos, out, out_pos,
+                                  min_t(loff_t, len, MAX_RW_COUNT), 0);
+
+        if (n < 0)
+            return n;
+        if (n == 0)
+            return -EIO;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * 顺序读一遍日志中的全部记录并计算 crc32c，只在回放别人留下的日志时用；
+ * *pos 返回 commit 记录所在的位置
+ */
+static int ramfs_journal_checksum(struct file *jf,
+                                  const struct ramfs_journal_header *hdr,
+                                  char *buf, u32 *crc_out, loff_t *pos)
+{
+    struct ramfs_journal_range rr;
+    u32 crc, i;
+
+    crc = crc32c(~0, hdr, sizeof(*hdr));
+    *pos = sizeof(*hdr);
+    for (i = 0; i < hdr->nr_ranges; i++) {
+        u64 len;
+
+        if (kernel_read(jf, &rr, sizeof(rr), pos) != sizeof(rr) ||
+            rr.offset + rr.len > hdr->new_size)
+            return -EBADMSG;
+        crc = crc32c(crc, &rr, sizeof(rr));
+
+        for (len = rr.len; len > 0; ) {
+            size_t chunk = min_t(u64, len, PAGE_SIZE);
+
+            if (kernel_read(jf, buf, chunk, pos) != chunk)
+                return -EBADMSG;
+            crc = crc32c(crc, buf, chunk);
+            len -= chunk;
+        }
+    }
+
+    *crc_out = crc;
+    return 0;
+}
+
+/* 往日志里写一段内容，并累加进 src->crc */
+int ramfs_journal_put(struct ramfs_journal_src *src, struct file *jf,
+                      const void *buf, size_t len, loff_t *pos)
+{
+    src->crc = crc32c(src->crc, buf, len);
+    return ramfs_write_all(jf, buf, len, pos);
+}
+
+/* 日志中一段数据的头部，调用者紧接着写 len 字节数据 */
+int ramfs_journal_put_range(struct ramfs_journal_src *src, struct file *jf,
+                            loff_t *pos, loff_t offset, loff_t len)
+{
+    struct ramfs_journal_range rr = {
+        .offset = offset,
+        .len = len,
+    };
+
+    return ramfs_journal_put(src, jf, &rr, sizeof(rr), pos);
+}
+
+/* 普通镜像：日志里的数据直接来自快照里的页 */
+struct ramfs_page_src {
+    struct ramfs_journal_src src;
+    struct ramfs_snapshot *snap;
+    u32 *crcs;			/* 各段每页的校验和，可以为空 */
+    u32 *crc_next;
+};
+
+static int ramfs_page_src_emit(struct ramfs_journal_src *src, int i,
+                               struct file *jf, loff_t *pos)
+{
+    struct ramfs_page_src *ps = container_of(src, struct ramfs_page_src, src);
+    const struct ramfs_range *r = &ps->snap->ranges[i];
+    int ret;
+
+    ret = ramfs_journal_put_range(src, jf, pos, r->start, r->len);
+    if (!ret)
+        ret = ramfs_write_snapshot(ps->snap, r->start, r->len, jf, pos,
+                                   ps->crc_next, &src->crc);
+    if (!ret && ps->crc_next)
+        ps->crc_next += DIV_ROUND_UP(r->len, PAGE_SIZE);
+    return ret;
+}
+
+/*
+ * 数据段由 src->emit 逐段写入日志，校验和在写出时顺手累加，不需要回读日志。
+ * 数据都来自冻结的快照，并发写者会先复制页，累加的内容就是写进日志的内容
+ */
+static int ramfs_journal_write(struct file *jf, struct ramfs_journal_src *src)
+{
+    struct ramfs_journal_header hdr = {
+        .magic = RAMFS_JOURNAL_MAGIC,
+        .nr_ranges = src->nr,
+        .min_size = src->min_size,
+        .new_size = src->new_size,
+    };
+    struct ramfs_journal_commit cm;
+    loff_t pos = 0;
+    int i, ret;
+
+    src->crc = ~0;
+    ret = ramfs_journal_put(src, jf, &hdr, sizeof(hdr), &pos);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < src->nr; i++) {
+        ret = src->emit(src, i, jf, &pos);
+        if (ret)
+            return ret;
+    }
+
+    cm.magic = RAMFS_JOURNAL_COMMIT;
+    cm.crc = src->crc;
+    return ramfs_write_all(jf, &cm, sizeof(cm), &pos);
+}
+
+/**
+ * ramfs_journal_replay - 校验日志并把它应用到目标文件
+ * @jf: 日志文件（可读）
+ * @target: 同步目录中的镜像文件（可写）
+ * @buf: PAGE_SIZE 大小的缓冲区
+ * @verify: 先整份读一遍核对校验和；刷盘时刚写完并 fsync 的日志不需要
+ * @applied: 不为空时返回写进目标文件的数据字节数
+ *
+ * 重复回放是幂等的
+ * 返回0表示已应用；-ENODATA 表示空日志，-EBADMSG 表示日志未完整提交
+ */
+static int ramfs_journal_replay(struct file *jf, struct file *target, char *buf,
+                                bool verify, loff_t *applied)
+{
+    struct ramfs_journal_header hdr;
+    struct ramfs_journal_range rr;
+    struct ramfs_journal_commit cm;
+    loff_t pos = 0, out_pos;
+    u32 crc, i;
+    int ret;
+
+    if (kernel_read(jf, &hdr, sizeof(hdr), &pos) != sizeof(hdr) ||
+        hdr.magic != RAMFS_JOURNAL_MAGIC)
+        return -ENODATA;
+
+    /* 第一遍：只校验，确认整份日志已经提交 */
+    if (verify) {
+        ret = ramfs_journal_checksum(jf, &hdr, buf, &crc, &pos);
+        if (ret)
+            return ret;
+        if (kernel_read(jf, &cm, sizeof(cm), &pos) != sizeof(cm) ||
+            cm.magic != RAMFS_JOURNAL_COMMIT || cm.crc != crc)
+            return -EBADMSG;
+    }
+
+    /* 第二遍：应用到目标文件 */
+    if (i_size_read(file_inode(target)) > hdr.min_size) {
+        ret = vfs_truncate(&target->f_path, hdr.min_size);
+        if (ret)
+            return ret;
+    }
+
+    pos = sizeof(hdr);
+    for (i = 0; i < hdr.nr_ranges; i++) {
+        if (kernel_read(jf, &rr, sizeof(rr), &pos) != sizeof(rr))
+            return -EIO;
+        out_pos = rr.offset;
+        ret = ramfs_splice_range(jf, &pos, target, &out_pos, rr.len);
+        if (ret)
+            return ret;
+        if (applied)
+            *applied += rr.len;
+    }
+
+    if (i_size_read(file_inode(target)) != hdr.new_size)
+        return vfs_truncate(&target->f_path, hdr.new_size);
+    return 0;
+}
+
+/* 回放上一次刷盘留下的日志（如果有），然后清空它 */
+int ramfs_journal_recover(const char *sync_dir, const char *filename,
+                          char *filepath, char *buf)
+{
+    struct file *jf, *target;
+    int ret = 0;
+
+    snprintf(filepath, PATH_MAX, "%s/.%s.journal", sync_dir, filename);
+    jf = filp_open(filepath, O_RDWR | O_LARGEFILE, 0);
+    if (IS_ERR(jf))
+        return PTR_ERR(jf) == -ENOENT ? 0 : PTR_ERR(jf);
+    if (!i_size_read(file_inode(jf)))
+        goto out;
+
+    snprintf(filepath, PATH_MAX, "%s/%s", sync_dir, filename);
+    target = filp_open(filepath, O_WRONLY | O_LARGEFILE, 0);
+    if (!IS_ERR(target)) {
+        ret = ramfs_journal_replay(jf, target, buf, true, NULL);
+        if (!ret) {
+            pr_info("RAMfs: Replayed journal for %s\n", filename);
+            ret = vfs_fsync(target, 1);
+            /* 不知道校验和文件更新到了哪一步，等下次整文件刷盘重建 */
+            ramfs_csum_drop(sync_dir, filename);
+        } else if (ret == -ENODATA || ret == -EBADMSG) {
+            /* 未提交的日志没有碰过目标文件，直接丢弃 */
+            ret = 0;
+        }
+        filp_close(target, NULL);
+    }
+    if (!ret)
+        ret = vfs_truncate(&jf->f_path, 0);
+out:
+    filp_close(jf, NULL);
+    return ret;
+}
+
+/* 把从 t0 开始的耗时记到刷盘的 phase 阶段 */
+static void ramfs_stat_phase(struct ramfs_fs_info *fsi, int phase, u64 t0)
+{
+    atomic64_add(ktime_get_ns() - t0, &fsi->flush_stats.phase_ns[phase]);
+}
+
+/*
+ * 只把快照的脏范围写回已有的镜像文件
+ * 返回 -ENOENT 表示镜像还不存在（或者格式不对），调用者应改为整文件刷盘
+ */
+static int ramfs_flush_incremental(struct ramfs_snapshot *snap,
+                                   const char *sync_dir, const char *filename,
+                                   char *filepath, char *buf)
+{
+    struct ramfs_fs_info *fsi = snap->inode->i_sb->s_fs_info;
+    loff_t min_size = snap->min_size, new_size = snap->size;
+    int nr = snap->nr;
+    struct ramfs_page_src ps = {};
+    struct ramfs_journal_src *src;
+    struct file *target, *jf;
+    loff_t jlen, applied = 0;
+    size_t nr_crcs = 0;
+    u64 t0;
+    int i, ret;
+
+    snprintf(filepath, PATH_MAX, "%s/%s", sync_dir, filename);
+    /* 压缩镜像要先读文件头 */
+    target = filp_open(filepath, O_RDWR | O_LARGEFILE, 0);
+    if (IS_ERR(target))
+        return PTR_ERR(target);
+
+    /* 没有任何变化 */
+    ret = 0;
+    if (!nr && min_size == new_size && !snap->xattrs &&
+        (fsi->mount_opts.compress ||
+         i_size_read(file_inode(target)) == new_size))
+        goto out_close_target;
+
+    if (fsi->mount_opts.compress) {
+        src = ramfs_cz_journal_src(snap, target);
+        if (IS_ERR(src)) {
+            ret = PTR_ERR(src);
+            goto out_close_target;
+        }
+    } else {
+        ps.src.nr = nr;
+        ps.src.min_size = min_size;
+        ps.src.new_size = new_size;
+        ps.src.emit = ramfs_page_src_emit;
+        ps.src.release = NULL;
+        ps.snap = snap;
+        /* 分配失败只是这次不更新校验和文件，下面会删掉它 */
+        for (i = 0; i < nr; i++)
+            nr_crcs += DIV_ROUND_UP(snap->ranges[i].len, PAGE_SIZE);
+        if (nr_crcs)
+            ps.crcs = kvmalloc_array(nr_crcs, sizeof(u32), GFP_KERNEL);
+        ps.crc_next = ps.crcs;
+        src = &ps.src;
+    }
+
+    snprintf(filepath, PATH_MAX, "%s/.%s.journal", sync_dir, filename);
+    jf = filp_open(filepath, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+    if (IS_ERR(jf)) {
+        ret = PTR_ERR(jf);
+        pr_err("RAMfs: Failed to open journal %s: %d\n", filepath, ret);
+        goto out_release;
+    }
+
+    /* 1. 日志落盘 */
+    t0 = ktime_get_ns();
+    ret = ramfs_journal_write(jf, src);
+    ramfs_stat_phase(fsi, RAMFS_PHASE_WRITE, t0);
+    if (!ret) {
+        t0 = ktime_get_ns();
+        ret = vfs_fsync(jf, 1);
+        ramfs_stat_phase(fsi, RAMFS_PHASE_FSYNC, t0);
+    }
+    if (ret) {
+        pr_err("RAMfs: Failed to write journal for %s: %d\n", filename, ret);
+        goto out_close_jf;
+    }
+    jlen = i_size_read(file_inode(jf));
+
+    /* 2. 原地更新目标文件 */
+    t0 = ktime_get_ns();
+    ret = ramfs_journal_replay(jf, target, buf, false, &applied);
+    ramfs_stat_phase(fsi, RAMFS_PHASE_WRITE, t0);
+    if (!ret) {
+        t0 = ktime_get_ns();
+        /* 扩展属性和数据一起随这次 fsync 落盘 */
+        if (!ret && snap->xattrs)
+            ret = ramfs_xattr_persist(snap->inode, target);
+        if (!ret)
+            ret = vfs_fsync(target, 1);
+        ramfs_stat_phase(fsi, RAMFS_PHASE_FSYNC, t0);
+    }
+    if (ret) {
+        pr_err("RAMfs: Failed to apply journal for %s: %d\n", filename, ret);
+        goto out_close_jf;
+    }
+
+    /* 校验和文件赶在日志作废之前更新，否则崩溃后的恢复会删掉它 */
+    if (!fsi->mount_opts.compress) {
+        if (nr_crcs && !ps.crcs)
+            ret = -ENOMEM;
+        else
+            ret = ramfs_csum_update(sync_dir, filename, target, snap,
+                                    ps.crcs, buf);
+        if (ret) {
+            pr_warn("RAMfs: Failed to update checksums for %s: %d\n",
+                    filename, ret);
+            ramfs_csum_drop(sync_dir, filename);
+            ret = 0;
+        }
+    }
+
+    /* 3. 作废日志；即使这一步丢失，回放也是幂等的 */
+    ret = vfs_truncate(&jf->f_path, 0);
+    if (!ret) {
+        snap->written = jlen + applied;
+        /* 回放读了提交记录之前的全部内容，校验和是写的时候算的 */
+        atomic64_add(jlen - sizeof(struct ramfs_journal_commit),
+                     &fsi->flush_stats.read_bytes);
+    }
+
+out_close_jf:
+    filp_close(jf, NULL);
+out_release:
+    if (src->release)
+        src->release(src);
+    kvfree(ps.crcs);
+out_close_target:
+    filp_close(target, NULL);
+    return ret;
+}
+
+/* ramfs_flush_dentry 的 flags */
+#define RAMFS_FLUSH_NO_DIRSYNC	0x1	/* 不 fsync 镜像所在目录，由调用者统一处理 */
+
+/*
+ * 返回 ramfs 目录 dir 在同步目录中对应的路径（调用者 kfree）：
+ * <sync_dir>/<dir 相对 ramfs 根的路径>，这样 a/x 和 b/x 不会互相覆盖
+ */
+static char *ramfs_backing_path(const char *sync_dir, struct dentry *dir)
+{
+    char *buf, *rel, *res;
+
+    buf = kmalloc(PATH_MAX, GFP_KERNEL);
+    if (!buf)
+        return ERR_PTR(-ENOMEM);
+
+    rel = dentry_path_raw(dir, buf, PATH_MAX);
+    if (IS_ERR(rel)) {
+        kfree(buf);
+        return rel;
+    }
+    /* 根目录的相对路径是 "/" */
+    if (IS_ROOT(dir))
+        rel = "";
+
+    res = kasprintf(GFP_KERNEL, "%s%s", sync_dir, rel);
+    kfree(buf);
+    if (!res)
+        return ERR_PTR(-ENOMEM);
+
+    /* 还要能放下 "/.<name>.journal" */
+    if (strlen(res) + NAME_MAX + 16 >= PATH_MAX) {
+        kfree(res);
+        return ERR_PTR(-ENAMETOOLONG);
+    }
+    return res;
+}
+
+/* 类似 mkdir -p：逐级创建同步目录中缺失的目录 */
+int ramfs_mkdir_p(char *path)
+{
+    struct path parent;
+    struct dentry *dentry;
+    char *p, c;
+    int ret;
+
+    /* 常见情况：目录已经存在 */
+    if (!kern_path(path, LOOKUP_FOLLOW | LOOKUP_DIRECTORY, &parent)) {
+        path_put(&parent);
+        return 0;
+    }
+
+    for (p = path + 1; ; p++) {
+        if (*p != '/' && *p != '\0')
+            continue;
+        if (p[-1] == '/') {
+            if (!*p)
+                break;
+            continue;
+        }
+
+        c = *p;
+        *p = '\0';
+        dentry = kern_path_create(AT_FDCWD, path, &parent, LOOKUP_DIRECTORY);
+        if (!IS_ERR(dentry)) {
+            ret = vfs_mkdir(&init_user_ns, d_inode(parent.dentry), dentry, 0755);
+            done_path_create(&parent, dentry);
+        } else {
+            ret = PTR_ERR(dentry);
+        }
+        *p = c;
+
+        if (ret && ret != -EEXIST)
+            return ret;
+        if (!c)
+            break;
+    }
+    return 0;
+}
+
+int ramfs_fsync_dir(const char *path)
+{
+    struct file *dir;
+    int ret;
+
+    dir = filp_open(path, O_RDONLY | O_DIRECTORY, 0);
+    if (IS_ERR(dir))
+        return PTR_ERR(dir);
+    ret = vfs_fsync(dir, 0);
+    filp_close(dir, NULL);
+    return ret;
+}
+
+/* 快照整个写入 ".<name>.tmp"，fsync 后原子重命名为 "<name>" */
+static int ramfs_flush_full(struct ramfs_snapshot *snap, const char *temp_path,
+                            const char *filename, char *filepath)
+{
+    struct ramfs_fs_info *fsi = snap->inode->i_sb->s_fs_info;
+    pgoff_t nr_pages = DIV_ROUND_UP(snap->size, PAGE_SIZE);
+    struct file *sync_file;
+    u32 *crcs = NULL;
+    loff_t pos = 0;
+    u64 t0;
+    int ret = 0;
+
+    /* 创建临时文件路径，tmp 是为了保证原子性 */
+    snprintf(filepath, PATH_MAX, "%s/.%s.tmp", temp_path, filename);
+
+    /* 以"写+截断"模式打开临时文件 */
+    sync_file = filp_open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0666);
+    if (IS_ERR(sync_file)) {
+        ret = PTR_ERR(sync_file);
+        pr_err("RAMfs: Failed to open temp file %s: %d\n", filepath, ret);
+        return ret;
+    }
+
+    /* 快照里的页直接写入 tmp 文件，压缩模式下逐块编码 */
+    t0 = ktime_get_ns();
+    if (fsi->mount_opts.compress) {
+        ret = ramfs_cz_write_file(snap, sync_file, &snap->written);
+    } else {
+        /* 分配失败就不写校验和文件，旧的那份和新镜像对不上，不会被采用 */
+        if (nr_pages)
+            crcs = kvmalloc_array(nr_pages, sizeof(u32), GFP_KERNEL);
+        ret = ramfs_write_snapshot(snap, 0, snap->size, sync_file, &pos, crcs,
+                                   NULL);
+        snap->written = pos;
+    }
+    ramfs_stat_phase(fsi, RAMFS_PHASE_WRITE, t0);
+    if (ret) {
+        pr_err("RAMfs: Failed to write to temp file: %d\n", ret);
+        goto out_close_file;
+    }
+
+    /* 扩展属性设在 tmp 文件上，随 rename 一起换上去 */
+    if (snap->xattrs || ramfs_xattr_present(snap->inode)) {
+        ret = ramfs_xattr_persist(snap->inode, sync_file);
+        if (ret) {
+            pr_err("RAMfs: Failed to write xattrs for %s: %d\n", filename, ret);
+            goto out_close_file;
+        }
+    }
+
+    /* 确保数据被写入磁盘 */
+    /* vfs_fsync：强制将文件的所有待写入数据从内存缓冲区刷到磁盘上 */
+    t0 = ktime_get_ns();
+    ret = vfs_fsync(sync_file, 0);
+    ramfs_stat_phase(fsi, RAMFS_PHASE_FSYNC, t0);
+    if (ret) {
+        pr_err("RAMfs: Failed to sync temp file: %d\n", ret);
+        goto out_close_file;
+    }
+
+    /* 校验和文件先于镜像 rename，中间崩溃时它和旧镜像对不上，只是不校验 */
+    if (crcs) {
+        ret = ramfs_csum_write_full(temp_path, filename, sync_file, crcs,
+                                    nr_pages);
+        if (ret)
+            pr_warn("RAMfs: Failed to write checksums for %s: %d\n",
+                    filename, ret);
+        else
+            snap->written += sizeof(u32) * nr_pages;
+        ret = 0;
+        kvfree(crcs);
+    }
+
+    filp_close(sync_file, NULL);
+
+    /* 原子重命名临时文件到最终文件 */
+    {
+        struct path old_path, new_dir_path;
+        struct dentry *new_dentry;
+        struct renamedata rd;  // 使用 renamedata 结构体
+        struct inode *dir_inode;
+
+        /* 获取临时文件路径 */
+        ret = kern_path(filepath, 0, &old_path);
+        if (ret) {
+            pr_err("RAMfs: Failed to get temp file path: %d\n", ret);
+            return ret;
+        }
+
+        /* 获取目标目录路径 */
+        ret = kern_path(temp_path, 0, &new_dir_path);
+        if (ret) {
+            pr_err("RAMfs: Failed to get sync dir path: %d\n", ret);
+            path_put(&old_path);
+            return ret;
+        }
+
+        /* 获取目录的 inode 并锁定 */
+        dir_inode = d_inode(new_dir_path.dentry);
+        inode_lock(dir_inode);
+
+        /* 在目标目录中查找或创建文件名 */
+        new_dentry = lookup_one_len(filename, new_dir_path.dentry, strlen(filename));
+        if (IS_ERR(new_dentry)) {
+            ret = PTR_ERR(new_dentry);
+            pr_err("RAMfs: Failed to lookup target file: %d\n", ret);
+            inode_unlock(dir_inode);  // 确保解锁
+            path_put(&old_path);
+            path_put(&new_dir_path);
+            return ret;
+        }
+
+        memset(&rd, 0, sizeof(rd));
+        rd.old_dentry = old_path.dentry;
+        rd.old_dir = d_inode(old_path.dentry->d_parent);
+        rd.new_dentry = new_dentry;
+        rd.new_dir = dir_inode;  // 使用已获取的指针
+        rd.flags = 0;
+
+        /* 执行原子重命名操作 */
+        t0 = ktime_get_ns();
+        ret = vfs_rename(&rd);
+        ramfs_stat_phase(fsi, RAMFS_PHASE_RENAME, t0);
+
+        if (ret)
+            pr_err("RAMfs: Failed to rename temp file to target: %d\n", ret);
+
+        dput(new_dentry);
+        inode_unlock(dir_inode);  // 解锁 inode
+        path_put(&old_path);
+        path_put(&new_dir_path);
+    }
+    return ret;
+
+out_close_file:
+    kvfree(crcs);
+    filp_close(sync_file, NULL);
+    return ret;
+}
+
+/*
+ * 刷盘分两步：ramfs_flush_submit 在 inode 锁下冻结一个快照，
+ * 写出放到 ramfs_flush_wq 上由 ramfs_flush_work 异步完成。
+ * 写者只在冻结的那一下被挡住，写出期间的修改由快照写时复制隔开，见 snapshot.c
+ */
+static struct workqueue_struct *ramfs_flush_wq;
+
+static int ramfs_range_cmp(const void *a, const void *b)
+{
+    const struct ramfs_range *x = a, *y = b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* 算出快照要冻结的范围：脏范围按 align 对齐后合并 */
+int ramfs_flush_frozen(struct ramfs_snapshot *snap, loff_t align)
+{
+    struct ramfs_range *fr;
+    int i, n = 0, m = 0;
+
+    if (snap->full) {
+        if (!snap->size)
+            return 0;
+        fr = kmalloc(sizeof(*fr), GFP_KERNEL);
+        if (!fr)
+            return -ENOMEM;
+        fr->start = 0;
+        fr->len = round_up(snap->size, PAGE_SIZE);
+        snap->frozen = fr;
+        snap->nr_frozen = 1;
+        return 0;
+    }
+
+    fr = kmalloc_array(snap->nr + 1, sizeof(*fr), GFP_KERNEL);
+    if (!fr)
+        return -ENOMEM;
+    for (i = 0; i < snap->nr; i++) {
+        fr[n].start = round_down(snap->ranges[i].start, align);
+        fr[n].len = round_up(snap->ranges[i].start + snap->ranges[i].len,
+                             align) - fr[n].start;
+        n++;
+    }
+    /* 压缩镜像还要重新编码跨 min_size 的那一块 */
+    if (align > PAGE_SIZE && (snap->min_size & (align - 1))) {
+        fr[n].start = round_down(snap->min_size, align);
+        fr[n].len = align;
+        n++;
+        sort(fr, n, sizeof(*fr), ramfs_range_cmp, NULL);
+    }
+
+    /* 对齐以后相邻的范围可能重叠 */
+    for (i = 0; i < n; i++) {
+        if (m) {
+            struct ramfs_range *last = &fr[m - 1];
+
+            if (fr[i].start <= last->start + last->len) {
+                last->len = max(last->len,
+                                fr[i].start + fr[i].len - last->start);
+                continue;
+            }
+        }
+        fr[m++] = fr[i];
+    }
+    snap->frozen = fr;
+    snap->nr_frozen = m;
+    return 0;
+}
+
+/*
+ * 调用者持有 inode 锁：取出脏页集合，决定刷盘方式并冻结快照
+ * 返回 -EAGAIN 表示需要先把镜像里的页都读进来再重试
+ */
+static int ramfs_flush_freeze(struct ramfs_snapshot *snap)
+{
+    struct inode *inode = snap->inode;
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    loff_t dirty_bytes = 0;
+    int ret;
+
+    /* 这次刷盘会带上所有修改，包括没进日志模式日志的 */
+    clear_bit(RAMFS_I_WAL_BYPASS, &ri->flags);
+
+    snap->size = i_size_read(inode);
+    spin_lock(&ri->lock);
+    snap->min_size = ri->min_size;
+    ri->min_size = snap->size;
+    spin_unlock(&ri->lock);
+
+    snap->full = ramfs_take_dirty(inode, snap->size, &snap->ranges, &snap->nr,
+                                  &dirty_bytes) != 0;
+    if (test_and_clear_bit(RAMFS_I_FULL_FLUSH, &ri->flags))
+        snap->full = true;
+    snap->xattrs = test_and_clear_bit(RAMFS_I_XATTR_DIRTY, &ri->flags);
+    snap->restoring = test_bit(RAMFS_I_RESTORING, &ri->flags);
+    /* 走日志的数据要写两遍，脏数据过半不如整文件重写 */
+    if (!snap->restoring && dirty_bytes * 2 > snap->size)
+        snap->full = true;
+
+    /* 还没从镜像读进来的页不能当成空洞写出去，读入要在 inode 锁外面做 */
+    ret = snap->full && snap->restoring ? -EAGAIN : 0;
+    if (!ret)
+        ret = ramfs_flush_frozen(snap, fsi->mount_opts.compress ?
+                                       RAMFS_CZ_BLOCK_SIZE : PAGE_SIZE);
+    if (!ret)
+        ret = ramfs_snapshot_freeze(snap);
+
+    /* 已经清掉的脏页信息还回去，下一次整文件重写 */
+    if (ret) {
+        set_bit(RAMFS_I_FULL_FLUSH, &ri->flags);
+        set_bit(RAMFS_I_WAL_BYPASS, &ri->flags);
+        if (snap->xattrs)
+            set_bit(RAMFS_I_XATTR_DIRTY, &ri->flags);
+        ramfs_note_size(inode, snap->min_size);
+        kfree(snap->ranges);
+        snap->ranges = NULL;
+        snap->nr = 0;
+        kfree(snap->frozen);
+        snap->frozen = NULL;
+        snap->nr_frozen = 0;
+    }
+    return ret;
+}
+
+/* 释放写出用的缓冲区，快照本身由引用计数管理 */
+static void ramfs_flush_release(struct ramfs_snapshot *snap)
+{
+    release_dentry_name_snapshot(&snap->name);
+    if (snap->cred)
+        put_cred(snap->cred);
+    snap->cred = NULL;
+    kfree(snap->buf);
+    kfree(snap->filepath);
+    kfree(snap->temp_path);
+    snap->buf = snap->filepath = snap->temp_path = NULL;
+}
+
+/*
+ * 把快照写进同步目录：镜像已存在且脏数据不多时只通过日志原地更新脏范围，
+ * 否则整文件重写
+ */
+static void ramfs_flush_work(struct work_struct *work)
+{
+    struct ramfs_snapshot *snap = container_of(work, struct ramfs_snapshot, work);
+    struct inode *inode = snap->inode;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_flush_stats *st = &fsi->flush_stats;
+    const char *filename = snap->name.name.name;
+    const struct cred *old_cred;
+    bool full = snap->full;
+    loff_t data;
+    u64 t0, lat;
+    int i, ret = 0;
+
+    old_cred = override_creds(snap->cred);
+    if (!full) {
+        ret = ramfs_flush_incremental(snap, snap->temp_path, filename,
+                                      snap->filepath, snap->buf);
+        /* 镜像还不存在；预热中的文件没法整文件重写，只能报错 */
+        if (ret == -ENOENT && !snap->restoring)
+            full = true;
+    }
+    if (full) {
+        ret = ramfs_flush_full(snap, snap->temp_path, filename, snap->filepath);
+        /* rename 要落盘还得 fsync 所在目录；整树同步时最后统一做 */
+        if (!ret && !(snap->flags & RAMFS_FLUSH_NO_DIRSYNC)) {
+            t0 = ktime_get_ns();
+            ret = ramfs_fsync_dir(snap->temp_path);
+            ramfs_stat_phase(fsi, RAMFS_PHASE_DIRSYNC, t0);
+        }
+    }
+    /* 分层挂载：写出的页可以回收了 */
+    if (!ret)
+        ramfs_tier_commit(snap, filename);
+    revert_creds(old_cred);
+
+    /* 失败时已经清掉的脏页信息找不回来了，下一次整文件重写 */
+    if (ret) {
+        set_bit(RAMFS_I_FULL_FLUSH, &ri->flags);
+        set_bit(RAMFS_I_WAL_BYPASS, &ri->flags);
+        if (snap->xattrs)
+            set_bit(RAMFS_I_XATTR_DIRTY, &ri->flags);
+        ramfs_note_size(inode, snap->min_size);
+        atomic64_inc(&st->failed);
+    } else {
+        data = full ? snap->size : 0;
+        for (i = 0; !full && i < snap->nr; i++)
+            data += snap->ranges[i].len;
+        atomic64_inc(&st->flushes);
+        if (full)
+            atomic64_inc(&st->full);
+        atomic64_add(data, &st->data_bytes);
+        atomic64_add(snap->written, &st->written_bytes);
+    }
+
+    lat = ktime_get_ns() - snap->start_ns;
+    i = min_t(int, lat >= NSEC_PER_USEC ?
+                   ilog2(div_u64(lat, NSEC_PER_USEC)) + 1 : 0,
+              RAMFS_LAT_BUCKETS - 1);
+    atomic64_inc(&st->latency[i]);
+    trace_ramfs_flush_end(inode, filename, full, ret, snap->written, lat);
+
+    ramfs_flush_release(snap);
+    ramfs_snapshot_finish(snap, ret);
+}
+
+/**
+ * ramfs_flush_submit - 为一个 ramfs 文件冻结快照并开始异步写出
+ * @dentry: 要持久化的文件
+ * @flags: RAMFS_FLUSH_*
+ *
+ * 同一文件上一次的快照写完之后才会冻结下一次。打包模式不走这里
+ * 返回快照，调用者用 ramfs_snapshot_wait 等待写出结果；
+ * 没有绑定同步目录时返回 NULL，出错时返回 ERR_PTR
+ */
+struct ramfs_snapshot *ramfs_flush_submit(struct dentry *dentry,
+                                          unsigned int flags)
+{
+    struct ramfs_fs_info *fsi = dentry->d_sb->s_fs_info;
+    struct inode *inode = d_inode(dentry);
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_snapshot *snap, *prev;
+    struct dentry *parent;
+    char *sync_dir, *temp_path;
+    int ret;
+
+    /* 如果没有设置同步目录，直接返回成功 */
+    sync_dir = ramfs_get_sync_dir(fsi, NULL);
+    if (!sync_dir)
+        return NULL;
+    if (IS_ERR(sync_dir))
+        return ERR_CAST(sync_dir);
+
+    /* 镜像放在同步目录下与 ramfs 中相同的相对位置 */
+    parent = dget_parent(dentry);
+    temp_path = ramfs_backing_path(sync_dir, parent);
+    dput(parent);
+    kfree(sync_dir);
+    if (IS_ERR(temp_path))
+        return ERR_CAST(temp_path);
+
+    snap = ramfs_snapshot_alloc(inode);
+    if (!snap) {
+        kfree(temp_path);
+        return ERR_PTR(-ENOMEM);
+    }
+    INIT_WORK(&snap->work, ramfs_flush_work);
+    snap->flags = flags;
+    snap->temp_path = temp_path;
+    /* 并发 rename 会改 d_name，拿一份快照 */
+    take_dentry_name_snapshot(&snap->name, dentry);
+    snap->filepath = kmalloc(PATH_MAX, GFP_KERNEL);
+    snap->buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (!snap->filepath || !snap->buf) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    ret = ramfs_mkdir_p(temp_path);
+    if (ret) {
+        pr_err("RAMfs: Failed to create backing dir %s: %d\n", temp_path, ret);
+        goto out_free;
+    }
+    mutex_lock(&ri->flush_mutex);
+
+    prev = ramfs_snapshot_get(inode);
+    if (prev)
+        ramfs_snapshot_wait(prev);
+
+    /* 先回放上一次可能中断的日志，保证镜像文件一致 */
+    ret = ramfs_journal_recover(temp_path, snap->name.name.name,
+                                snap->filepath, snap->buf);
+    if (ret)
+        goto out_unlock;
+
+    do {
+        if (test_bit(RAMFS_I_FULL_FLUSH, &ri->flags) &&
+            test_bit(RAMFS_I_RESTORING, &ri->flags)) {
+            ret = ramfs_restore_populate(inode);
+            if (ret)
+                goto out_unlock;
+        }
+
+        inode_lock(inode);
+        ret = ramfs_flush_freeze(snap);
+        inode_unlock(inode);
+    } while (ret == -EAGAIN);
+    if (ret)
+        goto out_unlock;
+
+    mutex_unlock(&ri->flush_mutex);
+
+    snap->start_ns = ktime_get_ns();
+    trace_ramfs_flush_start(inode, snap->name.name.name, snap->full, snap->nr,
+                            snap->size);
+
+    /* 写出期间快照由 ri->snap 上的引用保持，ramfs_snapshot_finish 释放 */
+    snap->cred = get_current_cred();
+    queue_work(ramfs_flush_wq, &snap->work);
+    return snap;
+
+out_unlock:
+    mutex_unlock(&ri->flush_mutex);
+out_free:
+    atomic64_inc(&fsi->flush_stats.failed);
+    ramfs_flush_release(snap);
+    ramfs_snapshot_put(snap);
+    return ERR_PTR(ret);
+}
+
+/**
+ * ramfs_flush_dentry - 将一个 ramfs 文件刷新到持久存储
+ * @dentry: 要持久化的文件
+ *
+ * fsync、/proc 接口和整树同步都走这里，等快照写出完成再返回
+ * 返回0表示成功，负数表示错误码
+ */
+static int ramfs_flush_dentry(struct dentry *dentry, unsigned int flags)
+{
+    struct ramfs_fs_info *fsi = dentry->d_sb->s_fs_info;
+    struct ramfs_snapshot *snap;
+
+    /* 打包模式：一次提交带上整个挂载的修改 */
+    if (fsi->pack)
+        return ramfs_pack_sync(dentry->d_sb);
+
+    snap = ramfs_flush_submit(dentry, flags);
+    if (IS_ERR_OR_NULL(snap))
+        return PTR_ERR_OR_ZERO(snap);
+    return ramfs_snapshot_wait(snap);
+}
+
+/**
+ * ramfs_file_flush - 将ramfs文件刷新到持久存储
+ * @file: 要持久化的文件
+ *
+ * 把ramfs文件的内容写入到已绑定的同步目录中
+ * 返回0表示成功，负数表示错误码
+ */
+int ramfs_file_flush(struct file *file)
+{
+    // 确保检查 file 参数是否有效
+    if (!file || IS_ERR(file)) {
+        pr_err("RAMfs: Invalid file pointer passed to ramfs_file_flush\n");
+        return -EINVAL;
+    }
+
+    // 检查文件是否属于RAMfs
+    if (!file->f_path.dentry || !file->f_path.dentry->d_sb ||
+        file->f_path.dentry->d_sb->s_type != &ramfs_fs_type) {
+        pr_info("RAMfs: Not a ramfs file, skipping flush\n");
+        return 0;  // 返回成功但不做任何事
+    }
+
+    return ramfs_flush_dentry(file->f_path.dentry, 0);
+}
+EXPORT_SYMBOL(ramfs_file_flush);
+
+/*
+ * 后台回写
+ *
+ * 挂载时指定 flush_interval= 或 dirty_bytes= 后，每个超级块有一个回写线程：
+ * 被写过的文件挂在 fsi->dirty_inodes 上，线程每隔 flush_interval 秒或者
+ * 脏数据超过 dirty_bytes 时被唤醒，先给队列里的每个文件冻结快照，
+ * 再等它们在 ramfs_flush_wq 上并发写完。
+ * 一个文件两次回写之间的多次写入只会产生一次刷盘
+ */
+static struct ramfs_snapshot *ramfs_writeback_inode(struct inode *inode)
+{
+    struct ramfs_snapshot *snap;
+    struct dentry *dentry;
+
+    /* 已经被删除的文件没有别名，不需要再持久化 */
+    dentry = d_find_alias(inode);
+    if (!dentry)
+        return NULL;
+
+    snap = ramfs_flush_submit(dentry, 0);
+    if (IS_ERR(snap))
+        pr_warn("RAMfs: Background flush of %pd failed: %ld\n", dentry,
+                PTR_ERR(snap));
+    dput(dentry);
+    return snap;
+}
+
+#define RAMFS_WB_INFLIGHT	64	/* 一轮回写最多同时挂着的快照数 */
+
+/* 等一个快照写完，返回1表示失败（文件已重新排队） */
+static int ramfs_writeback_reap(struct ramfs_snapshot *snap)
+{
+    int failed = 0;
+
+    list_del(&snap->list);
+    wait_for_completion(&snap->done);
+    if (snap->error) {
+        pr_warn("RAMfs: Background flush of inode %lu failed: %d\n",
+                snap->inode->i_ino, snap->error);
+        ramfs_inode_dirtied(snap->inode);
+        failed = 1;
+    }
+    ramfs_snapshot_put(snap);
+    return failed;
+}
+
+/* 返回本轮刷盘失败的文件数，失败的文件重新排队等下一轮 */
+int ramfs_writeback_sb(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct ramfs_snapshot *snap, *tmp;
+    struct ramfs_inode_info *ri;
+    struct inode *inode;
+    LIST_HEAD(inflight);
+    LIST_HEAD(batch);
+    int failed = 0, nr_inflight = 0;
+
+    /* 本轮只处理当前队列中的文件，回写期间新弄脏的留给下一轮 */
+    spin_lock(&fsi->dirty_lock);
+    list_splice_init(&fsi->dirty_inodes, &batch);
+    while (!list_empty(&batch)) {
+        ri = list_first_entry(&batch, struct ramfs_inode_info, dirty_list);
+        list_del_init(&ri->dirty_list);
+        inode = igrab(&ri->vfs_inode);
+        spin_unlock(&fsi->dirty_lock);
+
+        if (inode) {
+            snap = ramfs_writeback_inode(inode);
+            if (IS_ERR(snap)) {
+                failed++;
+                ramfs_inode_dirtied(inode);
+            } else if (snap) {
+                list_add_tail(&snap->list, &inflight);
+                nr_inflight++;
+            }
+            iput(inode);
+        }
+        /* 每个快照带着路径缓冲区，挂太多就先收掉最早的 */
+        if (nr_inflight > RAMFS_WB_INFLIGHT) {
+            failed += ramfs_writeback_reap(list_first_entry(&inflight,
+                                            struct ramfs_snapshot, list));
+            nr_inflight--;
+        }
+        /* 脏页已经记到快照上，被限流的写者可以继续了 */
+        wake_up_all(&fsi->writeback_wait);
+        cond_resched();
+
+        spin_lock(&fsi->dirty_lock);
+    }
+    spin_unlock(&fsi->dirty_lock);
+
+    list_for_each_entry_safe(snap, tmp, &inflight, list)
+        failed += ramfs_writeback_reap(snap);
+    return failed;
+}
+
+/*
+ * 日志模式下每一轮回写就是一次检查点，打包模式下是一次提交；
+ * 分层挂载刷完以后再逐出超出上限的干净页
+ */
+static void ramfs_writeback_pass(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+
+    if (fsi->mount_opts.wal)
+        ramfs_wal_checkpoint(sb);
+    else if (fsi->pack)
+        ramfs_pack_sync(sb);
+    else
+        ramfs_writeback_sb(sb);
+    ramfs_tier_balance(sb);
+}
+
+static int ramfs_writeback_thread(void *data)
+{
+    struct super_block *sb = data;
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    long timeout;
+
+    set_freezable();
+    while (!kthread_should_stop()) {
+        if (fsi->mount_opts.flush_interval)
+            timeout = fsi->mount_opts.flush_interval * HZ;
+        else if (fsi->mount_opts.wal)
+            timeout = RAMFS_WAL_CHECKPOINT_INTERVAL * HZ;
+        else
+            timeout = MAX_SCHEDULE_TIMEOUT;
+        /* 读回的页不会弄脏文件，分层挂载还要定期看一下常驻页数 */
+        if (fsi->mount_opts.max_resident)
+            timeout = min_t(long, timeout, RAMFS_TIER_INTERVAL * HZ);
+
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!ramfs_over_dirty_limit(fsi, 1) && !ramfs_wal_full(fsi) &&
+            !kthread_should_stop())
+            schedule_timeout(timeout);
+        __set_current_state(TASK_RUNNING);
+        try_to_freeze();
+
+        ramfs_writeback_pass(sb);
+    }
+
+    /* 卸载：把剩下的脏文件写完 */
+    ramfs_writeback_pass(sb);
+    return 0;
+}
+
+/*
+ * 整树同步
+ *
+ * 向 /proc/fs/ramfs/sync 写入一个目录（或挂载点）时，先按层次遍历整棵树并在
+ * 同步目录中建好对应的目录，然后把每个普通文件的刷盘作为一个 work 放到
+ * ramfs_sync_wq 上并发执行（最多 RAMFS_SYNC_MAX_ACTIVE 个），全部完成后
+ * 再对每个目录 fsync 一次，而不是每个文件 rename 后都 fsync 一次目录
+ */
+#define RAMFS_SYNC_MAX_ACTIVE	8
+
+static struct workqueue_struct *ramfs_sync_wq;
+
+struct ramfs_tree_sync {
+    atomic_t pending;		/* 未完成的 work 数，遍历本身也占一个 */
+    struct completion done;
+    int error;			/* 第一个错误 */
+    const struct cred *cred;	/* 以发起者的身份访问同步目录 */
+};
+
+struct ramfs_sync_item {
+    struct work_struct work;
+    struct dentry *dentry;
+    struct ramfs_tree_sync *ts;
+};
+
+static void ramfs_tree_sync_put(struct ramfs_tree_sync *ts)
+{
+    if (atomic_dec_and_test(&ts->pending))
+        complete(&ts->done);
+}
+
+static void ramfs_sync_item_fn(struct work_struct *work)
+{
+    struct ramfs_sync_item *item = container_of(work, struct ramfs_sync_item, work);
+    struct ramfs_tree_sync *ts = item->ts;
+    const struct cred *old_cred;
+    int ret;
+
+    old_cred = override_creds(ts->cred);
+    ret = ramfs_flush_dentry(item->dentry, RAMFS_FLUSH_NO_DIRSYNC);
+    revert_creds(old_cred);
+    if (ret)
+        cmpxchg(&ts->error, 0, ret);
+
+    dput(item->dentry);
+    kfree(item);
+    ramfs_tree_sync_put(ts);
+}
+
+/* 返回 parent 下排在 prev 之后的下一个有 inode 的子项（已 dget），并释放 prev */
+struct dentry *ramfs_next_child(struct dentry *parent, struct dentry *prev)
+{
+    struct list_head *p = prev ? &prev->d_child : &parent->d_subdirs;
+    struct dentry *found = NULL;
+
+    spin_lock(&parent->d_lock);
+    while ((p = p->next) != &parent->d_subdirs) {
+        struct dentry *d = list_entry(p, struct dentry, d_child);
+
+        spin_lock_nested(&d->d_lock, DENTRY_D_LOCK_NESTED);
+        if (simple_positive(d))
+            found = dget_dlock(d);
+        spin_unlock(&d->d_lock);
+        if (found)
+            break;
+    }
+    spin_unlock(&parent->d_lock);
+    dput(prev);
+    return found;
+}
+
+static int ramfs_sync_tree(struct dentry *top)
+{
+    struct ramfs_tree_sync ts;
+    struct dentry **dirs, **tmp, *child;
+    char *sync_dir, *path;
+    int nr_dirs = 1, cap = 64, i;
+    int ret = 0;
+
+    /* 打包模式每次提交本来就是整个挂载 */
+    if (((struct ramfs_fs_info *)top->d_sb->s_fs_info)->pack)
+        return ramfs_pack_sync(top->d_sb);
+
+    sync_dir = ramfs_get_sync_dir(top->d_sb->s_fs_info, NULL);
+    if (!sync_dir)
         return 0;
-        
-    if (count > len - *ppos) /* 用户请求的读取长度（count）超过剩余可读数据长度，则只读取剩余部分 */
-        count = len - *ppos;
-        
-    if (copy_to_user(buf, temp + *ppos, count))
-        return -EFAULT;
-        
-    *ppos += count;
-    return count;
+    if (IS_ERR(sync_dir))
+        return PTR_ERR(sync_dir);
+
+    dirs = kmalloc_array(cap, sizeof(*dirs), GFP_KERNEL);
+    if (!dirs) {
+        kfree(sync_dir);
+        return -ENOMEM;
+    }
+    dirs[0] = dget(top);
+
+    atomic_set(&ts.pending, 1);
+    init_completion(&ts.done);
+    ts.error = 0;
+    ts.cred = current_cred();
+
+    /* dirs 既是广度优先遍历的队列，也是最后要 fsync 的目录列表 */
+    for (i = 0; i < nr_dirs; i++) {
+        path = ramfs_backing_path(sync_dir, dirs[i]);
+        ret = IS_ERR(path) ? PTR_ERR(path) : ramfs_mkdir_p(path);
+        if (!IS_ERR(path))
+            kfree(path);
+        if (ret) {
+            /* 这个子树同步不了，继续处理其余部分 */
+            cmpxchg(&ts.error, 0, ret);
+            continue;
+        }
+
+        /* 共享锁住目录，防止遍历期间子项被 rename 到别处 */
+        inode_lock_shared(d_inode(dirs[i]));
+        child = NULL;
+        while ((child = ramfs_next_child(dirs[i], child)) != NULL) {
+            if (d_is_dir(child)) {
+                if (nr_dirs == cap) {
+                    tmp = krealloc(dirs, cap * 2 * sizeof(*dirs), GFP_KERNEL);
+                    if (!tmp) {
+                        cmpxchg(&ts.error, 0, -ENOMEM);
+                        continue;
+                    }
+                    dirs = tmp;
+                    cap *= 2;
+                }
+                dirs[nr_dirs++] = dget(child);
+            } else if (d_is_reg(child)) {
+                struct ramfs_sync_item *item = kmalloc(sizeof(*item), GFP_KERNEL);
+
+                if (!item) {
+                    cmpxchg(&ts.error, 0, -ENOMEM);
+                    continue;
+                }
+                INIT_WORK(&item->work, ramfs_sync_item_fn);
+                item->dentry = dget(child);
+                item->ts = &ts;
+                atomic_inc(&ts.pending);
+                queue_work(ramfs_sync_wq, &item->work);
+            }
+        }
+        inode_unlock_shared(d_inode(dirs[i]));
+    }
+
+    ramfs_tree_sync_put(&ts);
+    wait_for_completion(&ts.done);
+
+    /* 所有文件都 rename 完了，每个目录 fsync 一次 */
+    for (i = 0; i < nr_dirs; i++) {
+        path = ramfs_backing_path(sync_dir, dirs[i]);
+        if (!IS_ERR(path)) {
+            ret = ramfs_fsync_dir(path);
+            if (ret && ret != -ENOENT)
+                cmpxchg(&ts.error, 0, ret);
+            kfree(path);
+        }
+        dput(dirs[i]);
+    }
+
+    pr_debug("RAMfs: Synced tree %pd (%d directories)\n", top, nr_dirs);
+    kfree(dirs);
+    kfree(sync_dir);
+    return ts.error;
+}
+
+/* 处理 /proc/fs/ramfs/bind 的读操作：每个挂载一行 "<设备号> <同步目录>" */
+static int ramfs_proc_bind_show(struct seq_file *m, void *v)
+{
+    struct ramfs_fs_info *fsi;
+    int nr = 0;
+
+    mutex_lock(&ramfs_supers_mutex);
+    list_for_each_entry(fsi, &ramfs_supers, sb_list) {
+        struct super_block *sb = fsi->sb;
+
+        mutex_lock(&fsi->sync_mutex);
+        seq_printf(m, "%u:%u %s\n", MAJOR(sb->s_dev), MINOR(sb->s_dev),
+                   fsi->sync_dir ? : "-");
+        mutex_unlock(&fsi->sync_mutex);
+        nr++;
+    }
+    mutex_unlock(&ramfs_supers_mutex);
+
+    if (!nr)
+        seq_puts(m, "No sync directory bound\n");
+    return 0;
+}
+
+static int ramfs_proc_bind_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, ramfs_proc_bind_show, NULL);
 }
 
 /* 处理 /proc/fs/ramfs/bind 的写操作 */
@@ -689,6 +2526,7 @@ static ssize_t ramfs_proc_bind_write(struct file *file, const char __user *buf,
                                      size_t count, loff_t *ppos)
 {
     char *kbuf, *ramfs_path, *sync_path;
+    struct path path;
     int ret;
     
     if (count >= PATH_MAX)
@@ -720,10 +2558,16 @@ static ssize_t ramfs_proc_bind_write(struct file *file, const char __user *buf,
     ret = parse_mount_path(kbuf, ramfs_path, sync_path); /* 解析出两个 path */
     if (ret)
         goto out;
-    
-    
-    /* 绑定同步目录 */
-    ret = ramfs_bind(sync_path);
+
+    /* 找到 ramfs_path 所在的挂载，只绑定它 */
+    ret = kern_path(ramfs_path, LOOKUP_FOLLOW, &path);
+    if (ret)
+        goto out;
+    if (path.dentry->d_sb->s_type == &ramfs_fs_type)
+        ret = ramfs_bind(path.dentry->d_sb, sync_path);
+    else
+        ret = -EINVAL;
+    path_put(&path);
     if (ret == 0)
         ret = count;
     
@@ -763,11 +2607,22 @@ static ssize_t ramfs_proc_sync_write(struct file *file, const char __user *buf,
         kbuf[count-1] = '\0';
     
     /* 查找文件 */
-    ret = kern_path(kbuf, 0, &path);
+    ret = kern_path(kbuf, LOOKUP_FOLLOW, &path);
     if (ret) {
         kfree(kbuf);
         return ret;
     }
+
+    /* 目录（包括挂载点）：同步整棵子树 */
+    if (d_is_dir(path.dentry)) {
+        if (path.dentry->d_sb->s_type == &ramfs_fs_type)
+            ret = ramfs_sync_tree(path.dentry);
+        else
+            ret = -EINVAL;
+        path_put(&path);
+        kfree(kbuf);
+        return ret == 0 ? count : ret;
+    }
     
     /* 打开文件 */
     target_file = dentry_open(&path, O_RDWR, current_cred());
@@ -790,10 +2645,222 @@ static ssize_t ramfs_proc_sync_write(struct file *file, const char __user *buf,
 
 /* 定义 /proc/fs/ramfs/bind 的文件操作 */
 static const struct proc_ops ramfs_bind_fops = {
-    .proc_read = ramfs_proc_bind_read,
+    .proc_open = ramfs_proc_bind_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
     .proc_write = ramfs_proc_bind_write,
 };
 
+/*
+ * 每个挂载一个 /proc/fs/ramfs/<major:minor>/sync_dir，
+ * 设备号和 /proc/self/mountinfo 第三列一致；读出当前绑定，写入重新绑定
+ */
+static int ramfs_proc_sync_dir_show(struct seq_file *m, void *v)
+{
+    struct ramfs_fs_info *fsi = ((struct super_block *)m->private)->s_fs_info;
+
+    mutex_lock(&fsi->sync_mutex);
+    if (fsi->sync_dir)
+        seq_printf(m, "%s\n", fsi->sync_dir);
+    mutex_unlock(&fsi->sync_mutex);
+    return 0;
+}
+
+static int ramfs_proc_sync_dir_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, ramfs_proc_sync_dir_show, PDE_DATA(inode));
+}
+
+static ssize_t ramfs_proc_sync_dir_write(struct file *file,
+                                         const char __user *buf,
+                                         size_t count, loff_t *ppos)
+{
+    struct super_block *sb = PDE_DATA(file_inode(file));
+    char *kbuf;
+    int ret;
+
+    if (count >= PATH_MAX)
+        return -EINVAL;
+
+    kbuf = memdup_user_nul(buf, count);
+    if (IS_ERR(kbuf))
+        return PTR_ERR(kbuf);
+    strim(kbuf);
+
+    ret = *kbuf ? ramfs_bind(sb, kbuf) : -EINVAL;
+    kfree(kbuf);
+    return ret ? ret : count;
+}
+
+static const struct proc_ops ramfs_sync_dir_fops = {
+    .proc_open = ramfs_proc_sync_dir_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+    .proc_write = ramfs_proc_sync_dir_write,
+};
+
+/* 刷盘统计的一份读数，/proc/fs/ramfs/stats 把所有挂载的加在一起 */
+struct ramfs_flush_totals {
+    u64 flushes, full, failed;
+    u64 data_bytes, written_bytes, read_bytes;
+    u64 phase_ns[RAMFS_PHASE_NR];
+    u64 latency[RAMFS_LAT_BUCKETS];
+    u64 dirty_bytes;
+    u64 csum_errors;
+};
+
+static const char * const ramfs_phase_names[RAMFS_PHASE_NR] = {
+    [RAMFS_PHASE_WRITE]		= "write",
+    [RAMFS_PHASE_FSYNC]		= "fsync",
+    [RAMFS_PHASE_RENAME]	= "rename",
+    [RAMFS_PHASE_DIRSYNC]	= "dirsync",
+};
+
+static void ramfs_flush_totals_add(struct ramfs_flush_totals *t,
+                                   struct ramfs_fs_info *fsi)
+{
+    struct ramfs_flush_stats *st = &fsi->flush_stats;
+    int i;
+
+    t->flushes += atomic64_read(&st->flushes);
+    t->full += atomic64_read(&st->full);
+    t->failed += atomic64_read(&st->failed);
+    t->data_bytes += atomic64_read(&st->data_bytes);
+    t->written_bytes += atomic64_read(&st->written_bytes);
+    t->read_bytes += atomic64_read(&st->read_bytes);
+    for (i = 0; i < RAMFS_PHASE_NR; i++)
+        t->phase_ns[i] += atomic64_read(&st->phase_ns[i]);
+    for (i = 0; i < RAMFS_LAT_BUCKETS; i++)
+        t->latency[i] += atomic64_read(&st->latency[i]);
+    t->dirty_bytes += (u64)max(atomic_long_read(&fsi->nr_dirty_pages), 0L) *
+                      PAGE_SIZE;
+    t->csum_errors += atomic64_read(&fsi->csum_errors);
+}
+
+static void ramfs_flush_totals_show(struct seq_file *m,
+                                    const struct ramfs_flush_totals *t)
+{
+    int i;
+
+    seq_printf(m, "flushes %llu\n", t->flushes);
+    seq_printf(m, "flushes_full %llu\n", t->full);
+    seq_printf(m, "flushes_incremental %llu\n", t->flushes - t->full);
+    seq_printf(m, "flush_failures %llu\n", t->failed);
+    seq_printf(m, "flush_data_bytes %llu\n", t->data_bytes);
+    seq_printf(m, "flush_written_bytes %llu\n", t->written_bytes);
+    seq_printf(m, "flush_read_bytes %llu\n", t->read_bytes);
+    seq_printf(m, "dirty_bytes %llu\n", t->dirty_bytes);
+    seq_printf(m, "checksum_errors %llu\n", t->csum_errors);
+    for (i = 0; i < RAMFS_PHASE_NR; i++)
+        seq_printf(m, "flush_%s_time_us %llu\n", ramfs_phase_names[i],
+                   div_u64(t->phase_ns[i], NSEC_PER_USEC));
+    /* 每一格的上界，最后一格没有上界 */
+    for (i = 0; i < RAMFS_LAT_BUCKETS - 1; i++)
+        seq_printf(m, "flush_latency_us_lt_%lu %llu\n", 1UL << i,
+                   t->latency[i]);
+    seq_printf(m, "flush_latency_us_ge_%lu %llu\n",
+               1UL << (RAMFS_LAT_BUCKETS - 2), t->latency[i]);
+}
+
+/* /proc/fs/ramfs/<major:minor>/stats：这个挂载的刷盘统计 */
+static int ramfs_proc_stats_show(struct seq_file *m, void *v)
+{
+    struct ramfs_fs_info *fsi = ((struct super_block *)m->private)->s_fs_info;
+    struct ramfs_flush_totals t = {};
+
+    ramfs_flush_totals_add(&t, fsi);
+    ramfs_flush_totals_show(m, &t);
+    ramfs_cz_show_stats(m, fsi);
+    ramfs_tier_show_stats(m, fsi);
+    return 0;
+}
+
+static int ramfs_proc_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, ramfs_proc_stats_show, PDE_DATA(inode));
+}
+
+static const struct proc_ops ramfs_stats_fops = {
+    .proc_open = ramfs_proc_stats_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+/* /proc/fs/ramfs/stats：所有挂载的刷盘统计之和 */
+static int ramfs_proc_all_stats_show(struct seq_file *m, void *v)
+{
+    struct ramfs_flush_totals *t;
+    struct ramfs_fs_info *fsi;
+    int nr = 0;
+
+    t = kzalloc(sizeof(*t), GFP_KERNEL);
+    if (!t)
+        return -ENOMEM;
+
+    mutex_lock(&ramfs_supers_mutex);
+    list_for_each_entry(fsi, &ramfs_supers, sb_list) {
+        ramfs_flush_totals_add(t, fsi);
+        nr++;
+    }
+    mutex_unlock(&ramfs_supers_mutex);
+
+    seq_printf(m, "mounts %d\n", nr);
+    ramfs_flush_totals_show(m, t);
+    kfree(t);
+    return 0;
+}
+
+static int ramfs_proc_all_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, ramfs_proc_all_stats_show, NULL);
+}
+
+static const struct proc_ops ramfs_all_stats_fops = {
+    .proc_open = ramfs_proc_all_stats_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+/* fill_super 成功后登记挂载并建立它的 proc 目录 */
+static void ramfs_register_sb(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    char name[24];
+
+    fsi->sb = sb;
+    mutex_lock(&ramfs_supers_mutex);
+    list_add_tail(&fsi->sb_list, &ramfs_supers);
+    mutex_unlock(&ramfs_supers_mutex);
+
+    /* rootfs 可能在 proc 接口初始化之前挂载 */
+    if (!ramfs_proc_dir)
+        return;
+    snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+    fsi->proc_dir = proc_mkdir(name, ramfs_proc_dir);
+    if (fsi->proc_dir &&
+        (!proc_create_data(RAMFS_SYNC_DIR_ENTRY, 0644, fsi->proc_dir,
+                           &ramfs_sync_dir_fops, sb) ||
+         !proc_create_data(RAMFS_STATS_ENTRY, 0444, fsi->proc_dir,
+                           &ramfs_stats_fops, sb)))
+        pr_warn("RAMfs: Failed to create proc entries for %s\n", name);
+}
+
+/* proc_remove 会等正在进行的读写结束 */
+static void ramfs_unregister_sb(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+
+    proc_remove(fsi->proc_dir);
+    fsi->proc_dir = NULL;
+    mutex_lock(&ramfs_supers_mutex);
+    list_del_init(&fsi->sb_list);
+    mutex_unlock(&ramfs_supers_mutex);
+}
+
 /* 定义 /proc/fs/ramfs/sync 的文件操作 */
 static const struct proc_ops ramfs_sync_fops = {
     .proc_write = ramfs_proc_sync_write,
@@ -814,10 +2881,17 @@ static int __init ramfs_init_proc(void)
     /* 创建 /proc/fs/ramfs/sync 文件 */
     if (!proc_create(RAMFS_SYNC_ENTRY, 0200, ramfs_proc_dir, &ramfs_sync_fops))
         goto remove_bind;
+
+    /* 创建 /proc/fs/ramfs/stats 文件 */
+    if (!proc_create(RAMFS_STATS_ENTRY, 0444, ramfs_proc_dir,
+                     &ramfs_all_stats_fops))
+        goto remove_sync;
         
     pr_info("RAMfs: Persistence interface initialized\n");
     return 0;
     
+remove_sync:
+    remove_proc_entry(RAMFS_SYNC_ENTRY, ramfs_proc_dir);
 remove_bind:
     remove_proc_entry(RAMFS_BIND_ENTRY, ramfs_proc_dir);
 remove_dir:
@@ -828,6 +2902,7 @@ remove_dir:
 /* 清理 proc 接口 */
 static void __exit ramfs_exit_proc(void)
 {
+    remove_proc_entry(RAMFS_STATS_ENTRY, ramfs_proc_dir);
     remove_proc_entry(RAMFS_SYNC_ENTRY, ramfs_proc_dir);
     remove_proc_entry(RAMFS_BIND_ENTRY, ramfs_proc_dir);
     remove_proc_entry(RAMFS_PROC_DIR, NULL);
@@ -841,6 +2916,17 @@ static int __init init_ramfs_fs(void)
     ret = ramfs_init_proc();
     if (ret)
         pr_warn("RAMfs: Failed to initialize procfs interface\n");
+
+    ramfs_sync_wq = alloc_workqueue("ramfs_sync", WQ_UNBOUND,
+                                    RAMFS_SYNC_MAX_ACTIVE);
+    if (!ramfs_sync_wq)
+        return -ENOMEM;
+    ramfs_flush_wq = alloc_workqueue("ramfs_flush", WQ_UNBOUND,
+                                     RAMFS_SYNC_MAX_ACTIVE);
+    if (!ramfs_flush_wq) {
+        destroy_workqueue(ramfs_sync_wq);
+        return -ENOMEM;
+    }
         
     return register_filesystem(&ramfs_fs_type);
 }
@@ -849,8 +2935,9 @@ static int __init init_ramfs_fs(void)
 static void __exit exit_ramfs_fs(void)
 {
     ramfs_exit_proc();
+    destroy_workqueue(ramfs_sync_wq);
+    destroy_workqueue(ramfs_flush_wq);
     unregister_filesystem(&ramfs_fs_type);
-    kfree(ramfs_sync_dir);
 }
 
 module_init(init_ramfs_fs)
@@ -10,8 +10,409 @@ extern const struct inode_operations ramfs_file_inode_operations;
 
 // ------------------code added------------------
 
-/* 持久化支持相关函数和变量 */
-extern char *ramfs_sync_dir;
-extern int ramfs_bind(const char *sync_dir);
+#include <linux/xarray.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/refcount.h>
+#include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/dcache.h>
+#include <linux/mm_types.h>
+#include <linux/percpu_counter.h>
+#include <linux/mempolicy.h>
+#include <linux/rbtree.h>
+#include <linux/rwsem.h>
+
+/* 持久化支持相关函数 */
+extern int ramfs_bind(struct super_block *sb, const char *sync_dir);
 extern int ramfs_file_flush(struct file *file);
-// ------------------code added------------------
\ No newline at end of file
+
+/*
+ * ramfs 私有 inode：记录自上次刷盘以来被修改过的页，
+ * 使 ramfs_file_flush 只需要写回脏的范围
+ */
+struct ramfs_inode_info {
+	spinlock_t		lock;		/* 保护 min_size */
+	struct mutex		flush_mutex;	/* 同一文件的刷盘互斥 */
+	struct xarray		dirty_pages;	/* 脏页页号 -> xa_mk_value(0) */
+	loff_t			min_size;	/* 上次刷盘后 i_size 的最小值 */
+	unsigned long		flags;
+	struct list_head	dirty_list;	/* 挂在 ramfs_fs_info->dirty_inodes 上 */
+
+	/* 预热挂载：数据还在同步目录的镜像里，按需读入 */
+	char			*restore_path;	/* 镜像路径，evict 时释放 */
+	struct file		*restore_file;	/* 第一次缺页时打开，受 lock 保护 */
+	struct file		*csum_file;	/* 镜像的校验和文件，可以为空，同上 */
+	loff_t			restore_size;	/* 镜像中仍然有效的长度，受 lock 保护 */
+	struct list_head	restore_list;	/* 挂在 ramfs_fs_info->restore_inodes 上 */
+	struct list_head	tier_list;	/* 挂在 ramfs_fs_info->tier_inodes 上 */
+
+	/* 打包模式：内容在镜像中的位置，受 ramfs_pack->mutex 保护 */
+	struct ramfs_pack_map	*pack_map;
+
+	struct ramfs_snapshot	*snap;		/* 正在写出的快照，受 lock 保护 */
+	struct shared_policy	policy;		/* NUMA 策略，见 mpol.c */
+	struct rb_root		xattrs;		/* user.* 扩展属性，见 xattr.c */
+	size_t			xattr_bytes;	/* xattrs 占用的字节数，见 limit.c */
+	struct rw_semaphore	xattr_sem;	/* 保护 xattrs 和 xattr_bytes */
+	struct inode		vfs_inode;
+};
+
+/* ramfs_inode_info->flags */
+#define RAMFS_I_FULL_FLUSH	0	/* 下一次刷盘必须整文件重写 */
+#define RAMFS_I_WAL_BYPASS	1	/* 有没进日志的修改，fsync 不能只同步日志 */
+#define RAMFS_I_RESTORING	2	/* 还有页没从镜像读进来 */
+#define RAMFS_I_RESTORE_CZ	3	/* 预热用的镜像是压缩格式 */
+#define RAMFS_I_TIERED		4	/* 干净页可能已被回收，缺页时从镜像读 */
+#define RAMFS_I_TIER_REF	5	/* 上次逐出扫描以来被访问过 */
+#define RAMFS_I_XATTR_DIRTY	6	/* 扩展属性改过，还没同步到镜像上 */
+
+static inline struct ramfs_inode_info *RAMFS_I(struct inode *inode)
+{
+	return container_of(inode, struct ramfs_inode_info, vfs_inode);
+}
+
+/* 不在页缓存里的页不一定是空洞，可能还在镜像里 */
+static inline bool ramfs_image_backed(struct inode *inode)
+{
+	struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+	return test_bit(RAMFS_I_RESTORING, &ri->flags) ||
+	       test_bit(RAMFS_I_TIERED, &ri->flags);
+}
+
+/* 分层挂载的逐出扫描会跳过最近访问过的文件 */
+static inline void ramfs_tier_touch(struct inode *inode)
+{
+	struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+	if (!test_bit(RAMFS_I_TIER_REF, &ri->flags))
+		set_bit(RAMFS_I_TIER_REF, &ri->flags);
+}
+
+struct ramfs_mount_opts {
+	umode_t mode;
+	unsigned int flush_interval;	/* 后台回写周期（秒），0 表示不定期回写 */
+	unsigned long long dirty_bytes;	/* 未刷盘数据上限，0 表示不限制 */
+	bool wal;			/* 日志模式 */
+	bool warm;			/* 挂载时从同步目录重建目录树 */
+	unsigned long long wal_size;	/* 日志超过这个大小就做检查点 */
+	bool pack;			/* 整个挂载存成同步目录下的一个镜像文件 */
+	bool compress;			/* 镜像按块 LZ4 压缩 */
+	unsigned long long max_resident; /* 常驻内存上限，0 表示页不可回收 */
+	int fault_around;		/* RAMFS_FAULT_AROUND_*，见 file-mmu.c */
+	unsigned long max_blocks;	/* size= 换算成页数，0 表示不限制 */
+	unsigned long max_inodes;	/* nr_inodes=，0 表示不限制 */
+};
+
+/* ramfs_mount_opts->fault_around：什么时候按整个 PMD 预映射 */
+#define RAMFS_FAULT_AROUND_DEFAULT	0	/* 用内核的 fault_around_bytes */
+#define RAMFS_FAULT_AROUND_PMD		1	/* 所有文件 */
+#define RAMFS_FAULT_AROUND_WITHIN_SIZE	2	/* 只对不小于 PMD_SIZE 的文件 */
+#define RAMFS_FAULT_AROUND_ADVISE	3	/* 只对 madvise(MADV_HUGEPAGE) 过的映射 */
+
+/* 刷盘各阶段，用于 ramfs_flush_stats->phase_ns */
+enum ramfs_flush_phase {
+	RAMFS_PHASE_WRITE,		/* 写镜像和日志 */
+	RAMFS_PHASE_FSYNC,		/* fsync 镜像和日志 */
+	RAMFS_PHASE_RENAME,		/* 整文件刷盘的 rename */
+	RAMFS_PHASE_DIRSYNC,		/* fsync 镜像所在目录 */
+	RAMFS_PHASE_NR,
+};
+
+/* 刷盘延迟直方图：第 i 格是 [2^(i-1), 2^i) 微秒，最后一格收下所有更慢的 */
+#define RAMFS_LAT_BUCKETS	24
+
+/* 刷盘统计，见 /proc/fs/ramfs/stats 和 /proc/fs/ramfs/<major:minor>/stats */
+struct ramfs_flush_stats {
+	atomic64_t	flushes;	/* 写出成功的次数 */
+	atomic64_t	full;		/* 其中整文件重写的次数 */
+	atomic64_t	failed;		/* 冻结或写出失败的次数 */
+	atomic64_t	data_bytes;	/* 写出的文件数据 */
+	atomic64_t	written_bytes;	/* 写进同步目录的字节数，含日志 */
+	atomic64_t	read_bytes;	/* 从同步目录回读的字节数（日志回放） */
+	atomic64_t	phase_ns[RAMFS_PHASE_NR];
+	atomic64_t	latency[RAMFS_LAT_BUCKETS];
+};
+
+#define RAMFS_WAL_DEFAULT_SIZE		(64ULL << 20)
+#define RAMFS_WAL_CHECKPOINT_INTERVAL	30	/* 没有 flush_interval 时的检查点周期（秒） */
+#define RAMFS_TIER_INTERVAL		5	/* 分层挂载检查常驻页数的最长周期（秒） */
+
+struct ramfs_fs_info {
+	struct ramfs_mount_opts mount_opts;
+	struct super_block	*sb;
+	struct list_head	sb_list;	/* 挂在全局的 ramfs_supers 上 */
+	struct proc_dir_entry	*proc_dir;	/* /proc/fs/ramfs/<major:minor> */
+
+	/* 同步目录：每个挂载各自绑定，刷盘只拿自己的锁 */
+	struct mutex		sync_mutex;	/* 保护 sync_dir */
+	char			*sync_dir;
+	int			sync_gen;	/* 每次重新绑定加一 */
+
+	/* 后台回写 */
+	struct task_struct	*writeback_task;
+	spinlock_t		dirty_lock;	/* 保护 dirty_inodes */
+	struct list_head	dirty_inodes;	/* 有未刷盘数据的 inode */
+	atomic_long_t		nr_dirty_pages;
+	wait_queue_head_t	writeback_wait;	/* 被限流的写者在这里等待 */
+
+	/* 日志模式：两份日志轮流使用，检查点期间旧的一份等镜像落盘后再清空 */
+	struct mutex		wal_mutex;	/* 保护以下字段 */
+	struct file		*wal_file[2];
+	int			wal_active;	/* 正在追加的那一份 */
+	bool			wal_ckpt_pending; /* 另一份还没能清空 */
+	u64			wal_gen;
+	loff_t			wal_pos;	/* 活动日志的追加位置 */
+	loff_t			wal_synced;	/* 活动日志已 fdatasync 到这里 */
+	int			wal_sync_gen;	/* 打开日志时的 sync_gen */
+
+	/* 预热挂载 */
+	const struct cred	*restore_cred;	/* 以挂载者的身份读同步目录 */
+	struct task_struct	*restore_task;	/* 后台预读线程 */
+	spinlock_t		restore_lock;	/* 保护 restore_inodes */
+	struct list_head	restore_inodes;	/* 还没读完的文件 */
+
+	/* 打包模式 */
+	struct ramfs_pack	*pack;
+
+	/* 压缩统计，见 /proc/fs/ramfs/<major:minor>/stats */
+	atomic64_t		cz_in_bytes;	/* 压缩前的字节数 */
+	atomic64_t		cz_out_bytes;	/* 写进镜像的字节数（含块头） */
+	atomic64_t		cz_ns;		/* 压缩耗时 */
+	atomic64_t		dcz_bytes;	/* 解压出的字节数 */
+	atomic64_t		dcz_ns;		/* 解压耗时 */
+
+	/* 分层挂载 */
+	spinlock_t		tier_lock;	/* 保护 tier_inodes */
+	struct list_head	tier_inodes;	/* 已有镜像兜底的文件，时钟算法的环 */
+	atomic_long_t		nr_resident;	/* 常驻页数的估计，逐出时校正 */
+	atomic64_t		tier_evicted;	/* 主动逐出的页数 */
+	atomic64_t		tier_refaults;	/* 从镜像读回的页数 */
+
+	atomic64_t		csum_errors;	/* 读回时校验和对不上的页数 */
+
+	struct ramfs_flush_stats flush_stats;
+
+	/* 容量限制，见 limit.c */
+	struct percpu_counter	used_blocks;	/* 页缓存里记过账的页数，加上属性占的页 */
+	struct percpu_counter	used_inodes;
+	atomic_long_t		xattr_blocks;	/* used_blocks 中属于扩展属性的部分 */
+
+	struct mempolicy	*mpol;		/* mpol=，挂载后不变 */
+};
+
+extern void ramfs_mark_dirty(struct inode *inode, loff_t pos, size_t len);
+extern void ramfs_note_size(struct inode *inode, loff_t newsize);
+extern void ramfs_balance_dirty(struct inode *inode);
+
+extern char *ramfs_get_sync_dir(struct ramfs_fs_info *fsi, int *gen);
+
+/* 刷盘时取出的一段连续脏数据 */
+struct ramfs_range {
+	loff_t start;
+	loff_t len;
+};
+
+/* inode.c 中供日志模式、打包模式复用的刷盘工具 */
+extern int ramfs_take_dirty(struct inode *inode, loff_t size,
+			    struct ramfs_range **out, int *nr_out,
+			    loff_t *bytes_out);
+extern int ramfs_write_all(struct file *file, const void *buf, size_t len,
+			   loff_t *pos);
+extern int ramfs_write_pages(struct address_space *mapping, loff_t start,
+			     loff_t len, struct file *out, loff_t *pos);
+extern u32 ramfs_crc_pages(struct address_space *mapping, loff_t start,
+			   loff_t len, u32 crc);
+extern int ramfs_splice_range(struct file *in, loff_t *in_pos,
+			      struct file *out, loff_t *out_pos, loff_t len);
+/*
+ * 增量刷盘日志的内容：emit 把第 i 段写进日志，
+ * 先用 ramfs_journal_put_range 写段头，再写数据；
+ * 写出的每个字节都要累加进 crc，ramfs_journal_put 会顺手做
+ */
+struct ramfs_journal_src {
+	int nr;				/* 段数 */
+	loff_t min_size;		/* 回放时先把镜像截断到这里 */
+	loff_t new_size;		/* 最后把镜像设置成这个大小 */
+	int (*emit)(struct ramfs_journal_src *src, int i, struct file *jf,
+		    loff_t *pos);
+	void (*release)(struct ramfs_journal_src *src);	/* 可以为空 */
+	u32 crc;			/* 已写出内容的 crc32c，由 ramfs_journal_write 初始化 */
+};
+
+/*
+ * 一次刷盘的快照，见 snapshot.c。写出用到的字段由 inode.c 填写
+ */
+struct ramfs_snapshot {
+	refcount_t		ref;
+	struct inode		*inode;		/* 持有引用 */
+	loff_t			size;		/* 冻结时的 i_size */
+	loff_t			min_size;	/* 上次刷盘以来的最小文件大小 */
+	struct ramfs_range	*ranges;	/* 脏范围，整文件刷盘时不用 */
+	int			nr;
+	bool			full;		/* 整文件重写 */
+	bool			restoring;	/* 冻结时还有页没从镜像读进来 */
+	bool			xattrs;		/* 要把扩展属性同步到镜像上 */
+	struct ramfs_range	*frozen;	/* 冻结的范围：页对齐、升序、不重叠 */
+	int			nr_frozen;
+	struct xarray		pages;		/* 页号 -> 写者改动前的页，空洞是 xa_mk_value(0) */
+
+	unsigned int		flags;		/* RAMFS_FLUSH_* */
+	const struct cred	*cred;		/* 以发起者的身份访问同步目录 */
+	struct name_snapshot	name;
+	char			*temp_path;	/* 镜像所在目录 */
+	char			*filepath;
+	char			*buf;
+	struct work_struct	work;
+	struct list_head	list;		/* 供调用者把多个快照串起来 */
+	struct completion	done;
+	int			error;		/* 写出的结果，done 之后有效 */
+	u64			start_ns;	/* 冻结完成的时间 */
+	loff_t			written;	/* 写进同步目录的字节数 */
+};
+
+extern int ramfs_journal_put(struct ramfs_journal_src *src, struct file *jf,
+			     const void *buf, size_t len, loff_t *pos);
+extern int ramfs_journal_put_range(struct ramfs_journal_src *src,
+				   struct file *jf, loff_t *pos, loff_t offset,
+				   loff_t len);
+extern int ramfs_journal_recover(const char *sync_dir, const char *filename,
+				 char *filepath, char *buf);
+extern int ramfs_mkdir_p(char *path);
+extern int ramfs_fsync_dir(const char *path);
+extern int ramfs_writeback_sb(struct super_block *sb);
+extern struct dentry *ramfs_next_child(struct dentry *parent,
+				       struct dentry *prev);
+extern struct ramfs_snapshot *ramfs_flush_submit(struct dentry *dentry,
+						 unsigned int flags);
+extern int ramfs_flush_frozen(struct ramfs_snapshot *snap, loff_t align);
+extern int ramfs_write_snapshot(struct ramfs_snapshot *snap, loff_t start,
+				loff_t len, struct file *out, loff_t *pos,
+				u32 *crcs, u32 *crc);
+
+/* wal.c */
+extern int ramfs_wal_log_write(struct file *file, loff_t pos, size_t len);
+extern int ramfs_wal_log_truncate(struct dentry *dentry);
+extern int ramfs_wal_fsync(struct super_block *sb);
+extern bool ramfs_wal_full(struct ramfs_fs_info *fsi);
+extern void ramfs_wal_checkpoint(struct super_block *sb);
+extern int ramfs_wal_replay(const char *sync_dir);
+extern void ramfs_wal_close(struct ramfs_fs_info *fsi);
+
+/* restore.c */
+extern int ramfs_restore_tree(struct super_block *sb, const char *sync_dir);
+extern int ramfs_restore_populate(struct inode *inode);
+extern void ramfs_restore_pin(struct inode *inode);
+extern void ramfs_restore_evict(struct inode *inode);
+extern void ramfs_restore_stop(struct ramfs_fs_info *fsi);
+extern const struct address_space_operations ramfs_restore_aops;
+
+/* pack.c */
+extern int ramfs_pack_open(struct super_block *sb);
+extern int ramfs_pack_sync(struct super_block *sb);
+extern void ramfs_pack_close(struct ramfs_fs_info *fsi);
+extern void ramfs_pack_evict(struct inode *inode);
+
+/* compress.c */
+#define RAMFS_CZ_BLOCK_SHIFT	(PAGE_SHIFT > 14 ? PAGE_SHIFT : 14)
+#define RAMFS_CZ_BLOCK_SIZE	(1UL << RAMFS_CZ_BLOCK_SHIFT)
+
+struct seq_file;
+extern bool ramfs_cz_supported(void);
+extern int ramfs_cz_read_header(struct file *file, loff_t *size);
+extern int ramfs_cz_write_file(struct ramfs_snapshot *snap, struct file *out,
+			       loff_t *written);
+extern struct ramfs_journal_src *
+ramfs_cz_journal_src(struct ramfs_snapshot *snap, struct file *target);
+extern int ramfs_cz_read_page(struct inode *inode, struct file *img,
+			      pgoff_t index, void *addr, loff_t limit);
+extern void ramfs_cz_show_stats(struct seq_file *m, struct ramfs_fs_info *fsi);
+
+/* snapshot.c */
+extern struct ramfs_snapshot *ramfs_snapshot_alloc(struct inode *inode);
+extern void ramfs_snapshot_put(struct ramfs_snapshot *snap);
+extern struct ramfs_snapshot *ramfs_snapshot_get(struct inode *inode);
+extern int ramfs_snapshot_freeze(struct ramfs_snapshot *snap);
+extern void ramfs_snapshot_finish(struct ramfs_snapshot *snap, int error);
+extern int ramfs_snapshot_wait(struct ramfs_snapshot *snap);
+extern void ramfs_snapshot_cow(struct inode *inode, loff_t pos, loff_t len);
+extern void ramfs_snapshot_truncate(struct inode *inode, loff_t newsize);
+extern vm_fault_t ramfs_snapshot_mkwrite(struct vm_fault *vmf);
+extern struct page *ramfs_snapshot_page(struct ramfs_snapshot *snap,
+					pgoff_t index);
+
+/* xattr.c */
+struct xattr_handler;
+extern const struct xattr_handler *ramfs_xattr_handlers[];
+extern ssize_t ramfs_listxattr(struct dentry *dentry, char *buffer, size_t size);
+extern void ramfs_xattr_evict(struct inode *inode);
+extern bool ramfs_xattr_present(struct inode *inode);
+extern int ramfs_xattr_persist(struct inode *inode, struct file *img);
+extern void ramfs_xattr_load(struct inode *inode, const char *path);
+extern void ramfs_inode_dirtied(struct inode *inode);
+
+/* csum.c */
+extern u32 ramfs_csum_page(struct page *page, unsigned int len);
+extern void ramfs_csum_drop(const char *dir, const char *name);
+extern int ramfs_csum_write_full(const char *dir, const char *name,
+				 struct file *img, const u32 *crcs, pgoff_t nr);
+extern int ramfs_csum_update(const char *dir, const char *name,
+			     struct file *img, struct ramfs_snapshot *snap,
+			     const u32 *crcs, char *buf);
+extern struct file *ramfs_csum_open(struct file *img, const char *img_path);
+extern int ramfs_csum_verify(struct inode *inode, struct file *csum,
+			     pgoff_t index, const void *addr);
+
+/* limit.c */
+struct kstatfs;
+extern int ramfs_limit_init(struct ramfs_fs_info *fsi);
+extern void ramfs_limit_destroy(struct ramfs_fs_info *fsi);
+extern int ramfs_charge_inode(struct ramfs_fs_info *fsi);
+extern void ramfs_uncharge_inode(struct ramfs_fs_info *fsi);
+extern int ramfs_charge_page(struct page *page, bool force);
+extern void ramfs_uncharge_pages(struct inode *inode, unsigned long nr);
+extern int ramfs_charge_xattr(struct inode *inode, long delta, bool force);
+extern int ramfs_statfs(struct dentry *dentry, struct kstatfs *buf);
+extern const struct address_space_operations ramfs_aops;
+
+/* mpol.c */
+#ifdef CONFIG_NUMA
+extern void ramfs_mpol_init(struct inode *inode);
+extern void ramfs_mpol_evict(struct inode *inode);
+extern struct page *ramfs_grab_page(struct address_space *mapping,
+				    pgoff_t index, unsigned int flags);
+extern void ramfs_mpol_prefault(struct file *file, pgoff_t index);
+extern int ramfs_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol);
+extern struct mempolicy *ramfs_get_policy(struct vm_area_struct *vma,
+					  unsigned long addr);
+#else
+static inline void ramfs_mpol_init(struct inode *inode)
+{
+}
+
+static inline void ramfs_mpol_evict(struct inode *inode)
+{
+}
+
+static inline struct page *ramfs_grab_page(struct address_space *mapping,
+					   pgoff_t index, unsigned int flags)
+{
+	return grab_cache_page_write_begin(mapping, index, flags);
+}
+
+static inline void ramfs_mpol_prefault(struct file *file, pgoff_t index)
+{
+}
+#endif
+
+/* tier.c */
+extern void ramfs_tier_charge(struct inode *inode);
+extern void ramfs_tier_commit(struct ramfs_snapshot *snap, const char *filename);
+extern void ramfs_tier_balance(struct super_block *sb);
+extern void ramfs_tier_evict(struct inode *inode);
+extern void ramfs_tier_show_stats(struct seq_file *m, struct ramfs_fs_info *fsi);
+// ------------------code added------------------
@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 容量限制（mount -o size=<size>,nr_inodes=<n>）
+ *
+ * 原版 ramfs 没有上限，一个失控的写者就能吃光内存。这里和 tmpfs 一样
+ * 限制页数和 inode 数，用量记在 percpu_counter 里：离上限还远时检查只读
+ * 本 CPU 的计数，多线程写同一个挂载不会在一个全局计数的缓存行上来回抢；
+ * 接近上限时 percpu_counter_compare 才去精确求和。
+ *
+ * 页在加进页缓存的地方记账：write_begin 和 readpage，记过账的页打上
+ * PG_checked，同一页不会记两次。PG_checked 会随页迁移一起带走。
+ * freepage 被调用时页已经离开了 mapping，找不到挂载，所以退账放在删页的
+ * 地方按 nrpages 的差计算：截断、evict，以及分层挂载的逐出扫描
+ * （内核回收分层挂载的干净页不经过 ramfs，由 ramfs_tier_balance 每轮校正）。
+ *
+ * 扩展属性不在页缓存里，按每个 inode 的属性总字节数向上取整成页记账，
+ * 否则 setxattr 可以绕过 size= 无限占用内存。
+ *
+ * 只有 write_begin、共享映射的写缺页和 setxattr 会因为超出 size= 失败；
+ * 读空洞和从镜像读回来的页照样放进来，不让读操作返回 ENOSPC
+ */
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/percpu_counter.h>
+#include <linux/statfs.h>
+#include "internal.h"
+
+int ramfs_limit_init(struct ramfs_fs_info *fsi)
+{
+    int ret;
+
+    ret = percpu_counter_init(&fsi->used_blocks, 0, GFP_KERNEL);
+    if (ret)
+        return ret;
+    ret = percpu_counter_init(&fsi->used_inodes, 0, GFP_KERNEL);
+    if (ret)
+        percpu_counter_destroy(&fsi->used_blocks);
+    return ret;
+}
+
+void ramfs_limit_destroy(struct ramfs_fs_info *fsi)
+{
+    percpu_counter_destroy(&fsi->used_blocks);
+    percpu_counter_destroy(&fsi->used_inodes);
+}
+
+/**
+ * ramfs_charge_inode - 新建 inode 之前调用
+ * @fsi: 挂载
+ *
+ * 返回0表示可以新建，-ENOSPC 表示已经达到 nr_inodes=
+ */
+int ramfs_charge_inode(struct ramfs_fs_info *fsi)
+{
+    unsigned long max = fsi->mount_opts.max_inodes;
+
+    if (max && percpu_counter_compare(&fsi->used_inodes, max - 1) > 0)
+        return -ENOSPC;
+    percpu_counter_inc(&fsi->used_inodes);
+    return 0;
+}
+
+void ramfs_uncharge_inode(struct ramfs_fs_info *fsi)
+{
+    percpu_counter_dec(&fsi->used_inodes);
+}
+
+/**
+ * ramfs_charge_page - 给刚放进页缓存的页记账
+ * @page: 锁住的页
+ * @force: 为真时不检查 size=
+ *
+ * 返回0表示成功，-ENOSPC 表示已经达到 size=
+ */
+int ramfs_charge_page(struct page *page, bool force)
+{
+    struct ramfs_fs_info *fsi = page->mapping->host->i_sb->s_fs_info;
+    unsigned long max = fsi->mount_opts.max_blocks;
+
+    if (PageChecked(page))
+        return 0;
+    if (!force && max && percpu_counter_compare(&fsi->used_blocks, max - 1) > 0)
+        return -ENOSPC;
+    SetPageChecked(page);
+    percpu_counter_inc(&fsi->used_blocks);
+    return 0;
+}
+
+void ramfs_uncharge_pages(struct inode *inode, unsigned long nr)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+
+    if (nr)
+        percpu_counter_sub(&fsi->used_blocks, nr);
+}
+
+/**
+ * ramfs_charge_xattr - 扩展属性总量变化时记账
+ * @inode: ramfs inode，调用者持有 xattr_sem 写锁
+ * @delta: 属性占用字节数的变化
+ * @force: 为真时不检查 size=（预热载入和释放）
+ *
+ * 返回0表示成功，-ENOSPC 表示已经达到 size=
+ */
+int ramfs_charge_xattr(struct inode *inode, long delta, bool force)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    unsigned long max = fsi->mount_opts.max_blocks;
+    long nr = (long)DIV_ROUND_UP(ri->xattr_bytes + delta, PAGE_SIZE) -
+              (long)DIV_ROUND_UP(ri->xattr_bytes, PAGE_SIZE);
+
+    if (nr > 0 && !force && max &&
+        ((unsigned long)nr > max ||
+         percpu_counter_compare(&fsi->used_blocks, max - nr) > 0))
+        return -ENOSPC;
+    ri->xattr_bytes += delta;
+    if (nr) {
+        percpu_counter_add(&fsi->used_blocks, nr);
+        atomic_long_add(nr, &fsi->xattr_blocks);
+    }
+    return 0;
+}
+
+/* 和 ram_aops 一样：空洞读出来是零页 */
+static int ramfs_readpage(struct file *file, struct page *page)
+{
+    ramfs_charge_page(page, true);
+    clear_highpage(page);
+    flush_dcache_page(page);
+    SetPageUptodate(page);
+    unlock_page(page);
+    return 0;
+}
+
+static int ramfs_write_begin(struct file *file, struct address_space *mapping,
+                             loff_t pos, unsigned len, unsigned flags,
+                             struct page **pagep, void **fsdata)
+{
+    struct page *page;
+    int ret;
+
+    /* 新页按文件的 NUMA 策略分配，见 mpol.c */
+    page = ramfs_grab_page(mapping, pos >> PAGE_SHIFT, flags);
+    if (!page)
+        return -ENOMEM;
+
+    ret = ramfs_charge_page(page, false);
+    if (ret) {
+        /* 没记账的新页里什么也没有，也没被映射过，直接拿掉 */
+        if (!PageUptodate(page))
+            delete_from_page_cache(page);
+        unlock_page(page);
+        put_page(page);
+        return ret;
+    }
+
+    /* 以下和 simple_write_begin 一样 */
+    if (!PageUptodate(page) && len != PAGE_SIZE) {
+        unsigned int from = pos & (PAGE_SIZE - 1);
+
+        zero_user_segments(page, 0, from, from + len, PAGE_SIZE);
+    }
+    *pagep = page;
+    return 0;
+}
+
+const struct address_space_operations ramfs_aops = {
+	.readpage	= ramfs_readpage,
+	.write_begin	= ramfs_write_begin,
+	.write_end	= simple_write_end,
+	.set_page_dirty	= __set_page_dirty_no_writeback,
+};
+
+/*
+ * 没有 size= 时以物理内存为名义容量，没有 nr_inodes= 时 inode 数不设上限，
+ * 两种情况下用量都照实报告
+ */
+int ramfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+    struct ramfs_fs_info *fsi = dentry->d_sb->s_fs_info;
+    unsigned long max_blocks = fsi->mount_opts.max_blocks ?: totalram_pages();
+    unsigned long max_inodes = fsi->mount_opts.max_inodes ?: LONG_MAX;
+    s64 used;
+
+    simple_statfs(dentry, buf);
+
+    used = percpu_counter_sum_positive(&fsi->used_blocks);
+    buf->f_blocks = max_blocks;
+    buf->f_bfree = buf->f_bavail = max_blocks - min_t(u64, used, max_blocks);
+
+    used = percpu_counter_sum_positive(&fsi->used_inodes);
+    buf->f_files = max_inodes;
+    buf->f_ffree = max_inodes - min_t(u64, used, max_inodes);
+    return 0;
+}
@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 的 NUMA 内存策略（mount -o mpol=，取值和 tmpfs 一样）
+ *
+ * 页缓存的页平时由 __page_cache_alloc 按分配者自己的策略分配，
+ * 谁先写就落在谁的节点上。这里照 shmem 的做法给每个文件一棵 shared_policy：
+ * 新建文件时装上挂载的 mpol=，之后可以对 MAP_SHARED 映射 mbind() 改写
+ * 其中一段；没有任何策略的文件退回到分配者的 set_mempolicy()。
+ *
+ * 新页用只带策略的伪 vma 分配，interleave 按文件偏移（加上 inode 号错开）
+ * 轮转节点，和谁来写无关。write_begin 和缺页会按策略分配；read() 读空洞、
+ * 预读从镜像读回的页仍然走通用路径，按读者的策略分配
+ */
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/mempolicy.h>
+#include "internal.h"
+
+/* 文件有没有自己的策略（包括建文件时装上的 mpol=） */
+static bool ramfs_mpol_active(struct inode *inode)
+{
+    return !RB_EMPTY_ROOT(&RAMFS_I(inode)->policy.root);
+}
+
+/**
+ * ramfs_mpol_init - 新建 inode 时装上挂载的策略
+ * @inode: 新 inode
+ */
+void ramfs_mpol_init(struct inode *inode)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct mempolicy *mpol = NULL;
+
+    /* mpol_shared_policy_init 会放掉这个引用 */
+    if (S_ISREG(inode->i_mode) && fsi->mpol) {
+        mpol = fsi->mpol;
+        mpol_get(mpol);
+    }
+    mpol_shared_policy_init(&RAMFS_I(inode)->policy, mpol);
+}
+
+void ramfs_mpol_evict(struct inode *inode)
+{
+    mpol_free_shared_policy(&RAMFS_I(inode)->policy);
+}
+
+static struct page *ramfs_mpol_alloc(struct inode *inode, pgoff_t index,
+                                     gfp_t gfp)
+{
+    struct vm_area_struct pvma;
+    struct page *page;
+
+    vma_init(&pvma, NULL);
+    /* 和 shmem 一样按 inode 号错开，小文件不会都从同一个节点开始 */
+    pvma.vm_pgoff = index + inode->i_ino;
+    pvma.vm_policy = mpol_shared_policy_lookup(&RAMFS_I(inode)->policy, index);
+    page = alloc_page_vma(gfp, &pvma, 0);
+    mpol_cond_put(pvma.vm_policy);
+    return page;
+}
+
+/* 按策略分配一页放进页缓存，返回锁住的页；已经有人放进去时返回 NULL */
+static struct page *ramfs_mpol_add(struct address_space *mapping,
+                                   pgoff_t index, gfp_t gfp, int *err)
+{
+    struct page *page;
+
+    page = ramfs_mpol_alloc(mapping->host, index, gfp);
+    if (!page) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+    *err = add_to_page_cache_lru(page, mapping, index,
+                                 gfp & GFP_RECLAIM_MASK);
+    if (*err) {
+        put_page(page);
+        return NULL;
+    }
+    return page;
+}
+
+/**
+ * ramfs_grab_page - write_begin 取页，和 grab_cache_page_write_begin 一样
+ * @mapping: ramfs 文件的 address_space
+ * @index: 页号
+ * @flags: AOP_FLAG_*
+ *
+ * 页不在页缓存里时按文件的策略分配
+ * 返回锁住的页，失败时返回 NULL
+ */
+struct page *ramfs_grab_page(struct address_space *mapping, pgoff_t index,
+                             unsigned int flags)
+{
+    gfp_t gfp = mapping_gfp_mask(mapping);
+    struct page *page;
+    int err;
+
+    if (!ramfs_mpol_active(mapping->host))
+        return grab_cache_page_write_begin(mapping, index, flags);
+    if (flags & AOP_FLAG_NOFS)
+        gfp &= ~__GFP_FS;
+
+    do {
+        page = find_lock_page(mapping, index);
+        if (page)
+            return page;
+        page = ramfs_mpol_add(mapping, index, gfp, &err);
+    } while (!page && err == -EEXIST);
+    return page;
+}
+
+/**
+ * ramfs_mpol_prefault - 缺页之前按文件的策略把缺的页放进页缓存
+ * @file: 被映射的文件
+ * @index: 缺页的页号
+ *
+ * 之后的 filemap_fault 会在页缓存里找到它。分配失败不要紧，
+ * filemap_fault 会自己再分配一次
+ */
+void ramfs_mpol_prefault(struct file *file, pgoff_t index)
+{
+    struct address_space *mapping = file->f_mapping;
+    struct inode *inode = mapping->host;
+    struct page *page;
+    int err;
+
+    if (!ramfs_mpol_active(inode) ||
+        index >= DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE))
+        return;
+
+    page = find_get_page(mapping, index);
+    if (page) {
+        put_page(page);
+        return;
+    }
+
+    page = ramfs_mpol_add(mapping, index, mapping_gfp_mask(mapping), &err);
+    if (!page)
+        return;
+    /* readpage 填好内容（空洞清零，或者从镜像读回）并解锁 */
+    mapping->a_ops->readpage(file, page);
+    put_page(page);
+}
+
+/* mbind() 一段 MAP_SHARED 映射，改的是文件的策略，所有映射者共享 */
+int ramfs_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol)
+{
+    struct inode *inode = file_inode(vma->vm_file);
+
+    return mpol_set_shared_policy(&RAMFS_I(inode)->policy, vma, mpol);
+}
+
+struct mempolicy *ramfs_get_policy(struct vm_area_struct *vma,
+                                   unsigned long addr)
+{
+    struct inode *inode = file_inode(vma->vm_file);
+    pgoff_t index;
+
+    index = ((addr - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
+    return mpol_shared_policy_lookup(&RAMFS_I(inode)->policy, index);
+}
@@ -0,0 +1,1093 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 打包镜像（mount -o pack,sync_dir=<dir>）
+ *
+ * 默认的刷盘方式在同步目录里给每个文件各维护一个镜像，每个文件都要经过
+ * 临时文件、fsync、rename，上万个小文件时瓶颈在下层文件系统的元数据路径上。
+ * 打包模式把整个挂载存进同步目录下一个预分配的文件 ".ramfs.pack"：
+ *
+ *   slot 0 | slot 1 | 数据和元数据表（只追加）
+ *
+ * 两个槽各放一份带 crc32c 的超级块，序号为 seq 的提交写 seq % 2 号槽。
+ * 一次提交遍历整棵树：脏文件只把脏范围追加到尾部并更新自己的 extent 表，
+ * 数据从每个文件冻结的快照读出，写出期间的修改由写时复制隔开（见 snapshot.c），
+ * 然后追加一张记录全部目录和文件（路径、属性、extent）的元数据表，最后写
+ * 超级块，整个提交只 fsync 一次。并发的 fsync 合并成一次提交。
+ *
+ * 超级块里记着本次提交新写的数据范围和元数据表的 crc，挂载时从新到旧选第一个
+ * 校验全部通过的槽：崩溃时没写完的提交校验不过，自然退回上一次提交。
+ * 提交从不覆盖上一次提交引用的数据，所以上一次提交总是完整的。
+ *
+ * 尾部超过有效数据的两倍时做压缩：把所有文件整文件写进 ".ramfs.pack.tmp"，
+ * 落盘后 rename 覆盖旧镜像。挂载时按元数据表建出目录树并读入全部数据。
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/sizes.h>
+#include <linux/string.h>
+#include <linux/namei.h>
+#include <linux/file.h>
+#include <linux/dcache.h>
+#include <linux/sched.h>
+#include <linux/falloc.h>
+#include <linux/crc32c.h>
+#include <linux/ramfs.h>
+#include "internal.h"
+
+#define RAMFS_PACK_MAGIC	0x4b435052	/* "RPCK" */
+#define RAMFS_PACK_VERSION	1
+#define RAMFS_PACK_NAME		".ramfs.pack"
+#define RAMFS_PACK_SLOT_SIZE	4096
+#define RAMFS_PACK_DATA_START	(2 * RAMFS_PACK_SLOT_SIZE)
+#define RAMFS_PACK_PREALLOC	(64LL << 20)	/* 每次预分配的粒度 */
+#define RAMFS_PACK_COMPACT_MIN	(64LL << 20)	/* 镜像小于这个大小不压缩 */
+#define RAMFS_PACK_BUF_SIZE	max_t(size_t, PATH_MAX, PAGE_SIZE)
+
+struct ramfs_pack_super {
+    u32 magic;
+    u32 version;
+    u64 seq;		/* 提交序号，越大越新 */
+    u64 data_start;	/* 本次提交新写的数据 */
+    u64 data_len;
+    u64 table_offset;	/* 元数据表紧跟在数据后面 */
+    u64 table_len;
+    u32 nr_records;
+    u32 data_crc;
+    u32 table_crc;
+    u32 crc;		/* 本结构的 crc32c，计算时 crc 字段按 0 算 */
+};
+
+/* 元数据表：(record, path, 补齐到 8 字节, extent * nr_extents)* */
+struct ramfs_pack_record {
+    u32 mode;
+    u32 uid;
+    u32 gid;
+    u32 nr_extents;
+    u64 size;
+    s64 mtime;
+    u32 mtime_nsec;
+    u16 path_len;	/* 相对 ramfs 根的路径，不含开头的 '/' 和结尾的 '\0' */
+    u16 pad;
+};
+
+struct ramfs_pack_extent {
+    u64 offset;		/* 文件内偏移 */
+    u64 len;
+    u64 pos;		/* 镜像中的位置 */
+};
+
+/* 文件当前内容在镜像里的位置，挂在 ramfs_inode_info->pack_map 上 */
+struct ramfs_pack_map {
+    u64 size;		/* 最近一次提交时的文件大小 */
+    unsigned int nr;
+    struct ramfs_pack_extent ext[];
+};
+
+struct ramfs_pack {
+    struct mutex mutex;		/* 串行化提交，保护以下字段和所有 pack_map */
+    struct file *file;
+    char *dir;			/* 镜像所在的同步目录 */
+    u64 seq;			/* 最近一次成功提交的序号 */
+    loff_t tail;		/* 最近一次成功提交之后的追加位置 */
+    loff_t prealloc;		/* 镜像已经预分配到这里 */
+    unsigned long nr_started;	/* 开始过的提交数，用来合并并发的 fsync */
+    int last_err;		/* 最近一次提交的结果 */
+};
+
+/* 一次提交的状态 */
+struct ramfs_pack_ctx {
+    struct file *out;
+    loff_t tail;
+    loff_t prealloc;
+    loff_t live;		/* 新元数据表引用的数据量 */
+    u32 data_crc;		/* 本次追加的数据的 crc32c，边写边算 */
+    bool compact;		/* 所有文件整文件重写 */
+    char *table;
+    size_t table_len;
+    size_t table_cap;
+    u32 nr_records;
+};
+
+static void ramfs_pack_reserve(struct ramfs_pack_ctx *c, loff_t end)
+{
+    loff_t len;
+    int ret;
+
+    if (end <= c->prealloc)
+        return;
+
+    /* 成块预分配，追加写不用每次都分配空间、改文件大小 */
+    len = round_up(end - c->prealloc, RAMFS_PACK_PREALLOC);
+    ret = vfs_fallocate(c->out, 0, c->prealloc, len);
+    if (!ret)
+        c->prealloc += len;
+    else if (ret == -EOPNOTSUPP)
+        c->prealloc = LLONG_MAX;  /* 下层不支持就不再尝试 */
+}
+
+static int ramfs_pack_table_add(struct ramfs_pack_ctx *c, const void *data,
+                                size_t len)
+{
+    if (c->table_len + len > c->table_cap) {
+        size_t cap = max3(c->table_cap * 2, c->table_len + len, (size_t)SZ_64K);
+        char *table = kvmalloc(cap, GFP_KERNEL);
+
+        if (!table)
+            return -ENOMEM;
+        if (c->table)
+            memcpy(table, c->table, c->table_len);
+        kvfree(c->table);
+        c->table = table;
+        c->table_cap = cap;
+    }
+    memcpy(c->table + c->table_len, data, len);
+    c->table_len += len;
+    return 0;
+}
+
+static int ramfs_pack_crc_file(struct file *file, loff_t pos, loff_t len,
+                               char *buf, u32 *crc_out)
+{
+    u32 crc = ~0;
+
+    while (len > 0) {
+        size_t chunk = min_t(loff_t, len, PAGE_SIZE);
+        ssize_t n = kernel_read(file, buf, chunk, &pos);
+
+        if (n != chunk)
+            return n < 0 ? n : -EIO;
+        crc = crc32c(crc, buf, chunk);
+        len -= chunk;
+    }
+    *crc_out = crc;
+    return 0;
+}
+
+static struct ramfs_pack_map *ramfs_pack_map_alloc(unsigned int nr)
+{
+    struct ramfs_pack_map *map;
+
+    map = kvmalloc(struct_size(map, ext, nr), GFP_KERNEL);
+    if (map)
+        map->nr = 0;
+    return map;
+}
+
+/* 追加一个 extent，文件内和镜像中都连续的话和前一个合并 */
+static void ramfs_pack_map_add(struct ramfs_pack_map *map,
+                               const struct ramfs_pack_extent *e)
+{
+    struct ramfs_pack_extent *last = map->nr ? &map->ext[map->nr - 1] : NULL;
+
+    if (last && last->offset + last->len == e->offset &&
+        last->pos + last->len == e->pos)
+        last->len += e->len;
+    else
+        map->ext[map->nr++] = *e;
+}
+
+/*
+ * 增量提交后的 extent 表：旧表截到 min_size，挖掉被重写的范围，
+ * 再按文件偏移合并进新写的范围（从镜像的 pos 处开始依次存放）
+ */
+static struct ramfs_pack_map *
+ramfs_pack_map_merge(const struct ramfs_pack_map *old, loff_t min_size,
+                     const struct ramfs_range *ranges, int nr, loff_t pos)
+{
+    struct ramfs_pack_extent *kept, e;
+    struct ramfs_pack_map *map;
+    unsigned int i, k = 0;
+    int j = 0;
+
+    /* 每个范围最多把一个旧 extent 切成两段 */
+    kept = kvmalloc_array(old->nr + nr, sizeof(*kept), GFP_KERNEL);
+    map = ramfs_pack_map_alloc(old->nr + 2 * nr);
+    if (!kept || !map) {
+        kvfree(kept);
+        kvfree(map);
+        return NULL;
+    }
+
+    /* 两边都按偏移排好序且互不重叠，一遍扫完 */
+    for (i = 0; i < old->nr; i++) {
+        loff_t cur = old->ext[i].offset;
+        loff_t end = min_t(loff_t, cur + old->ext[i].len, min_size);
+
+        while (cur < end) {
+            loff_t stop = end;
+
+            while (j < nr && ranges[j].start + ranges[j].len <= cur)
+                j++;
+            if (j < nr && ranges[j].start <= cur) {
+                cur = ranges[j].start + ranges[j].len;
+                continue;
+            }
+            if (j < nr && ranges[j].start < end)
+                stop = ranges[j].start;
+            kept[k].offset = cur;
+            kept[k].len = stop - cur;
+            kept[k].pos = old->ext[i].pos + (cur - old->ext[i].offset);
+            k++;
+            cur = stop;
+        }
+    }
+
+    for (i = 0, j = 0; i < k || j < nr; ) {
+        if (j >= nr || (i < k && kept[i].offset < ranges[j].start)) {
+            e = kept[i++];
+        } else {
+            e.offset = ranges[j].start;
+            e.len = ranges[j].len;
+            e.pos = pos;
+            pos += ranges[j].len;
+            j++;
+        }
+        ramfs_pack_map_add(map, &e);
+    }
+
+    kvfree(kept);
+    return map;
+}
+
+/* 没有任何修改的文件不用冻结，也不用拿 inode 锁 */
+static bool ramfs_pack_clean(struct ramfs_pack_ctx *c, struct inode *inode)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_pack_map *map = ri->pack_map;
+    loff_t size = i_size_read(inode);
+
+    return !c->compact && map && map->size == size &&
+           READ_ONCE(ri->min_size) == size &&
+           xa_empty(&ri->dirty_pages) &&
+           !test_bit(RAMFS_I_FULL_FLUSH, &ri->flags);
+}
+
+/*
+ * 在 inode 锁下取出脏范围并冻结快照，和 write、截断看到的是同一个时刻；
+ * 失败时脏范围已经放进 snap，由调用者还回去
+ */
+static int ramfs_pack_freeze(struct ramfs_pack_ctx *c,
+                             struct ramfs_snapshot *snap)
+{
+    struct inode *inode = snap->inode;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    loff_t bytes;
+    int ret;
+
+    inode_lock(inode);
+    snap->size = i_size_read(inode);
+    spin_lock(&ri->lock);
+    snap->min_size = ri->min_size;
+    ri->min_size = snap->size;
+    spin_unlock(&ri->lock);
+
+    snap->full = ramfs_take_dirty(inode, snap->size, &snap->ranges, &snap->nr,
+                                  &bytes) != 0;
+    if (test_and_clear_bit(RAMFS_I_FULL_FLUSH, &ri->flags))
+        snap->full = true;
+    if (c->compact || !ri->pack_map)
+        snap->full = true;
+
+    ret = ramfs_flush_frozen(snap, PAGE_SIZE);
+    if (!ret)
+        ret = ramfs_snapshot_freeze(snap);
+    inode_unlock(inode);
+    return ret;
+}
+
+/*
+ * 把一个文件自上次提交以来的修改追加到镜像尾部并更新它的 extent 表；
+ * 没有变化的文件什么都不写
+ */
+static int ramfs_pack_update(struct ramfs_pack_ctx *c, struct inode *inode)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_pack_map *map = ri->pack_map, *new;
+    struct ramfs_snapshot *snap;
+    struct ramfs_range *ranges;
+    loff_t size, min_size, bytes = 0, pos;
+    bool full;
+    int nr, i, ret;
+
+    if (ramfs_pack_clean(c, inode))
+        return 0;
+
+    snap = ramfs_snapshot_alloc(inode);
+    if (!snap)
+        return -ENOMEM;
+    ret = ramfs_pack_freeze(c, snap);
+    size = snap->size;
+    min_size = snap->min_size;
+    ranges = snap->ranges;
+    nr = snap->nr;
+    full = snap->full;
+    if (ret)
+        goto out_fail;
+
+    if (!full && !nr && min_size == size && map->size == size)
+        goto out;
+
+    for (i = 0; i < nr; i++)
+        bytes += ranges[i].len;
+    pos = c->tail;
+    ramfs_pack_reserve(c, pos + (full ? size : bytes));
+    if (full) {
+        ret = ramfs_write_snapshot(snap, 0, size, c->out, &c->tail,
+                                   NULL, &c->data_crc);
+    } else {
+        for (i = 0; i < nr && !ret; i++)
+            ret = ramfs_write_snapshot(snap, ranges[i].start, ranges[i].len,
+                                       c->out, &c->tail, NULL, &c->data_crc);
+    }
+    if (ret)
+        goto out_fail;
+
+    if (full) {
+        new = ramfs_pack_map_alloc(1);
+        if (new && size) {
+            struct ramfs_pack_extent e = { .offset = 0, .len = size, .pos = pos };
+
+            ramfs_pack_map_add(new, &e);
+        }
+    } else {
+        new = ramfs_pack_map_merge(map, min_size, ranges, nr, pos);
+    }
+    if (!new) {
+        ret = -ENOMEM;
+        goto out_fail;
+    }
+    new->size = size;
+    kvfree(map);
+    ri->pack_map = new;
+    goto out;
+
+out_fail:
+    /* 清掉的脏页信息找不回来了，下一次整文件重写 */
+    set_bit(RAMFS_I_FULL_FLUSH, &ri->flags);
+    ramfs_note_size(inode, min_size);
+out:
+    ramfs_snapshot_finish(snap, ret);
+    ramfs_snapshot_put(snap);
+    return ret;
+}
+
+/* 把一个目录或文件的元数据追加到元数据表 */
+static int ramfs_pack_emit(struct ramfs_pack_ctx *c, struct dentry *dentry,
+                           char *buf)
+{
+    static const char zeros[8];
+    struct inode *inode = d_inode(dentry);
+    struct ramfs_pack_map *map = NULL;
+    struct ramfs_pack_record rec = {};
+    char *path;
+    size_t len;
+    unsigned int i;
+    int ret;
+
+    /* 收集之后才被删掉的 */
+    if (d_unhashed(dentry))
+        return 0;
+
+    path = dentry_path_raw(dentry, buf, PATH_MAX);
+    if (IS_ERR(path))
+        return PTR_ERR(path);
+    path++;  /* 去掉开头的 '/' */
+    len = strlen(path);
+
+    if (S_ISREG(inode->i_mode))
+        map = RAMFS_I(inode)->pack_map;
+
+    rec.mode = inode->i_mode;
+    rec.uid = from_kuid(&init_user_ns, inode->i_uid);
+    rec.gid = from_kgid(&init_user_ns, inode->i_gid);
+    rec.nr_extents = map ? map->nr : 0;
+    rec.size = map ? map->size : 0;
+    rec.mtime = inode->i_mtime.tv_sec;
+    rec.mtime_nsec = inode->i_mtime.tv_nsec;
+    rec.path_len = len;
+
+    ret = ramfs_pack_table_add(c, &rec, sizeof(rec));
+    if (!ret)
+        ret = ramfs_pack_table_add(c, path, len);
+    if (!ret)
+        ret = ramfs_pack_table_add(c, zeros, ALIGN(len, 8) - len);
+    if (!ret && map)
+        ret = ramfs_pack_table_add(c, map->ext, map->nr * sizeof(map->ext[0]));
+    if (ret)
+        return ret;
+
+    for (i = 0; i < rec.nr_extents; i++)
+        c->live += map->ext[i].len;
+    c->nr_records++;
+    return 0;
+}
+
+/* 按层次收集整棵树（已 dget），父目录总是排在它的子项前面 */
+static int ramfs_pack_collect(struct dentry *root, struct dentry ***out,
+                              int *nr_out)
+{
+    struct dentry **list, **tmp, *child;
+    int nr = 1, cap = 256, i, ret = 0;
+
+    list = kvmalloc_array(cap, sizeof(*list), GFP_KERNEL);
+    if (!list)
+        return -ENOMEM;
+    list[0] = dget(root);
+
+    for (i = 0; i < nr && !ret; i++) {
+        if (!d_is_dir(list[i]))
+            continue;
+
+        /* 共享锁住目录，防止遍历期间子项被 rename 到别处 */
+        inode_lock_shared(d_inode(list[i]));
+        child = NULL;
+        while ((child = ramfs_next_child(list[i], child)) != NULL) {
+            if (!d_is_dir(child) && !d_is_reg(child))
+                continue;
+            if (nr == cap) {
+                tmp = kvmalloc_array(cap * 2, sizeof(*list), GFP_KERNEL);
+                if (!tmp) {
+                    dput(child);
+                    ret = -ENOMEM;
+                    break;
+                }
+                memcpy(tmp, list, nr * sizeof(*list));
+                kvfree(list);
+                list = tmp;
+                cap *= 2;
+            }
+            list[nr++] = dget(child);
+        }
+        inode_unlock_shared(d_inode(list[i]));
+    }
+
+    if (ret) {
+        for (i = 0; i < nr; i++)
+            dput(list[i]);
+        kvfree(list);
+        return ret;
+    }
+    *out = list;
+    *nr_out = nr;
+    return 0;
+}
+
+/* 本次提交会带上所有脏文件，回写队列里的不用再单独处理 */
+static void ramfs_pack_drain(struct ramfs_fs_info *fsi)
+{
+    struct ramfs_inode_info *ri, *tmp;
+
+    spin_lock(&fsi->dirty_lock);
+    list_for_each_entry_safe(ri, tmp, &fsi->dirty_inodes, dirty_list)
+        list_del_init(&ri->dirty_list);
+    spin_unlock(&fsi->dirty_lock);
+}
+
+/* 压缩：把写好的 ".ramfs.pack.tmp" 换成正式的镜像 */
+static int ramfs_pack_replace(struct ramfs_pack *pk)
+{
+    struct renamedata rd = {
+        .old_mnt_userns = &init_user_ns,
+        .new_mnt_userns = &init_user_ns,
+    };
+    struct dentry *old, *new;
+    struct path dir;
+    int ret;
+
+    ret = kern_path(pk->dir, LOOKUP_FOLLOW | LOOKUP_DIRECTORY, &dir);
+    if (ret)
+        return ret;
+
+    lock_rename(dir.dentry, dir.dentry);
+    old = lookup_one_len(RAMFS_PACK_NAME ".tmp", dir.dentry,
+                         strlen(RAMFS_PACK_NAME ".tmp"));
+    if (IS_ERR(old)) {
+        ret = PTR_ERR(old);
+        goto out_unlock;
+    }
+    new = lookup_one_len(RAMFS_PACK_NAME, dir.dentry, strlen(RAMFS_PACK_NAME));
+    if (IS_ERR(new)) {
+        ret = PTR_ERR(new);
+        goto out_put_old;
+    }
+
+    rd.old_dir = rd.new_dir = d_inode(dir.dentry);
+    rd.old_dentry = old;
+    rd.new_dentry = new;
+    ret = vfs_rename(&rd);
+
+    dput(new);
+out_put_old:
+    dput(old);
+out_unlock:
+    unlock_rename(dir.dentry, dir.dentry);
+    path_put(&dir);
+    if (!ret)
+        ret = ramfs_fsync_dir(pk->dir);
+    return ret;
+}
+
+/*
+ * 一次提交：追加脏数据和元数据表，写超级块，fsync 一次；
+ * 压缩时写的是临时文件，落盘后再换成正式镜像。调用者持有 pk->mutex
+ */
+static int ramfs_pack_commit(struct super_block *sb, struct ramfs_pack_ctx *c)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct ramfs_pack *pk = fsi->pack;
+    struct ramfs_pack_super ps = {};
+    struct dentry **list;
+    loff_t start = c->tail, slot;
+    char *buf;
+    int nr, i, ret;
+
+    buf = kmalloc(RAMFS_PACK_BUF_SIZE, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+
+    ramfs_pack_drain(fsi);
+    c->data_crc = ~0;
+    ret = ramfs_pack_collect(sb->s_root, &list, &nr);
+    if (ret) {
+        kfree(buf);
+        return ret;
+    }
+
+    /* 根目录来自挂载参数，不进元数据表 */
+    for (i = 1; i < nr && !ret; i++) {
+        if (d_is_reg(list[i]))
+            ret = ramfs_pack_update(c, d_inode(list[i]));
+        if (!ret)
+            ret = ramfs_pack_emit(c, list[i], buf);
+        cond_resched();
+    }
+
+    ps.magic = RAMFS_PACK_MAGIC;
+    ps.version = RAMFS_PACK_VERSION;
+    ps.seq = pk->seq + 1;
+    ps.data_start = start;
+    ps.data_len = c->tail - start;
+    ps.table_offset = c->tail;
+    ps.table_len = c->table_len;
+    ps.nr_records = c->nr_records;
+    if (!ret) {
+        ramfs_pack_reserve(c, c->tail + c->table_len);
+        ret = ramfs_write_all(c->out, c->table, c->table_len, &c->tail);
+    }
+    /* 数据来自冻结的快照，写出时累加的就是写进镜像的内容，不用回读 */
+    ps.data_crc = c->data_crc;
+    if (!ret) {
+        ps.table_crc = crc32c(~0, c->table, c->table_len);
+        ps.crc = crc32c(~0, &ps, sizeof(ps));
+        slot = (ps.seq & 1) * RAMFS_PACK_SLOT_SIZE;
+        ret = ramfs_write_all(c->out, &ps, sizeof(ps), &slot);
+    }
+    if (!ret)
+        ret = vfs_fsync(c->out, 1);
+    if (!ret && c->compact)
+        ret = ramfs_pack_replace(pk);
+
+    if (ret) {
+        /* 这次写的数据不一定落盘，新的 extent 表都不可信，下次整文件重写 */
+        for (i = 1; i < nr; i++)
+            if (d_is_reg(list[i]))
+                set_bit(RAMFS_I_FULL_FLUSH, &RAMFS_I(d_inode(list[i]))->flags);
+    } else {
+        pk->seq = ps.seq;
+    }
+
+    for (i = 0; i < nr; i++)
+        dput(list[i]);
+    kvfree(list);
+    kvfree(c->table);
+    c->table = NULL;
+    kfree(buf);
+    wake_up_all(&fsi->writeback_wait);
+    return ret;
+}
+
+/* 尾部增长到有效数据两倍以上时重写一份紧凑的镜像 */
+static void ramfs_pack_compact(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct ramfs_pack *pk = fsi->pack;
+    struct ramfs_pack_ctx c = {
+        .tail = RAMFS_PACK_DATA_START,
+        .compact = true,
+    };
+    loff_t old_size = pk->tail;
+    char *path;
+    int ret;
+
+    path = kasprintf(GFP_KERNEL, "%s/" RAMFS_PACK_NAME ".tmp", pk->dir);
+    if (!path)
+        return;
+    c.out = filp_open(path, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+    kfree(path);
+    if (IS_ERR(c.out)) {
+        pr_warn("RAMfs: Failed to create compacted image: %ld\n", PTR_ERR(c.out));
+        return;
+    }
+
+    ret = ramfs_pack_commit(sb, &c);
+    if (ret) {
+        pr_warn("RAMfs: Failed to compact %s/" RAMFS_PACK_NAME ": %d\n",
+                pk->dir, ret);
+        fput(c.out);
+        return;
+    }
+
+    fput(pk->file);
+    pk->file = c.out;
+    pk->tail = c.tail;
+    pk->prealloc = c.prealloc;
+    pr_info("RAMfs: Compacted %s/" RAMFS_PACK_NAME " from %lld to %lld bytes\n",
+            pk->dir, old_size, c.tail);
+}
+
+/**
+ * ramfs_pack_sync - 把整个挂载提交到打包镜像
+ * @sb: 打包模式的 ramfs 超级块
+ *
+ * fsync、/proc 同步接口和回写线程都走这里。正在提交时到达的调用等它结束后
+ * 只需要再做一次提交，排在后面的调用直接共享这次提交的结果
+ * 返回0表示成功，负数表示错误码
+ */
+int ramfs_pack_sync(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct ramfs_pack *pk = fsi->pack;
+    struct ramfs_pack_ctx c = {};
+    unsigned long ticket = READ_ONCE(pk->nr_started);
+    int ret;
+
+    mutex_lock(&pk->mutex);
+
+    /* 我们到达之后才开始的提交已经带上了我们的修改 */
+    if (pk->nr_started != ticket) {
+        ret = pk->last_err;
+        goto out;
+    }
+    WRITE_ONCE(pk->nr_started, pk->nr_started + 1);
+
+    c.out = pk->file;
+    c.tail = pk->tail;
+    c.prealloc = pk->prealloc;
+    ret = ramfs_pack_commit(sb, &c);
+    pk->prealloc = c.prealloc;
+    if (!ret) {
+        pk->tail = c.tail;
+        if (pk->tail > RAMFS_PACK_COMPACT_MIN &&
+            pk->tail - RAMFS_PACK_DATA_START > 2 * c.live)
+            ramfs_pack_compact(sb);
+    } else {
+        pr_err("RAMfs: Commit to %s/" RAMFS_PACK_NAME " failed: %d\n",
+               pk->dir, ret);
+    }
+    pk->last_err = ret;
+
+out:
+    mutex_unlock(&pk->mutex);
+    return ret;
+}
+
+/* 读入 idx 号槽；-ENODATA 表示从没写过，-EBADMSG 表示写了一半 */
+static int ramfs_pack_read_super(struct file *file, int idx,
+                                 struct ramfs_pack_super *ps)
+{
+    loff_t pos = idx * RAMFS_PACK_SLOT_SIZE;
+    u32 crc;
+
+    if (kernel_read(file, ps, sizeof(*ps), &pos) != sizeof(*ps) ||
+        ps->magic != RAMFS_PACK_MAGIC)
+        return -ENODATA;
+
+    crc = ps->crc;
+    ps->crc = 0;
+    if (ps->version != RAMFS_PACK_VERSION ||
+        crc32c(~0, ps, sizeof(*ps)) != crc)
+        return -EBADMSG;
+    ps->crc = crc;
+    return 0;
+}
+
+/* 读出元数据表，同时确认这次提交的数据和表都完整落盘了 */
+static char *ramfs_pack_read_table(struct file *file,
+                                   const struct ramfs_pack_super *ps, char *buf)
+{
+    loff_t pos = ps->table_offset;
+    char *table;
+    u32 crc;
+    int ret;
+
+    ret = ramfs_pack_crc_file(file, ps->data_start, ps->data_len, buf, &crc);
+    if (ret)
+        return ERR_PTR(ret);
+    if (crc != ps->data_crc)
+        return ERR_PTR(-EBADMSG);
+
+    if (ps->table_len > INT_MAX)
+        return ERR_PTR(-EBADMSG);
+    table = kvmalloc(ps->table_len ? : 1, GFP_KERNEL);
+    if (!table)
+        return ERR_PTR(-ENOMEM);
+    if (kernel_read(file, table, ps->table_len, &pos) != ps->table_len ||
+        crc32c(~0, table, ps->table_len) != ps->table_crc) {
+        kvfree(table);
+        return ERR_PTR(-EBADMSG);
+    }
+    return table;
+}
+
+/* 沿着已经建好的目录找到 path 的父目录（已 dget），*name 指向最后一个分量 */
+static struct dentry *ramfs_pack_parent(struct super_block *sb, char *path,
+                                        char **name)
+{
+    struct dentry *dir = dget(sb->s_root), *next;
+    char *p = path, *slash;
+
+    while ((slash = strchr(p, '/')) != NULL) {
+        struct qstr q = QSTR_INIT(p, slash - p);
+
+        next = d_hash_and_lookup(dir, &q);
+        dput(dir);
+        if (IS_ERR_OR_NULL(next))
+            return ERR_PTR(-ENOENT);
+        if (!d_is_dir(next)) {
+            dput(next);
+            return ERR_PTR(-ENOENT);
+        }
+        dir = next;
+        p = slash + 1;
+    }
+
+    *name = p;
+    return dir;
+}
+
+/* 把一个 extent 的数据从镜像读进页缓存 */
+static int ramfs_pack_fill(struct inode *inode, struct file *file,
+                           const struct ramfs_pack_extent *e)
+{
+    struct address_space *mapping = inode->i_mapping;
+    loff_t off = e->offset, pos = e->pos, len = e->len;
+
+    while (len > 0) {
+        unsigned int offset = offset_in_page(off);
+        size_t chunk = min_t(loff_t, len, PAGE_SIZE - offset);
+        struct page *page;
+        ssize_t n;
+
+        page = find_or_create_page(mapping, off >> PAGE_SHIFT,
+                                   mapping_gfp_mask(mapping));
+        if (!page)
+            return -ENOMEM;
+        /* 挂载时载入的数据照样记账，但不因为 size= 失败 */
+        ramfs_charge_page(page, true);
+        if (!PageUptodate(page)) {
+            zero_user(page, 0, PAGE_SIZE);
+            SetPageUptodate(page);
+        }
+        n = kernel_read(file, kmap(page) + offset, chunk, &pos);
+        kunmap(page);
+        set_page_dirty(page);
+        unlock_page(page);
+        put_page(page);
+        if (n != chunk)
+            return n < 0 ? n : -EIO;
+
+        off += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static int ramfs_pack_load_file(struct inode *inode, struct file *file,
+                                const struct ramfs_pack_record *rec,
+                                const char *ext)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_pack_map *map;
+    unsigned int i;
+    int ret;
+
+    map = ramfs_pack_map_alloc(rec->nr_extents);
+    if (!map)
+        return -ENOMEM;
+    memcpy(map->ext, ext, rec->nr_extents * sizeof(map->ext[0]));
+    map->nr = rec->nr_extents;
+    map->size = rec->size;
+
+    for (i = 0; i < map->nr; i++) {
+        const struct ramfs_pack_extent *e = &map->ext[i];
+
+        if (!e->len || e->offset + e->len > rec->size ||
+            e->offset + e->len < e->offset) {
+            ret = -EUCLEAN;
+            goto out_free;
+        }
+        ret = ramfs_pack_fill(inode, file, e);
+        if (ret)
+            goto out_free;
+    }
+
+    i_size_write(inode, rec->size);
+    /* 镜像就是当前内容，以后只需要增量提交 */
+    ri->min_size = rec->size;
+    ri->flags = 0;
+    ri->pack_map = map;
+    return 0;
+
+out_free:
+    kvfree(map);
+    return ret;
+}
+
+/* 按一条记录建出目录或文件 */
+static int ramfs_pack_load_record(struct super_block *sb, struct file *file,
+                                  const struct ramfs_pack_record *rec,
+                                  const char *path, const char *ext)
+{
+    struct dentry *parent, *dentry;
+    struct inode *inode;
+    struct qstr q;
+    char *copy, *name;
+    int ret = 0;
+
+    if (!S_ISDIR(rec->mode) && !S_ISREG(rec->mode))
+        return -EUCLEAN;
+
+    copy = kmemdup_nul(path, rec->path_len, GFP_KERNEL);
+    if (!copy)
+        return -ENOMEM;
+
+    parent = ramfs_pack_parent(sb, copy, &name);
+    if (IS_ERR(parent)) {
+        /* 提交时和 rename 撞上了，下一次提交会修正 */
+        pr_warn("RAMfs: Skipping %s: parent missing in image\n", copy);
+        goto out_free;
+    }
+    if (!*name || strlen(name) > NAME_MAX || !strcmp(name, ".") ||
+        !strcmp(name, "..")) {
+        ret = -EUCLEAN;
+        goto out_put;
+    }
+
+    q = (struct qstr)QSTR_INIT(name, strlen(name));
+    dentry = d_hash_and_lookup(parent, &q);
+    if (!IS_ERR_OR_NULL(dentry)) {
+        pr_warn("RAMfs: Skipping duplicate %s in image\n", copy);
+        dput(dentry);
+        goto out_put;
+    }
+
+    dentry = d_alloc_name(parent, name);
+    if (!dentry) {
+        ret = -ENOMEM;
+        goto out_put;
+    }
+
+    inode = ramfs_get_inode(sb, d_inode(parent), rec->mode & (S_IFMT | S_IALLUGO), 0);
+    if (!inode) {
+        dput(dentry);
+        ret = -ENOSPC;
+        goto out_put;
+    }
+    inode->i_uid = make_kuid(&init_user_ns, rec->uid);
+    inode->i_gid = make_kgid(&init_user_ns, rec->gid);
+    inode->i_mtime.tv_sec = rec->mtime;
+    inode->i_mtime.tv_nsec = rec->mtime_nsec;
+    inode->i_atime = inode->i_ctime = inode->i_mtime;
+
+    if (S_ISDIR(rec->mode)) {
+        inc_nlink(d_inode(parent));
+    } else {
+        ret = ramfs_pack_load_file(inode, file, rec, ext);
+        if (ret) {
+            iput(inode);
+            dput(dentry);
+            goto out_put;
+        }
+    }
+
+    /* 和 ramfs_mknod 一样，d_alloc 的引用就是钉住 dentry 的那一个 */
+    d_add(dentry, inode);
+
+out_put:
+    dput(parent);
+out_free:
+    kfree(copy);
+    return ret;
+}
+
+static int ramfs_pack_build(struct super_block *sb, struct file *file,
+                            const struct ramfs_pack_super *ps,
+                            const char *table, loff_t *bytes)
+{
+    struct ramfs_pack_record rec;
+    size_t off = 0, need;
+    u32 n;
+    int ret;
+
+    for (n = 0; n < ps->nr_records; n++) {
+        if (ps->table_len - off < sizeof(rec))
+            return -EUCLEAN;
+        memcpy(&rec, table + off, sizeof(rec));
+        need = sizeof(rec) + ALIGN(rec.path_len, 8) +
+               (size_t)rec.nr_extents * sizeof(struct ramfs_pack_extent);
+        if (!rec.path_len || ps->table_len - off < need)
+            return -EUCLEAN;
+
+        ret = ramfs_pack_load_record(sb, file, &rec, table + off + sizeof(rec),
+                                     table + off + sizeof(rec) +
+                                     ALIGN(rec.path_len, 8));
+        if (ret)
+            return ret;
+        if (S_ISREG(rec.mode))
+            *bytes += rec.size;
+        off += need;
+        cond_resched();
+    }
+    return 0;
+}
+
+/* 从新到旧找第一个完整的提交，按它建出整棵树 */
+static int ramfs_pack_load(struct super_block *sb, struct ramfs_pack *pk)
+{
+    struct ramfs_pack_super ps[2];
+    int err[2], order[2], i, k, ret;
+    loff_t bytes = 0;
+    char *buf, *table;
+
+    for (i = 0; i < 2; i++)
+        err[i] = ramfs_pack_read_super(pk->file, i, &ps[i]);
+
+    /* 新建的镜像 */
+    if (err[0] == -ENODATA && err[1] == -ENODATA) {
+        pk->seq = 0;
+        pk->tail = RAMFS_PACK_DATA_START;
+        return 0;
+    }
+
+    if (!err[0] && !err[1])
+        i = ps[1].seq > ps[0].seq;
+    else
+        i = err[0] ? 1 : 0;
+    order[0] = i;
+    order[1] = !i;
+
+    buf = kmalloc(RAMFS_PACK_BUF_SIZE, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+
+    ret = -EUCLEAN;
+    for (k = 0; k < 2; k++) {
+        i = order[k];
+        if (err[i])
+            continue;
+
+        table = ramfs_pack_read_table(pk->file, &ps[i], buf);
+        if (IS_ERR(table)) {
+            ret = PTR_ERR(table);
+            if (ret == -ENOMEM)
+                break;
+            pr_warn("RAMfs: Commit %llu in %s/" RAMFS_PACK_NAME
+                    " is incomplete, trying the previous one\n",
+                    ps[i].seq, pk->dir);
+            ret = -EUCLEAN;
+            continue;
+        }
+
+        ret = ramfs_pack_build(sb, pk->file, &ps[i], table, &bytes);
+        kvfree(table);
+        if (!ret) {
+            pk->seq = ps[i].seq;
+            pk->tail = ps[i].table_offset + ps[i].table_len;
+            pr_info("RAMfs: Loaded commit %llu from %s/" RAMFS_PACK_NAME
+                    ": %u entries, %lld bytes\n",
+                    pk->seq, pk->dir, ps[i].nr_records, bytes);
+        }
+        break;
+    }
+
+    if (ret)
+        pr_err("RAMfs: No usable commit in %s/" RAMFS_PACK_NAME ": %d\n",
+               pk->dir, ret);
+    kfree(buf);
+    return ret;
+}
+
+/**
+ * ramfs_pack_open - 打开（必要时新建）同步目录下的打包镜像并载入
+ * @sb: 正在 fill_super 的超级块，同步目录已经绑定
+ *
+ * 返回0表示成功，负数表示错误码
+ */
+int ramfs_pack_open(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct ramfs_pack *pk;
+    char *path;
+    int ret;
+
+    pk = kzalloc(sizeof(*pk), GFP_KERNEL);
+    if (!pk)
+        return -ENOMEM;
+    mutex_init(&pk->mutex);
+    pk->dir = kstrdup(fsi->sync_dir, GFP_KERNEL);
+    if (!pk->dir) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    path = kasprintf(GFP_KERNEL, "%s/" RAMFS_PACK_NAME, pk->dir);
+    if (!path) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+    pk->file = filp_open(path, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+    kfree(path);
+    if (IS_ERR(pk->file)) {
+        ret = PTR_ERR(pk->file);
+        goto out_free;
+    }
+    pk->prealloc = i_size_read(file_inode(pk->file));
+
+    ret = ramfs_pack_load(sb, pk);
+    if (ret) {
+        fput(pk->file);
+        goto out_free;
+    }
+
+    fsi->pack = pk;
+    return 0;
+
+out_free:
+    kfree(pk->dir);
+    kfree(pk);
+    return ret;
+}
+
+void ramfs_pack_close(struct ramfs_fs_info *fsi)
+{
+    struct ramfs_pack *pk = fsi->pack;
+
+    if (!pk)
+        return;
+    fput(pk->file);
+    kfree(pk->dir);
+    kfree(pk);
+    fsi->pack = NULL;
+}
+
+void ramfs_pack_evict(struct inode *inode)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+    kvfree(ri->pack_map);
+    ri->pack_map = NULL;
+}
@@ -0,0 +1,661 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 预热挂载（mount -o warm）
+ *
+ * 重启后 ramfs 的内容只剩同步目录里的镜像，用 cp -a 拷回来要很久。
+ * 预热挂载时 ramfs_fill_super 只按同步目录里的元数据建出目录树（目录、
+ * 文件大小、属主、权限、时间），文件数据在第一次 read/mmap 缺页时才从
+ * 镜像读入，打开文件时顺带打开预读；同时一个低优先级的内核线程在后台把
+ * 剩下的文件逐个读完。挂载立刻可用，恢复 I/O 和业务启动重叠进行。
+ *
+ * 还在恢复中的文件使用 ramfs_restore_aops：readpage 从镜像读，
+ * write_begin 在部分覆盖一页之前先把这一页读进来。整文件刷盘会把缺页当成
+ * 空洞写出去，所以之前要先 ramfs_restore_populate 读完整个文件。
+ *
+ * 分层挂载（见 tier.c）的文件也用这套 aops，镜像是最近一次刷盘写出的那个。
+ * 普通镜像有校验和文件时，读回的每一页都要先对上校验和，见 csum.c。
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/namei.h>
+#include <linux/file.h>
+#include <linux/cred.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/ramfs.h>
+#include "internal.h"
+
+/*
+ * 取得镜像文件（第一次调用时打开），返回 NULL 表示没有镜像兜底
+ * （已经恢复完成，或者分层挂载的文件还没刷过盘）
+ * *limit 返回镜像中仍然有效的长度；csum 不为空时 *csum 返回
+ * 镜像的校验和文件，没有时为 NULL，同样由调用者 fput
+ */
+static struct file *ramfs_restore_get(struct inode *inode, loff_t *limit,
+                                      struct file **csum)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct file *file, *new_file, *new_csum = NULL;
+    const struct cred *old_cred;
+
+    spin_lock(&ri->lock);
+    if (!ramfs_image_backed(inode)) {
+        spin_unlock(&ri->lock);
+        return NULL;
+    }
+    file = ri->restore_file;
+    if (file) {
+        get_file(file);
+        if (csum && (*csum = ri->csum_file))
+            get_file(*csum);
+    }
+    *limit = ri->restore_size;
+    spin_unlock(&ri->lock);
+    if (file)
+        return file;
+
+    /* 缺页的进程不一定有权限访问同步目录 */
+    old_cred = override_creds(fsi->restore_cred);
+    new_file = filp_open(ri->restore_path, O_RDONLY | O_LARGEFILE, 0);
+    if (!IS_ERR(new_file) && !test_bit(RAMFS_I_RESTORE_CZ, &ri->flags))
+        new_csum = ramfs_csum_open(new_file, ri->restore_path);
+    revert_creds(old_cred);
+    if (IS_ERR(new_file))
+        return new_file;
+
+    spin_lock(&ri->lock);
+    if (!ri->restore_file && ramfs_image_backed(inode)) {
+        ri->restore_file = new_file;
+        ri->csum_file = new_csum;
+        new_file = NULL;
+        new_csum = NULL;
+    }
+    file = ri->restore_file;
+    if (file) {
+        get_file(file);
+        if (csum && (*csum = ri->csum_file))
+            get_file(*csum);
+    }
+    spin_unlock(&ri->lock);
+
+    /* 并发打开的另一份 */
+    if (new_file)
+        fput(new_file);
+    if (new_csum)
+        fput(new_csum);
+    return file;
+}
+
+/* 用镜像内容填充一个锁住的页，超出镜像有效长度的部分填零 */
+static int ramfs_restore_fill_page(struct inode *inode, struct page *page)
+{
+    loff_t pos = page_offset(page), limit = 0;
+    struct file *backing, *csum = NULL;
+    bool verify = false;
+    ssize_t n = 0;
+    void *addr;
+
+    backing = ramfs_restore_get(inode, &limit, &csum);
+    if (IS_ERR(backing))
+        return PTR_ERR(backing);
+
+    addr = kmap(page);
+    if (backing && pos < limit) {
+        /* 压缩镜像整页由解码填好（包括补零），块内自带校验 */
+        if (test_bit(RAMFS_I_RESTORE_CZ, &RAMFS_I(inode)->flags)) {
+            n = ramfs_cz_read_page(inode, backing, page->index, addr,
+                                   limit) ?: PAGE_SIZE;
+        } else {
+            n = kernel_read(backing, addr,
+                            min_t(loff_t, PAGE_SIZE, limit - pos), &pos);
+            /* 截断时镜像没跟着变，只有读到镜像结尾的页才和刷盘时一样 */
+            verify = csum && n >= 0 &&
+                     (n == PAGE_SIZE || pos >= i_size_read(file_inode(backing)));
+        }
+    }
+    if (n >= 0)
+        memset(addr + n, 0, PAGE_SIZE - n);
+    if (verify)
+        n = ramfs_csum_verify(inode, csum, page->index, addr) ?: n;
+    kunmap(page);
+    if (csum)
+        fput(csum);
+    if (backing)
+        fput(backing);
+    if (n < 0)
+        return n;
+
+    flush_dcache_page(page);
+    SetPageUptodate(page);
+    return 0;
+}
+
+static int ramfs_restore_readpage(struct file *file, struct page *page)
+{
+    struct inode *inode = page->mapping->host;
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    int ret = ramfs_restore_fill_page(inode, page);
+
+    ramfs_charge_page(page, true);
+
+    if (test_bit(RAMFS_I_TIERED, &RAMFS_I(inode)->flags))
+        atomic64_inc(&fsi->tier_refaults);
+    ramfs_tier_charge(inode);
+    if (ret)
+        SetPageError(page);
+    unlock_page(page);
+    return ret;
+}
+
+/* 和 simple_write_begin 一样，只是不完整的页先从镜像读入而不是清零 */
+static int ramfs_restore_write_begin(struct file *file,
+                                     struct address_space *mapping,
+                                     loff_t pos, unsigned len, unsigned flags,
+                                     struct page **pagep, void **fsdata)
+{
+    struct page *page;
+    int ret;
+
+    page = ramfs_grab_page(mapping, pos >> PAGE_SHIFT, flags);
+    if (!page)
+        return -ENOMEM;
+
+    if (!PageUptodate(page)) {
+        /* 和 ramfs_aops 的 write_begin 一样，超出 size= 的新页直接拿掉 */
+        ret = ramfs_charge_page(page, false);
+        if (ret)
+            delete_from_page_cache(page);
+        else
+            ret = ramfs_restore_fill_page(mapping->host, page);
+        if (ret) {
+            unlock_page(page);
+            put_page(page);
+            return ret;
+        }
+        ramfs_tier_charge(mapping->host);
+    }
+
+    *pagep = page;
+    return 0;
+}
+
+const struct address_space_operations ramfs_restore_aops = {
+	.readpage	= ramfs_restore_readpage,
+	.write_begin	= ramfs_restore_write_begin,
+	.write_end	= simple_write_end,
+	.set_page_dirty	= __set_page_dirty_no_writeback,
+};
+
+static void ramfs_restore_dequeue(struct inode *inode)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+    spin_lock(&fsi->restore_lock);
+    list_del_init(&ri->restore_list);
+    spin_unlock(&fsi->restore_lock);
+}
+
+/**
+ * ramfs_restore_populate - 把整个文件从镜像读进页缓存
+ * @inode: ramfs 文件
+ *
+ * 完成后关闭镜像，之后这个文件和普通 ramfs 文件没有区别；
+ * 分层挂载的文件还要留着镜像给被回收的页读回来
+ * 返回0表示成功，负数表示错误码
+ */
+int ramfs_restore_populate(struct inode *inode)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct file *file, *csum;
+    pgoff_t index, end;
+
+    if (!test_bit(RAMFS_I_RESTORING, &ri->flags))
+        return 0;
+
+    /* 之后写入扩展出来的页本来就在页缓存里 */
+    end = DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE);
+    for (index = 0; index < end; index++) {
+        struct page *page = read_mapping_page(inode->i_mapping, index, NULL);
+
+        if (IS_ERR(page))
+            return PTR_ERR(page);
+        put_page(page);
+        cond_resched();
+    }
+
+    spin_lock(&ri->lock);
+    clear_bit(RAMFS_I_RESTORING, &ri->flags);
+    file = csum = NULL;
+    if (!test_bit(RAMFS_I_TIERED, &ri->flags)) {
+        file = ri->restore_file;
+        csum = ri->csum_file;
+        ri->restore_file = NULL;
+        ri->csum_file = NULL;
+    }
+    spin_unlock(&ri->lock);
+    if (file)
+        fput(file);
+    if (csum)
+        fput(csum);
+
+    ramfs_restore_dequeue(inode);
+    return 0;
+}
+
+/*
+ * rename/link 之后镜像路径上可能出现别的文件的新镜像，
+ * 先把当前镜像打开，之后一直从它读
+ */
+void ramfs_restore_pin(struct inode *inode)
+{
+    struct file *file;
+    loff_t limit;
+
+    file = ramfs_restore_get(inode, &limit, NULL);
+    if (!IS_ERR_OR_NULL(file))
+        fput(file);
+}
+
+void ramfs_restore_evict(struct inode *inode)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+    if (!ri->restore_path)
+        return;
+
+    ramfs_restore_dequeue(inode);
+    if (ri->restore_file)
+        fput(ri->restore_file);
+    if (ri->csum_file)
+        fput(ri->csum_file);
+    ri->restore_file = NULL;
+    ri->csum_file = NULL;
+    kfree(ri->restore_path);
+    ri->restore_path = NULL;
+}
+
+/* 后台预读：按建树的顺序把还没读完的文件逐个读进来 */
+static int ramfs_restore_thread(void *data)
+{
+    struct super_block *sb = data;
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct ramfs_inode_info *ri;
+    struct inode *inode;
+    unsigned long nr = 0;
+    int ret;
+
+    set_user_nice(current, MAX_NICE);
+    set_freezable();
+
+    while (!kthread_should_stop()) {
+        spin_lock(&fsi->restore_lock);
+        ri = list_first_entry_or_null(&fsi->restore_inodes,
+                                      struct ramfs_inode_info, restore_list);
+        inode = ri ? igrab(&ri->vfs_inode) : NULL;
+        /* 正在被释放的 inode 由 evict 自己摘掉 */
+        if (ri && !inode)
+            list_del_init(&ri->restore_list);
+        spin_unlock(&fsi->restore_lock);
+
+        if (!ri) {
+            if (nr) {
+                pr_info("RAMfs: Warm start finished, %lu files prefetched\n", nr);
+                nr = 0;
+            }
+            /* 不会再有新文件加入，等卸载 */
+            set_current_state(TASK_INTERRUPTIBLE);
+            if (!kthread_should_stop())
+                schedule();
+            __set_current_state(TASK_RUNNING);
+            continue;
+        }
+        if (!inode)
+            continue;
+
+        ret = ramfs_restore_populate(inode);
+        if (ret) {
+            /* 留给缺页时再试 */
+            pr_warn("RAMfs: Failed to prefetch %s: %d\n", ri->restore_path, ret);
+            ramfs_restore_dequeue(inode);
+        } else {
+            nr++;
+        }
+        iput(inode);
+        try_to_freeze();
+        cond_resched();
+    }
+    return 0;
+}
+
+void ramfs_restore_stop(struct ramfs_fs_info *fsi)
+{
+    if (fsi->restore_task)
+        kthread_stop(fsi->restore_task);
+    fsi->restore_task = NULL;
+}
+
+/*
+ * 建树
+ */
+struct ramfs_restore_dir {
+    struct list_head list;
+    struct dentry *dentry;	/* ramfs 中的目录 */
+    char *path;			/* 同步目录中对应的目录 */
+};
+
+struct ramfs_restore_name {
+    struct list_head list;
+    char name[];
+};
+
+struct ramfs_restore_ctx {
+    struct dir_context ctx;
+    struct list_head names;
+    int error;
+};
+
+/* 日志模式的日志和打包镜像不是 ramfs 的内容 */
+static bool ramfs_restore_skip(const char *name, int len)
+{
+    if (name[0] != '.')
+        return false;
+    if (len == 1 || (len == 2 && name[1] == '.'))
+        return true;
+    if (len == 11 && !memcmp(name, ".ramfs.pack", 11))
+        return true;
+    if (len == 15 && !memcmp(name, ".ramfs.pack.tmp", 15))
+        return true;
+    return len > 11 && !memcmp(name, ".ramfs.wal.", 11);
+}
+
+/*
+ * 刷盘给镜像 "<foo>" 用的临时文件、意图日志和校验和文件：
+ * ".<foo>.tmp"、".<foo>.journal"、".<foo>.crc"、".<foo>.crc.tmp"。
+ * 只有旁边真有 <foo> 这个镜像时才跳过，用户自己的 ".x.tmp" 之类照常恢复
+ */
+static bool ramfs_restore_sidecar(const char *dir, const char *name,
+                                  char *scratch)
+{
+    static const char * const suffixes[] = {
+        ".tmp", ".journal", ".crc", ".crc.tmp",
+    };
+    int len = strlen(name), i;
+    struct path path;
+
+    if (name[0] != '.')
+        return false;
+    for (i = 0; i < ARRAY_SIZE(suffixes); i++) {
+        int n = strlen(suffixes[i]);
+        bool found;
+
+        if (len <= n + 1 || memcmp(name + len - n, suffixes[i], n))
+            continue;
+        snprintf(scratch, PATH_MAX, "%s/%.*s", dir, len - n - 1, name + 1);
+        if (kern_path(scratch, 0, &path))
+            continue;
+        found = d_is_reg(path.dentry);
+        path_put(&path);
+        if (found)
+            return true;
+    }
+    return false;
+}
+
+static int ramfs_restore_filldir(struct dir_context *ctx, const char *name,
+                                 int len, loff_t offset, u64 ino,
+                                 unsigned int d_type)
+{
+    struct ramfs_restore_ctx *rc = container_of(ctx, struct ramfs_restore_ctx, ctx);
+    struct ramfs_restore_name *rn;
+
+    if (ramfs_restore_skip(name, len))
+        return 0;
+
+    rn = kmalloc(struct_size(rn, name, len + 1), GFP_KERNEL);
+    if (!rn) {
+        rc->error = -ENOMEM;
+        return -ENOMEM;
+    }
+    memcpy(rn->name, name, len);
+    rn->name[len] = '\0';
+    list_add_tail(&rn->list, &rc->names);
+    return 0;
+}
+
+/* 在 ramfs 目录 rd 下建出同步目录中 name 对应的目录或文件 */
+static int ramfs_restore_entry(struct super_block *sb,
+                               struct ramfs_restore_dir *rd, const char *name,
+                               struct list_head *queue, char *scratch,
+                               char *buf, unsigned long *nr_files,
+                               loff_t *bytes)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct inode *dir = d_inode(rd->dentry);
+    struct ramfs_restore_dir *sub;
+    struct dentry *dentry;
+    struct inode *inode;
+    struct kstat stat;
+    struct path path;
+    struct file *img;
+    bool cz = false;
+    char *full;
+    int ret;
+
+    full = kasprintf(GFP_KERNEL, "%s/%s", rd->path, name);
+    if (!full)
+        return -ENOMEM;
+    if (strlen(full) + NAME_MAX + 16 >= PATH_MAX) {
+        ret = -ENAMETOOLONG;
+        goto out_free;
+    }
+
+    ret = kern_path(full, 0, &path);
+    if (ret)
+        goto out_free;
+    ret = vfs_getattr(&path, &stat, STATX_BASIC_STATS, AT_STATX_SYNC_AS_STAT);
+    path_put(&path);
+    if (ret)
+        goto out_free;
+
+    /* 刷盘只产生目录和普通文件 */
+    if (!S_ISDIR(stat.mode) && !S_ISREG(stat.mode))
+        goto out_free;
+
+    if (S_ISREG(stat.mode)) {
+        /* 上次中断的增量刷盘先补完，镜像才是一致的 */
+        ret = ramfs_journal_recover(rd->path, name, scratch, buf);
+        if (!ret)
+            ret = kern_path(full, 0, &path);
+        if (ret)
+            goto out_free;
+        ret = vfs_getattr(&path, &stat, STATX_BASIC_STATS, AT_STATX_SYNC_AS_STAT);
+        path_put(&path);
+        if (ret)
+            goto out_free;
+
+        /* 压缩镜像的文件大小在文件头里 */
+        img = filp_open(full, O_RDONLY | O_LARGEFILE, 0);
+        if (IS_ERR(img)) {
+            ret = PTR_ERR(img);
+            goto out_free;
+        }
+        ret = ramfs_cz_read_header(img, &stat.size);
+        filp_close(img, NULL);
+        if (!ret)
+            cz = true;
+        else if (ret != -ENODATA)
+            goto out_free;
+        ret = 0;
+    }
+
+    dentry = d_alloc_name(rd->dentry, name);
+    if (!dentry) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+    inode = ramfs_get_inode(sb, dir, stat.mode & (S_IFMT | S_IALLUGO), 0);
+    if (!inode) {
+        dput(dentry);
+        ret = -ENOSPC;
+        goto out_free;
+    }
+    inode->i_uid = stat.uid;
+    inode->i_gid = stat.gid;
+    inode->i_atime = stat.atime;
+    inode->i_mtime = stat.mtime;
+    inode->i_ctime = stat.ctime;
+
+    if (S_ISDIR(stat.mode)) {
+        sub = kmalloc(sizeof(*sub), GFP_KERNEL);
+        if (!sub) {
+            iput(inode);
+            dput(dentry);
+            ret = -ENOMEM;
+            goto out_free;
+        }
+        inc_nlink(dir);
+        sub->dentry = dentry;
+        sub->path = full;
+        list_add_tail(&sub->list, queue);
+        full = NULL;
+    } else {
+        struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+        i_size_write(inode, stat.size);
+        inode->i_mapping->a_ops = &ramfs_restore_aops;
+        /* 镜像就是当前内容，以后只需要增量刷盘 */
+        ri->min_size = stat.size;
+        ri->restore_size = stat.size;
+        ri->restore_path = full;
+        ri->flags = BIT(RAMFS_I_RESTORING);
+        /* 扩展属性在镜像上，一并读回来 */
+        ramfs_xattr_load(inode, full);
+        if (cz)
+            ri->flags |= BIT(RAMFS_I_RESTORE_CZ);
+        /* 镜像格式和这次挂载不一样，第一次刷盘要整个重写 */
+        if (cz != fsi->mount_opts.compress)
+            ri->flags |= BIT(RAMFS_I_FULL_FLUSH);
+        full = NULL;
+        if (stat.size) {
+            spin_lock(&fsi->restore_lock);
+            list_add_tail(&ri->restore_list, &fsi->restore_inodes);
+            spin_unlock(&fsi->restore_lock);
+        }
+        (*nr_files)++;
+        *bytes += stat.size;
+    }
+
+    /* 和 ramfs_mknod 一样，d_alloc 的引用就是钉住 dentry 的那一个 */
+    d_add(dentry, inode);
+
+out_free:
+    kfree(full);
+    return ret;
+}
+
+static int ramfs_restore_one_dir(struct super_block *sb,
+                                 struct ramfs_restore_dir *rd,
+                                 struct list_head *queue, char *scratch,
+                                 char *buf, unsigned long *nr_files,
+                                 loff_t *bytes)
+{
+    struct ramfs_restore_ctx rc = {
+        .ctx.actor = ramfs_restore_filldir,
+        .names = LIST_HEAD_INIT(rc.names),
+    };
+    struct ramfs_restore_name *rn, *tmp;
+    struct file *dir;
+    int ret;
+
+    dir = filp_open(rd->path, O_RDONLY | O_DIRECTORY, 0);
+    if (IS_ERR(dir))
+        return PTR_ERR(dir);
+    ret = iterate_dir(dir, &rc.ctx);
+    if (!ret)
+        ret = rc.error;
+    filp_close(dir, NULL);
+
+    list_for_each_entry_safe(rn, tmp, &rc.names, list) {
+        if (!ret && !ramfs_restore_sidecar(rd->path, rn->name, scratch))
+            ret = ramfs_restore_entry(sb, rd, rn->name, queue, scratch, buf,
+                                      nr_files, bytes);
+        list_del(&rn->list);
+        kfree(rn);
+    }
+    return ret;
+}
+
+/**
+ * ramfs_restore_tree - 按同步目录的元数据建出整棵目录树
+ * @sb: 正在 fill_super 的超级块，根目录已经建好
+ * @sync_dir: 同步目录
+ *
+ * 按层次遍历，不读任何文件数据；建完后启动后台预读线程
+ * 返回0表示成功，负数表示错误码
+ */
+int ramfs_restore_tree(struct super_block *sb, const char *sync_dir)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct ramfs_restore_dir *rd;
+    struct task_struct *task;
+    unsigned long nr_files = 0;
+    loff_t bytes = 0;
+    char *scratch, *buf;
+    LIST_HEAD(queue);
+    int ret = 0;
+
+    fsi->restore_cred = get_current_cred();
+
+    rd = kmalloc(sizeof(*rd), GFP_KERNEL);
+    scratch = kmalloc(PATH_MAX, GFP_KERNEL);
+    buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (!rd || !scratch || !buf) {
+        kfree(rd);
+        ret = -ENOMEM;
+        goto out;
+    }
+    rd->dentry = sb->s_root;
+    rd->path = kstrdup(sync_dir, GFP_KERNEL);
+    list_add_tail(&rd->list, &queue);
+    if (!rd->path)
+        ret = -ENOMEM;
+
+    while (!list_empty(&queue)) {
+        rd = list_first_entry(&queue, struct ramfs_restore_dir, list);
+        if (!ret) {
+            ret = ramfs_restore_one_dir(sb, rd, &queue, scratch, buf,
+                                        &nr_files, &bytes);
+            if (ret)
+                pr_err("RAMfs: Failed to restore %s: %d\n", rd->path, ret);
+        }
+        list_del(&rd->list);
+        kfree(rd->path);
+        kfree(rd);
+        cond_resched();
+    }
+    if (ret)
+        goto out;
+
+    pr_info("RAMfs: Warm start from %s: %lu files, %lld bytes to fault in\n",
+            sync_dir, nr_files, bytes);
+
+    /* 分层挂载不预读，否则整个同步目录都要在内存里过一遍 */
+    if (!list_empty(&fsi->restore_inodes) && !fsi->mount_opts.max_resident) {
+        task = kthread_run(ramfs_restore_thread, sb, "ramfs-restore");
+        if (IS_ERR(task))
+            ret = PTR_ERR(task);
+        else
+            fsi->restore_task = task;
+    }
+
+out:
+    kfree(buf);
+    kfree(scratch);
+    return ret;
+}
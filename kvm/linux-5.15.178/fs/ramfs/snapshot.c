@@ -0,0 +1,451 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 刷盘快照
+ *
+ * 刷盘要读很久的页缓存，期间写者照样在改，写出去的镜像可能一半新一半旧；
+ * 让写者等着又会把整个刷盘时间都算到写延迟上。所以刷盘先拍一个快照：
+ *
+ *   冻结    持有 inode 锁，记下这次要写出的页范围（整文件刷盘就是 [0, size)），
+ *           挂到 ramfs_inode_info->snap 上，映射着的页重新写保护。
+ *           只是内存操作，不需要枚举没被映射的页
+ *   写时复制 写者第一次修改冻结范围内的某页之前，把原来的页留在快照里，
+ *           页缓存里换成一份拷贝再改（write、截断、mmap 写缺页都会经过这里）；
+ *           原来是空洞的位置记成空洞。有镜像兜底的文件（预热中或分层挂载）
+ *           不在页缓存里的页要先从镜像读进来，才知道它原来的内容
+ *   写出    在工作队列上异步进行，读页时优先用快照里留下的页，
+ *           否则就是页缓存里还没被改过的那一页。写完后摘下快照，唤醒等待者
+ *
+ * 写者最多等冻结那一下，刷盘本身不再阻塞写者；复制一页失败时才退回去等刷盘结束
+ */
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/pagevec.h>
+#include <linux/highmem.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include "internal.h"
+
+/**
+ * ramfs_snapshot_alloc - 为 inode 分配一个空快照
+ * @inode: ramfs 文件，快照持有它的引用
+ *
+ * 返回的快照引用计数为 1，由调用者 ramfs_snapshot_put
+ */
+struct ramfs_snapshot *ramfs_snapshot_alloc(struct inode *inode)
+{
+    struct ramfs_snapshot *snap;
+
+    snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap)
+        return NULL;
+    refcount_set(&snap->ref, 1);
+    ihold(inode);
+    snap->inode = inode;
+    xa_init(&snap->pages);
+    init_completion(&snap->done);
+    INIT_LIST_HEAD(&snap->list);
+    return snap;
+}
+
+void ramfs_snapshot_put(struct ramfs_snapshot *snap)
+{
+    unsigned long index;
+    void *entry;
+
+    if (!refcount_dec_and_test(&snap->ref))
+        return;
+
+    xa_for_each(&snap->pages, index, entry)
+        if (!xa_is_value(entry))
+            put_page(entry);
+    xa_destroy(&snap->pages);
+    kfree(snap->ranges);
+    kfree(snap->frozen);
+    iput(snap->inode);
+    kfree(snap);
+}
+
+/* 返回 inode 上正在写出的快照（已加引用），没有时返回 NULL */
+struct ramfs_snapshot *ramfs_snapshot_get(struct inode *inode)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_snapshot *snap;
+
+    if (!READ_ONCE(ri->snap))
+        return NULL;
+
+    spin_lock(&ri->lock);
+    snap = ri->snap;
+    if (snap)
+        refcount_inc(&snap->ref);
+    spin_unlock(&ri->lock);
+    return snap;
+}
+
+/* index 这一页在不在冻结范围里；frozen 页对齐、升序且互不重叠 */
+static bool ramfs_snapshot_covers(struct ramfs_snapshot *snap, pgoff_t index)
+{
+    loff_t pos = (loff_t)index << PAGE_SHIFT;
+    int lo = 0, hi = snap->nr_frozen;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const struct ramfs_range *r = &snap->frozen[mid];
+
+        if (pos < r->start)
+            hi = mid;
+        else if (pos >= r->start + r->len)
+            lo = mid + 1;
+        else
+            return true;
+    }
+    return false;
+}
+
+/**
+ * ramfs_snapshot_freeze - 发布快照
+ * @snap: 已经填好 size、frozen 等字段的快照
+ *
+ * 调用者持有 inode 锁，所以 write 和截断看到的要么是冻结前、要么是冻结后；
+ * mmap 写不拿 inode 锁，靠页锁和重新写保护保证同样的效果
+ * 返回 -EBUSY 表示上一个快照还没写完
+ */
+int ramfs_snapshot_freeze(struct ramfs_snapshot *snap)
+{
+    struct inode *inode = snap->inode;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct address_space *mapping = inode->i_mapping;
+    struct pagevec pvec;
+    int i, j;
+
+    spin_lock(&ri->lock);
+    if (ri->snap) {
+        spin_unlock(&ri->lock);
+        return -EBUSY;
+    }
+    refcount_inc(&snap->ref);
+    ri->snap = snap;
+    spin_unlock(&ri->lock);
+
+    /*
+     * 之后新变成可写的映射都要经过 ramfs_snapshot_mkwrite；
+     * 之前已经可写的在这里撤掉，page_mkwrite 在页锁下装 PTE，
+     * 锁住页以后再看 page_mapped 就不会漏掉正在进行的缺页
+     */
+    smp_mb();
+    if (!mapping_mapped(mapping))
+        return 0;
+
+    pagevec_init(&pvec);
+    for (i = 0; i < snap->nr_frozen; i++) {
+        pgoff_t index = snap->frozen[i].start >> PAGE_SHIFT;
+        pgoff_t end = index + (snap->frozen[i].len >> PAGE_SHIFT) - 1;
+
+        while (index <= end && pagevec_lookup_range(&pvec, mapping, &index, end)) {
+            for (j = 0; j < pagevec_count(&pvec); j++) {
+                struct page *page = pvec.pages[j];
+
+                lock_page(page);
+                if (page_mapped(page))
+                    page_mkclean(page);
+                unlock_page(page);
+            }
+            pagevec_release(&pvec);
+            cond_resched();
+        }
+    }
+    return 0;
+}
+
+/**
+ * ramfs_snapshot_finish - 写出结束，摘下快照并唤醒等待者
+ * @snap: 快照
+ * @error: 写出的结果
+ */
+void ramfs_snapshot_finish(struct ramfs_snapshot *snap, int error)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(snap->inode);
+    bool detached = false;
+
+    spin_lock(&ri->lock);
+    if (ri->snap == snap) {
+        ri->snap = NULL;
+        detached = true;
+    }
+    spin_unlock(&ri->lock);
+
+    snap->error = error;
+    complete_all(&snap->done);
+    if (detached)
+        ramfs_snapshot_put(snap);
+}
+
+/* 等快照写完，返回写出的结果并释放调用者的引用 */
+int ramfs_snapshot_wait(struct ramfs_snapshot *snap)
+{
+    int ret;
+
+    wait_for_completion(&snap->done);
+    ret = snap->error;
+    ramfs_snapshot_put(snap);
+    return ret;
+}
+
+/*
+ * 用 old 的拷贝替换页缓存里的 old，old 原样留给快照。
+ * 调用者锁住了 old；映射着 old 的 PTE 被去掉，下一次访问会映射到新页
+ */
+static int ramfs_snapshot_replace(struct address_space *mapping, pgoff_t index,
+                                  struct page *old)
+{
+    struct page *new;
+
+    new = alloc_page(mapping_gfp_mask(mapping));
+    if (!new)
+        return -ENOMEM;
+
+    copy_highpage(new, old);
+    __SetPageLocked(new);
+    SetPageUptodate(new);
+    /* 记账跟着换到新页上，否则下一次 write_begin 会再记一次 */
+    if (PageChecked(old))
+        SetPageChecked(new);
+    replace_page_cache_page(old, new);
+    lru_cache_add(new);
+    set_page_dirty(new);
+    unlock_page(new);
+    put_page(new);
+
+    if (mapping_mapped(mapping))
+        unmap_mapping_pages(mapping, index, 1, false);
+    return 0;
+}
+
+/*
+ * 写者要修改 index 之前调用：page 是锁住的当前页，空洞时为 NULL。
+ * 第一次碰到时把当前内容留给快照；replace 为真时还要让页缓存换一页，
+ * 否则调用者保证之后不会原地修改 page（例如它马上要被截断掉）
+ */
+static int ramfs_snapshot_preserve(struct ramfs_snapshot *snap,
+                                   struct address_space *mapping,
+                                   pgoff_t index, struct page *page,
+                                   bool replace)
+{
+    void *entry = xa_load(&snap->pages, index);
+    int ret;
+
+    if (!entry) {
+        entry = page ? (void *)page : xa_mk_value(0);
+        if (page)
+            get_page(page);
+        ret = xa_insert(&snap->pages, index, entry, GFP_KERNEL);
+        if (ret) {
+            if (page)
+                put_page(page);
+            if (ret != -EBUSY)
+                return ret;
+            entry = xa_load(&snap->pages, index);
+        }
+    }
+
+    /* 留下的已经是别的页（或空洞），当前页可以随便改 */
+    if (!page || entry != page || !replace)
+        return 0;
+    return ramfs_snapshot_replace(mapping, index, page);
+}
+
+/*
+ * 锁住 index 处的当前页，空洞返回 NULL。有镜像兜底的文件先把页读进来，
+ * 读完到加锁之间可能又被回收，所以要重试
+ */
+static struct page *ramfs_snapshot_lock_page(struct inode *inode, pgoff_t index)
+{
+    struct address_space *mapping = inode->i_mapping;
+    struct page *page;
+
+    for (;;) {
+        page = find_lock_page(mapping, index);
+        if (page || !ramfs_image_backed(inode))
+            return page;
+        page = read_mapping_page(mapping, index, NULL);
+        if (IS_ERR(page))
+            return page;
+        put_page(page);
+    }
+}
+
+/**
+ * ramfs_snapshot_cow - write 修改 [pos, pos + len) 之前调用
+ * @inode: ramfs 文件，调用者持有 inode 锁
+ * @pos: 起始偏移
+ * @len: 长度
+ */
+void ramfs_snapshot_cow(struct inode *inode, loff_t pos, loff_t len)
+{
+    struct address_space *mapping = inode->i_mapping;
+    struct ramfs_snapshot *snap;
+    pgoff_t index, end;
+    int ret = 0;
+
+    if (len <= 0)
+        return;
+    snap = ramfs_snapshot_get(inode);
+    if (!snap)
+        return;
+
+    index = pos >> PAGE_SHIFT;
+    end = (pos + len - 1) >> PAGE_SHIFT;
+    for (; index <= end && !ret; index++) {
+        struct page *page;
+
+        if (!ramfs_snapshot_covers(snap, index))
+            continue;
+        page = ramfs_snapshot_lock_page(inode, index);
+        if (IS_ERR(page)) {
+            ret = PTR_ERR(page);
+            break;
+        }
+        ret = ramfs_snapshot_preserve(snap, mapping, index, page, true);
+        if (page) {
+            unlock_page(page);
+            put_page(page);
+        }
+        cond_resched();
+    }
+
+    /* 复制不了，只能等这次写出结束再原地修改 */
+    if (ret)
+        wait_for_completion(&snap->done);
+    ramfs_snapshot_put(snap);
+}
+
+/**
+ * ramfs_snapshot_truncate - 截断到 newsize 之前调用
+ * @inode: ramfs 文件，调用者持有 inode 锁
+ * @newsize: 新的大小
+ *
+ * 被截掉的整页从页缓存删掉后内容不会再变，只要留下引用；
+ * 跨 newsize 的那一页尾部会被原地清零，要先复制。
+ * 截断以后镜像里的这部分也读不回来了，已被回收的页要先读进来
+ */
+void ramfs_snapshot_truncate(struct inode *inode, loff_t newsize)
+{
+    struct address_space *mapping = inode->i_mapping;
+    struct ramfs_snapshot *snap;
+    pgoff_t index, partial, end;
+    loff_t size = i_size_read(inode);
+    int ret = 0;
+
+    if (newsize >= size)
+        return;
+    snap = ramfs_snapshot_get(inode);
+    if (!snap)
+        return;
+
+    partial = offset_in_page(newsize) ? newsize >> PAGE_SHIFT : ULONG_MAX;
+    index = newsize >> PAGE_SHIFT;
+    end = (size - 1) >> PAGE_SHIFT;
+    for (; index <= end && !ret; index++) {
+        struct page *page;
+
+        if (!ramfs_snapshot_covers(snap, index))
+            continue;
+        page = ramfs_snapshot_lock_page(inode, index);
+        if (IS_ERR(page)) {
+            ret = PTR_ERR(page);
+            break;
+        }
+        if (!page)
+            continue;
+        ret = ramfs_snapshot_preserve(snap, mapping, index, page,
+                                      index == partial);
+        unlock_page(page);
+        put_page(page);
+        cond_resched();
+    }
+
+    if (ret)
+        wait_for_completion(&snap->done);
+    ramfs_snapshot_put(snap);
+}
+
+/**
+ * ramfs_snapshot_mkwrite - mmap 写缺页时调用
+ * @vmf: 缺页信息
+ *
+ * 冻结范围内的页换成拷贝后返回 VM_FAULT_NOPAGE，旧页的映射已经去掉，
+ * 重新缺页会映射到新页；不需要处理时返回0
+ */
+vm_fault_t ramfs_snapshot_mkwrite(struct vm_fault *vmf)
+{
+    struct inode *inode = file_inode(vmf->vma->vm_file);
+    struct address_space *mapping = inode->i_mapping;
+    struct page *page = vmf->page;
+    struct ramfs_snapshot *snap;
+    vm_fault_t ret = 0;
+    int err = 0;
+
+    snap = ramfs_snapshot_get(inode);
+    if (!snap)
+        return 0;
+
+    if (ramfs_snapshot_covers(snap, page->index)) {
+        lock_page(page);
+        if (page->mapping == mapping)
+            err = ramfs_snapshot_preserve(snap, mapping, page->index,
+                                          page, true);
+        /* 被换掉或者被截断了，重新缺页 */
+        if (page->mapping != mapping)
+            ret = VM_FAULT_NOPAGE;
+        unlock_page(page);
+    }
+
+    if (err)
+        wait_for_completion(&snap->done);
+    ramfs_snapshot_put(snap);
+    return ret;
+}
+
+/**
+ * ramfs_snapshot_page - 写出时读快照中的一页
+ * @snap: 快照
+ * @index: 冻结范围内的页号
+ *
+ * 返回加了引用的页，空洞返回 NULL，从镜像读回失败时返回 ERR_PTR
+ */
+struct page *ramfs_snapshot_page(struct ramfs_snapshot *snap, pgoff_t index)
+{
+    struct address_space *mapping = snap->inode->i_mapping;
+    struct page *page;
+    void *entry;
+
+    entry = xa_load(&snap->pages, index);
+    if (!entry) {
+        page = find_get_page(mapping, index);
+        /* 被回收的页和冻结时一样，还是镜像里的内容 */
+        if (!page && ramfs_image_backed(snap->inode)) {
+            page = read_mapping_page(mapping, index, NULL);
+            if (IS_ERR(page))
+                return page;
+        }
+        /*
+         * 写者总是先把旧页留进快照再替换页缓存，拿到的页如果已经是替换后的，
+         * 这里一定能看到留下的旧页（find_get_page 加引用是全屏障）
+         */
+        entry = xa_load(&snap->pages, index);
+        if (!entry)
+            return page;
+        if (page)
+            put_page(page);
+    }
+
+    if (xa_is_value(entry))
+        return NULL;
+    page = entry;
+    get_page(page);
+    return page;
+}
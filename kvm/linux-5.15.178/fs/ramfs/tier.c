@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 分层挂载（mount -o max_resident=<size>）
+ *
+ * 普通 ramfs 的页不可回收，文件有多大就钉住多少内存。绑定了同步目录以后，
+ * 已经写进镜像、之后没再改过的页其实在盘上有一份一样的，没必要一直留着：
+ *
+ *   刷盘成功后 ramfs_tier_commit 打开刚写好的镜像挂到 inode 上，
+ *   把快照里没被写者换掉的页的脏标记清掉。这些干净页在普通 LRU 上，
+ *   内存紧张时由内核直接回收；再次访问时 ramfs_restore_aops 的 readpage
+ *   从镜像读回来，和预热挂载走同一条路径
+ *
+ *   挂载的常驻页数超过 max_resident 时，回写线程先把脏数据刷下去，
+ *   再按时钟算法挑最近没被访问过的文件，逐出它们的干净页
+ *
+ * 被映射着的页和还没刷盘的页都不会被逐出，所以上限是软的：脏数据默认
+ * 最多占上限的一半（dirty_bytes），超过后写者被限流，等回写线程追上来
+ */
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/pagevec.h>
+#include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include "internal.h"
+
+#define RAMFS_TIER_CHUNK	512	/* 逐出时每次处理的页数 */
+
+static unsigned long ramfs_tier_limit(struct ramfs_fs_info *fsi)
+{
+    return fsi->mount_opts.max_resident >> PAGE_SHIFT;
+}
+
+/**
+ * ramfs_tier_charge - 页缓存里多了一页时调用
+ * @inode: ramfs 文件
+ *
+ * 常驻页数的估计第一次越过上限时唤醒回写线程；估计值只增不减，
+ * 由 ramfs_tier_balance 每轮校正，所以这里不会反复唤醒
+ */
+void ramfs_tier_charge(struct inode *inode)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    unsigned long limit = ramfs_tier_limit(fsi);
+
+    if (!limit || !fsi->writeback_task)
+        return;
+    if (atomic_long_inc_return(&fsi->nr_resident) == limit + 1)
+        wake_up_process(fsi->writeback_task);
+}
+
+/* 快照冻结范围内、写出期间没被写者换掉的页就是镜像里的内容 */
+static void ramfs_tier_clean(struct ramfs_snapshot *snap)
+{
+    struct address_space *mapping = snap->inode->i_mapping;
+    struct pagevec pvec;
+    int i, j;
+
+    pagevec_init(&pvec);
+    for (i = 0; i < snap->nr_frozen; i++) {
+        pgoff_t index = snap->frozen[i].start >> PAGE_SHIFT;
+        pgoff_t end = index + (snap->frozen[i].len >> PAGE_SHIFT) - 1;
+
+        while (index <= end && pagevec_lookup_range(&pvec, mapping, &index, end)) {
+            for (j = 0; j < pagevec_count(&pvec); j++) {
+                struct page *page = pvec.pages[j];
+
+                /* 写者在页锁下把旧页留进快照，锁住后看到的是确定的状态 */
+                lock_page(page);
+                if (page->mapping == mapping &&
+                    !xa_load(&snap->pages, page->index))
+                    cancel_dirty_page(page);
+                unlock_page(page);
+            }
+            pagevec_release(&pvec);
+            cond_resched();
+        }
+    }
+}
+
+/**
+ * ramfs_tier_commit - 快照成功写出后调用，让写出的页可以被回收
+ * @snap: 刚写完、还没摘下的快照
+ * @filename: 镜像在 snap->temp_path 下的文件名
+ *
+ * 在发起者的身份下调用。打开镜像失败时页保持为脏，下次刷盘再试
+ */
+void ramfs_tier_commit(struct ramfs_snapshot *snap, const char *filename)
+{
+    struct inode *inode = snap->inode;
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct file *file, *old_file, *csum, *old_csum;
+    char *path, *old_path;
+
+    if (!ramfs_tier_limit(fsi))
+        return;
+
+    path = kasprintf(GFP_KERNEL, "%s/%s", snap->temp_path, filename);
+    if (!path)
+        return;
+    /* 整文件刷盘换了一个新镜像，之后 rename 到这里的别的镜像也不影响已打开的 */
+    file = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+    if (IS_ERR(file)) {
+        pr_warn("RAMfs: Failed to open %s for tiering: %ld\n", path,
+                PTR_ERR(file));
+        kfree(path);
+        return;
+    }
+    csum = ramfs_csum_open(file, path);
+
+    spin_lock(&ri->lock);
+    old_file = ri->restore_file;
+    old_csum = ri->csum_file;
+    old_path = ri->restore_path;
+    ri->restore_file = file;
+    ri->csum_file = csum;
+    ri->restore_path = path;
+    /* 写出期间被截掉的部分不能再从镜像读回来 */
+    ri->restore_size = min(snap->size, ri->min_size);
+    /* 分层挂载不压缩，写出的一定是普通镜像 */
+    clear_bit(RAMFS_I_RESTORE_CZ, &ri->flags);
+    set_bit(RAMFS_I_TIERED, &ri->flags);
+    spin_unlock(&ri->lock);
+
+    ramfs_tier_clean(snap);
+
+    spin_lock(&fsi->tier_lock);
+    if (list_empty(&ri->tier_list))
+        list_add_tail(&ri->tier_list, &fsi->tier_inodes);
+    spin_unlock(&fsi->tier_lock);
+
+    if (old_file)
+        fput(old_file);
+    if (old_csum)
+        fput(old_csum);
+    kfree(old_path);
+}
+
+/* 整个挂载在页缓存里的页数 */
+static unsigned long ramfs_tier_resident(struct super_block *sb)
+{
+    unsigned long nr = 0;
+    struct inode *inode;
+
+    spin_lock(&sb->s_inode_list_lock);
+    list_for_each_entry(inode, &sb->s_inodes, i_sb_list)
+        nr += READ_ONCE(inode->i_data.nrpages);
+    spin_unlock(&sb->s_inode_list_lock);
+    return nr;
+}
+
+/**
+ * ramfs_tier_balance - 常驻页数超过上限时逐出冷文件的干净页
+ * @sb: 分层挂载的超级块
+ *
+ * 回写线程每轮刷盘之后调用。时钟算法：从队头取文件放到队尾，
+ * 最近被访问过的清掉访问标记跳过，否则分批丢掉它的干净页直到回到上限以下；
+ * 转两圈还不够说明剩下的都是脏页或者被映射着，留给下一轮
+ */
+void ramfs_tier_balance(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    unsigned long limit = ramfs_tier_limit(fsi);
+    unsigned long resident, evicted = 0, scan = 0;
+    struct ramfs_inode_info *ri;
+    struct inode *inode;
+
+    if (!limit)
+        return;
+
+    resident = ramfs_tier_resident(sb);
+    if (resident > limit) {
+        spin_lock(&fsi->tier_lock);
+        list_for_each_entry(ri, &fsi->tier_inodes, tier_list)
+            scan += 2;
+        spin_unlock(&fsi->tier_lock);
+    }
+
+    while (resident > limit && scan--) {
+        pgoff_t index, end;
+
+        spin_lock(&fsi->tier_lock);
+        ri = list_first_entry_or_null(&fsi->tier_inodes,
+                                      struct ramfs_inode_info, tier_list);
+        if (!ri) {
+            spin_unlock(&fsi->tier_lock);
+            break;
+        }
+        list_move_tail(&ri->tier_list, &fsi->tier_inodes);
+        /* 最近被访问过，给第二次机会 */
+        if (test_and_clear_bit(RAMFS_I_TIER_REF, &ri->flags)) {
+            spin_unlock(&fsi->tier_lock);
+            continue;
+        }
+        /* 正在被释放的 inode 由 evict 自己摘掉 */
+        inode = igrab(&ri->vfs_inode);
+        spin_unlock(&fsi->tier_lock);
+        if (!inode)
+            continue;
+
+        /* 脏的、被映射着的和有别人引用的页会被跳过 */
+        end = DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE);
+        for (index = 0; index < end && resident > limit;
+             index += RAMFS_TIER_CHUNK) {
+            unsigned long nr;
+
+            nr = invalidate_mapping_pages(inode->i_mapping, index,
+                                          index + RAMFS_TIER_CHUNK - 1);
+            resident -= min(nr, resident);
+            evicted += nr;
+            cond_resched();
+        }
+        iput(inode);
+    }
+
+    atomic64_add(evicted, &fsi->tier_evicted);
+    atomic_long_set(&fsi->nr_resident, resident);
+    /* 内核回收干净页时不会通知 ramfs，size= 的用量也在这里校正 */
+    percpu_counter_set(&fsi->used_blocks,
+                       resident + atomic_long_read(&fsi->xattr_blocks));
+}
+
+void ramfs_tier_evict(struct inode *inode)
+{
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+
+    if (list_empty(&ri->tier_list))
+        return;
+
+    spin_lock(&fsi->tier_lock);
+    list_del_init(&ri->tier_list);
+    spin_unlock(&fsi->tier_lock);
+}
+
+void ramfs_tier_show_stats(struct seq_file *m, struct ramfs_fs_info *fsi)
+{
+    seq_printf(m, "max_resident_pages %lu\n", ramfs_tier_limit(fsi));
+    seq_printf(m, "resident_pages %lu\n", ramfs_tier_resident(fsi->sb));
+    seq_printf(m, "tier_evicted_pages %llu\n",
+               (u64)atomic64_read(&fsi->tier_evicted));
+    seq_printf(m, "tier_refaults %llu\n",
+               (u64)atomic64_read(&fsi->tier_refaults));
+}
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * ramfs 刷盘的 tracepoint，代替原来每次刷盘都打的 pr_info：
+ *
+ *   echo 1 > /sys/kernel/tracing/events/ramfs/enable
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ramfs
+
+#if !defined(_RAMFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _RAMFS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* 快照冻结完成，写出排进了 ramfs_flush_wq */
+TRACE_EVENT(ramfs_flush_start,
+	TP_PROTO(struct inode *inode, const char *name, bool full, int nr,
+		 loff_t size),
+
+	TP_ARGS(inode, name, full, nr, size),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(ino_t,		ino)
+		__string(name,		name)
+		__field(bool,		full)
+		__field(int,		nr)
+		__field(loff_t,		size)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		__assign_str(name, name);
+		__entry->full	= full;
+		__entry->nr	= nr;
+		__entry->size	= size;
+	),
+
+	TP_printk("dev %d:%d ino %lu name %s %s ranges %d size %lld",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, __get_str(name),
+		  __entry->full ? "full" : "incremental",
+		  __entry->nr, __entry->size)
+);
+
+/* 写出结束，latency 从冻结算起 */
+TRACE_EVENT(ramfs_flush_end,
+	TP_PROTO(struct inode *inode, const char *name, bool full, int ret,
+		 loff_t written, u64 latency_ns),
+
+	TP_ARGS(inode, name, full, ret, written, latency_ns),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(ino_t,		ino)
+		__string(name,		name)
+		__field(bool,		full)
+		__field(int,		ret)
+		__field(loff_t,		written)
+		__field(u64,		latency_ns)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= inode->i_sb->s_dev;
+		__entry->ino		= inode->i_ino;
+		__assign_str(name, name);
+		__entry->full		= full;
+		__entry->ret		= ret;
+		__entry->written	= written;
+		__entry->latency_ns	= latency_ns;
+	),
+
+	TP_printk("dev %d:%d ino %lu name %s %s ret %d written %lld latency %llu ns",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, __get_str(name),
+		  __entry->full ? "full" : "incremental",
+		  __entry->ret, __entry->written, __entry->latency_ns)
+);
+
+#endif /* _RAMFS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
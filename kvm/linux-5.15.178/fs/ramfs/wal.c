@@ -0,0 +1,606 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 日志模式（mount -o wal）
+ *
+ * 普通模式下每次 fsync 都要把整个文件（或脏范围加意图日志）写回镜像，
+ * 延迟和文件大小相关。日志模式下每次 write/truncate 都在同一把 inode 锁下
+ * 往同步目录里的 ".ramfs.wal.<n>" 追加一条带 crc32c 的记录，fsync 只需要
+ * fdatasync 日志尾部。回写线程定期做检查点：先切换到另一份日志，再把所有
+ * 脏文件写成完整镜像，镜像全部落盘后清空旧日志。
+ *
+ * 绑定同步目录时先按 gen 从旧到新回放两份日志，遇到第一条不完整或校验
+ * 失败的记录就停下（那是崩溃时还没 fsync 的尾巴）。同一文件的记录顺序与
+ * 写入顺序一致，所以即使镜像比日志里的某些记录新，按顺序回放完的结果
+ * 也是最后一次记录下来的内容。
+ *
+ * 日志格式：header | (record, path, data)*
+ *
+ * mmap 写入、rename/link 以及追加日志失败都不进日志，
+ * 这时设置 RAMFS_I_WAL_BYPASS，下一次 fsync 退回普通刷盘。
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/namei.h>
+#include <linux/file.h>
+#include <linux/dcache.h>
+#include <linux/sched.h>
+#include <linux/crc32c.h>
+#include "internal.h"
+
+#define RAMFS_WAL_MAGIC		0x4c415752	/* "RWAL" */
+#define RAMFS_WAL_REC_MAGIC	0x43455257	/* "WREC" */
+#define RAMFS_WAL_NAME		".ramfs.wal"
+
+struct ramfs_wal_header {
+    u32 magic;
+    u32 pad;
+    u64 gen;		/* 越大越新，回放时先回放旧的一份 */
+};
+
+struct ramfs_wal_record {
+    u32 magic;
+    u32 crc;		/* 整条记录的 crc32c，计算时 crc 字段按 0 算 */
+    u64 offset;
+    u64 len;		/* 数据长度，截断记录为 0 */
+    u64 size;		/* 操作完成后的文件大小 */
+    u16 type;
+    u16 path_len;	/* 后面紧跟相对 ramfs 根的路径（不含 '\0'），再跟数据 */
+    u32 pad;
+};
+
+enum {
+    RAMFS_WAL_WRITE = 1,
+    RAMFS_WAL_TRUNCATE,
+};
+
+static struct file *ramfs_wal_open_log(const char *sync_dir, int idx, int flags)
+{
+    struct file *log;
+    char *path;
+
+    path = kasprintf(GFP_KERNEL, "%s/" RAMFS_WAL_NAME ".%d", sync_dir, idx);
+    if (!path)
+        return ERR_PTR(-ENOMEM);
+    log = filp_open(path, flags | O_LARGEFILE, 0600);
+    kfree(path);
+    return log;
+}
+
+/* 清空第 idx 份日志并写入新的 header，之后的记录都追加到这里 */
+static int ramfs_wal_reset(struct ramfs_fs_info *fsi, int idx)
+{
+    struct file *log = fsi->wal_file[idx];
+    struct ramfs_wal_header hdr = {
+        .magic = RAMFS_WAL_MAGIC,
+        .gen = ++fsi->wal_gen,
+    };
+    loff_t pos = 0;
+    int ret;
+
+    ret = vfs_truncate(&log->f_path, 0);
+    if (!ret)
+        ret = ramfs_write_all(log, &hdr, sizeof(hdr), &pos);
+    if (ret)
+        return ret;
+
+    fsi->wal_active = idx;
+    fsi->wal_pos = pos;
+    fsi->wal_synced = 0;
+    return 0;
+}
+
+/* 日志落盘后关闭；调用者持有 wal_mutex */
+static void ramfs_wal_release(struct ramfs_fs_info *fsi)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (!fsi->wal_file[i])
+            continue;
+        vfs_fsync(fsi->wal_file[i], 1);
+        fput(fsi->wal_file[i]);
+        fsi->wal_file[i] = NULL;
+    }
+    fsi->wal_ckpt_pending = false;
+}
+
+/*
+ * 按需打开当前同步目录下的两份日志，调用者持有 wal_mutex
+ * 返回 -ENOENT 表示还没有绑定同步目录
+ */
+static int ramfs_wal_open(struct ramfs_fs_info *fsi)
+{
+    char *sync_dir;
+    int i, gen, ret = 0;
+
+    if (fsi->wal_file[0] && fsi->wal_sync_gen == READ_ONCE(fsi->sync_gen))
+        return 0;
+
+    /* 同步目录换过了：旧日志落盘后留在原处，下次绑定那个目录时回放 */
+    ramfs_wal_release(fsi);
+
+    sync_dir = ramfs_get_sync_dir(fsi, &gen);
+    if (!sync_dir)
+        return -ENOENT;
+    if (IS_ERR(sync_dir))
+        return PTR_ERR(sync_dir);
+
+    for (i = 0; i < 2; i++) {
+        struct file *log = ramfs_wal_open_log(sync_dir, i, O_RDWR | O_CREAT);
+
+        if (IS_ERR(log)) {
+            ret = PTR_ERR(log);
+            pr_err("RAMfs: Failed to open log in %s: %d\n", sync_dir, ret);
+            break;
+        }
+        fsi->wal_file[i] = log;
+    }
+
+    /* 绑定时已经回放过这里的旧日志，可以直接从头开始 */
+    if (!ret)
+        ret = ramfs_wal_reset(fsi, 0);
+    if (!ret)
+        ret = vfs_truncate(&fsi->wal_file[1]->f_path, 0);
+    if (ret)
+        ramfs_wal_release(fsi);
+    else
+        fsi->wal_sync_gen = gen;
+
+    kfree(sync_dir);
+    return ret;
+}
+
+bool ramfs_wal_full(struct ramfs_fs_info *fsi)
+{
+    return fsi->mount_opts.wal &&
+           READ_ONCE(fsi->wal_pos) > fsi->mount_opts.wal_size;
+}
+
+/*
+ * 追加一条记录。调用者持有 inode 锁，所以同一文件的记录顺序和修改顺序一致，
+ * crc 和写进日志的数据看到的是同一份页内容
+ */
+static int ramfs_wal_append(struct dentry *dentry, u16 type,
+                            loff_t offset, loff_t len)
+{
+    struct inode *inode = d_inode(dentry);
+    struct ramfs_fs_info *fsi = inode->i_sb->s_fs_info;
+    struct ramfs_wal_record rec = {
+        .magic = RAMFS_WAL_REC_MAGIC,
+        .offset = offset,
+        .len = len,
+        .size = i_size_read(inode),
+        .type = type,
+    };
+    struct file *log;
+    char *buf, *path;
+    loff_t pos;
+    u32 crc;
+    int ret;
+
+    buf = kmalloc(PATH_MAX, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+    path = dentry_path_raw(dentry, buf, PATH_MAX);
+    if (IS_ERR(path)) {
+        ret = PTR_ERR(path);
+        goto out_free;
+    }
+    rec.path_len = strlen(path);
+
+    /* 在拿 wal_mutex 之前算好校验和，缩短所有写者串行的那一段 */
+    crc = crc32c(~0, &rec, sizeof(rec));
+    crc = crc32c(crc, path, rec.path_len);
+    if (len)
+        crc = ramfs_crc_pages(inode->i_mapping, offset, len, crc);
+    rec.crc = crc;
+
+    mutex_lock(&fsi->wal_mutex);
+    ret = ramfs_wal_open(fsi);
+    if (ret)
+        goto out_unlock;
+
+    log = fsi->wal_file[fsi->wal_active];
+    pos = fsi->wal_pos;
+    ret = ramfs_write_all(log, &rec, sizeof(rec), &pos);
+    if (!ret)
+        ret = ramfs_write_all(log, path, rec.path_len, &pos);
+    if (!ret && len)
+        ret = ramfs_write_pages(inode->i_mapping, offset, len, log, &pos);
+
+    /* 失败时不前移 wal_pos：半条记录会被覆盖，或者在回放时因校验失败被丢弃 */
+    if (!ret) {
+        WRITE_ONCE(fsi->wal_pos, pos);
+        if (ramfs_wal_full(fsi) && fsi->writeback_task)
+            wake_up_process(fsi->writeback_task);
+    }
+
+out_unlock:
+    mutex_unlock(&fsi->wal_mutex);
+out_free:
+    kfree(buf);
+    return ret;
+}
+
+/**
+ * ramfs_wal_log_write - 记录一次 write
+ * @file: 被写的文件
+ * @pos: 写入起点
+ * @len: 写入长度
+ *
+ * 在 write_iter 中持有 inode 锁时调用
+ */
+int ramfs_wal_log_write(struct file *file, loff_t pos, size_t len)
+{
+    return ramfs_wal_append(file->f_path.dentry, RAMFS_WAL_WRITE, pos, len);
+}
+
+/* 记录一次截断，新大小取自 i_size；在 setattr 中持有 inode 锁时调用 */
+int ramfs_wal_log_truncate(struct dentry *dentry)
+{
+    return ramfs_wal_append(dentry, RAMFS_WAL_TRUNCATE, 0, 0);
+}
+
+/**
+ * ramfs_wal_fsync - 日志模式下的 fsync
+ * @sb: ramfs 超级块
+ *
+ * 只 fdatasync 活动日志里上次同步之后追加的部分。日志是整个挂载共享的，
+ * 一次 fsync 会顺带让其他文件之前的记录也落盘
+ */
+int ramfs_wal_fsync(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct file *log;
+    loff_t start, end;
+    int ret = 0;
+
+    mutex_lock(&fsi->wal_mutex);
+    if (!fsi->wal_file[0]) {
+        mutex_unlock(&fsi->wal_mutex);
+        return 0;
+    }
+    log = get_file(fsi->wal_file[fsi->wal_active]);
+    start = fsi->wal_synced;
+    end = fsi->wal_pos;
+    mutex_unlock(&fsi->wal_mutex);
+
+    /* 在锁外同步，其他写者可以继续追加 */
+    if (end > start)
+        ret = vfs_fsync_range(log, start, end - 1, 1);
+
+    if (!ret) {
+        mutex_lock(&fsi->wal_mutex);
+        if (log == fsi->wal_file[fsi->wal_active] && fsi->wal_synced < end)
+            fsi->wal_synced = end;
+        mutex_unlock(&fsi->wal_mutex);
+    }
+    fput(log);
+    return ret;
+}
+
+static bool ramfs_wal_idle(struct ramfs_fs_info *fsi)
+{
+    bool idle;
+
+    spin_lock(&fsi->dirty_lock);
+    idle = list_empty(&fsi->dirty_inodes);
+    spin_unlock(&fsi->dirty_lock);
+    return idle;
+}
+
+/**
+ * ramfs_wal_checkpoint - 把日志合并成完整镜像
+ * @sb: ramfs 超级块
+ *
+ * 由回写线程调用。先把追加切到另一份日志，再刷所有脏文件；
+ * 只有全部刷盘成功，旧日志才能清空，否则下一轮重试（期间不再切换）
+ */
+void ramfs_wal_checkpoint(struct super_block *sb)
+{
+    struct ramfs_fs_info *fsi = sb->s_fs_info;
+    struct file *old = NULL;
+    int idx, failed, ret;
+
+    mutex_lock(&fsi->wal_mutex);
+    /* 空闲的挂载：上次切换以来没有记录也没有脏文件，不碰同步目录 */
+    if (fsi->wal_file[0] && !fsi->wal_ckpt_pending &&
+        fsi->wal_pos == sizeof(struct ramfs_wal_header) &&
+        ramfs_wal_idle(fsi)) {
+        mutex_unlock(&fsi->wal_mutex);
+        return;
+    }
+    if (fsi->wal_file[0]) {
+        idx = fsi->wal_active;
+        if (fsi->wal_ckpt_pending) {
+            old = get_file(fsi->wal_file[!idx]);
+        } else {
+            /* 旧日志剩下的记录先落盘，之后 fsync 只需要管新日志 */
+            ret = vfs_fsync(fsi->wal_file[idx], 1);
+            if (!ret)
+                ret = ramfs_wal_reset(fsi, !idx);
+            if (!ret)
+                old = get_file(fsi->wal_file[idx]);
+            else
+                pr_warn("RAMfs: Failed to switch log: %d\n", ret);
+        }
+    }
+    mutex_unlock(&fsi->wal_mutex);
+
+    failed = ramfs_writeback_sb(sb);
+    if (!old)
+        return;
+
+    mutex_lock(&fsi->wal_mutex);
+    /* 期间换过同步目录的话，日志已经被关掉了 */
+    if (old == fsi->wal_file[!fsi->wal_active]) {
+        ret = failed ? -EIO : vfs_truncate(&old->f_path, 0);
+        fsi->wal_ckpt_pending = ret != 0;
+        if (!ret)
+            pr_debug("RAMfs: Checkpointed log generation %llu\n",
+                    fsi->wal_gen - 1);
+    }
+    mutex_unlock(&fsi->wal_mutex);
+    fput(old);
+}
+
+/* 卸载时调用，回写线程已经做完最后一次检查点 */
+void ramfs_wal_close(struct ramfs_fs_info *fsi)
+{
+    mutex_lock(&fsi->wal_mutex);
+    ramfs_wal_release(fsi);
+    mutex_unlock(&fsi->wal_mutex);
+}
+
+/*
+ * 回放
+ */
+struct ramfs_wal_replay {
+    const char *sync_dir;
+    struct file *target;	/* 当前正在更新的镜像 */
+    char *target_rel;		/* 它的相对路径 */
+    char *rel;			/* 当前记录的相对路径 */
+    char *dir;			/* 镜像所在目录，后面跟着文件名 */
+    char *path;			/* 临时路径 */
+    char *buf;			/* PAGE_SIZE */
+};
+
+/* 读满 len 字节；短读返回 -ENODATA，表示到了日志尾部 */
+static int ramfs_wal_read(struct file *log, void *buf, size_t len, loff_t *pos)
+{
+    ssize_t n = kernel_read(log, buf, len, pos);
+
+    if (n < 0)
+        return n;
+    return n == len ? 0 : -ENODATA;
+}
+
+/*
+ * 读出并校验一条记录，完成后 *pos 指向下一条记录
+ * 返回 -ENODATA / -EBADMSG 表示日志到此为止
+ */
+static int ramfs_wal_check(struct ramfs_wal_replay *r, struct file *log,
+                           struct ramfs_wal_record *rec, loff_t *pos)
+{
+    struct ramfs_wal_record tmp;
+    u64 len;
+    u32 crc;
+    int ret;
+
+    ret = ramfs_wal_read(log, rec, sizeof(*rec), pos);
+    if (ret)
+        return ret;
+    if (rec->magic != RAMFS_WAL_REC_MAGIC || !rec->path_len ||
+        rec->path_len + strlen(r->sync_dir) + NAME_MAX + 16 >= PATH_MAX)
+        return -EBADMSG;
+
+    ret = ramfs_wal_read(log, r->rel, rec->path_len, pos);
+    if (ret)
+        return ret;
+    r->rel[rec->path_len] = '\0';
+    /* 只接受 dentry_path_raw 生成的那种绝对路径 */
+    if (r->rel[0] != '/' || strstr(r->rel, "/../") ||
+        strlen(r->rel) != rec->path_len)
+        return -EBADMSG;
+
+    tmp = *rec;
+    tmp.crc = 0;
+    crc = crc32c(~0, &tmp, sizeof(tmp));
+    crc = crc32c(crc, r->rel, rec->path_len);
+    for (len = rec->len; len > 0; ) {
+        size_t chunk = min_t(u64, len, PAGE_SIZE);
+
+        ret = ramfs_wal_read(log, r->buf, chunk, pos);
+        if (ret)
+            return ret;
+        crc = crc32c(crc, r->buf, chunk);
+        len -= chunk;
+    }
+
+    return crc == rec->crc ? 0 : -EBADMSG;
+}
+
+static int ramfs_wal_close_target(struct ramfs_wal_replay *r)
+{
+    int ret;
+
+    if (!r->target)
+        return 0;
+    ret = vfs_fsync(r->target, 1);
+    filp_close(r->target, NULL);
+    r->target = NULL;
+    return ret;
+}
+
+static int ramfs_wal_open_target(struct ramfs_wal_replay *r)
+{
+    struct file *target;
+    bool created = false;
+    char *name;
+    int ret;
+
+    ret = ramfs_wal_close_target(r);
+    if (ret)
+        return ret;
+
+    snprintf(r->dir, PATH_MAX, "%s%s", r->sync_dir, r->rel);
+    name = strrchr(r->dir, '/');
+    *name++ = '\0';
+
+    ret = ramfs_mkdir_p(r->dir);
+    if (ret)
+        return ret;
+    /* 先完成上一次中断的增量刷盘，再在它之上叠加更新的记录 */
+    ret = ramfs_journal_recover(r->dir, name, r->path, r->buf);
+    if (ret)
+        return ret;
+
+    snprintf(r->path, PATH_MAX, "%s/%s", r->dir, name);
+    target = filp_open(r->path, O_WRONLY | O_LARGEFILE, 0);
+    if (IS_ERR(target) && PTR_ERR(target) == -ENOENT) {
+        target = filp_open(r->path, O_WRONLY | O_CREAT | O_LARGEFILE, 0666);
+        created = true;
+    }
+    if (IS_ERR(target))
+        return PTR_ERR(target);
+    /* 镜像要被改写了，校验和文件作废 */
+    ramfs_csum_drop(r->dir, name);
+
+    /* 新建的镜像要让目录项也落盘 */
+    if (created) {
+        ret = ramfs_fsync_dir(r->dir);
+        if (ret) {
+            filp_close(target, NULL);
+            return ret;
+        }
+    }
+
+    r->target = target;
+    strscpy(r->target_rel, r->rel, PATH_MAX);
+    return 0;
+}
+
+static int ramfs_wal_apply(struct ramfs_wal_replay *r, struct file *log,
+                           const struct ramfs_wal_record *rec, loff_t data_pos)
+{
+    loff_t out_pos = rec->offset;
+    int ret;
+
+    /* 日志里同一文件的记录通常挨在一起，镜像保持打开 */
+    if (!r->target || strcmp(r->target_rel, r->rel)) {
+        ret = ramfs_wal_open_target(r);
+        if (ret)
+            return ret;
+    }
+
+    if (rec->type == RAMFS_WAL_WRITE) {
+        ret = ramfs_splice_range(log, &data_pos, r->target, &out_pos, rec->len);
+        if (ret)
+            return ret;
+    }
+
+    if (i_size_read(file_inode(r->target)) != rec->size)
+        return vfs_truncate(&r->target->f_path, rec->size);
+    return 0;
+}
+
+static int ramfs_wal_replay_log(struct ramfs_wal_replay *r, struct file *log,
+                                int *nr)
+{
+    struct ramfs_wal_record rec;
+    loff_t pos = sizeof(struct ramfs_wal_header);
+    int ret;
+
+    for (;;) {
+        ret = ramfs_wal_check(r, log, &rec, &pos);
+        /* 没写完或没校验过的尾巴是崩溃前还没 fsync 的部分 */
+        if (ret == -ENODATA || ret == -EBADMSG)
+            return 0;
+        if (ret)
+            return ret;
+
+        ret = ramfs_wal_apply(r, log, &rec, pos - rec.len);
+        if (ret) {
+            pr_err("RAMfs: Failed to replay log record for %s: %d\n",
+                   r->rel, ret);
+            return ret;
+        }
+        (*nr)++;
+        cond_resched();
+    }
+}
+
+/**
+ * ramfs_wal_replay - 把同步目录里残留的日志合并进镜像
+ * @sync_dir: 同步目录
+ *
+ * 绑定同步目录时调用；所有镜像 fsync 之后才清空日志，
+ * 中途失败或再次崩溃都可以从头再回放一遍
+ * 返回0表示成功（包括没有日志），负数表示错误码
+ */
+int ramfs_wal_replay(const char *sync_dir)
+{
+    struct ramfs_wal_replay r = { .sync_dir = sync_dir };
+    struct ramfs_wal_header hdr[2] = {};
+    struct file *log[2] = {};
+    int i, idx, nr = 0, ret = 0, err;
+
+    for (i = 0; i < 2; i++) {
+        loff_t pos = 0;
+
+        log[i] = ramfs_wal_open_log(sync_dir, i, O_RDWR);
+        if (IS_ERR(log[i])) {
+            if (PTR_ERR(log[i]) != -ENOENT)
+                ret = PTR_ERR(log[i]);
+            log[i] = NULL;
+            continue;
+        }
+        /* 没有合法 header 的日志里不可能有提交过的记录 */
+        if (ramfs_wal_read(log[i], &hdr[i], sizeof(hdr[i]), &pos) ||
+            hdr[i].magic != RAMFS_WAL_MAGIC)
+            hdr[i].gen = 0;
+    }
+    if (ret || (!hdr[0].gen && !hdr[1].gen))
+        goto out_close;
+
+    r.target_rel = kmalloc(PATH_MAX, GFP_KERNEL);
+    r.rel = kmalloc(PATH_MAX, GFP_KERNEL);
+    r.dir = kmalloc(PATH_MAX, GFP_KERNEL);
+    r.path = kmalloc(PATH_MAX, GFP_KERNEL);
+    r.buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (!r.target_rel || !r.rel || !r.dir || !r.path || !r.buf) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    /* 先回放较旧的一份 */
+    idx = hdr[0].gen <= hdr[1].gen ? 0 : 1;
+    for (i = 0; i < 2 && !ret; i++, idx = !idx)
+        if (hdr[idx].gen)
+            ret = ramfs_wal_replay_log(&r, log[idx], &nr);
+
+    err = ramfs_wal_close_target(&r);
+    if (!ret)
+        ret = err;
+
+    for (i = 0; i < 2 && !ret; i++)
+        if (log[i])
+            ret = vfs_truncate(&log[i]->f_path, 0);
+    if (!ret && nr)
+        pr_info("RAMfs: Replayed %d log records in %s\n", nr, sync_dir);
+
+out_free:
+    kfree(r.buf);
+    kfree(r.path);
+    kfree(r.dir);
+    kfree(r.rel);
+    kfree(r.target_rel);
+out_close:
+    for (i = 0; i < 2; i++)
+        if (log[i])
+            filp_close(log[i], NULL);
+    return ret;
+}
@@ -0,0 +1,383 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ramfs 的 user.* 扩展属性
+ *
+ * 每个 inode 一棵按名字排序的红黑树，一个文件上有几千个属性时查找也是
+ * O(log n)；listxattr 按名字顺序输出。树由 xattr_sem 保护，用读写信号量
+ * 是因为刷盘要拿着读锁把属性逐个 vfs_setxattr 到镜像上。
+ *
+ * 持久化：属性直接设在同步目录里的镜像上（后端文件系统要支持 user.*
+ * 属性，ext4、xfs 都可以）。整文件刷盘设在 tmp 镜像上，和数据一起 rename；
+ * 增量刷盘只在属性改过之后同步一遍，镜像上多出来的 user.* 属性删掉。
+ * 预热挂载建文件时从镜像读回来
+ */
+
+#include <linux/fs.h>
+#include <linux/xattr.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include "internal.h"
+
+struct ramfs_xattr {
+    struct rb_node node;
+    char *name;		/* 不含 "user." 前缀 */
+    size_t size;
+    char value[];
+};
+
+static struct ramfs_xattr *ramfs_xattr_lookup(struct rb_root *root,
+                                              const char *name)
+{
+    struct rb_node *n = root->rb_node;
+
+    while (n) {
+        struct ramfs_xattr *x = rb_entry(n, struct ramfs_xattr, node);
+        int cmp = strcmp(name, x->name);
+
+        if (cmp < 0)
+            n = n->rb_left;
+        else if (cmp > 0)
+            n = n->rb_right;
+        else
+            return x;
+    }
+    return NULL;
+}
+
+/* 插入 new，同名的旧属性被替换并返回 */
+static struct ramfs_xattr *ramfs_xattr_insert(struct rb_root *root,
+                                              struct ramfs_xattr *new)
+{
+    struct rb_node **p = &root->rb_node, *parent = NULL;
+
+    while (*p) {
+        struct ramfs_xattr *x = rb_entry(*p, struct ramfs_xattr, node);
+        int cmp = strcmp(new->name, x->name);
+
+        parent = *p;
+        if (cmp < 0) {
+            p = &(*p)->rb_left;
+        } else if (cmp > 0) {
+            p = &(*p)->rb_right;
+        } else {
+            rb_replace_node(&x->node, &new->node, root);
+            return x;
+        }
+    }
+    rb_link_node(&new->node, parent, p);
+    rb_insert_color(&new->node, root);
+    return NULL;
+}
+
+static void ramfs_xattr_free(struct ramfs_xattr *x)
+{
+    if (!x)
+        return;
+    kfree(x->name);
+    kvfree(x);
+}
+
+/* 一个属性记账的字节数，x 为空时是0 */
+static long ramfs_xattr_bytes(const struct ramfs_xattr *x)
+{
+    return x ? struct_size(x, value, x->size) + strlen(x->name) + 1 : 0;
+}
+
+static struct ramfs_xattr *ramfs_xattr_alloc(const char *name,
+                                             const void *value, size_t size)
+{
+    struct ramfs_xattr *x;
+
+    x = kvmalloc(struct_size(x, value, size), GFP_KERNEL);
+    if (!x)
+        return NULL;
+    x->name = kstrdup(name, GFP_KERNEL);
+    if (!x->name) {
+        kvfree(x);
+        return NULL;
+    }
+    x->size = size;
+    memcpy(x->value, value, size);
+    return x;
+}
+
+/**
+ * ramfs_xattr_set - 设置或删除（value 为 NULL）一个属性
+ * @inode: ramfs inode
+ * @name: 不含 "user." 前缀的名字
+ * @value: 属性值
+ * @size: 长度
+ * @flags: XATTR_CREATE / XATTR_REPLACE
+ * @force: 为真时不检查 size=，预热载入用
+ *
+ * 不标记脏，预热载入也用它；名字和值都算进 size= 的用量
+ * 返回0表示成功，-ENOSPC 表示超出 size=，其他负数表示错误码
+ */
+static int ramfs_xattr_set(struct inode *inode, const char *name,
+                           const void *value, size_t size, int flags,
+                           bool force)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_xattr *new = NULL, *old;
+    int ret = 0;
+
+    if (value) {
+        new = ramfs_xattr_alloc(name, value, size);
+        if (!new)
+            return -ENOMEM;
+    }
+
+    down_write(&ri->xattr_sem);
+    old = ramfs_xattr_lookup(&ri->xattrs, name);
+    if (old && (flags & XATTR_CREATE)) {
+        ret = -EEXIST;
+    } else if (!old && (flags & XATTR_REPLACE)) {
+        ret = -ENODATA;
+    } else if (!old && !new) {
+        ret = -ENODATA;
+    } else {
+        ret = ramfs_charge_xattr(inode, ramfs_xattr_bytes(new) -
+                                        ramfs_xattr_bytes(old), force);
+    }
+    if (!ret && new) {
+        ramfs_xattr_insert(&ri->xattrs, new);
+        new = NULL;
+    } else if (!ret) {
+        rb_erase(&old->node, &ri->xattrs);
+    }
+    if (ret)
+        old = NULL;
+    up_write(&ri->xattr_sem);
+
+    ramfs_xattr_free(old);
+    ramfs_xattr_free(new);
+    return ret;
+}
+
+static int ramfs_xattr_user_get(const struct xattr_handler *handler,
+                                struct dentry *unused, struct inode *inode,
+                                const char *name, void *buffer, size_t size)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_xattr *x;
+    int ret;
+
+    down_read(&ri->xattr_sem);
+    x = ramfs_xattr_lookup(&ri->xattrs, name);
+    if (!x) {
+        ret = -ENODATA;
+    } else {
+        ret = x->size;
+        if (buffer) {
+            if (size < x->size)
+                ret = -ERANGE;
+            else
+                memcpy(buffer, x->value, x->size);
+        }
+    }
+    up_read(&ri->xattr_sem);
+    return ret;
+}
+
+static int ramfs_xattr_user_set(const struct xattr_handler *handler,
+                                struct user_namespace *mnt_userns,
+                                struct dentry *unused, struct inode *inode,
+                                const char *name, const void *value,
+                                size_t size, int flags)
+{
+    int ret;
+
+    ret = ramfs_xattr_set(inode, name, value, size, flags, false);
+    if (!ret) {
+        inode->i_ctime = current_time(inode);
+        /* 下一次刷盘把属性同步到镜像上；日志里没有属性，fsync 不能只同步日志 */
+        set_bit(RAMFS_I_XATTR_DIRTY, &RAMFS_I(inode)->flags);
+        set_bit(RAMFS_I_WAL_BYPASS, &RAMFS_I(inode)->flags);
+        ramfs_inode_dirtied(inode);
+    }
+    return ret;
+}
+
+static const struct xattr_handler ramfs_user_xattr_handler = {
+    .prefix = XATTR_USER_PREFIX,
+    .get = ramfs_xattr_user_get,
+    .set = ramfs_xattr_user_set,
+};
+
+const struct xattr_handler *ramfs_xattr_handlers[] = {
+    &ramfs_user_xattr_handler,
+    NULL
+};
+
+ssize_t ramfs_listxattr(struct dentry *dentry, char *buffer, size_t size)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(d_inode(dentry));
+    struct rb_node *n;
+    ssize_t total = 0;
+
+    down_read(&ri->xattr_sem);
+    for (n = rb_first(&ri->xattrs); n; n = rb_next(n)) {
+        struct ramfs_xattr *x = rb_entry(n, struct ramfs_xattr, node);
+        size_t len = XATTR_USER_PREFIX_LEN + strlen(x->name) + 1;
+
+        if (buffer) {
+            if (total + len > size) {
+                total = -ERANGE;
+                break;
+            }
+            memcpy(buffer + total, XATTR_USER_PREFIX, XATTR_USER_PREFIX_LEN);
+            memcpy(buffer + total + XATTR_USER_PREFIX_LEN, x->name,
+                   len - XATTR_USER_PREFIX_LEN);
+        }
+        total += len;
+    }
+    up_read(&ri->xattr_sem);
+    return total;
+}
+
+void ramfs_xattr_evict(struct inode *inode)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct ramfs_xattr *x, *tmp;
+
+    rbtree_postorder_for_each_entry_safe(x, tmp, &ri->xattrs, node)
+        ramfs_xattr_free(x);
+    ri->xattrs = RB_ROOT;
+    ramfs_charge_xattr(inode, -(long)ri->xattr_bytes, true);
+}
+
+bool ramfs_xattr_present(struct inode *inode)
+{
+    return !RB_EMPTY_ROOT(&RAMFS_I(inode)->xattrs);
+}
+
+/* 镜像上的 user.* 属性名列表，调用者 kvfree */
+static ssize_t ramfs_xattr_list_backing(struct dentry *dentry, char **out)
+{
+    ssize_t len;
+    char *buf;
+
+    *out = NULL;
+    for (;;) {
+        len = vfs_listxattr(dentry, NULL, 0);
+        if (len <= 0)
+            return len;
+        buf = kvmalloc(len, GFP_KERNEL);
+        if (!buf)
+            return -ENOMEM;
+        len = vfs_listxattr(dentry, buf, len);
+        /* 两次调用之间被改过，重来 */
+        if (len == -ERANGE) {
+            kvfree(buf);
+            continue;
+        }
+        if (len < 0) {
+            kvfree(buf);
+            return len;
+        }
+        *out = buf;
+        return len;
+    }
+}
+
+static char *ramfs_xattr_full_name(const char *name)
+{
+    return kasprintf(GFP_KERNEL, XATTR_USER_PREFIX "%s", name);
+}
+
+/**
+ * ramfs_xattr_persist - 把 inode 的属性同步到镜像上
+ * @inode: ramfs 文件
+ * @img: 同步目录里的镜像
+ *
+ * 以刷盘发起者的身份调用，镜像的 fsync 由调用者做
+ * 后端文件系统不支持 user.* 属性时只警告一次，返回0
+ * 返回0表示成功，负数表示错误码
+ */
+int ramfs_xattr_persist(struct inode *inode, struct file *img)
+{
+    struct ramfs_inode_info *ri = RAMFS_I(inode);
+    struct user_namespace *mnt_userns = file_mnt_user_ns(img);
+    struct dentry *dentry = file_dentry(img);
+    struct rb_node *n;
+    char *list, *p, *full;
+    ssize_t len;
+    int ret = 0;
+
+    down_read(&ri->xattr_sem);
+
+    /* 删掉 ramfs 里已经没有的 */
+    len = ramfs_xattr_list_backing(dentry, &list);
+    if (len < 0) {
+        ret = len;
+        goto out;
+    }
+    for (p = list; p < list + len && !ret; p += strlen(p) + 1) {
+        if (strncmp(p, XATTR_USER_PREFIX, XATTR_USER_PREFIX_LEN) ||
+            ramfs_xattr_lookup(&ri->xattrs, p + XATTR_USER_PREFIX_LEN))
+            continue;
+        ret = vfs_removexattr(mnt_userns, dentry, p);
+        if (ret == -ENODATA)
+            ret = 0;
+    }
+    kvfree(list);
+
+    for (n = rb_first(&ri->xattrs); n && !ret; n = rb_next(n)) {
+        struct ramfs_xattr *x = rb_entry(n, struct ramfs_xattr, node);
+
+        full = ramfs_xattr_full_name(x->name);
+        if (!full) {
+            ret = -ENOMEM;
+            break;
+        }
+        ret = vfs_setxattr(mnt_userns, dentry, full, x->value, x->size, 0);
+        kfree(full);
+        cond_resched();
+    }
+
+out:
+    up_read(&ri->xattr_sem);
+    if (ret == -EOPNOTSUPP) {
+        pr_warn_once("RAMfs: Sync dir does not support user xattrs, not persisting them\n");
+        ret = 0;
+    }
+    return ret;
+}
+
+/**
+ * ramfs_xattr_load - 预热挂载时从镜像读回属性
+ * @inode: 刚建好的 ramfs 文件
+ * @path: 镜像路径
+ *
+ * 读不回来的属性跳过，不影响挂载
+ */
+void ramfs_xattr_load(struct inode *inode, const char *path)
+{
+    struct path img;
+    char *list, *p;
+    void *value;
+    ssize_t len, size;
+
+    if (kern_path(path, 0, &img))
+        return;
+    len = ramfs_xattr_list_backing(img.dentry, &list);
+    for (p = list; len > 0 && p < list + len; p += strlen(p) + 1) {
+        if (strncmp(p, XATTR_USER_PREFIX, XATTR_USER_PREFIX_LEN))
+            continue;
+        size = vfs_getxattr(mnt_user_ns(img.mnt), img.dentry, p, NULL, 0);
+        if (size < 0)
+            continue;
+        value = kvmalloc(size ?: 1, GFP_KERNEL);
+        if (!value)
+            break;
+        size = vfs_getxattr(mnt_user_ns(img.mnt), img.dentry, p, value, size);
+        if (size >= 0)
+            ramfs_xattr_set(inode, p + XATTR_USER_PREFIX_LEN, value, size,
+                            0, true);
+        kvfree(value);
+    }
+    kvfree(list);
+    path_put(&img);
+}
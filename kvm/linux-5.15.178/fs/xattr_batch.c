@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * xattr_batch(2)：一次调用读写一个文件的多个扩展属性
+ *
+ * listxattr 两次再逐个 getxattr 两次，导出 N 个属性要 2N+2 次系统调用、
+ * N 次路径查找，属性之间也不是同一时刻的值。这里路径只解析一次，
+ * 读时持有 inode 读锁、写时持有 inode 写锁把所有属性一次做完。
+ * 缓冲区格式见 include/uapi/linux/xattr_batch.h
+ */
+
+#include <linux/kernel.h>
+#include <linux/syscalls.h>
+#include <linux/fs.h>
+#include <linux/fcntl.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/uaccess.h>
+#include <linux/xattr.h>
+#include <linux/posix_acl_xattr.h>
+#include <linux/security.h>
+#include <linux/xattr_batch.h>
+
+static bool xattr_batch_is_acl(const char *name)
+{
+    return !strcmp(name, XATTR_NAME_POSIX_ACL_ACCESS) ||
+           !strcmp(name, XATTR_NAME_POSIX_ACL_DEFAULT);
+}
+
+static size_t xattr_batch_ent_size(const struct xattr_batch_ent *ent)
+{
+    return XATTR_BATCH_ENT_SIZE((size_t)ent->name_len, (size_t)ent->value_len);
+}
+
+/*
+ * 调用前整体校验一遍用户给的列表，格式不对时什么也不做
+ * 返回0表示成功，负数表示错误码
+ */
+static int xattr_batch_check(const char *kbuf, size_t size, unsigned int op)
+{
+    const struct xattr_batch_ent *ent;
+    size_t pos;
+
+    for (pos = 0; pos < size; pos += xattr_batch_ent_size(ent)) {
+        ent = (const void *)(kbuf + pos);
+        if (size - pos < sizeof(*ent))
+            return -EINVAL;
+        if (!ent->name_len || ent->name_len > XATTR_NAME_MAX + 1)
+            return -ERANGE;
+        if (ent->value_len > XATTR_BATCH_MAX ||
+            xattr_batch_ent_size(ent) > size - pos)
+            return -EINVAL;
+        if (strnlen(ent->data, ent->name_len) != ent->name_len - 1)
+            return -EINVAL;
+        if (op != XATTR_BATCH_SET)
+            continue;
+        if (ent->flags & ~(XATTR_CREATE | XATTR_REPLACE | XATTR_BATCH_REMOVE))
+            return -EINVAL;
+        if (ent->value_len > XATTR_SIZE_MAX)
+            return -E2BIG;
+    }
+    return 0;
+}
+
+/* 和 getxattr(2) 一样，size 为 0 时只返回值的长度 */
+static ssize_t xattr_batch_getone(struct user_namespace *mnt_userns,
+                                  struct dentry *d, const char *name,
+                                  void *value, size_t size)
+{
+    ssize_t ret;
+
+    size = min_t(size_t, size, XATTR_SIZE_MAX);
+    ret = vfs_getxattr(mnt_userns, d, name, size ? value : NULL, size);
+    if (ret > 0 && size && xattr_batch_is_acl(name))
+        posix_acl_fix_xattr_to_user(mnt_userns, value, ret);
+    return ret;
+}
+
+/*
+ * 和 setxattr(2) 一样把 ACL 里的 uid/gid 转换过来。转换是原地进行的，
+ * 不能重复做，所以在拿 inode 锁之前对整个列表做一遍，
+ * 等 NFS 委托后的重试和 ESTALE 重试都不会再碰这些值
+ */
+static void xattr_batch_fix_acls(struct user_namespace *mnt_userns,
+                                 char *kbuf, size_t size)
+{
+    struct xattr_batch_ent *ent;
+    size_t pos;
+
+    for (pos = 0; pos < size; pos += xattr_batch_ent_size(ent)) {
+        ent = (void *)(kbuf + pos);
+        if (!(ent->flags & XATTR_BATCH_REMOVE) && ent->value_len &&
+            xattr_batch_is_acl(ent->data))
+            posix_acl_fix_xattr_from_user(mnt_userns,
+                                          ent->data + ent->name_len,
+                                          ent->value_len);
+    }
+}
+
+/*
+ * 和 setxattr(2) 一样转换 file capability，ACL 已经由 xattr_batch_fix_acls
+ * 转换过；调用者持有 inode 锁
+ */
+static int xattr_batch_setone(struct user_namespace *mnt_userns,
+                              struct dentry *d, struct xattr_batch_ent *ent,
+                              struct inode **delegated_inode)
+{
+    const char *name = ent->data;
+    void *value = ent->data + ent->name_len, *caps = NULL;
+    size_t size = ent->value_len;
+    int ret;
+
+    /* cap_convert_nscap 可能换掉并释放值，给它一份单独的拷贝 */
+    if (size && !strcmp(name, XATTR_NAME_CAPS)) {
+        caps = kmemdup(value, size, GFP_KERNEL);
+        if (!caps)
+            return -ENOMEM;
+        ret = cap_convert_nscap(mnt_userns, d, (const void **)&caps, size);
+        if (ret < 0)
+            goto out;
+        value = caps;
+        size = ret;
+    }
+    ret = __vfs_setxattr_locked(mnt_userns, d, name, value, size,
+                                ent->flags, delegated_inode);
+out:
+    kvfree(caps);
+    return ret;
+}
+
+/* 返回成功读到的个数 */
+static long xattr_batch_get(struct user_namespace *mnt_userns, struct dentry *d,
+                            char *kbuf, size_t size)
+{
+    struct inode *inode = d_inode(d);
+    struct xattr_batch_ent *ent;
+    size_t pos;
+    long ok = 0;
+
+    inode_lock_shared(inode);
+    for (pos = 0; pos < size; pos += xattr_batch_ent_size(ent)) {
+        ent = (void *)(kbuf + pos);
+        ent->result = xattr_batch_getone(mnt_userns, d, ent->data,
+                                         ent->data + ent->name_len,
+                                         ent->value_len);
+        if (ent->result >= 0)
+            ok++;
+    }
+    inode_unlock_shared(inode);
+    return ok;
+}
+
+/*
+ * 名字和值都由内核填写
+ * 返回写出的字节数；ubuf 不够大时返回 -ERANGE，size 为 0 时返回需要的大小
+ */
+static long xattr_batch_get_all(struct user_namespace *mnt_userns,
+                                struct dentry *d, void __user *ubuf,
+                                size_t size)
+{
+    struct inode *inode = d_inode(d);
+    struct xattr_batch_ent *ent;
+    char *names = NULL, *name, *kbuf = NULL;
+    size_t total = 0, hdr, len, room;
+    ssize_t names_len, vlen;
+    long ret;
+
+    size = min_t(size_t, size, XATTR_BATCH_MAX);
+    if (size) {
+        kbuf = kvzalloc(size, GFP_KERNEL);
+        if (!kbuf)
+            return -ENOMEM;
+    }
+
+    /* 持有读锁期间没人能改属性，两次 listxattr 的结果一样 */
+    inode_lock_shared(inode);
+    names_len = vfs_listxattr(d, NULL, 0);
+    if (names_len <= 0) {
+        ret = names_len;
+        goto out_unlock;
+    }
+    names = kvmalloc(names_len, GFP_KERNEL);
+    if (!names) {
+        ret = -ENOMEM;
+        goto out_unlock;
+    }
+    names_len = vfs_listxattr(d, names, names_len);
+    if (names_len < 0) {
+        ret = names_len;
+        goto out_unlock;
+    }
+
+    ret = 0;
+    for (name = names; name < names + names_len; name += strlen(name) + 1) {
+        hdr = sizeof(*ent) + strlen(name) + 1;
+        /* 值直接读到它在输出里的位置，放不下时只问长度 */
+        room = kbuf && total + hdr < size ? size - total - hdr : 0;
+        vlen = room ? xattr_batch_getone(mnt_userns, d, name,
+                                         kbuf + total + hdr, room) : -ERANGE;
+        if (vlen == -ERANGE)
+            vlen = vfs_getxattr(mnt_userns, d, name, NULL, 0);
+
+        len = XATTR_BATCH_ENT_SIZE(hdr - sizeof(*ent), max_t(ssize_t, vlen, 0));
+        if (kbuf && total + len > size) {
+            ret = -ERANGE;
+            break;
+        }
+        if (kbuf) {
+            ent = (void *)(kbuf + total);
+            ent->name_len = hdr - sizeof(*ent);
+            ent->value_len = max_t(ssize_t, vlen, 0);
+            ent->flags = 0;
+            ent->result = vlen;
+            memcpy(ent->data, name, ent->name_len);
+        }
+        total += len;
+        if (total > XATTR_BATCH_MAX) {
+            ret = -E2BIG;
+            break;
+        }
+    }
+
+out_unlock:
+    inode_unlock_shared(inode);
+    if (!ret) {
+        ret = total;
+        if (kbuf && copy_to_user(ubuf, kbuf, total))
+            ret = -EFAULT;
+    }
+    kvfree(names);
+    kvfree(kbuf);
+    return ret;
+}
+
+/* 返回成功写入的个数 */
+static long xattr_batch_set(const struct path *path, char *kbuf, size_t size)
+{
+    struct user_namespace *mnt_userns = mnt_user_ns(path->mnt);
+    struct dentry *d = path->dentry;
+    struct inode *inode = d_inode(d), *delegated_inode = NULL;
+    struct xattr_batch_ent *ent;
+    size_t pos = 0;
+    long ok = 0;
+    int ret;
+
+    ret = mnt_want_write(path->mnt);
+    if (ret)
+        return ret;
+retry_deleg:
+    inode_lock(inode);
+    while (pos < size) {
+        ent = (void *)(kbuf + pos);
+        if (ent->flags & XATTR_BATCH_REMOVE)
+            ret = __vfs_removexattr_locked(mnt_userns, d, ent->data,
+                                           &delegated_inode);
+        else
+            ret = xattr_batch_setone(mnt_userns, d, ent, &delegated_inode);
+        /* 要先收回 NFS 委托，放掉锁等它，再从这一项接着做 */
+        if (delegated_inode) {
+            inode_unlock(inode);
+            ret = break_deleg_wait(&delegated_inode);
+            if (ret)
+                goto out;
+            goto retry_deleg;
+        }
+        ent->result = ret;
+        if (!ret)
+            ok++;
+        pos += xattr_batch_ent_size(ent);
+    }
+    inode_unlock(inode);
+    ret = 0;
+out:
+    mnt_drop_write(path->mnt);
+    return ret ?: ok;
+}
+
+/* SET 时值可能被改写过（ACL 转换），只把 result 拷回去 */
+static int xattr_batch_put_results(char __user *ubuf, const char *kbuf,
+                                   size_t size)
+{
+    const struct xattr_batch_ent *ent;
+    struct xattr_batch_ent __user *uent;
+    size_t pos;
+
+    for (pos = 0; pos < size; pos += xattr_batch_ent_size(ent)) {
+        ent = (const void *)(kbuf + pos);
+        uent = (void __user *)(ubuf + pos);
+        if (put_user(ent->result, &uent->result))
+            return -EFAULT;
+    }
+    return 0;
+}
+
+/**
+ * sys_xattr_batch - 一次读写一个文件的多个扩展属性
+ * @dfd: 和 *at 系列一样，pathname 的起点；AT_EMPTY_PATH 时就是目标文件
+ * @pathname: 文件路径
+ * @at_flags: AT_SYMLINK_NOFOLLOW / AT_EMPTY_PATH
+ * @op: XATTR_BATCH_GET_ALL / XATTR_BATCH_GET / XATTR_BATCH_SET
+ * @buf: struct xattr_batch_ent 列表
+ * @size: buf 的长度，GET 和 SET 时必须正好是列表的长度
+ *
+ * GET 和 SET 逐项在 result 里报告结果，单项失败不影响其他项
+ * 返回：GET_ALL 返回写出（或需要）的字节数，GET 和 SET 返回成功的项数，
+ * 失败返回负的错误码
+ */
+SYSCALL_DEFINE6(xattr_batch, int, dfd, const char __user *, pathname,
+                unsigned int, at_flags, unsigned int, op,
+                void __user *, buf, size_t, size)
+{
+    unsigned int lookup_flags = 0;
+    bool acls_fixed = false;
+    struct path path;
+    char *kbuf = NULL;
+    long ret;
+
+    if (at_flags & ~(AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH))
+        return -EINVAL;
+    if (op > XATTR_BATCH_SET)
+        return -EINVAL;
+    if (!(at_flags & AT_SYMLINK_NOFOLLOW))
+        lookup_flags |= LOOKUP_FOLLOW;
+    if (at_flags & AT_EMPTY_PATH)
+        lookup_flags |= LOOKUP_EMPTY;
+
+    if (op != XATTR_BATCH_GET_ALL) {
+        if (!size)
+            return 0;
+        if (size > XATTR_BATCH_MAX)
+            return -E2BIG;
+        kbuf = vmemdup_user(buf, size);
+        if (IS_ERR(kbuf))
+            return PTR_ERR(kbuf);
+        ret = xattr_batch_check(kbuf, size, op);
+        if (ret)
+            goto out_free;
+    }
+
+retry:
+    ret = user_path_at(dfd, pathname, lookup_flags, &path);
+    if (ret)
+        goto out_free;
+    switch (op) {
+    case XATTR_BATCH_GET_ALL:
+        ret = xattr_batch_get_all(mnt_user_ns(path.mnt), path.dentry,
+                                  buf, size);
+        break;
+    case XATTR_BATCH_GET:
+        ret = xattr_batch_get(mnt_user_ns(path.mnt), path.dentry, kbuf, size);
+        break;
+    case XATTR_BATCH_SET:
+        if (!acls_fixed) {
+            xattr_batch_fix_acls(mnt_user_ns(path.mnt), kbuf, size);
+            acls_fixed = true;
+        }
+        ret = xattr_batch_set(&path, kbuf, size);
+        break;
+    }
+    path_put(&path);
+    if (retry_estale(ret, lookup_flags)) {
+        lookup_flags |= LOOKUP_REVAL;
+        goto retry;
+    }
+
+    if (ret >= 0 && op == XATTR_BATCH_GET && copy_to_user(buf, kbuf, size))
+        ret = -EFAULT;
+    if (ret >= 0 && op == XATTR_BATCH_SET &&
+        xattr_batch_put_results(buf, kbuf, size))
+        ret = -EFAULT;
+out_free:
+    kvfree(kbuf);
+    return ret;
+}
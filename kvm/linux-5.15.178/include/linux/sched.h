@@ -65,6 +65,7 @@ struct sched_param;
 struct seq_file;
 struct sighand_struct;
 struct signal_struct;
+struct sock_fair_group;
 struct task_delay_info;
 struct task_group;
 
@@ -741,6 +742,14 @@ struct task_struct {
 	int max_socket_allowed;  
 	int priority_level;       
 	int socket_count;
+	/* 线程组的 socket 计数，只有组长的非空，见 linux/socket_fairness.h */
+	struct sock_fair_group *sock_group;
+	/*
+	 * socket 创建速率，configure_socket_rate 设置，只用组长的，
+	 * sock_rate 为 0 表示不限；令牌桶在 sock_group 里
+	 */
+	unsigned int sock_rate;
+	unsigned int sock_burst;
     
 	void				*stack;
 	refcount_t			usage;
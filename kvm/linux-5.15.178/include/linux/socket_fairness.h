@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Socket 公平性：configure_socket_fairness 设置的限制在 socket 路径上的落实
+ *
+ * 计数按线程组：socket 属于 fd 表，线程 A 创建、线程 B 关闭很常见，
+ * 按线程计数会漂移。限制取创建者线程自己的 max_socket_allowed（0 表示不限）。
+ *
+ * 速率（configure_socket_rate）：每个线程组一个令牌桶，每秒补 rate 个、
+ * 最多攒 burst 个，拿不到令牌的创建返回 -EAGAIN，计入 SocketThrottled。
+ * 数量上限挡不住短时间内反复建了又关的连接风暴，端口和内存会先耗尽。
+ * 桶按线程组而不是按线程，否则多开几个线程就能成倍地拿到 burst。
+ *
+ * 容器里的进程来来去去，按 pid 设置不方便，所以还有一层 sockets cgroup
+ * 控制器（kernel/cgroup/sockets.c）：socket 同时计到创建者所在的 cgroup
+ * 及其所有祖先上，任何一层超过 sockets.max 都失败。两层限制都要满足。
+ *
+ * 计过的账户存在 struct socket 的 fair_acct 里，调用点在 net/socket.c：
+ *   __sys_socket 在 sock_create 之前计数，__sys_socketpair 两个都建好以后
+ *   各计一次，do_accept 在 sock_alloc 之后马上计数；失败时返回错误，
+ *   已经建好的 socket 随 sock_release 退回计数。
+ *   __sock_release 里 sock_fair_uncharge(&sock->fair_acct)。
+ *   __sys_socket 在 sock_create 之后、do_accept 在 ops->accept 之后调用
+ *   sock_fair_init_sock 设置 sk_priority。
+ * 内核内部创建的 socket（sock_create_kern）不计数。
+ *
+ * priority_level 映射到 sk_priority（TC_PRIO_*），出包的 skb->priority
+ * 由协议栈从 sk_priority 带上。默认的 pfifo_fast 和不带 priomap 的 prio
+ * qdisc 用同一张 prio2band 表，三档各进一个 band，高档先出队：
+ *
+ * 线程没有设置 priority_level 时用所在 cgroup 的 sockets.priority。
+ *
+ *   priority_level   sk_priority                band
+ *   0                不改（TC_PRIO_BESTEFFORT）   1
+ *   1 - 24           TC_PRIO_BULK               2
+ *   25 - 74          TC_PRIO_INTERACTIVE_BULK   1
+ *   75 及以上        TC_PRIO_INTERACTIVE        0
+ *
+ * mqprio 设备用 "map 1 2 2 2 1 2 0 0 1 1 1 1 1 1 1 1" 得到同样的分档。
+ * 不映射到 TC_PRIO_CONTROL 及以上：那几档 SO_PRIORITY 要 CAP_NET_ADMIN，
+ * 而线程可以不带特权给自己设 priority_level。
+ *
+ * 按优先级唤醒（/proc/sys/kernel/sock_fair_wakeup，默认关）：很多线程
+ * 阻塞在同一个监听 socket 的 accept 或同一个 epoll 的 epoll_wait 上时，
+ * 互斥等待者默认先来先醒。打开后按入队时的等级（同上，线程没设就用
+ * cgroup 的）从高到低排队，同级仍然先来先醒，新连接先交给高等级的线程。
+ * 非互斥的等待者（poll、不带 EPOLLEXCLUSIVE 的 epoll 回调）照旧排在前面
+ * 全部唤醒；没走这里入队的互斥等待者按等级 0 算。等待期间改等级要到
+ * 下一次入队才生效。调用点：
+ *   net/ipv4/inet_connection_sock.c  inet_csk_wait_for_connect 用
+ *                                    sock_fair_prepare_to_wait_exclusive
+ *   fs/eventpoll.c                   ep_poll 用 __sock_fair_add_wait_exclusive
+ */
+#ifndef _LINUX_SOCKET_FAIRNESS_H
+#define _LINUX_SOCKET_FAIRNESS_H
+
+#include <linux/atomic.h>
+#include <linux/rcupdate.h>
+#include <linux/time64.h>
+#include <linux/types.h>
+
+struct task_struct;
+struct seq_file;
+struct sock;
+struct sock_fair_cgroup;
+struct wait_queue_head;
+struct wait_queue_entry;
+
+/*
+ * 入队时的等级记在 wait_queue_entry->flags 的高 16 位，SOCK_FAIR_WQ_FLAG
+ * 表示这几位有效。不能和 linux/wait.h 里的 WQ_FLAG_* 重叠
+ */
+#define SOCK_FAIR_WQ_FLAG	0x100
+#define SOCK_FAIR_WQ_SHIFT	16
+#define SOCK_FAIR_WQ_MASK	(~0U << SOCK_FAIR_WQ_SHIFT)
+
+/*
+ * 线程组的 socket 账户，挂在组长的 task_struct->sock_group 上，第一次
+ * 创建 socket 时分配。组长持有一个引用，每个计了数的 socket 持有一个，
+ * 所以组长还在时 ref - 1 就是打开的 socket 数；socket 可能比进程活得久
+ * （SCM_RIGHTS 传出去），最后一个引用放掉时释放。
+ * 组长的 task_struct->socket_count 是这个数的快照，组里的线程计数、
+ * 退计数时顺手更新，在组外关掉的 socket 要等组里下一次计数才反映出来。
+ *
+ * 创建速率的令牌桶也在这里，速率和容量取组长的 sock_rate、sock_burst。
+ */
+struct sock_fair_group {
+	atomic_t		ref;
+	atomic64_t		rate_tat;	/* GCRA 的理论到达时间，纳秒 */
+	atomic64_t		rate_throttled;	/* 因为没有令牌失败的次数 */
+	struct rcu_head		rcu;
+};
+
+/* 一个 socket 计过数的账户，释放时原样退回，跟之后在哪个进程、哪个 cgroup 无关 */
+struct sock_fair_acct {
+	struct sock_fair_group	*group;
+	struct sock_fair_cgroup	*cg;
+};
+
+/* configure_socket_rate 的上限：burst * 每个令牌的纳秒数不能溢出 */
+#define SOCK_FAIR_RATE_MAX	NSEC_PER_SEC
+#define SOCK_FAIR_BURST_MAX	(1U << 20)
+
+extern int sock_fair_charge(struct sock_fair_acct *acct);
+extern void sock_fair_uncharge(struct sock_fair_acct *acct);
+extern void sock_fair_task_free(struct task_struct *tsk);
+extern void proc_sock_fair_status(struct seq_file *m, struct task_struct *task);
+extern u32 sock_fair_sk_priority(int priority_level);
+extern void sock_fair_init_sock(struct sock *sk);
+extern void __sock_fair_add_wait_exclusive(struct wait_queue_head *wq_head,
+					   struct wait_queue_entry *wq_entry);
+extern bool sock_fair_prepare_to_wait_exclusive(struct wait_queue_head *wq_head,
+						struct wait_queue_entry *wq_entry,
+						int state);
+
+#ifdef CONFIG_CGROUP_SOCKETS
+extern struct sock_fair_cgroup *sock_fair_cg_charge(void);
+extern void sock_fair_cg_uncharge(struct sock_fair_cgroup *cg);
+extern int sock_fair_cg_priority(struct task_struct *task);
+#else
+static inline struct sock_fair_cgroup *sock_fair_cg_charge(void)
+{
+	return NULL;
+}
+static inline void sock_fair_cg_uncharge(struct sock_fair_cgroup *cg) { }
+static inline int sock_fair_cg_priority(struct task_struct *task)
+{
+	return 0;
+}
+#endif
+
+#endif /* _LINUX_SOCKET_FAIRNESS_H */
@@ -373,6 +373,11 @@ asmlinkage long sys_lremovexattr(const char __user *path,
 				 const char __user *name);
 asmlinkage long sys_fremovexattr(int fd, const char __user *name);
 
+/* fs/xattr_batch.c */
+asmlinkage long sys_xattr_batch(int dfd, const char __user *pathname,
+				unsigned int at_flags, unsigned int op,
+				void __user *buf, size_t size);
+
 /* fs/dcache.c */
 asmlinkage long sys_getcwd(char __user *buf, unsigned long size);
 
@@ -793,6 +798,10 @@ asmlinkage long sys_sysinfo(struct sysinfo __user *info);
 asmlinkage long sys_write_kv(int k, int v);
 asmlinkage long sys_read_kv(int k);
 
+/* kernel/configure_socket_fairness.c */
+asmlinkage long sys_configure_socket_rate(pid_t pid, unsigned int rate,
+					  unsigned int burst);
+
 /* ipc/mqueue.c */
 asmlinkage long sys_mq_open(const char __user *name, int oflag, umode_t mode, struct mq_attr __user *attr);
 asmlinkage long sys_mq_unlink(const char __user *name);
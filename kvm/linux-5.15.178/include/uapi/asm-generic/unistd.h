@@ -888,8 +888,14 @@ __SYSCALL(__NR_read_kv, sys_read_kv)
 #define __NR_configure_socket_fairness 451
 __SYSCALL(__NR_configure_socket_fairness, sys_configure_socket_fairness)
 
+#define __NR_xattr_batch 452
+__SYSCALL(__NR_xattr_batch, sys_xattr_batch)
+
+#define __NR_configure_socket_rate 453
+__SYSCALL(__NR_configure_socket_rate, sys_configure_socket_rate)
+
 #undef __NR_syscalls
-#define __NR_syscalls 452
+#define __NR_syscalls 454
 
 /*
  * 32 bit systems traditionally used different
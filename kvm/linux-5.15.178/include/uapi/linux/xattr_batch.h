@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * xattr_batch(2)：一次系统调用读写一个文件的多个扩展属性
+ *
+ * 缓冲区是一串 struct xattr_batch_ent，每项后面依次是名字（含结尾 '\0'，
+ * 长度 name_len）和值（长度 value_len），整项补齐到 8 字节，
+ * 下一项从 XATTR_BATCH_ENT_SIZE(ent) 处开始。
+ */
+#ifndef _UAPI_LINUX_XATTR_BATCH_H
+#define _UAPI_LINUX_XATTR_BATCH_H
+
+#include <linux/types.h>
+
+/* op */
+#define XATTR_BATCH_GET_ALL	0	/* 输出所有属性；size 为 0 时只返回需要的长度 */
+#define XATTR_BATCH_GET		1	/* 读给定的名字，value_len 是值缓冲区大小 */
+#define XATTR_BATCH_SET		2	/* 写给定的名字 */
+
+/* xattr_batch_ent->flags，SET 时有效，另外两个取值和 setxattr 一样 */
+#define XATTR_BATCH_REMOVE	0x4	/* 删除这个属性，忽略值 */
+
+struct xattr_batch_ent {
+	__u32	name_len;	/* 含结尾 '\0' */
+	__u32	value_len;	/* 值所占空间，GET_ALL 时由内核填写 */
+	__u32	flags;		/* XATTR_CREATE / XATTR_REPLACE / XATTR_BATCH_REMOVE */
+	__s32	result;		/* 出参：GET 为值的实际长度，SET 为0，出错为负的错误码 */
+	char	data[];
+};
+
+#define XATTR_BATCH_ALIGN	8
+#define XATTR_BATCH_ENT_SIZE(name_len, value_len)			\
+	((sizeof(struct xattr_batch_ent) + (name_len) + (value_len) +	\
+	  XATTR_BATCH_ALIGN - 1) & ~(XATTR_BATCH_ALIGN - 1))
+
+/* 一次调用的缓冲区上限 */
+#define XATTR_BATCH_MAX		(16 << 20)
+
+#endif /* _UAPI_LINUX_XATTR_BATCH_H */
@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sockets 控制器：按 cgroup 限制 socket 数、给组里的线程一个默认优先级
+ *
+ *   sockets.max       本层及所有子孙一共能打开的 socket 数，"max" 表示不限
+ *   sockets.priority  没有自己设置 priority_level 的线程新建 socket 时用的等级，
+ *                     0 表示沿用上一层
+ *   sockets.current   本层及所有子孙计了的数（含各 CPU 上预留的余量）
+ *   sockets.events    max：因为某一层达到上限而创建失败的次数
+ *
+ * 计数是分层的：计到一个 cgroup 上，沿途每个祖先都要加，任何一层超过
+ * sockets.max 就失败。为了不让一个容器里所有 CPU 都去抢同一串计数器，
+ * 学 memcg 的 stock：每个 CPU 缓存一个 cgroup 已经计好、还没用掉的余量，
+ * 一次沿层级批量计 SOCK_FAIR_CHARGE_BATCH 个，之后的创建和关闭只动本
+ * CPU 的缓存。sockets.current 因此最多多算 nr_cpus * SOCK_FAIR_CHARGE_BATCH；
+ * 批量计失败时先按 1 个重试，再把各 CPU 的余量退回后重试，所以不会因为
+ * 余量被别的 CPU 占着而提前失败。
+ *
+ * 接入：
+ *   include/linux/cgroup_subsys.h  SUBSYS(sockets)，由 CONFIG_CGROUP_SOCKETS 控制
+ *   init/Kconfig                   config CGROUP_SOCKETS，在 CGROUP_PIDS 旁边
+ *   kernel/cgroup/Makefile         obj-$(CONFIG_CGROUP_SOCKETS) += sockets.o
+ */
+
+#include <linux/kernel.h>
+#include <linux/cgroup.h>
+#include <linux/err.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/socket_fairness.h>
+
+#define SOCK_FAIR_CHARGE_BATCH	32
+#define SOCK_FAIR_MAX		LONG_MAX
+#define SOCK_FAIR_MAX_STR	"max"
+
+struct sock_fair_cgroup {
+	struct cgroup_subsys_state	css;
+
+	atomic_long_t			usage;
+	long				max;
+	int				priority;
+
+	atomic64_t			events_max;
+	struct cgroup_file		events_file;
+};
+
+/* 每个 CPU 的余量：在 cached 及其祖先上已经计了、还没分给 socket 的 nr 个 */
+struct sock_fair_stock {
+	spinlock_t			lock;
+	struct sock_fair_cgroup		*cached;
+	unsigned int			nr;
+};
+
+static DEFINE_PER_CPU(struct sock_fair_stock, sock_fair_stock) = {
+	.lock	= __SPIN_LOCK_UNLOCKED(sock_fair_stock.lock),
+};
+
+static struct sock_fair_cgroup *css_sock_fair(struct cgroup_subsys_state *css)
+{
+	return container_of(css, struct sock_fair_cgroup, css);
+}
+
+static struct sock_fair_cgroup *parent_sock_fair(struct sock_fair_cgroup *cg)
+{
+	return cg->css.parent ? css_sock_fair(cg->css.parent) : NULL;
+}
+
+static struct cgroup_subsys_state *
+sockets_css_alloc(struct cgroup_subsys_state *parent)
+{
+    struct sock_fair_cgroup *cg;
+
+    cg = kzalloc(sizeof(*cg), GFP_KERNEL);
+    if (!cg)
+        return ERR_PTR(-ENOMEM);
+
+    cg->max = SOCK_FAIR_MAX;
+    atomic_long_set(&cg->usage, 0);
+    atomic64_set(&cg->events_max, 0);
+    return &cg->css;
+}
+
+static void sockets_css_free(struct cgroup_subsys_state *css)
+{
+    kfree(css_sock_fair(css));
+}
+
+static void sock_fair_cancel(struct sock_fair_cgroup *cg, long nr)
+{
+    /* 退多了说明哪里少计或多退了一次 */
+    WARN_ON_ONCE(atomic_long_add_negative(-nr, &cg->usage));
+}
+
+static void sock_fair_uncharge_hier(struct sock_fair_cgroup *cg, long nr)
+{
+    for (; cg; cg = parent_sock_fair(cg))
+        sock_fair_cancel(cg, nr);
+}
+
+/*
+ * 从 cg 往上逐层加 nr，某一层超过 sockets.max 就把已经加上的退回，
+ * 并用 *fail 带回超限的那一层
+ */
+static int sock_fair_try_charge_hier(struct sock_fair_cgroup *cg, long nr,
+                                     struct sock_fair_cgroup **fail)
+{
+    struct sock_fair_cgroup *p, *q;
+
+    for (p = cg; p; p = parent_sock_fair(p)) {
+        long new = atomic_long_add_return(nr, &p->usage);
+
+        if (new > READ_ONCE(p->max)) {
+            *fail = p;
+            goto revert;
+        }
+    }
+    return 0;
+
+revert:
+    for (q = cg; q != p; q = parent_sock_fair(q))
+        sock_fair_cancel(q, nr);
+    sock_fair_cancel(p, nr);
+    return -EMFILE;
+}
+
+/* 把一个 CPU 的余量退回层级，调用者持有 stock->lock */
+static void drain_stock(struct sock_fair_stock *stock)
+{
+    struct sock_fair_cgroup *old = stock->cached;
+
+    if (!old)
+        return;
+    if (stock->nr)
+        sock_fair_uncharge_hier(old, stock->nr);
+    css_put(&old->css);
+    stock->cached = NULL;
+    stock->nr = 0;
+}
+
+static bool consume_stock(struct sock_fair_cgroup *cg)
+{
+    struct sock_fair_stock *stock;
+    unsigned long flags;
+    bool ret = false;
+
+    stock = get_cpu_ptr(&sock_fair_stock);
+    spin_lock_irqsave(&stock->lock, flags);
+    if (stock->cached == cg && stock->nr) {
+        stock->nr--;
+        ret = true;
+    }
+    spin_unlock_irqrestore(&stock->lock, flags);
+    put_cpu_ptr(&sock_fair_stock);
+    return ret;
+}
+
+/* 把 nr 个已经计好的数放进本 CPU 的余量，本 CPU 原来缓存的别的 cgroup 先退回 */
+static void refill_stock(struct sock_fair_cgroup *cg, unsigned int nr)
+{
+    struct sock_fair_stock *stock;
+    unsigned long flags;
+
+    stock = get_cpu_ptr(&sock_fair_stock);
+    spin_lock_irqsave(&stock->lock, flags);
+    if (stock->cached != cg) {
+        drain_stock(stock);
+        css_get(&cg->css);
+        stock->cached = cg;
+    }
+    stock->nr += nr;
+    if (stock->nr > SOCK_FAIR_CHARGE_BATCH)
+        drain_stock(stock);
+    spin_unlock_irqrestore(&stock->lock, flags);
+    put_cpu_ptr(&sock_fair_stock);
+}
+
+/*
+ * 退回所有缓存了 root 或其子孙的 CPU 余量。只在计数失败、改 sockets.max
+ * 和 cgroup 下线时走到，所以直接逐个 CPU 拿锁，不用 per-CPU work
+ */
+static void drain_all_stock(struct sock_fair_cgroup *root)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct sock_fair_stock *stock = per_cpu_ptr(&sock_fair_stock, cpu);
+        unsigned long flags;
+
+        spin_lock_irqsave(&stock->lock, flags);
+        if (stock->cached &&
+            cgroup_is_descendant(stock->cached->css.cgroup, root->css.cgroup))
+            drain_stock(stock);
+        spin_unlock_irqrestore(&stock->lock, flags);
+    }
+}
+
+/**
+ * sock_fair_cg_charge - 给当前线程所在的 cgroup 计一个 socket
+ *
+ * 返回：计上的 cgroup，带一个引用，由 sock_fair_cg_uncharge 放掉；
+ * 某一层达到 sockets.max 返回 ERR_PTR(-EMFILE)
+ */
+struct sock_fair_cgroup *sock_fair_cg_charge(void)
+{
+    struct sock_fair_cgroup *cg, *fail;
+    unsigned int batch = SOCK_FAIR_CHARGE_BATCH;
+    bool drained = false;
+
+    cg = css_sock_fair(task_get_css(current, sockets_cgrp_id));
+    if (consume_stock(cg))
+        return cg;
+
+    while (sock_fair_try_charge_hier(cg, batch, &fail)) {
+        if (batch > 1) {
+            /* 差不到一批，不要让余量挡住最后几个 */
+            batch = 1;
+            continue;
+        }
+        if (!drained) {
+            drain_all_stock(fail);
+            drained = true;
+            continue;
+        }
+        atomic64_inc(&fail->events_max);
+        cgroup_file_notify(&fail->events_file);
+        css_put(&cg->css);
+        return ERR_PTR(-EMFILE);
+    }
+
+    if (batch > 1)
+        refill_stock(cg, batch - 1);
+    return cg;
+}
+
+/**
+ * sock_fair_cg_uncharge - 退回 sock_fair_cg_charge 计的数
+ * @cg: sock_fair_cg_charge 的返回值
+ *
+ * 退到本 CPU 的余量里，下一个在这个 cgroup 里创建的 socket 直接拿走；
+ * cgroup 正在删除时直接退回层级，免得余量把它拖住
+ */
+void sock_fair_cg_uncharge(struct sock_fair_cgroup *cg)
+{
+    if (unlikely(css_is_dying(&cg->css)))
+        sock_fair_uncharge_hier(cg, 1);
+    else
+        refill_stock(cg, 1);
+    css_put(&cg->css);
+}
+
+/**
+ * sock_fair_cg_priority - task 所在 cgroup 的默认优先级
+ * @task: 目标线程
+ *
+ * 返回：从 task 所在的 cgroup 往上第一个非 0 的 sockets.priority，都没设返回 0
+ */
+int sock_fair_cg_priority(struct task_struct *task)
+{
+    struct sock_fair_cgroup *cg;
+    int level = 0;
+
+    rcu_read_lock();
+    for (cg = css_sock_fair(task_css(task, sockets_cgrp_id));
+         cg && !level; cg = parent_sock_fair(cg))
+        level = READ_ONCE(cg->priority);
+    rcu_read_unlock();
+    return level;
+}
+
+static void sockets_css_offline(struct cgroup_subsys_state *css)
+{
+    drain_all_stock(css_sock_fair(css));
+}
+
+static int sockets_max_show(struct seq_file *sf, void *v)
+{
+    long max = READ_ONCE(css_sock_fair(seq_css(sf))->max);
+
+    if (max >= SOCK_FAIR_MAX)
+        seq_printf(sf, "%s\n", SOCK_FAIR_MAX_STR);
+    else
+        seq_printf(sf, "%ld\n", max);
+    return 0;
+}
+
+static ssize_t sockets_max_write(struct kernfs_open_file *of, char *buf,
+                                 size_t nbytes, loff_t off)
+{
+    struct sock_fair_cgroup *cg = css_sock_fair(of_css(of));
+    long max;
+    int err;
+
+    buf = strstrip(buf);
+    if (!strcmp(buf, SOCK_FAIR_MAX_STR)) {
+        max = SOCK_FAIR_MAX;
+    } else {
+        err = kstrtol(buf, 0, &max);
+        if (err)
+            return err;
+        if (max < 0 || max >= SOCK_FAIR_MAX)
+            return -EINVAL;
+    }
+
+    WRITE_ONCE(cg->max, max);
+    /* 余量已经算在 usage 里，收紧上限后不该由它们占着名额 */
+    drain_all_stock(cg);
+    return nbytes;
+}
+
+static s64 sockets_current_read(struct cgroup_subsys_state *css,
+                                struct cftype *cft)
+{
+    return atomic_long_read(&css_sock_fair(css)->usage);
+}
+
+static s64 sockets_priority_read(struct cgroup_subsys_state *css,
+                                 struct cftype *cft)
+{
+    return READ_ONCE(css_sock_fair(css)->priority);
+}
+
+static int sockets_priority_write(struct cgroup_subsys_state *css,
+                                  struct cftype *cft, s64 val)
+{
+    /* 跟 configure_socket_fairness 一样只拒绝负数 */
+    if (val < 0 || val > INT_MAX)
+        return -EINVAL;
+    WRITE_ONCE(css_sock_fair(css)->priority, val);
+    return 0;
+}
+
+static int sockets_events_show(struct seq_file *sf, void *v)
+{
+    struct sock_fair_cgroup *cg = css_sock_fair(seq_css(sf));
+
+    seq_printf(sf, "max %lld\n", (s64)atomic64_read(&cg->events_max));
+    return 0;
+}
+
+static struct cftype sockets_files[] = {
+	{
+		.name = "max",
+		.write = sockets_max_write,
+		.seq_show = sockets_max_show,
+		.flags = CFTYPE_NOT_ON_ROOT,
+	},
+	{
+		.name = "priority",
+		.read_s64 = sockets_priority_read,
+		.write_s64 = sockets_priority_write,
+		.flags = CFTYPE_NOT_ON_ROOT,
+	},
+	{
+		.name = "current",
+		.read_s64 = sockets_current_read,
+		.flags = CFTYPE_NOT_ON_ROOT,
+	},
+	{
+		.name = "events",
+		.seq_show = sockets_events_show,
+		.file_offset = offsetof(struct sock_fair_cgroup, events_file),
+		.flags = CFTYPE_NOT_ON_ROOT,
+	},
+	{ }	/* terminate */
+};
+
+struct cgroup_subsys sockets_cgrp_subsys = {
+	.css_alloc	= sockets_css_alloc,
+	.css_offline	= sockets_css_offline,
+	.css_free	= sockets_css_free,
+	.legacy_cftypes	= sockets_files,
+	.dfl_cftypes	= sockets_files,
+	.threaded	= true,
+};
@@ -1,4 +1,5 @@
 #include <linux/kernel.h>
+#include <linux/err.h>
 #include <linux/syscalls.h>
 #include <linux/sched.h>
 #include <linux/sched/task.h>
@@ -7,6 +8,15 @@
 #include <linux/cred.h>
 #include <linux/capability.h>
 #include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include <linux/wait.h>
+#include <linux/sysctl.h>
+#include <linux/jump_label.h>
+#include <linux/math64.h>
+#include <linux/timekeeping.h>
+#include <linux/socket_fairness.h>
+#include <linux/pkt_sched.h>
+#include <net/sock.h>
 
 /**
  * sys_configure_socket_fairness - 为特定进程配置Socket级别的公平管理策略
@@ -51,3 +61,397 @@ SYSCALL_DEFINE3(configure_socket_fairness, pid_t, pid,
     rcu_read_unlock();
     return ret;
 }
+
+/**
+ * sys_configure_socket_rate - 限制进程创建socket的速率
+ * @pid: 进程里任意一个线程的ID
+ * @rate: 每秒补充的令牌数，0 表示不限
+ * @burst: 桶的容量，即空闲之后最多能连续创建的个数；rate 为 0 时忽略
+ *
+ * 设置的是整个线程组：组里所有线程共用一个桶，多开线程拿不到更多令牌。
+ * 之后 fork 出来的进程沿用同样的速率，但有自己的桶。
+ * 重新设置会把桶装满，SocketThrottled 计数不清零
+ * 返回：成功时返回0，失败返回负的错误码
+ */
+SYSCALL_DEFINE3(configure_socket_rate, pid_t, pid,
+                unsigned int, rate, unsigned int, burst)
+{
+    struct task_struct *task, *leader;
+    struct sock_fair_group *grp;
+
+    if (rate > SOCK_FAIR_RATE_MAX)
+        return -EINVAL;
+    if (rate && (!burst || burst > SOCK_FAIR_BURST_MAX))
+        return -EINVAL;
+    if (!rate)
+        burst = 0;
+
+    rcu_read_lock();
+    task = find_task_by_vpid(pid);
+    if (!task) {
+        rcu_read_unlock();
+        return -ESRCH;
+    }
+
+    /* 和 configure_socket_fairness 一样：特权进程或者同一个线程组 */
+    if (!capable(CAP_SYS_ADMIN) &&
+        !same_thread_group(current, task)) {
+        rcu_read_unlock();
+        return -EPERM;
+    }
+
+    /*
+     * 速率存在组长上，桶在组长的 sock_group 里，还没分配的话第一次创建
+     * socket 时拿到的就是满桶。不加锁：创建路径只用 READ_ONCE 读，
+     * 换配置的瞬间按新旧哪套算都行
+     */
+    leader = task->group_leader;
+    WRITE_ONCE(leader->sock_burst, burst);
+    WRITE_ONCE(leader->sock_rate, rate);
+    grp = READ_ONCE(leader->sock_group);
+    if (grp)
+        atomic64_set(&grp->rate_tat, 0);
+
+    rcu_read_unlock();
+    return 0;
+}
+
+/*
+ * 从当前线程组的令牌桶里拿一个令牌，无锁，只有一次 cmpxchg。
+ *
+ * 桶按 GCRA 记：tat 是把已经发出的令牌按 1/rate 的间隔排下去以后，
+ * 最后一个的时刻。tat 不超过 now 表示桶是满的；拿一个令牌把 tat 往后推
+ * 一个间隔，推完以后超出 now 不到 burst 个间隔就放行。这和按时间补令牌
+ * 的桶是等价的，但只需要一个 64 位的量，用单调时钟的纳秒数
+ */
+static int sock_fair_rate_take(struct sock_fair_group *grp)
+{
+    struct task_struct *leader = current->group_leader;
+    unsigned int rate = READ_ONCE(leader->sock_rate);
+    unsigned int burst;
+    u64 interval, now, tat, base;
+
+    if (!rate)
+        return 0;
+    burst = max(READ_ONCE(leader->sock_burst), 1U);
+    interval = div_u64(NSEC_PER_SEC, rate);
+    now = ktime_get_ns();
+
+    tat = atomic64_read(&grp->rate_tat);
+    do {
+        base = max(tat, now);
+        if (base + interval - now > (u64)burst * interval) {
+            atomic64_inc(&grp->rate_throttled);
+            return -EAGAIN;
+        }
+    } while (!atomic64_try_cmpxchg(&grp->rate_tat, &tat, base + interval));
+
+    return 0;
+}
+
+/* 当前线程组的账户，第一次用到时分配；分配失败返回 NULL */
+static struct sock_fair_group *sock_fair_group(void)
+{
+    struct task_struct *leader = current->group_leader;
+    struct sock_fair_group *grp, *old;
+
+    grp = READ_ONCE(leader->sock_group);
+    if (likely(grp))
+        return grp;
+
+    grp = kmalloc(sizeof(*grp), GFP_KERNEL);
+    if (!grp)
+        return NULL;
+    atomic_set(&grp->ref, 1);   /* 组长的引用，free_task 时放掉 */
+    atomic64_set(&grp->rate_tat, 0);
+    atomic64_set(&grp->rate_throttled, 0);
+
+    /* 同组的另一个线程可能同时在分配 */
+    old = cmpxchg(&leader->sock_group, NULL, grp);
+    if (old) {
+        kfree(grp);
+        return old;
+    }
+    return grp;
+}
+
+/*
+ * 把线程组的计数抄到组长的 socket_count 上。只在当前线程属于这个组时抄：
+ * 组长的 task_struct 在组里还有线程时一直有效，组外（SCM_RIGHTS 传走、
+ * 内核线程里的延迟 fput）就留给组里下一次计数
+ */
+static void sock_fair_group_sync(struct sock_fair_group *grp)
+{
+    struct task_struct *leader = current->group_leader;
+
+    if (grp && READ_ONCE(leader->sock_group) == grp)
+        WRITE_ONCE(leader->socket_count, max(atomic_read(&grp->ref) - 1, 0));
+}
+
+static void sock_fair_group_put(struct sock_fair_group *grp)
+{
+    if (grp && atomic_dec_and_test(&grp->ref))
+        kfree_rcu(grp, rcu);
+}
+
+/*
+ * 给当前线程组计数，无锁：只有一次 cmpxchg，不限制时也照样计数，
+ * 供 /proc/<pid>/status 显示
+ */
+static int sock_fair_group_charge(struct sock_fair_group *grp)
+{
+    int max = READ_ONCE(current->max_socket_allowed);
+    int ref;
+
+    /* ref - 1 是已经打开的 socket 数 */
+    ref = atomic_read(&grp->ref);
+    do {
+        if (max && ref - 1 >= max)
+            return -EMFILE;
+    } while (!atomic_try_cmpxchg(&grp->ref, &ref, ref + 1));
+
+    sock_fair_group_sync(grp);
+    return 0;
+}
+
+/**
+ * sock_fair_charge - 新建 socket 之前给当前线程组和所在 cgroup 计数
+ * @acct: 成功时存放计了数的账户，由 sock_fair_uncharge 退回
+ *
+ * 返回：成功返回0，超过 configure_socket_rate 的速率返回 -EAGAIN，
+ * 达到 max_socket_allowed 或某一层 sockets.max 返回 -EMFILE，
+ * 设置了限制但账户分配失败返回 -ENOBUFS
+ */
+int sock_fair_charge(struct sock_fair_acct *acct)
+{
+    struct sock_fair_group *grp;
+    struct sock_fair_cgroup *cg;
+    int ret;
+
+    acct->group = NULL;
+    acct->cg = NULL;
+    grp = sock_fair_group();
+    if (grp) {
+        /* 先看速率：风暴里大部分请求在这里就被挡掉，不去碰计数和 cgroup */
+        ret = sock_fair_rate_take(grp);
+        if (ret)
+            return ret;
+        ret = sock_fair_group_charge(grp);
+        if (ret)
+            return ret;
+        acct->group = grp;
+    } else if (READ_ONCE(current->max_socket_allowed) ||
+               READ_ONCE(current->group_leader->sock_rate)) {
+        return -ENOBUFS;
+    }
+
+    cg = sock_fair_cg_charge();
+    if (IS_ERR(cg)) {
+        sock_fair_group_put(acct->group);
+        acct->group = NULL;
+        return PTR_ERR(cg);
+    }
+    acct->cg = cg;
+    return 0;
+}
+
+/**
+ * sock_fair_uncharge - socket 释放时退掉计数
+ * @acct: sock_fair_charge 填好的账户，没计过数的成员为 NULL
+ *
+ * 可能在别的进程里调用（socket 被 SCM_RIGHTS 传走），也可能在线程组退出、
+ * 创建者换了 cgroup 之后
+ */
+void sock_fair_uncharge(struct sock_fair_acct *acct)
+{
+    struct sock_fair_group *grp = acct->group;
+
+    /*
+     * 在组里退计数时组长的引用还在，put 不会释放 grp，sync 之后仍可用；
+     * 在组外退计数 sync 什么也不做，只看指针不解引用
+     */
+    sock_fair_group_put(grp);
+    sock_fair_group_sync(grp);
+    acct->group = NULL;
+    if (acct->cg) {
+        sock_fair_cg_uncharge(acct->cg);
+        acct->cg = NULL;
+    }
+}
+
+/* free_task 调用：组长放掉它的引用，组里的其他线程没有账户 */
+void sock_fair_task_free(struct task_struct *tsk)
+{
+    sock_fair_group_put(tsk->sock_group);
+    tsk->sock_group = NULL;
+}
+
+/**
+ * sock_fair_sk_priority - priority_level 对应的 sk_priority
+ * @priority_level: configure_socket_fairness 设置的等级
+ *
+ * 分档见 linux/socket_fairness.h
+ */
+u32 sock_fair_sk_priority(int priority_level)
+{
+    if (priority_level >= 75)
+        return TC_PRIO_INTERACTIVE;
+    if (priority_level >= 25)
+        return TC_PRIO_INTERACTIVE_BULK;
+    if (priority_level > 0)
+        return TC_PRIO_BULK;
+    return TC_PRIO_BESTEFFORT;
+}
+
+/**
+ * sock_fair_init_sock - 新 socket 继承创建者线程的优先级
+ * @sk: 刚创建（或 accept 得到）的 sock
+ *
+ * 线程没设置 priority_level 时用所在 cgroup 的 sockets.priority；两个都没有
+ * 就不改 sk_priority，accept 出来的 sock 保留从监听 sock 继承的值。
+ * 之后 SO_PRIORITY 照常可以覆盖
+ */
+void sock_fair_init_sock(struct sock *sk)
+{
+    int level = READ_ONCE(current->priority_level);
+
+    if (!level)
+        level = sock_fair_cg_priority(current);
+
+    if (level)
+        WRITE_ONCE(sk->sk_priority, sock_fair_sk_priority(level));
+}
+
+/* /proc/sys/kernel/sock_fair_wakeup，关着的时候入队路径只多一条 nop */
+static DEFINE_STATIC_KEY_FALSE(sock_fair_wakeup_key);
+
+static struct ctl_table sock_fair_sysctls[] = {
+	{
+		.procname	= "sock_fair_wakeup",
+		.data		= &sock_fair_wakeup_key.key,
+		.mode		= 0644,
+		.proc_handler	= proc_do_static_key,
+	},
+	{ }
+};
+
+static int __init sock_fair_sysctl_init(void)
+{
+    register_sysctl("kernel", sock_fair_sysctls);
+    return 0;
+}
+late_initcall(sock_fair_sysctl_init);
+
+static unsigned int sock_fair_wq_level(struct wait_queue_entry *wq_entry)
+{
+    if (!(wq_entry->flags & SOCK_FAIR_WQ_FLAG))
+        return 0;
+    return wq_entry->flags >> SOCK_FAIR_WQ_SHIFT;
+}
+
+/*
+ * 从队尾往前找，越过等级比自己低的互斥等待者，所以队列里互斥等待者
+ * 按等级从高到低、同级按入队先后排列，__wake_up_common 从队头唤醒时
+ * 先醒的就是等级最高、等得最久的那个。只越过比自己低的，一般高等级
+ * 线程少，走几步就停。调用者持有队列的锁
+ */
+static void sock_fair_enqueue(struct wait_queue_head *wq_head,
+                              struct wait_queue_entry *wq_entry)
+{
+    struct wait_queue_entry *curr;
+    struct list_head *pos = &wq_head->head;
+    unsigned int level;
+
+    level = READ_ONCE(current->priority_level);
+    if (!level)
+        level = sock_fair_cg_priority(current);
+    level = min_t(unsigned int, level, SOCK_FAIR_WQ_MASK >> SOCK_FAIR_WQ_SHIFT);
+    wq_entry->flags &= ~SOCK_FAIR_WQ_MASK;
+    wq_entry->flags |= WQ_FLAG_EXCLUSIVE | SOCK_FAIR_WQ_FLAG |
+                       (level << SOCK_FAIR_WQ_SHIFT);
+
+    list_for_each_entry_reverse(curr, &wq_head->head, entry) {
+        if (!(curr->flags & WQ_FLAG_EXCLUSIVE) ||
+            sock_fair_wq_level(curr) >= level) {
+            pos = &curr->entry;
+            break;
+        }
+    }
+    list_add(&wq_entry->entry, pos);
+}
+
+/**
+ * __sock_fair_add_wait_exclusive - 按当前线程的等级把互斥等待者放进队列
+ * @wq_head: 等待队列，调用者持有保护它的锁
+ * @wq_entry: 当前线程的等待项
+ *
+ * 没打开 sock_fair_wakeup 时就是 __add_wait_queue_exclusive，
+ * 放在队头（epoll 原来就是后来先醒）
+ */
+void __sock_fair_add_wait_exclusive(struct wait_queue_head *wq_head,
+                                    struct wait_queue_entry *wq_entry)
+{
+    if (static_branch_unlikely(&sock_fair_wakeup_key))
+        sock_fair_enqueue(wq_head, wq_entry);
+    else
+        __add_wait_queue_exclusive(wq_head, wq_entry);
+}
+
+/**
+ * sock_fair_prepare_to_wait_exclusive - 按等级排队的 prepare_to_wait_exclusive
+ * @wq_head: 等待队列
+ * @wq_entry: 当前线程的等待项
+ * @state: 睡眠状态
+ *
+ * 没打开 sock_fair_wakeup 时和 prepare_to_wait_exclusive 一样放在队尾
+ * 返回：这次是否新入队时队列为空，和 prepare_to_wait_exclusive 一样
+ */
+bool sock_fair_prepare_to_wait_exclusive(struct wait_queue_head *wq_head,
+                                         struct wait_queue_entry *wq_entry,
+                                         int state)
+{
+    unsigned long flags;
+    bool was_empty = false;
+
+    spin_lock_irqsave(&wq_head->lock, flags);
+    if (list_empty(&wq_entry->entry)) {
+        was_empty = list_empty(&wq_head->head);
+        if (static_branch_unlikely(&sock_fair_wakeup_key)) {
+            sock_fair_enqueue(wq_head, wq_entry);
+        } else {
+            wq_entry->flags |= WQ_FLAG_EXCLUSIVE;
+            __add_wait_queue_entry_tail(wq_head, wq_entry);
+        }
+    }
+    set_current_state(state);
+    spin_unlock_irqrestore(&wq_head->lock, flags);
+    return was_empty;
+}
+
+/* /proc/<pid>/status 里的 Socket 行，proc_pid_status 调用 */
+void proc_sock_fair_status(struct seq_file *m, struct task_struct *task)
+{
+    struct task_struct *leader;
+    struct sock_fair_group *grp;
+    unsigned int rate, burst;
+    u64 throttled = 0;
+    int count = 0;
+
+    rcu_read_lock();
+    leader = task->group_leader;
+    rate = READ_ONCE(leader->sock_rate);
+    burst = READ_ONCE(leader->sock_burst);
+    grp = READ_ONCE(leader->sock_group);
+    if (grp) {
+        count = max(atomic_read(&grp->ref) - 1, 0);
+        throttled = atomic64_read(&grp->rate_throttled);
+    }
+    rcu_read_unlock();
+
+    seq_printf(m, "SocketMax:\t%d\n", READ_ONCE(task->max_socket_allowed));
+    seq_printf(m, "SocketPriority:\t%d\n", READ_ONCE(task->priority_level));
+    seq_printf(m, "SocketCount:\t%d\n", count);
+    seq_printf(m, "SocketRate:\t%u\n", rate);
+    seq_printf(m, "SocketBurst:\t%u\n", burst);
+    seq_printf(m, "SocketThrottled:\t%llu\n", (unsigned long long)throttled);
+}
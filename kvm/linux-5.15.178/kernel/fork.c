@@ -98,6 +98,7 @@
 #include <linux/io_uring.h>
 #include <linux/bpf.h>
 #include <linux/tick.h>
+#include <linux/socket_fairness.h>
 
 #include <asm/pgalloc.h>
 #include <linux/uaccess.h>
@@ -512,6 +513,7 @@ void free_task(struct task_struct *tsk)
 	if (tsk->flags & PF_KTHREAD)
 		free_kthread_struct(tsk);
 	bpf_task_storage_free(tsk);
+	sock_fair_task_free(tsk);
 	free_task_struct(tsk);
 }
 EXPORT_SYMBOL(free_task);
@@ -2109,6 +2111,13 @@ static __latent_entropy struct task_struct *copy_process(
 	p->max_socket_allowed = 0;    
 	p->priority_level = 0;
     p->socket_count = 0;     
+    p->sock_group = NULL;     
+	/*
+	 * 速率只看组长的：新线程和组里其他线程共用一个桶。新进程沿用
+	 * 父进程所在线程组的速率，第一次创建 socket 时拿到自己的满桶
+	 */
+	p->sock_rate = READ_ONCE(current->group_leader->sock_rate);
+	p->sock_burst = READ_ONCE(current->group_leader->sock_burst);
 
 	retval = copy_creds(p, clone_flags);
 	if (retval < 0)
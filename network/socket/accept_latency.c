@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+
+/*
+ * 按优先级唤醒的 accept 时延测试：高、低两组线程阻塞在同一个监听 socket
+ * 的 accept（或 -e 时同一个 epoll 的 epoll_wait）上，客户端按固定间隔
+ * 连进来。每个连接从 connect 到被 accept 的时间记到接走它的那一组，
+ * 最后按组打印接走的份额和 p50/p99。
+ * /proc/sys/kernel/sock_fair_wakeup 可写时关、开各跑一轮
+ *
+ *   ./accept_latency [-e] [-H 高组线程数] [-L 低组线程数] [-n 连接数]
+ *                    [-i 连接间隔us] [-w 每个连接的处理时间us]
+ */
+
+#ifndef __NR_configure_socket_fairness
+#define __NR_configure_socket_fairness 451
+#endif
+
+#define WAKEUP_SYSCTL "/proc/sys/kernel/sock_fair_wakeup"
+#define MAX_THREADS 64
+
+enum { CLASS_HIGH, CLASS_LOW, NR_CLASSES };
+
+static const char *class_name[NR_CLASSES] = { "高", "低" };
+static int class_level[NR_CLASSES] = { 90, 10 };
+
+struct class_stats {
+    pthread_mutex_t lock;
+    double *lat;
+    int n;
+};
+
+static struct class_stats stats[NR_CLASSES];
+static int listen_fd, epoll_fd, use_epoll;
+static int work_us = 500;
+static atomic_int stop;
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int set_thread_socket_attrs(int max_sockets, int priority_level)
+{
+    pid_t tid = syscall(SYS_gettid);
+    int ret = syscall(__NR_configure_socket_fairness, tid, max_sockets, priority_level);
+    if (ret < 0) {
+        fprintf(stderr, "系统调用失败: %s (errno=%d)\n", strerror(errno), errno);
+    }
+    return ret;
+}
+
+/**
+ * 处理一个接进来的连接：读出客户端 connect 之前的时间戳，记时延，
+ * 再忙等 work_us 模拟处理请求
+ */
+static void handle(int fd, int cls)
+{
+    double t1 = now_us(), t0;
+    struct class_stats *s = &stats[cls];
+
+    if (read(fd, &t0, sizeof(t0)) == sizeof(t0)) {
+        pthread_mutex_lock(&s->lock);
+        s->lat[s->n++] = t1 - t0;
+        pthread_mutex_unlock(&s->lock);
+    }
+    close(fd);
+
+    while (now_us() - t1 < work_us)
+        ;
+}
+
+static void *acceptor(void *arg)
+{
+    int cls = (int)(long)arg;
+
+    set_thread_socket_attrs(0, class_level[cls]);
+    while (!atomic_load(&stop)) {
+        if (use_epoll) {
+            struct epoll_event ev;
+            /* 超时只是为了能看到 stop */
+            if (epoll_wait(epoll_fd, &ev, 1, 100) <= 0)
+                continue;
+        }
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;   /* EAGAIN（epoll 被别人抢先）或者 shutdown 之后 */
+        handle(fd, cls);
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double *v, int n, double p)
+{
+    int i = (int)(n * p);
+    return n ? v[i < n ? i : n - 1] : 0;
+}
+
+/**
+ * 跑一轮：建监听 socket 和两组线程，客户端连 count 次
+ */
+static void run_round(const char *title, int nthreads[NR_CLASSES],
+                      int count, int interval_us)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+    pthread_t threads[NR_CLASSES][MAX_THREADS];
+    int total = 0;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listen_fd = socket(AF_INET, SOCK_STREAM | (use_epoll ? SOCK_NONBLOCK : 0), 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 1024) < 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    if (use_epoll) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = listen_fd };
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+            perror("epoll");
+            exit(1);
+        }
+    }
+
+    for (int c = 0; c < NR_CLASSES; c++) {
+        stats[c].n = 0;
+        stats[c].lat = calloc(count, sizeof(double));
+        pthread_mutex_init(&stats[c].lock, NULL);
+    }
+    atomic_store(&stop, 0);
+    for (int c = 0; c < NR_CLASSES; c++)
+        for (int i = 0; i < nthreads[c]; i++)
+            pthread_create(&threads[c][i], NULL, acceptor, (void *)(long)c);
+    usleep(100 * 1000);     /* 等线程都睡进去 */
+
+    for (int i = 0; i < count; i++) {
+        double t0 = now_us();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            exit(1);
+        }
+        if (write(fd, &t0, sizeof(t0)) != sizeof(t0))
+            perror("write");
+        close(fd);
+        usleep(interval_us);
+    }
+    usleep(200 * 1000 + work_us);
+
+    atomic_store(&stop, 1);
+    shutdown(listen_fd, SHUT_RDWR);     /* 叫醒阻塞在 accept 里的线程 */
+    for (int c = 0; c < NR_CLASSES; c++)
+        for (int i = 0; i < nthreads[c]; i++)
+            pthread_join(threads[c][i], NULL);
+    close(listen_fd);
+    if (use_epoll)
+        close(epoll_fd);
+
+    printf("=== %s（%s）===\n", title, use_epoll ? "epoll_wait" : "accept");
+    for (int c = 0; c < NR_CLASSES; c++)
+        total += stats[c].n;
+    for (int c = 0; c < NR_CLASSES; c++) {
+        struct class_stats *s = &stats[c];
+        qsort(s->lat, s->n, sizeof(double), cmp_double);
+        printf("%s组 等级 %3d x %2d 线程: 接走 %5d (%5.1f%%)  p50 %8.1f us  p99 %8.1f us\n",
+               class_name[c], class_level[c], nthreads[c], s->n,
+               total ? 100.0 * s->n / total : 0,
+               percentile(s->lat, s->n, 0.5), percentile(s->lat, s->n, 0.99));
+        free(s->lat);
+        pthread_mutex_destroy(&s->lock);
+    }
+}
+
+static int set_wakeup_mode(int on)
+{
+    FILE *fp = fopen(WAKEUP_SYSCTL, "w");
+    if (!fp)
+        return -1;
+    fprintf(fp, "%d\n", on);
+    return fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    int nthreads[NR_CLASSES] = { 4, 4 };
+    int count = 5000, interval_us = 200, opt;
+
+    while ((opt = getopt(argc, argv, "eH:L:n:i:w:")) != -1) {
+        switch (opt) {
+        case 'e': use_epoll = 1; break;
+        case 'H': nthreads[CLASS_HIGH] = atoi(optarg); break;
+        case 'L': nthreads[CLASS_LOW] = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 'i': interval_us = atoi(optarg); break;
+        case 'w': work_us = atoi(optarg); break;
+        default:
+            fprintf(stderr, "用法: %s [-e] [-H n] [-L n] [-n 连接数] [-i 间隔us] [-w 处理us]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    for (int c = 0; c < NR_CLASSES; c++) {
+        if (nthreads[c] < 0 || nthreads[c] > MAX_THREADS) {
+            fprintf(stderr, "每组线程数在 0-%d 之间\n", MAX_THREADS);
+            return 2;
+        }
+    }
+
+    if (set_wakeup_mode(0) < 0) {
+        printf("无法写 %s，只跑当前模式\n", WAKEUP_SYSCTL);
+        run_round("当前模式", nthreads, count, interval_us);
+        return 0;
+    }
+    run_round("先来先醒", nthreads, count, interval_us);
+    set_wakeup_mode(1);
+    run_round("按优先级唤醒", nthreads, count, interval_us);
+    set_wakeup_mode(0);
+    return 0;
+}
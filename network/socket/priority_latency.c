@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+
+/*
+ * priority_level 对出包排队的影响：一个线程不停地发大包把出口队列塞满，
+ * 另一个线程每毫秒发一个小包测往返时延。先让两个线程用同样的等级跑一轮，
+ * 再把测时延的线程调到高等级跑一轮，比较 p99。
+ * 环境（netns、veth、tbf + prio）由 priority_latency.sh 搭好
+ *
+ *   ./priority_latency server 9000
+ *   ./priority_latency client 10.200.0.2 9000 [-n 次数] [-H 高等级] [-L 低等级]
+ */
+
+#ifndef __NR_configure_socket_fairness
+#define __NR_configure_socket_fairness 451
+#endif
+
+#define BULK_SIZE 1400
+#define PING_SIZE 64
+#define PING_INTERVAL_US 1000
+
+struct ping {
+    unsigned long seq;
+    struct timespec sent;
+};
+
+static atomic_int bulk_stop;
+static const char *host;
+static int port;
+
+static int set_thread_socket_attrs(int max_sockets, int priority_level)
+{
+    pid_t tid = syscall(SYS_gettid);
+    int ret = syscall(__NR_configure_socket_fairness, tid, max_sockets, priority_level);
+    if (ret < 0) {
+        fprintf(stderr, "系统调用失败: %s (errno=%d)\n", strerror(errno), errno);
+    }
+    return ret;
+}
+
+static double elapsed_us(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e6 + (b->tv_nsec - a->tv_nsec) / 1e3;
+}
+
+static int udp_socket(int p)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(p) };
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    if (host) {
+        inet_pton(AF_INET, host, &addr.sin_addr);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            exit(1);
+        }
+    } else {
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("bind");
+            exit(1);
+        }
+    }
+    return fd;
+}
+
+/**
+ * 服务端：port 上原样回显，port+1 上收下大包丢掉
+ */
+static void run_server(void)
+{
+    struct pollfd fds[2] = {
+        { .fd = udp_socket(port), .events = POLLIN },
+        { .fd = udp_socket(port + 1), .events = POLLIN },
+    };
+    char buf[2048];
+
+    printf("服务端: 回显 %d, 丢弃 %d\n", port, port + 1);
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+        if (fds[0].revents & POLLIN) {
+            struct sockaddr_in from;
+            socklen_t len = sizeof(from);
+            ssize_t n = recvfrom(fds[0].fd, buf, sizeof(buf), 0,
+                                 (struct sockaddr *)&from, &len);
+            if (n > 0)
+                sendto(fds[0].fd, buf, n, 0, (struct sockaddr *)&from, len);
+        }
+        if (fds[1].revents & POLLIN) {
+            while (recv(fds[1].fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                ;
+        }
+    }
+}
+
+/**
+ * 大流量线程：以 level 等级不停地发 BULK_SIZE 字节的包
+ */
+static void *bulk_thread(void *arg)
+{
+    int level = *(int *)arg;
+    char buf[BULK_SIZE];
+    long sent = 0;
+
+    set_thread_socket_attrs(0, level);
+    int fd = udp_socket(port + 1);
+    memset(buf, 'B', sizeof(buf));
+    while (!atomic_load(&bulk_stop)) {
+        /* qdisc 满了会返回 ENOBUFS，继续塞 */
+        if (send(fd, buf, sizeof(buf), 0) > 0)
+            sent++;
+    }
+    close(fd);
+    return (void *)sent;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+struct round_result {
+    double p50, p99, max;
+    int lost;
+};
+
+/**
+ * 一轮测试：大流量线程用 bulk_level，测时延的线程用 ping_level
+ */
+static void run_round(int count, int ping_level, int bulk_level,
+                      struct round_result *r)
+{
+    double *rtt = malloc(count * sizeof(double));
+    char buf[PING_SIZE];
+    pthread_t bulk;
+    int got = 0;
+
+    if (!rtt) {
+        perror("malloc");
+        exit(1);
+    }
+    atomic_store(&bulk_stop, 0);
+    pthread_create(&bulk, NULL, bulk_thread, &bulk_level);
+    usleep(200 * 1000);     /* 先让队列塞满 */
+
+    set_thread_socket_attrs(0, ping_level);
+    int fd = udp_socket(port);
+    memset(buf, 0, sizeof(buf));
+    for (int i = 0; i < count; i++) {
+        struct ping *p = (struct ping *)buf;
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        struct timespec now;
+
+        p->seq = i;
+        clock_gettime(CLOCK_MONOTONIC, &p->sent);
+        if (send(fd, buf, sizeof(buf), 0) < 0)
+            continue;
+        /* 只认自己这一个序号，迟到的旧回包丢掉 */
+        while (poll(&pfd, 1, 1000) > 0) {
+            char reply[PING_SIZE];
+            if (recv(fd, reply, sizeof(reply), 0) < (ssize_t)sizeof(struct ping))
+                continue;
+            if (((struct ping *)reply)->seq != (unsigned long)i)
+                continue;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            rtt[got++] = elapsed_us(&p->sent, &now);
+            break;
+        }
+        usleep(PING_INTERVAL_US);
+    }
+    close(fd);
+
+    atomic_store(&bulk_stop, 1);
+    pthread_join(bulk, NULL);
+
+    qsort(rtt, got, sizeof(double), cmp_double);
+    r->lost = count - got;
+    r->p50 = got ? rtt[got / 2] : 0;
+    r->p99 = got ? rtt[(int)(got * 0.99) < got ? (int)(got * 0.99) : got - 1] : 0;
+    r->max = got ? rtt[got - 1] : 0;
+    free(rtt);
+}
+
+static void print_round(const char *name, int level, const struct round_result *r)
+{
+    printf("%-6s 等级 %3d: p50 %9.1f us  p99 %9.1f us  max %9.1f us  丢失 %d\n",
+           name, level, r->p50, r->p99, r->max, r->lost);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = 2000, high = 90, low = 10, opt;
+    struct round_result same, prio;
+
+    if (argc >= 3 && !strcmp(argv[1], "server")) {
+        port = atoi(argv[2]);
+        run_server();
+        return 0;
+    }
+    if (argc < 4 || strcmp(argv[1], "client")) {
+        fprintf(stderr, "用法: %s server PORT\n"
+                        "      %s client HOST PORT [-n 次数] [-H 高等级] [-L 低等级]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    host = argv[2];
+    port = atoi(argv[3]);
+    optind = 4;
+    while ((opt = getopt(argc, argv, "n:H:L:")) != -1) {
+        switch (opt) {
+        case 'n': count = atoi(optarg); break;
+        case 'H': high = atoi(optarg); break;
+        case 'L': low = atoi(optarg); break;
+        default: return 2;
+        }
+    }
+
+    printf("=== 两个线程同一等级 ===\n");
+    run_round(count, low, low, &same);
+    print_round("同级", low, &same);
+
+    printf("=== 测时延的线程高等级 ===\n");
+    run_round(count, high, low, &prio);
+    print_round("高优先", high, &prio);
+
+    if (prio.p99 > 0)
+        printf("p99 降低为原来的 1/%.1f\n", same.p99 / prio.p99);
+    return 0;
+}
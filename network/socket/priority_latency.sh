@@ -0,0 +1,38 @@
+#!/bin/bash
+# priority_level -> sk_priority 的时延测试，需要 root 和带 configure_socket_fairness 的内核。
+# lo 和 veth 默认是 noqueue，包不会在出口排队，看不出效果；
+# 所以在 veth0 上用 tbf 限速制造瓶颈，下面挂一个 prio，按 skb->priority 分 band。
+set -e
+
+NS=prio_lat
+RATE=${RATE:-50mbit}
+PORT=9000
+DIR=$(cd "$(dirname "$0")" && pwd)
+
+cleanup() {
+    [ -n "$SERVER" ] && kill "$SERVER" 2>/dev/null
+    ip link del veth0 2>/dev/null || true
+    ip netns del $NS 2>/dev/null || true
+}
+trap cleanup EXIT
+
+gcc -O2 -Wall -o "$DIR/priority_latency" "$DIR/priority_latency.c" -lpthread
+
+ip netns add $NS
+ip link add veth0 type veth peer name veth1
+ip link set veth1 netns $NS
+ip addr add 10.200.0.1/24 dev veth0
+ip link set veth0 up
+ip netns exec $NS ip addr add 10.200.0.2/24 dev veth1
+ip netns exec $NS ip link set veth1 up
+ip netns exec $NS ip link set lo up
+
+tc qdisc add dev veth0 root handle 1: tbf rate $RATE burst 16k latency 200ms
+tc qdisc add dev veth0 parent 1:1 handle 10: prio
+
+ip netns exec $NS "$DIR/priority_latency" server $PORT &
+SERVER=$!
+sleep 0.5
+
+"$DIR/priority_latency" client 10.200.0.2 $PORT "$@"
+tc -s qdisc show dev veth0
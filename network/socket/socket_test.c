@@ -9,12 +9,18 @@
 #include <sys/socket.h>
 #include <pthread.h>
 #include <sched.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 /* 替换为实际实现的系统调用号 */
 #ifndef __NR_configure_socket_fairness
 #define __NR_configure_socket_fairness 451
 #endif
 
+#ifndef __NR_configure_socket_rate
+#define __NR_configure_socket_rate 453
+#endif
+
 /* 系统调用标志 */
 // #define CONFIGURE_SOCKET_FAIRNESS_NONE      0x00
 // #define CONFIGURE_SOCKET_FAIRNESS_RECURSIVE 0x01  /* 影响所有子线程 */
@@ -70,6 +76,9 @@ int* create_sockets(int count)
 {
     int *sock_fds = malloc(count * sizeof(int));
     if (!sock_fds) return NULL;
+    /* 失败之后的位置不能留垃圾值，close_sockets 会去关它们 */
+    for (int j = 0; j < count; j++)
+        sock_fds[j] = -1;
     
     int i;
     for (i = 0; i < count; i++) {
@@ -84,6 +93,19 @@ int* create_sockets(int count)
     return sock_fds;
 }
 
+/**
+ * 统计创建成功的套接字个数
+ */
+int count_sockets(const int *sock_fds, int count)
+{
+    int n = 0;
+    for (int i = 0; sock_fds && i < count; i++) {
+        if (sock_fds[i] >= 0)
+            n++;
+    }
+    return n;
+}
+
 /**
  * 关闭所有套接字
  */
@@ -148,6 +170,135 @@ void set_thread_priority(int priority)
     }
 }
 
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_TEST CGROUP_ROOT "/socket_test"
+
+/**
+ * 往 cgroup 文件里写一个字符串
+ */
+static int cgroup_write(const char *path, const char *val)
+{
+    int fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t n = write(fd, val, strlen(val));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * sockets cgroup 控制器：限制对整个 cgroup 生效，不用知道 pid
+ * 内核没有这个控制器（或没挂 cgroup v2）时跳过，返回 0
+ */
+int test_cgroup_limit(pid_t pid)
+{
+    char buf[256] = "";
+    char pidstr[32];
+    int fd, ret = 0;
+
+    fd = open(CGROUP_ROOT "/cgroup.controllers", O_RDONLY);
+    if (fd >= 0) {
+        read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+    }
+    if (!strstr(buf, "sockets")) {
+        printf("没有 sockets cgroup 控制器，跳过\n");
+        return 0;
+    }
+
+    cgroup_write(CGROUP_ROOT "/cgroup.subtree_control", "+sockets");
+    mkdir(CGROUP_TEST, 0755);
+    snprintf(pidstr, sizeof(pidstr), "%d", pid);
+    if (cgroup_write(CGROUP_TEST "/sockets.max", "4") < 0 ||
+        cgroup_write(CGROUP_TEST "/cgroup.procs", pidstr) < 0) {
+        perror("配置 cgroup 失败");
+        rmdir(CGROUP_TEST);
+        return 1;
+    }
+
+    /* 去掉线程自己的限制，只剩 cgroup 的 */
+    set_thread_socket_attrs(pid, 0, 0);
+    int *sockets = create_sockets(6);
+    int created = count_sockets(sockets, 6);
+    if (created != 4) {
+        fprintf(stderr, "测试4失败: sockets.max 为4，实际创建了 %d 个\n", created);
+        ret = 1;
+    }
+    close_sockets(sockets, 6);
+
+    fd = open(CGROUP_TEST "/sockets.events", O_RDONLY);
+    if (fd >= 0) {
+        memset(buf, 0, sizeof(buf));
+        read(fd, buf, sizeof(buf) - 1);
+        printf("sockets.events: %s", buf);
+        close(fd);
+    }
+
+    cgroup_write(CGROUP_ROOT "/cgroup.procs", pidstr);
+    rmdir(CGROUP_TEST);
+    return ret;
+}
+
+/* 测试5的子线程：各自尝试建 5 个，记下成功的个数 */
+static void *rate_thread(void *arg)
+{
+    int *created = arg;
+    int *sockets = create_sockets(5);
+
+    *created = count_sockets(sockets, 5);
+    close_sockets(sockets, 5);
+    return NULL;
+}
+
+/**
+ * 创建速率限制：桶里 5 个令牌、每秒补 10 个，连建 8 个应该只成 5 个，
+ * 多出来的以 EAGAIN 失败并计入 SocketThrottled；等 0.3 秒补回来再建 2 个。
+ * 桶是整个进程共用的：换成每秒补 1 个，两个线程各建 5 个加起来也只成 5 个
+ */
+int test_rate_limit(pid_t pid)
+{
+    int ret = 0;
+
+    if (syscall(__NR_configure_socket_rate, pid, 10, 5) < 0) {
+        fprintf(stderr, "设置速率失败: %s (errno=%d)\n", strerror(errno), errno);
+        return 1;
+    }
+
+    int *sockets = create_sockets(8);
+    int created = count_sockets(sockets, 8);
+    close_sockets(sockets, 8);
+    if (created != 5) {
+        fprintf(stderr, "测试5失败: 桶容量为5，实际创建了 %d 个\n", created);
+        ret = 1;
+    }
+
+    usleep(300 * 1000);
+    sockets = create_sockets(2);
+    created = count_sockets(sockets, 2);
+    close_sockets(sockets, 2);
+    if (created != 2) {
+        fprintf(stderr, "测试5失败: 等待补充后只创建了 %d 个\n", created);
+        ret = 1;
+    }
+
+    syscall(__NR_configure_socket_rate, pid, 1, 5);
+    pthread_t threads[2];
+    int thread_created[2] = {0, 0};
+    for (int i = 0; i < 2; i++)
+        pthread_create(&threads[i], NULL, rate_thread, &thread_created[i]);
+    for (int i = 0; i < 2; i++)
+        pthread_join(threads[i], NULL);
+    if (thread_created[0] + thread_created[1] != 5) {
+        fprintf(stderr, "测试5失败: 两个线程共创建了 %d 个，桶容量为5\n",
+                thread_created[0] + thread_created[1]);
+        ret = 1;
+    }
+    read_proc_status(pid);
+
+    syscall(__NR_configure_socket_rate, pid, 0, 0);
+    return ret;
+}
+
 /**
  * 主函数：运行测试
  */
@@ -163,6 +314,13 @@ int main(int argc, char *argv[])
     } else {
         read_proc_status(pid);
         int *sockets = create_sockets(12);  /* 尝试创建超过限制的socket */
+        /* 限制按线程组计数，超出的那两个应当以 EMFILE 失败 */
+        int created = count_sockets(sockets, 12);
+        if (created != 10) {
+            fprintf(stderr, "测试1失败: 限制为10，实际创建了 %d 个\n", created);
+            close_sockets(sockets, 12);
+            return 1;
+        }
         close_sockets(sockets, 12);
     }
     
@@ -193,6 +351,16 @@ int main(int argc, char *argv[])
     set_thread_priority(0);   /* 普通优先级 */
     read_proc_status(pid);
     
+    /* 测试4: cgroup 级别的socket限制 */
+    printf("\n=== 测试4: cgroup 级别的socket限制 ===\n");
+    if (test_cgroup_limit(pid))
+        return 1;
+    
+    /* 测试5: socket创建速率限制 */
+    printf("\n=== 测试5: socket创建速率限制 ===\n");
+    if (test_rate_limit(pid))
+        return 1;
+    
     printf("\n所有测试完成，你通过了所有测试\n");
     return 0;
 }
\ No newline at end of file
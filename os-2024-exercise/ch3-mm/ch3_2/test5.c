@@ -0,0 +1,95 @@
+// PMD Fault-Around Benchmark
+// Compare a default mount with a fault_around=pmd mount, e.g.
+//   mount -t ramfs none /mnt/ramfs
+//   mount -t ramfs -o fault_around=pmd none /mnt/ramfs_pmd
+//   ./test5 /mnt/ramfs/huge_bench.dat
+//   ./test5 /mnt/ramfs_pmd/huge_bench.dat
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#define DEFAULT_FILE "/mnt/ramfs/huge_bench.dat"
+#define FILE_SIZE_MB 256
+#define ROUNDS 5
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long minor_faults(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_FILE;
+    long size_mb = argc > 2 ? atol(argv[2]) : FILE_SIZE_MB;
+    size_t total = (size_t)size_mb * 1024 * 1024;
+    size_t chunk = 1024 * 1024;
+    char *buf = malloc(chunk);
+    unsigned long sum = 0;
+
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0 || !buf) {
+        perror("Failed to open RAMFS file");
+        exit(1);
+    }
+
+    memset(buf, 'A', chunk);
+    for (size_t written = 0; written < total; written += chunk) {
+        if (write(fd, buf, chunk) != (ssize_t)chunk) {
+            perror("Write error");
+            exit(1);
+        }
+    }
+
+    // Sequential read()
+    double start = now_sec();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (off_t off = 0; off < (off_t)total; off += chunk) {
+            if (pread(fd, buf, chunk, off) != (ssize_t)chunk) {
+                perror("Read error");
+                exit(1);
+            }
+            sum += buf[0];
+        }
+    }
+    double t = now_sec() - start;
+    printf("read():  %.1f MB/s\n", size_mb * ROUNDS / t);
+
+    // Fresh mapping each round, so every round faults the file in again
+    long faults = 0;
+    start = now_sec();
+    for (int r = 0; r < ROUNDS; r++) {
+        long before = minor_faults();
+        char *map = mmap(NULL, total, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap failed");
+            exit(1);
+        }
+        if (r == 0)
+            printf("mmap address %p (%s 2MB aligned)\n", map,
+                   ((unsigned long)map & ((2UL << 20) - 1)) ? "not" : "is");
+        for (size_t off = 0; off < total; off += 4096)
+            sum += map[off];
+        munmap(map, total);
+        faults += minor_faults() - before;
+    }
+    t = now_sec() - start;
+    printf("mmap:    %.1f MB/s, %ld minor faults per scan\n",
+           size_mb * ROUNDS / t, faults / ROUNDS);
+
+    printf("checksum %lu\n", sum);
+    close(fd);
+    unlink(path);
+    free(buf);
+    return 0;
+}
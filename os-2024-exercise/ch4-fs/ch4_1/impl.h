@@ -6,10 +6,36 @@
 #include <sys/xattr.h>
 #include <string.h>
 #include <sys/xattr.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
 
 #define SET_XATTR 188
 #define READ_KV_SYSCALL 191
 #define REMOVE_XATTR 197
+#define XATTR_BATCH 452
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000
+#endif
+
+// 以下和内核的 include/uapi/linux/xattr_batch.h 一致
+#define XATTR_BATCH_GET_ALL 0   // 输出所有属性；size 为 0 时只返回需要的长度
+#define XATTR_BATCH_GET     1   // 读给定的名字，value_len 是值缓冲区大小
+#define XATTR_BATCH_SET     2   // 写给定的名字
+#define XATTR_BATCH_REMOVE  0x4 // SET 时删除这个属性
+
+// 每项后面依次是名字（含 '\0'）和值，整项补齐到 8 字节
+struct xattr_batch_ent {
+    uint32_t name_len;
+    uint32_t value_len;
+    uint32_t flags;
+    int32_t result;     // GET 为值的实际长度，SET 为0，出错为负的错误码
+    char data[];
+};
+
+#define XATTR_BATCH_ENT_SIZE(name_len, value_len) \
+    ((sizeof(struct xattr_batch_ent) + (name_len) + (value_len) + 7) & ~(size_t)7)
 
 int _set_xattr(const char *path, const char *name, const char *value){
     return syscall(SET_XATTR, path, name, value);
@@ -109,4 +135,137 @@ int set_xattr(const char *path, const char *name, const char *value) {
 int remove_xattr(const char *path, const char *name) {
     int ret = removexattr(path, name);
     return (ret == 0) ? 1 : -1;
-}
\ No newline at end of file
+}
+
+// 一次系统调用操作一个文件的多个扩展属性，路径只解析一次
+// 返回值：GET_ALL 为字节数，GET/SET 为成功的项数，失败返回-1
+long _xattr_batch(const char *path, unsigned int op, void *buf, size_t size){
+    return syscall(XATTR_BATCH, AT_FDCWD, path, 0, op, buf, size);
+};
+
+long _fxattr_batch(int fd, unsigned int op, void *buf, size_t size){
+    return syscall(XATTR_BATCH, fd, "", AT_EMPTY_PATH, op, buf, size);
+};
+
+// 在 buf 的 pos 处追加一项，返回下一项的位置；buf 为 NULL 时只计算长度
+// GET 时 value 传 NULL，value_len 是留给值的空间
+size_t xattr_batch_add(char *buf, size_t pos, const char *name,
+                       const void *value, size_t value_len, unsigned int flags) {
+    size_t name_len = strlen(name) + 1;
+    if (buf) {
+        struct xattr_batch_ent *ent = (struct xattr_batch_ent *)(buf + pos);
+        memset(ent, 0, XATTR_BATCH_ENT_SIZE(name_len, value_len));
+        ent->name_len = name_len;
+        ent->value_len = value_len;
+        ent->flags = flags;
+        memcpy(ent->data, name, name_len);
+        if (value)
+            memcpy(ent->data + name_len, value, value_len);
+    }
+    return pos + XATTR_BATCH_ENT_SIZE(name_len, value_len);
+}
+
+// 一次调用取回所有扩展属性，返回堆分配的缓冲区（需调用者 free），长度写入 *len
+// 没有属性时返回 NULL 且 *len 为0，失败返回 NULL 且 *len 为-1
+char *get_all_xattrs(const char *filename, long *len) {
+    char *buf = NULL;
+    for (;;) {
+        long size = _xattr_batch(filename, XATTR_BATCH_GET_ALL, NULL, 0);
+        if (size <= 0) {
+            *len = size;
+            return NULL;
+        }
+        buf = (char *)malloc(size);
+        if (!buf) {
+            perror("malloc failed");
+            *len = -1;
+            return NULL;
+        }
+        *len = _xattr_batch(filename, XATTR_BATCH_GET_ALL, buf, size);
+        // 两次调用之间有人加了属性，重来
+        if (*len == -1 && errno == ERANGE) {
+            free(buf);
+            continue;
+        }
+        if (*len <= 0) {
+            free(buf);
+            return NULL;
+        }
+        return buf;
+    }
+}
+
+// 一次调用打印所有扩展属性（name=value）
+void dump_xattrs(const char *filename) {
+    long len;
+    char *buf = get_all_xattrs(filename, &len);
+    if (len == -1) {
+        perror("xattr_batch failed");
+        return;
+    }
+    if (len == 0) {
+        printf("No xattr found.\n");
+        return;
+    }
+    size_t pos = 0;
+    while (pos < (size_t)len) {
+        struct xattr_batch_ent *ent = (struct xattr_batch_ent *)(buf + pos);
+        if (ent->result < 0)
+            printf("%s: error %d\n", ent->data, ent->result);
+        else
+            printf("%s=%.*s\n", ent->data, (int)ent->value_len,
+                   ent->data + ent->name_len);
+        pos += XATTR_BATCH_ENT_SIZE(ent->name_len, ent->value_len);
+    }
+    free(buf);
+}
+
+// 一次调用设置 n 个扩展属性 names[i]=values[i]，返回成功的个数，失败返回-1
+int set_xattrs(const char *path, const char **names, const char **values, int n) {
+    size_t size = 0;
+    for (int i = 0; i < n; i++)
+        size = xattr_batch_add(NULL, size, names[i], NULL, strlen(values[i]), 0);
+    char *buf = (char *)malloc(size);
+    if (!buf) {
+        perror("malloc failed");
+        return -1;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < n; i++)
+        pos = xattr_batch_add(buf, pos, names[i], values[i], strlen(values[i]), 0);
+    long ret = _xattr_batch(path, XATTR_BATCH_SET, buf, size);
+    free(buf);
+    return ret;
+}
+
+// 一次调用读 n 个扩展属性，每个值最多 max_len 字节
+// values[i] 是堆分配的字符串（需调用者 free），不存在时为 NULL；返回读到的个数，失败返回-1
+int get_xattrs(const char *path, const char **names, char **values, int n, size_t max_len) {
+    size_t size = 0;
+    for (int i = 0; i < n; i++)
+        size = xattr_batch_add(NULL, size, names[i], NULL, max_len, 0);
+    char *buf = (char *)malloc(size);
+    if (!buf) {
+        perror("malloc failed");
+        return -1;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < n; i++)
+        pos = xattr_batch_add(buf, pos, names[i], NULL, max_len, 0);
+    long ret = _xattr_batch(path, XATTR_BATCH_GET, buf, size);
+    pos = 0;
+    for (int i = 0; i < n; i++) {
+        struct xattr_batch_ent *ent = (struct xattr_batch_ent *)(buf + pos);
+        values[i] = NULL;
+        if (ret >= 0 && ent->result >= 0) {
+            values[i] = (char *)malloc(ent->result + 1);
+            if (values[i]) {
+                memcpy(values[i], ent->data + ent->name_len, ent->result);
+                values[i][ent->result] = '\0';
+            }
+        }
+        pos += XATTR_BATCH_ENT_SIZE(ent->name_len, ent->value_len);
+    }
+    free(buf);
+    return ret;
+}
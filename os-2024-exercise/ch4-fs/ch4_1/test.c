@@ -76,6 +76,57 @@ void test_xattr_operations() {
     printf("Test xattr operations completed\n\n");
 }
 
+void test_xattr_batch() {
+    printf("Testing xattr_batch...\n");
+
+    // 空列表的 GET 什么也不做，返回0；上游内核的 452 号是 fchmodat2，这组参数会被它拒绝
+    if (_xattr_batch(TEST_FILE, XATTR_BATCH_GET, NULL, 0) != 0) {
+        printf("xattr_batch not supported by this kernel (%s), skipped\n\n", strerror(errno));
+        return;
+    }
+
+    // 一次设置三个属性
+    const char *names[] = {"user.a", "user.b", "user.c"};
+    const char *values[] = {"1", "22", "333"};
+    int result = set_xattrs(TEST_FILE, names, values, 3);
+    assert(result == 3);
+
+    // 一次取回全部
+    printf("Dumping all xattrs:\n");
+    dump_xattrs(TEST_FILE);
+
+    // 读给定的名字，不存在的那个单独报错
+    const char *want[] = {"user.c", "user.missing", "user.a"};
+    char *got[3];
+    result = get_xattrs(TEST_FILE, want, got, 3, 64);
+    assert(result == 2);
+    assert(got[0] && strcmp(got[0], "333") == 0);
+    assert(got[1] == NULL);
+    assert(got[2] && strcmp(got[2], "1") == 0);
+    free(got[0]);
+    free(got[2]);
+
+    // 一次删除三个
+    char buf[256];
+    size_t pos = 0;
+    for (int i = 0; i < 3; i++)
+        pos = xattr_batch_add(buf, pos, names[i], NULL, 0, XATTR_BATCH_REMOVE);
+    assert(_xattr_batch(TEST_FILE, XATTR_BATCH_SET, buf, pos) == 3);
+
+    // 文件上可能还有 security.selinux 之类的属性，只检查 user.* 都没了
+    long len;
+    char *all = get_all_xattrs(TEST_FILE, &len);
+    assert(len >= 0);
+    for (size_t off = 0; off < (size_t)len; ) {
+        struct xattr_batch_ent *ent = (struct xattr_batch_ent *)(all + off);
+        assert(strncmp(ent->data, "user.", 5) != 0);
+        off += XATTR_BATCH_ENT_SIZE(ent->name_len, ent->value_len);
+    }
+    free(all);
+
+    printf("Test xattr_batch completed\n\n");
+}
+
 int main() {
     printf("Starting xattr tests\n");
     
@@ -83,6 +134,7 @@ int main() {
     
     test_inode_info();
     test_xattr_operations();
+    test_xattr_batch();
     
     cleanup();
     
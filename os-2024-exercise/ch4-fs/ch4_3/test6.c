@@ -0,0 +1,499 @@
+// Test 6: Benchmark driver for the stress scenarios of tests 1-5
+// Times each scenario, and when the mount has a sync dir bound
+// (echo "/mnt/ramfs /mnt/sync" > /proc/fs/ramfs/bind) also the flush of
+// what the scenario created. Results go to stdout as JSON, e.g.
+//   ./test6 -d /mnt/ramfs -s 0.1 > small.json
+//   ./test6 -s 2 large small
+// Scenarios: concurrent links deep small large (default: all)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#define DEFAULT_DIR "/mnt/ramfs"
+#define THREAD_NUM 20
+#define ITERATION_NUM 1000   // per thread, test 1
+#define LINK_COUNT 1000      // test 2
+#define DEPTH 1000           // test 3
+#define FILE_COUNT 10000     // test 4
+#define LARGE_MB 100         // test 5
+#define CHUNK (1024 * 1024)
+
+struct lat {
+    double *us;
+    long n, cap;
+};
+
+struct flush_result {
+    int done;
+    double seconds;
+    long long flushes, written_bytes;
+    char error[64];
+};
+
+struct result {
+    const char *name;
+    long ops;
+    long long bytes;
+    double seconds;
+    struct lat lat;
+    struct flush_result flush;
+    char error[64];
+};
+
+static const char *base_dir = DEFAULT_DIR;
+static double scale = 1.0;
+static char proc_dir[64];   // /proc/fs/ramfs/<major:minor>, empty if unbound
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long scaled(long n) {
+    long v = (long)(n * scale);
+    return v > 0 ? v : 1;
+}
+
+static void lat_add(struct lat *l, double us) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 1024;
+        l->us = realloc(l->us, l->cap * sizeof(double));
+        if (!l->us) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    l->us[l->n++] = us;
+}
+
+static void lat_merge(struct lat *dst, struct lat *src) {
+    for (long i = 0; i < src->n; i++)
+        lat_add(dst, src->us[i]);
+    free(src->us);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Time one operation into the scenario's latency list
+#define TIMED(l, expr) ({                           \
+    double _t0 = now_sec();                         \
+    int _ok = (expr);                               \
+    lat_add((l), (now_sec() - _t0) * 1e6);          \
+    _ok; })
+
+static void fail(struct result *r, const char *what) {
+    if (!r->error[0])
+        snprintf(r->error, sizeof(r->error), "%s: %s", what, strerror(errno));
+}
+
+// The flush counters of this mount, from /proc/fs/ramfs/<major:minor>/stats
+static void read_stats(long long *flushes, long long *written) {
+    char path[96], key[64];
+    long long val;
+    FILE *fp;
+
+    *flushes = *written = 0;
+    snprintf(path, sizeof(path), "%s/stats", proc_dir);
+    fp = fopen(path, "r");
+    if (!fp)
+        return;
+    while (fscanf(fp, "%63s %lld", key, &val) == 2) {
+        if (!strcmp(key, "flushes"))
+            *flushes = val;
+        else if (!strcmp(key, "flush_written_bytes"))
+            *written = val;
+    }
+    fclose(fp);
+}
+
+// Sync a whole subtree through /proc/fs/ramfs/sync and time it
+static void flush_tree(const char *path, struct flush_result *f) {
+    long long flushes, written;
+    double start;
+    int fd;
+
+    if (!proc_dir[0])
+        return;
+    f->done = 1;
+    read_stats(&flushes, &written);
+    fd = open("/proc/fs/ramfs/sync", O_WRONLY);
+    start = now_sec();
+    if (fd < 0 || write(fd, path, strlen(path)) < 0)
+        snprintf(f->error, sizeof(f->error), "%s", strerror(errno));
+    f->seconds = now_sec() - start;
+    if (fd >= 0)
+        close(fd);
+    read_stats(&f->flushes, &f->written_bytes);
+    f->flushes -= flushes;
+    f->written_bytes -= written;
+}
+
+// Find out whether the mount under test has a sync dir bound
+static void detect_sync_dir(char *sync_dir, size_t len) {
+    char path[96];
+    struct stat st;
+    FILE *fp;
+
+    sync_dir[0] = '\0';
+    if (stat(base_dir, &st) != 0) {
+        perror("stat failed");
+        exit(1);
+    }
+    snprintf(proc_dir, sizeof(proc_dir), "/proc/fs/ramfs/%u:%u",
+             major(st.st_dev), minor(st.st_dev));
+    snprintf(path, sizeof(path), "%s/sync_dir", proc_dir);
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fgets(sync_dir, len, fp))
+            sync_dir[strcspn(sync_dir, "\n")] = '\0';
+        fclose(fp);
+    }
+    if (!sync_dir[0])
+        proc_dir[0] = '\0';
+}
+
+// Test 1: half the threads rewrite a file, the other half read it
+struct rw_arg {
+    const char *path;
+    long iterations;
+    int writer;
+    struct lat lat;
+};
+
+static int rw_once(struct rw_arg *a, int i) {
+    char buf[64];
+    FILE *fp = fopen(a->path, a->writer ? "w" : "r");
+    if (!fp)
+        return 0;
+    if (a->writer) {
+        snprintf(buf, sizeof(buf), "Thread write %d\n", i);
+        fwrite(buf, 1, strlen(buf), fp);
+    } else {
+        fread(buf, 1, sizeof(buf) - 1, fp);
+    }
+    return fclose(fp) == 0;
+}
+
+static void *rw_thread(void *p) {
+    struct rw_arg *a = p;
+    for (long i = 0; i < a->iterations; i++)
+        TIMED(&a->lat, rw_once(a, i));
+    return NULL;
+}
+
+static void run_concurrent(struct result *r) {
+    pthread_t tid[THREAD_NUM];
+    struct rw_arg args[THREAD_NUM];
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/concurrent_test.txt", base_dir);
+    close(open(path, O_CREAT | O_WRONLY, 0666));
+    for (int i = 0; i < THREAD_NUM; i++)
+        args[i] = (struct rw_arg){ path, scaled(ITERATION_NUM), i < THREAD_NUM / 2 };
+
+    double start = now_sec();
+    for (int i = 0; i < THREAD_NUM; i++)
+        pthread_create(&tid[i], NULL, rw_thread, &args[i]);
+    for (int i = 0; i < THREAD_NUM; i++)
+        pthread_join(tid[i], NULL);
+    r->seconds = now_sec() - start;
+
+    for (int i = 0; i < THREAD_NUM; i++)
+        lat_merge(&r->lat, &args[i].lat);
+    r->ops = r->lat.n;
+    flush_tree(path, &r->flush);
+    unlink(path);
+}
+
+// Test 2: hard links to one file, created then removed
+static void run_links(struct result *r) {
+    char dir[256], orig[300], path[300];
+    long n = scaled(LINK_COUNT);
+
+    snprintf(dir, sizeof(dir), "%s/link-stress", base_dir);
+    snprintf(orig, sizeof(orig), "%s/original_file", dir);
+    mkdir(dir, 0755);
+    close(open(orig, O_CREAT | O_WRONLY | O_TRUNC, 0666));
+
+    double start = now_sec();
+    for (long i = 1; i <= n; i++) {
+        snprintf(path, sizeof(path), "%s/link_%ld", dir, i);
+        if (!TIMED(&r->lat, link(orig, path) == 0))
+            fail(r, "link");
+    }
+    r->seconds = now_sec() - start;
+    flush_tree(dir, &r->flush);
+
+    start = now_sec();
+    for (long i = 1; i <= n; i++) {
+        snprintf(path, sizeof(path), "%s/link_%ld", dir, i);
+        if (!TIMED(&r->lat, unlink(path) == 0))
+            fail(r, "unlink");
+    }
+    r->seconds += now_sec() - start;
+    r->ops = r->lat.n;
+    unlink(orig);
+    rmdir(dir);
+}
+
+// Test 3: nested directories, each with one file. Walks down with chdir
+// because the full path soon exceeds PATH_MAX
+static int deep_level(long i) {
+    char name[32];
+    int fd;
+
+    snprintf(name, sizeof(name), "dir_%ld", i);
+    if (mkdir(name, 0755) != 0 || chdir(name) != 0)
+        return 0;
+    snprintf(name, sizeof(name), "file_%ld.txt", i);
+    fd = open(name, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if (fd < 0)
+        return 0;
+    dprintf(fd, "Test at depth %ld\n", i);
+    return close(fd) == 0;
+}
+
+static void run_deep(struct result *r) {
+    char dir[256], name[32];
+    long depth = scaled(DEPTH), i;
+    int cwd = open(".", O_RDONLY | O_DIRECTORY);
+
+    snprintf(dir, sizeof(dir), "%s/deep_test", base_dir);
+    if (mkdir(dir, 0755) != 0 || chdir(dir) != 0) {
+        fail(r, "mkdir");
+        return;
+    }
+
+    double start = now_sec();
+    for (i = 1; i <= depth; i++)
+        if (!TIMED(&r->lat, deep_level(i))) {
+            fail(r, "mkdir");
+            break;
+        }
+    r->seconds = now_sec() - start;
+    r->ops = r->lat.n;
+    flush_tree(dir, &r->flush);
+
+    // Remove bottom-up, not timed
+    for (i = i > depth ? depth : i; i >= 1; i--) {
+        snprintf(name, sizeof(name), "file_%ld.txt", i);
+        unlink(name);
+        snprintf(name, sizeof(name), "dir_%ld", i);
+        if (chdir("..") == 0)
+            rmdir(name);
+    }
+    if (cwd >= 0) {
+        fchdir(cwd);
+        close(cwd);
+    }
+    rmdir(dir);
+}
+
+// Test 4: many small files, created then removed
+static void run_small(struct result *r) {
+    char dir[256], path[300], buf[32];
+    long n = scaled(FILE_COUNT);
+
+    snprintf(dir, sizeof(dir), "%s/small_files_test", base_dir);
+    mkdir(dir, 0755);
+
+    double start = now_sec();
+    for (long i = 1; i <= n; i++) {
+        snprintf(path, sizeof(path), "%s/small%ld.txt", dir, i);
+        int len = snprintf(buf, sizeof(buf), "small data %ld\n", i);
+        int ok = TIMED(&r->lat, ({
+            int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+            fd >= 0 && write(fd, buf, len) == len && close(fd) == 0;
+        }));
+        if (!ok)
+            fail(r, "create");
+        r->bytes += len;
+    }
+    r->seconds = now_sec() - start;
+    flush_tree(dir, &r->flush);
+
+    start = now_sec();
+    for (long i = 1; i <= n; i++) {
+        snprintf(path, sizeof(path), "%s/small%ld.txt", dir, i);
+        if (!TIMED(&r->lat, unlink(path) == 0))
+            fail(r, "unlink");
+    }
+    r->seconds += now_sec() - start;
+    r->ops = r->lat.n;
+    rmdir(dir);
+}
+
+// Test 5: one large file written then read back in 1 MB chunks
+static void run_large(struct result *r) {
+    long chunks = scaled(LARGE_MB);
+    char *wbuf = malloc(CHUNK), *rbuf = malloc(CHUNK);
+    char path[256];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/large_test.dat", base_dir);
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0 || !wbuf || !rbuf) {
+        fail(r, "open");
+        goto out;
+    }
+    memset(wbuf, 'A', CHUNK);
+
+    double start = now_sec();
+    for (long i = 0; i < chunks; i++)
+        if (!TIMED(&r->lat, write(fd, wbuf, CHUNK) == CHUNK))
+            fail(r, "write");
+    r->seconds = now_sec() - start;
+    flush_tree(path, &r->flush);
+
+    start = now_sec();
+    for (long i = 0; i < chunks; i++) {
+        if (!TIMED(&r->lat, pread(fd, rbuf, CHUNK, (off_t)i * CHUNK) == CHUNK))
+            fail(r, "read");
+        else if (memcmp(wbuf, rbuf, CHUNK) != 0 && !r->error[0])
+            snprintf(r->error, sizeof(r->error), "read/write consistency FAILED");
+    }
+    r->seconds += now_sec() - start;
+    r->ops = r->lat.n;
+    r->bytes = 2LL * chunks * CHUNK;
+    close(fd);
+    unlink(path);
+out:
+    free(wbuf);
+    free(rbuf);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(struct result *r);
+} scenarios[] = {
+    { "concurrent", run_concurrent },
+    { "links", run_links },
+    { "deep", run_deep },
+    { "small", run_small },
+    { "large", run_large },
+};
+#define NR_SCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+// Paths and error messages can contain anything, escape them for JSON
+static void print_json(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c == '\n')
+            printf("\\n");
+        else if (c == '\t')
+            printf("\\t");
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+// Empty strings mean no error
+static void print_str(const char *s) {
+    if (s[0])
+        print_json(s);
+    else
+        printf("null");
+}
+
+static void print_result(const struct result *r, int last) {
+    const struct lat *l = &r->lat;
+    double sum = 0;
+
+    qsort(l->us, l->n, sizeof(double), cmp_double);
+    for (long i = 0; i < l->n; i++)
+        sum += l->us[i];
+
+    printf("    {\n      \"name\": \"%s\",\n", r->name);
+    printf("      \"ops\": %ld,\n      \"bytes\": %lld,\n", r->ops, r->bytes);
+    printf("      \"seconds\": %.6f,\n", r->seconds);
+    printf("      \"ops_per_sec\": %.1f,\n", r->seconds > 0 ? r->ops / r->seconds : 0);
+    if (l->n)
+        printf("      \"latency_us\": { \"mean\": %.2f, \"p50\": %.2f, "
+               "\"p99\": %.2f, \"max\": %.2f },\n", sum / l->n,
+               l->us[l->n / 2], l->us[(long)(l->n * 0.99)], l->us[l->n - 1]);
+    else
+        printf("      \"latency_us\": null,\n");
+    if (r->flush.done) {
+        printf("      \"flush\": { \"seconds\": %.6f, \"flushes\": %lld, "
+               "\"written_bytes\": %lld, \"error\": ",
+               r->flush.seconds, r->flush.flushes, r->flush.written_bytes);
+        print_str(r->flush.error);
+        printf(" },\n");
+    } else {
+        printf("      \"flush\": null,\n");
+    }
+    printf("      \"error\": ");
+    print_str(r->error);
+    printf("\n");
+    printf("    }%s\n", last ? "" : ",");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-d dir] [-s scale] [scenario...]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int selected[NR_SCENARIOS] = { 0 }, nr = 0, opt, done = 0;
+    struct result results[NR_SCENARIOS];
+    char sync_dir[4096];
+
+    while ((opt = getopt(argc, argv, "d:s:")) != -1) {
+        if (opt == 'd')
+            base_dir = optarg;
+        else if (opt == 's' && (scale = atof(optarg)) > 0)
+            ;
+        else
+            usage(argv[0]);
+    }
+    for (int i = optind; i < argc; i++) {
+        int j;
+        for (j = 0; j < NR_SCENARIOS && strcmp(argv[i], scenarios[j].name); j++)
+            ;
+        if (j == NR_SCENARIOS)
+            usage(argv[0]);
+        selected[j] = 1;
+        nr++;
+    }
+
+    detect_sync_dir(sync_dir, sizeof(sync_dir));
+    for (int i = 0; i < NR_SCENARIOS; i++) {
+        if (nr && !selected[i])
+            continue;
+        results[done] = (struct result){ .name = scenarios[i].name };
+        fprintf(stderr, "Running %s...\n", scenarios[i].name);
+        scenarios[i].run(&results[done]);
+        done++;
+    }
+
+    printf("{\n  \"dir\": ");
+    print_json(base_dir);
+    printf(",\n  \"scale\": %g,\n", scale);
+    printf("  \"sync_dir\": ");
+    print_str(sync_dir);
+    printf(",\n");
+    printf("  \"scenarios\": [\n");
+    for (int i = 0; i < done; i++) {
+        print_result(&results[i], i == done - 1);
+        free(results[i].lat.us);
+    }
+    printf("  ]\n}\n");
+    return 0;
+}